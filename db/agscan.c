@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "libxfs.h"
+#include "workqueue.h"
+#include "type.h"
+#include "agscan.h"
+#include "output.h"
+#include "init.h"
+#include "malloc.h"
+#include "sig.h"
+
+struct agscan_ag {
+	void			*priv;
+	struct agscan_out	out;
+	int			scanned;	/* not skipped by an interrupt */
+	int			done;
+};
+
+struct agscan {
+	struct agscan_ag	*ags;
+	xfs_agnumber_t		next_ag;
+	int			(*want)(xfs_agnumber_t agno);
+	agscan_scan_f		scan;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wakeup;
+};
+
+void
+agscan_printf(
+	struct agscan_out	*out,
+	const char		*fmt,
+	...)
+{
+	va_list			ap;
+	int			len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+
+	if (out->len + len + 1 > out->size) {
+		out->size = max(out->size * 2, out->len + len + 1);
+		out->buf = xrealloc(out->buf, out->size);
+	}
+	va_start(ap, fmt);
+	vsnprintf(out->buf + out->len, len + 1, fmt, ap);
+	va_end(ap);
+	out->len += len + 1;
+}
+
+/* Print and throw away everything saved in @out. */
+void
+agscan_flush(
+	struct agscan_out	*out)
+{
+	char			*msg;
+
+	for (msg = out->buf; msg < out->buf + out->len; msg += strlen(msg) + 1)
+		dbprintf("%s", msg);
+	xfree(out->buf);
+	memset(out, 0, sizeof(*out));
+}
+
+/*
+ * Read a buffer the way set_cur does, keeping it even if the verifier
+ * doesn't like it.  Returns NULL if there's nothing to look at.
+ */
+struct xfs_buf *
+agscan_readbuf(
+	typnm_t			typ,
+	xfs_daddr_t		daddr,
+	int			count)
+{
+	struct xfs_buf		*bp;
+
+	bp = libxfs_readbuf(mp->m_ddev_targp, daddr, count, 0,
+			typtab[typ].bops);
+	if (!bp)
+		return NULL;
+	if (bp->b_error && bp->b_error != -EFSCORRUPTED &&
+			   bp->b_error != -EFSBADCRC) {
+		libxfs_putbuf(bp);
+		return NULL;
+	}
+	return bp;
+}
+
+/*
+ * Start reading a block we're about to look at.  xfs_db doesn't use direct
+ * I/O, so the kernel can read it into the page cache while we carry on.
+ */
+void
+agscan_readahead(
+	xfs_daddr_t		daddr,
+	int			count)
+{
+	int			fd;
+
+	fd = libxfs_device_to_fd(mp->m_ddev_targp->dev);
+	posix_fadvise(fd, BBTOB(daddr), BBTOB(count), POSIX_FADV_WILLNEED);
+}
+
+static void
+agscan_worker(
+	struct workqueue	*wq,
+	__uint32_t		index,
+	void			*arg)
+{
+	struct agscan		*as = wq->wq_ctx;
+	struct agscan_ag	*ag;
+	xfs_agnumber_t		agno;
+
+	for (;;) {
+		pthread_mutex_lock(&as->lock);
+		while (as->next_ag < mp->m_sb.sb_agcount &&
+		       as->want && !as->want(as->next_ag))
+			as->next_ag++;
+		agno = as->next_ag++;
+		pthread_mutex_unlock(&as->lock);
+		if (agno >= mp->m_sb.sb_agcount)
+			break;
+
+		ag = &as->ags[agno];
+		if (!seenint()) {
+			as->scan(agno, ag->priv, &ag->out);
+			ag->scanned = 1;
+		}
+
+		pthread_mutex_lock(&as->lock);
+		ag->done = 1;
+		pthread_cond_broadcast(&as->wakeup);
+		pthread_mutex_unlock(&as->lock);
+	}
+}
+
+/*
+ * Scan each AG for which @want returns true (or all of them if @want is
+ * NULL).  The AGs are handed out in order to a thread per CPU.  As each
+ * one finishes, in order, its output is printed and @done is called on
+ * it, so the report starts as soon as the first AG is done.  AGs skipped
+ * because of an interrupt are never passed to @done.
+ */
+void
+agscan_run(
+	int			(*want)(xfs_agnumber_t agno),
+	agscan_scan_f		scan,
+	agscan_done_f		done,
+	size_t			privsize)
+{
+	struct agscan		as = { 0 };
+	struct workqueue	wq;
+	struct agscan_ag	*ag;
+	xfs_agnumber_t		agcount = mp->m_sb.sb_agcount;
+	xfs_agnumber_t		agno;
+	unsigned int		nthreads;
+	unsigned int		i = 0;
+	int			threaded;
+
+	as.ags = xcalloc(agcount, sizeof(struct agscan_ag));
+	for (agno = 0; agno < agcount; agno++)
+		as.ags[agno].priv = xcalloc(1, privsize);
+	as.want = want;
+	as.scan = scan;
+	pthread_mutex_init(&as.lock, NULL);
+	pthread_cond_init(&as.wakeup, NULL);
+
+	nthreads = min(workqueue_nr_cpus(), agcount);
+	threaded = workqueue_create(&wq, &as, nthreads) == 0;
+	if (threaded) {
+		for (; i < nthreads; i++)
+			if (workqueue_add(&wq, agscan_worker, i, NULL))
+				break;
+	}
+	if (i == 0) {
+		/* no threads, scan everything before reporting */
+		wq.wq_ctx = &as;
+		agscan_worker(&wq, 0, NULL);
+	}
+
+	for (agno = 0; agno < agcount; agno++) {
+		if (want && !want(agno))
+			continue;
+		ag = &as.ags[agno];
+		pthread_mutex_lock(&as.lock);
+		while (!ag->done)
+			pthread_cond_wait(&as.wakeup, &as.lock);
+		pthread_mutex_unlock(&as.lock);
+
+		agscan_flush(&ag->out);
+		if (ag->scanned)
+			done(agno, ag->priv);
+	}
+
+	if (threaded)
+		workqueue_destroy(&wq);
+	for (agno = 0; agno < agcount; agno++)
+		xfree(as.ags[agno].priv);
+	xfree(as.ags);
+	pthread_cond_destroy(&as.wakeup);
+	pthread_mutex_destroy(&as.lock);
+}
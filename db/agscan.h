@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Read-only scans of every AG on a pool of threads.  The scan functions
+ * can't use the iocur stack, so they read buffers with agscan_readbuf and
+ * print with agscan_printf; the output is held back and printed in AG
+ * order, so it comes out just as a serial scan would have printed it.
+ */
+
+struct agscan_out {
+	char		*buf;		/* NUL separated messages */
+	size_t		len;
+	size_t		size;
+};
+
+/* Scan @agno into @priv.  Called from the worker threads. */
+typedef void	(*agscan_scan_f)(xfs_agnumber_t agno, void *priv,
+				 struct agscan_out *out);
+/* Fold @agno's results into the totals.  Called in AG order. */
+typedef void	(*agscan_done_f)(xfs_agnumber_t agno, void *priv);
+
+extern void	agscan_run(int (*want)(xfs_agnumber_t agno),
+			   agscan_scan_f scan, agscan_done_f done,
+			   size_t privsize);
+extern void	agscan_printf(struct agscan_out *out, const char *fmt, ...);
+extern void	agscan_flush(struct agscan_out *out);
+extern struct xfs_buf *agscan_readbuf(typnm_t typ, xfs_daddr_t daddr,
+				      int count);
+extern void	agscan_readahead(xfs_daddr_t daddr, int count);
@@ -37,6 +37,7 @@
 #include "freesp.h"
 #include "help.h"
 #include "hash.h"
+#include "iextbench.h"
 #include "inode.h"
 #include "input.h"
 #include "io.h"
@@ -134,6 +135,7 @@ init_commands(void)
 	fsmap_init();
 	help_init();
 	hash_init();
+	iextbench_init();
 	inode_init();
 	input_init();
 	logformat_init();
@@ -26,12 +26,20 @@
 #include "type.h"
 #include "init.h"
 #include "malloc.h"
+#include "agscan.h"
 
 typedef struct extent {
 	xfs_fileoff_t	startoff;
 	xfs_filblks_t	blockcount;
 } extent_t;
 
+/* Extent counts for one AG, added to the totals once it's scanned. */
+typedef struct fragag {
+	struct agscan_out *out;
+	__uint64_t	actual;
+	__uint64_t	ideal;
+} fragag_t;
+
 typedef	struct extmap {
 	int		naents;
 	int		nents;
@@ -51,12 +59,14 @@ static int		Rflag;
 static int		rflag;
 static int		vflag;
 
-typedef void	(*scan_lbtree_f_t)(struct xfs_btree_block *block,
+typedef void	(*scan_lbtree_f_t)(fragag_t		*fa,
+				   struct xfs_btree_block *block,
 				   int			level,
 				   extmap_t		**extmapp,
 				   typnm_t		btype);
 
-typedef void	(*scan_sbtree_f_t)(struct xfs_btree_block *block,
+typedef void	(*scan_sbtree_f_t)(fragag_t		*fa,
+				   struct xfs_btree_block *block,
 				   int			level,
 				   xfs_agf_t		*agf);
 
@@ -68,23 +78,28 @@ static int		frag_f(int argc, char **argv);
 static int		init(int argc, char **argv);
 static void		process_bmbt_reclist(xfs_bmbt_rec_t *rp, int numrecs,
 					     extmap_t **extmapp);
-static void		process_btinode(xfs_dinode_t *dip, extmap_t **extmapp,
-					int whichfork);
+static void		process_btinode(fragag_t *fa, xfs_dinode_t *dip,
+					extmap_t **extmapp, int whichfork);
 static void		process_exinode(xfs_dinode_t *dip, extmap_t **extmapp,
 					int whichfork);
-static void		process_fork(xfs_dinode_t *dip, int whichfork);
-static void		process_inode(xfs_agf_t *agf, xfs_agino_t agino,
-				      xfs_dinode_t *dip);
-static void		scan_ag(xfs_agnumber_t agno);
-static void		scan_lbtree(xfs_fsblock_t root, int nlevels,
-				    scan_lbtree_f_t func, extmap_t **extmapp,
-				    typnm_t btype);
-static void		scan_sbtree(xfs_agf_t *agf, xfs_agblock_t root,
-				    int nlevels, scan_sbtree_f_t func,
-				    typnm_t btype);
-static void		scanfunc_bmap(struct xfs_btree_block *block, int level,
+static void		process_fork(fragag_t *fa, xfs_dinode_t *dip,
+				     int whichfork);
+static void		process_inode(fragag_t *fa, xfs_agf_t *agf,
+				      xfs_agino_t agino, xfs_dinode_t *dip);
+static void		scan_ag(xfs_agnumber_t agno, void *priv,
+				struct agscan_out *out);
+static void		scan_ag_done(xfs_agnumber_t agno, void *priv);
+static void		scan_lbtree(fragag_t *fa, xfs_fsblock_t root,
+				    int nlevels, scan_lbtree_f_t func,
+				    extmap_t **extmapp, typnm_t btype);
+static void		scan_sbtree(fragag_t *fa, xfs_agf_t *agf,
+				    xfs_agblock_t root, int nlevels,
+				    scan_sbtree_f_t func, typnm_t btype);
+static void		scanfunc_bmap(fragag_t *fa,
+				      struct xfs_btree_block *block, int level,
 				      extmap_t **extmapp, typnm_t btype);
-static void		scanfunc_ino(struct xfs_btree_block *block, int level,
+static void		scanfunc_ino(fragag_t *fa,
+				     struct xfs_btree_block *block, int level,
 				     xfs_agf_t *agf);
 
 static const cmdinfo_t	frag_cmd =
@@ -158,13 +173,11 @@ frag_f(
 	int		argc,
 	char		**argv)
 {
-	xfs_agnumber_t	agno;
 	double		answer;
 
 	if (!init(argc, argv))
 		return 0;
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
-		scan_ag(agno);
+	agscan_run(NULL, scan_ag, scan_ag_done, sizeof(fragag_t));
 	if (extcount_actual)
 		answer = (double)(extcount_actual - extcount_ideal) * 100.0 /
 			 (double)extcount_actual;
@@ -245,6 +258,7 @@ process_bmbt_reclist(
 
 static void
 process_btinode(
+	fragag_t		*fa,
 	xfs_dinode_t		*dip,
 	extmap_t		**extmapp,
 	int			whichfork)
@@ -262,7 +276,10 @@ process_btinode(
 	pp = XFS_BMDR_PTR_ADDR(dib, 1,
 		libxfs_bmdr_maxrecs(XFS_DFORK_SIZE(dip, mp, whichfork), 0));
 	for (i = 0; i < be16_to_cpu(dib->bb_numrecs); i++)
-		scan_lbtree(get_unaligned_be64(&pp[i]),
+		agscan_readahead(XFS_FSB_TO_DADDR(mp,
+				get_unaligned_be64(&pp[i])), blkbb);
+	for (i = 0; i < be16_to_cpu(dib->bb_numrecs); i++)
+		scan_lbtree(fa, get_unaligned_be64(&pp[i]),
 			 be16_to_cpu(dib->bb_level), scanfunc_bmap, extmapp,
 			whichfork == XFS_DATA_FORK ? TYP_BMAPBTD : TYP_BMAPBTA);
 }
@@ -281,6 +298,7 @@ process_exinode(
 
 static void
 process_fork(
+	fragag_t	*fa,
 	xfs_dinode_t	*dip,
 	int		whichfork)
 {
@@ -296,16 +314,17 @@ process_fork(
 		process_exinode(dip, &extmap, whichfork);
 		break;
 	case XFS_DINODE_FMT_BTREE:
-		process_btinode(dip, &extmap, whichfork);
+		process_btinode(fa, dip, &extmap, whichfork);
 		break;
 	}
-	extcount_actual += extmap->nents;
-	extcount_ideal += extmap_ideal(extmap);
+	fa->actual += extmap->nents;
+	fa->ideal += extmap_ideal(extmap);
 	xfree(extmap);
 }
 
 static void
 process_inode(
+	fragag_t		*fa,
 	xfs_agf_t		*agf,
 	xfs_agino_t		agino,
 	xfs_dinode_t		*dip)
@@ -343,73 +362,94 @@ process_inode(
 		skipd = 1;
 		break;
 	}
-	actual = extcount_actual;
-	ideal = extcount_ideal;
+	actual = fa->actual;
+	ideal = fa->ideal;
 	if (!skipd)
-		process_fork(dip, XFS_DATA_FORK);
+		process_fork(fa, dip, XFS_DATA_FORK);
 	skipa = !aflag || !XFS_DFORK_Q(dip);
 	if (!skipa)
-		process_fork(dip, XFS_ATTR_FORK);
+		process_fork(fa, dip, XFS_ATTR_FORK);
 	if (vflag && (!skipd || !skipa))
-		dbprintf(_("inode %lld actual %lld ideal %lld\n"),
-			ino, extcount_actual - actual, extcount_ideal - ideal);
+		agscan_printf(fa->out, _("inode %lld actual %lld ideal %lld\n"),
+			ino, fa->actual - actual, fa->ideal - ideal);
 }
 
+/*
+ * The AGs are scanned in parallel, each counting extents into its own
+ * fragag_t, which is added to the totals once all AGs before it are done.
+ */
 static void
 scan_ag(
-	xfs_agnumber_t	agno)
+	xfs_agnumber_t		agno,
+	void			*priv,
+	struct agscan_out	*out)
 {
-	xfs_agf_t	*agf;
-	xfs_agi_t	*agi;
-
-	push_cur();
-	set_cur(&typtab[TYP_AGF],
-		XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
-	if ((agf = iocur_top->data) == NULL) {
-		dbprintf(_("can't read agf block for ag %u\n"), agno);
-		pop_cur();
+	fragag_t		*fa = priv;
+	struct xfs_buf		*agfbp;
+	struct xfs_buf		*agibp;
+	xfs_agf_t		*agf;
+	xfs_agi_t		*agi;
+
+	fa->out = out;
+	agfbp = agscan_readbuf(TYP_AGF,
+			XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1));
+	if (!agfbp) {
+		agscan_printf(out, _("can't read agf block for ag %u\n"), agno);
 		return;
 	}
-	push_cur();
-	set_cur(&typtab[TYP_AGI],
-		XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
-	if ((agi = iocur_top->data) == NULL) {
-		dbprintf(_("can't read agi block for ag %u\n"), agno);
-		pop_cur();
-		pop_cur();
+	agf = agfbp->b_addr;
+	agibp = agscan_readbuf(TYP_AGI,
+			XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1));
+	if (!agibp) {
+		agscan_printf(out, _("can't read agi block for ag %u\n"), agno);
+		libxfs_putbuf(agfbp);
 		return;
 	}
-	scan_sbtree(agf, be32_to_cpu(agi->agi_root),
+	agi = agibp->b_addr;
+	scan_sbtree(fa, agf, be32_to_cpu(agi->agi_root),
 			be32_to_cpu(agi->agi_level), scanfunc_ino, TYP_INOBT);
-	pop_cur();
-	pop_cur();
+	libxfs_putbuf(agibp);
+	libxfs_putbuf(agfbp);
+}
+
+static void
+scan_ag_done(
+	xfs_agnumber_t	agno,
+	void		*priv)
+{
+	fragag_t	*fa = priv;
+
+	extcount_actual += fa->actual;
+	extcount_ideal += fa->ideal;
 }
 
 static void
 scan_lbtree(
+	fragag_t	*fa,
 	xfs_fsblock_t	root,
 	int		nlevels,
 	scan_lbtree_f_t	func,
 	extmap_t	**extmapp,
 	typnm_t		btype)
 {
-	push_cur();
-	set_cur(&typtab[btype], XFS_FSB_TO_DADDR(mp, root), blkbb, DB_RING_IGN,
-		NULL);
-	if (iocur_top->data == NULL) {
-		dbprintf(_("can't read btree block %u/%u\n"),
+	struct xfs_buf	*bp;
+
+	bp = agscan_readbuf(btype, XFS_FSB_TO_DADDR(mp, root), blkbb);
+	if (!bp) {
+		agscan_printf(fa->out, _("can't read btree block %u/%u\n"),
 			XFS_FSB_TO_AGNO(mp, root),
 			XFS_FSB_TO_AGBNO(mp, root));
 		return;
 	}
-	(*func)(iocur_top->data, nlevels - 1, extmapp, btype);
-	pop_cur();
+	(*func)(fa, bp->b_addr, nlevels - 1, extmapp, btype);
+	libxfs_putbuf(bp);
 }
 
 static void
 scan_sbtree(
+	fragag_t	*fa,
 	xfs_agf_t	*agf,
 	xfs_agblock_t	root,
 	int		nlevels,
@@ -417,20 +457,21 @@ scan_sbtree(
 	typnm_t		btype)
 {
 	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
+	struct xfs_buf	*bp;
 
-	push_cur();
-	set_cur(&typtab[btype], XFS_AGB_TO_DADDR(mp, seqno, root),
-		blkbb, DB_RING_IGN, NULL);
-	if (iocur_top->data == NULL) {
-		dbprintf(_("can't read btree block %u/%u\n"), seqno, root);
+	bp = agscan_readbuf(btype, XFS_AGB_TO_DADDR(mp, seqno, root), blkbb);
+	if (!bp) {
+		agscan_printf(fa->out, _("can't read btree block %u/%u\n"),
+			seqno, root);
 		return;
 	}
-	(*func)(iocur_top->data, nlevels - 1, agf);
-	pop_cur();
+	(*func)(fa, bp->b_addr, nlevels - 1, agf);
+	libxfs_putbuf(bp);
 }
 
 static void
 scanfunc_bmap(
+	fragag_t		*fa,
 	struct xfs_btree_block	*block,
 	int			level,
 	extmap_t		**extmapp,
@@ -445,8 +486,9 @@ scanfunc_bmap(
 
 	if (level == 0) {
 		if (nrecs > mp->m_bmap_dmxr[0]) {
-			dbprintf(_("invalid numrecs (%u) in %s block\n"),
-				   nrecs, typtab[btype].name);
+			agscan_printf(fa->out,
+				_("invalid numrecs (%u) in %s block\n"),
+				nrecs, typtab[btype].name);
 			return;
 		}
 		rp = XFS_BMBT_REC_ADDR(mp, block, 1);
@@ -455,24 +497,29 @@ scanfunc_bmap(
 	}
 
 	if (nrecs > mp->m_bmap_dmxr[1]) {
-		dbprintf(_("invalid numrecs (%u) in %s block\n"),
-			   nrecs, typtab[btype].name);
+		agscan_printf(fa->out, _("invalid numrecs (%u) in %s block\n"),
+			nrecs, typtab[btype].name);
 		return;
 	}
 	pp = XFS_BMBT_PTR_ADDR(mp, block, 1, mp->m_bmap_dmxr[0]);
 	for (i = 0; i < nrecs; i++)
-		scan_lbtree(be64_to_cpu(pp[i]), level, scanfunc_bmap, extmapp,
-									btype);
+		agscan_readahead(XFS_FSB_TO_DADDR(mp, be64_to_cpu(pp[i])),
+				blkbb);
+	for (i = 0; i < nrecs; i++)
+		scan_lbtree(fa, be64_to_cpu(pp[i]), level, scanfunc_bmap,
+							extmapp, btype);
 }
 
 static void
 scanfunc_ino(
+	fragag_t		*fa,
 	struct xfs_btree_block	*block,
 	int			level,
 	xfs_agf_t		*agf)
 {
 	xfs_agino_t		agino;
 	xfs_agnumber_t		seqno = be32_to_cpu(agf->agf_seqno);
+	struct xfs_buf		*bp;
 	int			i;
 	int			j;
 	int			off;
@@ -481,33 +528,40 @@ scanfunc_ino(
 
 	if (level == 0) {
 		rp = XFS_INOBT_REC_ADDR(mp, block, 1);
+		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
+			agscan_readahead(XFS_AGB_TO_DADDR(mp, seqno,
+				XFS_AGINO_TO_AGBNO(mp,
+					be32_to_cpu(rp[i].ir_startino))),
+				XFS_FSB_TO_BB(mp, mp->m_ialloc_blks));
 		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++) {
 			agino = be32_to_cpu(rp[i].ir_startino);
 			off = XFS_INO_TO_OFFSET(mp, agino);
-			push_cur();
-			set_cur(&typtab[TYP_INODE],
+			bp = agscan_readbuf(TYP_INODE,
 				XFS_AGB_TO_DADDR(mp, seqno,
 						 XFS_AGINO_TO_AGBNO(mp, agino)),
-				XFS_FSB_TO_BB(mp, mp->m_ialloc_blks),
-				DB_RING_IGN, NULL);
-			if (iocur_top->data == NULL) {
-				dbprintf(_("can't read inode block %u/%u\n"),
+				XFS_FSB_TO_BB(mp, mp->m_ialloc_blks));
+			if (!bp) {
+				agscan_printf(fa->out,
+					_("can't read inode block %u/%u\n"),
 					seqno, XFS_AGINO_TO_AGBNO(mp, agino));
 				continue;
 			}
 			for (j = 0; j < XFS_INODES_PER_CHUNK; j++) {
 				if (XFS_INOBT_IS_FREE_DISK(&rp[i], j))
 					continue;
-				process_inode(agf, agino + j, (xfs_dinode_t *)
-					((char *)iocur_top->data +
+				process_inode(fa, agf, agino + j,
+					(xfs_dinode_t *)((char *)bp->b_addr +
 					((off + j) << mp->m_sb.sb_inodelog)));
 			}
-			pop_cur();
+			libxfs_putbuf(bp);
 		}
 		return;
 	}
 	pp = XFS_INOBT_PTR_ADDR(mp, block, 1, mp->m_inobt_mxr[1]);
 	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-		scan_sbtree(agf, be32_to_cpu(pp[i]), level, scanfunc_ino,
+		agscan_readahead(XFS_AGB_TO_DADDR(mp, seqno,
+				be32_to_cpu(pp[i])), blkbb);
+	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
+		scan_sbtree(fa, agf, be32_to_cpu(pp[i]), level, scanfunc_ino,
 								TYP_INOBT);
 }
@@ -24,6 +24,7 @@
 #include "output.h"
 #include "init.h"
 #include "malloc.h"
+#include "agscan.h"
 
 typedef struct histent
 {
@@ -33,23 +34,37 @@ typedef struct histent
 	long long	blocks;
 } histent_t;
 
+/* Free space found in one AG, added to the totals once it's scanned. */
+typedef struct agfree
+{
+	struct agscan_out *out;
+	long long	totexts;
+	long long	totblocks;
+	long long	*count;		/* per histogram bucket */
+	long long	*blocks;
+} agfree_t;
+
 static void	addhistent(int h);
-static void	addtohist(xfs_agnumber_t agno, xfs_agblock_t agbno,
-			  xfs_extlen_t len);
+static void	addtohist(agfree_t *af, xfs_agnumber_t agno,
+			  xfs_agblock_t agbno, xfs_extlen_t len);
 static int	freesp_f(int argc, char **argv);
 static void	histinit(int maxlen);
 static int	init(int argc, char **argv);
 static void	printhist(void);
-static void	scan_ag(xfs_agnumber_t agno);
-static void	scanfunc_bno(struct xfs_btree_block *block, typnm_t typ, int level,
-			     xfs_agf_t *agf);
-static void	scanfunc_cnt(struct xfs_btree_block *block, typnm_t typ, int level,
-			     xfs_agf_t *agf);
-static void	scan_freelist(xfs_agf_t *agf);
-static void	scan_sbtree(xfs_agf_t *agf, xfs_agblock_t root, typnm_t typ,
-			    int nlevels,
-			    void (*func)(struct xfs_btree_block *block, typnm_t typ,
-					 int level, xfs_agf_t *agf));
+static void	scan_ag(xfs_agnumber_t agno, void *priv,
+			struct agscan_out *out);
+static void	scan_ag_done(xfs_agnumber_t agno, void *priv);
+static void	scanfunc_bno(agfree_t *af, struct xfs_btree_block *block,
+			     typnm_t typ, int level, xfs_agf_t *agf);
+static void	scanfunc_cnt(agfree_t *af, struct xfs_btree_block *block,
+			     typnm_t typ, int level, xfs_agf_t *agf);
+static void	scan_freelist(agfree_t *af, xfs_agf_t *agf);
+static void	scan_sbtree(agfree_t *af, xfs_agf_t *agf, xfs_agblock_t root,
+			    typnm_t typ, int nlevels,
+			    void (*func)(agfree_t *af,
+					 struct xfs_btree_block *block,
+					 typnm_t typ, int level,
+					 xfs_agf_t *agf));
 static int	usage(void);
 
 static int		agcount;
@@ -92,18 +107,13 @@ freesp_f(
 	int		argc,
 	char		**argv)
 {
-	xfs_agnumber_t	agno;
-
 	if (!init(argc, argv))
 		return 0;
 
 	if (dumpflag)
 		dbprintf("%8s %8s %8s\n", "agno", "agbno", "len");
 
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)  {
-		if (inaglist(agno))
-			scan_ag(agno);
-	}
+	agscan_run(inaglist, scan_ag, scan_ag_done, sizeof(agfree_t));
 	if (histcount)
 		printhist();
 	if (summaryflag) {
@@ -205,33 +215,67 @@ usage(void)
 	return 0;
 }
 
+/*
+ * The AGs are scanned in parallel; each one's extents are counted into
+ * its own agfree_t, which is added to the histogram once all the AGs
+ * before it are done.
+ */
 static void
 scan_ag(
-	xfs_agnumber_t	agno)
+	xfs_agnumber_t		agno,
+	void			*priv,
+	struct agscan_out	*out)
 {
-	xfs_agf_t	*agf;
+	agfree_t		*af = priv;
+	struct xfs_buf		*bp;
+	xfs_agf_t		*agf;
 
-	push_cur();
-	set_cur(&typtab[TYP_AGF], XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
-				XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
-	agf = iocur_top->data;
-	scan_freelist(agf);
+	af->out = out;
+	af->count = xcalloc(histcount + 1, sizeof(long long));
+	af->blocks = xcalloc(histcount + 1, sizeof(long long));
+
+	bp = agscan_readbuf(TYP_AGF, XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
+				XFS_FSS_TO_BB(mp, 1));
+	if (!bp)
+		return;
+	agf = bp->b_addr;
+	scan_freelist(af, agf);
 	if (countflag)
-		scan_sbtree(agf, be32_to_cpu(agf->agf_roots[XFS_BTNUM_CNT]),
+		scan_sbtree(af, agf, be32_to_cpu(agf->agf_roots[XFS_BTNUM_CNT]),
 			TYP_CNTBT, be32_to_cpu(agf->agf_levels[XFS_BTNUM_CNT]),
 			scanfunc_cnt);
 	else
-		scan_sbtree(agf, be32_to_cpu(agf->agf_roots[XFS_BTNUM_BNO]),
+		scan_sbtree(af, agf, be32_to_cpu(agf->agf_roots[XFS_BTNUM_BNO]),
 			TYP_BNOBT, be32_to_cpu(agf->agf_levels[XFS_BTNUM_BNO]),
 			scanfunc_bno);
-	pop_cur();
+	libxfs_putbuf(bp);
+}
+
+static void
+scan_ag_done(
+	xfs_agnumber_t	agno,
+	void		*priv)
+{
+	agfree_t	*af = priv;
+	int		i;
+
+	totexts += af->totexts;
+	totblocks += af->totblocks;
+	for (i = 0; i < histcount; i++) {
+		hist[i].count += af->count[i];
+		hist[i].blocks += af->blocks[i];
+	}
+	xfree(af->count);
+	xfree(af->blocks);
 }
 
 static void
 scan_freelist(
+	agfree_t	*af,
 	xfs_agf_t	*agf)
 {
 	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
+	struct xfs_buf	*bp;
 	xfs_agfl_t	*agfl;
 	xfs_agblock_t	bno;
 	int		i;
@@ -239,10 +283,12 @@ scan_freelist(
 
 	if (be32_to_cpu(agf->agf_flcount) == 0)
 		return;
-	push_cur();
-	set_cur(&typtab[TYP_AGFL], XFS_AG_DADDR(mp, seqno, XFS_AGFL_DADDR(mp)),
-				XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
-	agfl = iocur_top->data;
+	bp = agscan_readbuf(TYP_AGFL,
+			XFS_AG_DADDR(mp, seqno, XFS_AGFL_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1));
+	if (!bp)
+		return;
+	agfl = bp->b_addr;
 	i = be32_to_cpu(agf->agf_flfirst);
 
 	/* open coded XFS_BUF_TO_AGFL_BNO */
@@ -252,50 +298,68 @@ scan_freelist(
 	/* verify agf values before proceeding */
 	if (be32_to_cpu(agf->agf_flfirst) >= XFS_AGFL_SIZE(mp) ||
 	    be32_to_cpu(agf->agf_fllast) >= XFS_AGFL_SIZE(mp)) {
-		dbprintf(_("agf %d freelist blocks bad, skipping "
+		agscan_printf(af->out, _("agf %d freelist blocks bad, skipping "
 			  "freelist scan\n"), i);
-		pop_cur();
+		libxfs_putbuf(bp);
 		return;
 	}
 
 	for (;;) {
 		bno = be32_to_cpu(agfl_bno[i]);
-		addtohist(seqno, bno, 1);
+		addtohist(af, seqno, bno, 1);
 		if (i == be32_to_cpu(agf->agf_fllast))
 			break;
 		if (++i == XFS_AGFL_SIZE(mp))
 			i = 0;
 	}
-	pop_cur();
+	libxfs_putbuf(bp);
 }
 
 static void
 scan_sbtree(
+	agfree_t	*af,
 	xfs_agf_t	*agf,
 	xfs_agblock_t	root,
 	typnm_t		typ,
 	int		nlevels,
-	void		(*func)(struct xfs_btree_block	*block,
+	void		(*func)(agfree_t		*af,
+				struct xfs_btree_block	*block,
 				typnm_t			typ,
 				int			level,
 				xfs_agf_t		*agf))
 {
 	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
+	struct xfs_buf	*bp;
 
-	push_cur();
-	set_cur(&typtab[typ], XFS_AGB_TO_DADDR(mp, seqno, root),
-		blkbb, DB_RING_IGN, NULL);
-	if (iocur_top->data == NULL) {
-		dbprintf(_("can't read btree block %u/%u\n"), seqno, root);
+	bp = agscan_readbuf(typ, XFS_AGB_TO_DADDR(mp, seqno, root), blkbb);
+	if (!bp) {
+		agscan_printf(af->out, _("can't read btree block %u/%u\n"),
+			seqno, root);
 		return;
 	}
-	(*func)(iocur_top->data, typ, nlevels - 1, agf);
-	pop_cur();
+	(*func)(af, bp->b_addr, typ, nlevels - 1, agf);
+	libxfs_putbuf(bp);
+}
+
+/* Start reading all the children of a node before we descend into them. */
+static void
+readahead_children(
+	xfs_agf_t		*agf,
+	xfs_alloc_ptr_t		*pp,
+	int			numrecs)
+{
+	xfs_agnumber_t		seqno = be32_to_cpu(agf->agf_seqno);
+	int			i;
+
+	for (i = 0; i < numrecs; i++)
+		agscan_readahead(XFS_AGB_TO_DADDR(mp, seqno,
+				be32_to_cpu(pp[i])), blkbb);
 }
 
 /*ARGSUSED*/
 static void
 scanfunc_bno(
+	agfree_t		*af,
 	struct xfs_btree_block	*block,
 	typnm_t			typ,
 	int			level,
@@ -312,18 +376,21 @@ scanfunc_bno(
 	if (level == 0) {
 		rp = XFS_ALLOC_REC_ADDR(mp, block, 1);
 		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-			addtohist(be32_to_cpu(agf->agf_seqno),
+			addtohist(af, be32_to_cpu(agf->agf_seqno),
 					be32_to_cpu(rp[i].ar_startblock),
 					be32_to_cpu(rp[i].ar_blockcount));
 		return;
 	}
 	pp = XFS_ALLOC_PTR_ADDR(mp, block, 1, mp->m_alloc_mxr[1]);
+	readahead_children(agf, pp, be16_to_cpu(block->bb_numrecs));
 	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-		scan_sbtree(agf, be32_to_cpu(pp[i]), typ, level, scanfunc_bno);
+		scan_sbtree(af, agf, be32_to_cpu(pp[i]), typ, level,
+				scanfunc_bno);
 }
 
 static void
 scanfunc_cnt(
+	agfree_t		*af,
 	struct xfs_btree_block	*block,
 	typnm_t			typ,
 	int			level,
@@ -340,14 +407,16 @@ scanfunc_cnt(
 	if (level == 0) {
 		rp = XFS_ALLOC_REC_ADDR(mp, block, 1);
 		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-			addtohist(be32_to_cpu(agf->agf_seqno),
+			addtohist(af, be32_to_cpu(agf->agf_seqno),
 					be32_to_cpu(rp[i].ar_startblock),
 					be32_to_cpu(rp[i].ar_blockcount));
 		return;
 	}
 	pp = XFS_ALLOC_PTR_ADDR(mp, block, 1, mp->m_alloc_mxr[1]);
+	readahead_children(agf, pp, be16_to_cpu(block->bb_numrecs));
 	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
-		scan_sbtree(agf, be32_to_cpu(pp[i]), typ, level, scanfunc_cnt);
+		scan_sbtree(af, agf, be32_to_cpu(pp[i]), typ, level,
+				scanfunc_cnt);
 }
 
 static void
@@ -366,6 +435,7 @@ addhistent(
 
 static void
 addtohist(
+	agfree_t	*af,
 	xfs_agnumber_t	agno,
 	xfs_agblock_t	agbno,
 	xfs_extlen_t	len)
@@ -373,13 +443,13 @@ addtohist(
 	int		i;
 
 	if (dumpflag)
-		dbprintf("%8d %8d %8d\n", agno, agbno, len);
-	totexts++;
-	totblocks += len;
+		agscan_printf(af->out, "%8d %8d %8d\n", agno, agbno, len);
+	af->totexts++;
+	af->totblocks += len;
 	for (i = 0; i < histcount; i++) {
 		if (hist[i].high >= len) {
-			hist[i].count++;
-			hist[i].blocks += len;
+			af->count[i]++;
+			af->blocks[i] += len;
 			break;
 		}
 	}
@@ -22,6 +22,9 @@
 #include "fsmap.h"
 #include "output.h"
 #include "init.h"
+#include "malloc.h"
+#include "type.h"
+#include "agscan.h"
 
 struct fsmap_info {
 	unsigned long long	nr;
@@ -47,69 +50,416 @@ fsmap_fn(
 	return 0;
 }
 
+/*
+ * Summary mode: rather than printing every rmap record, add them up by
+ * owner class, by inode and by extent size.  Each AG is summarized into
+ * its own fsmap_ag on one of the agscan threads and then folded into the
+ * totals, so memory depends on the number of owners, not records.
+ */
+enum {
+	FSMAP_DATA = 0,
+	FSMAP_UNWRITTEN,
+	FSMAP_ATTR,
+	FSMAP_BMBT,
+	FSMAP_FS,
+	FSMAP_LOG,
+	FSMAP_AG,
+	FSMAP_INOBT,
+	FSMAP_INODES,
+	FSMAP_REFC,
+	FSMAP_COW,
+	FSMAP_OTHER,
+	FSMAP_NR_CLASSES,
+};
+
+static const char	*fsmap_class_names[FSMAP_NR_CLASSES] = {
+	[FSMAP_DATA]		= N_("file data"),
+	[FSMAP_UNWRITTEN]	= N_("unwritten data"),
+	[FSMAP_ATTR]		= N_("attr forks"),
+	[FSMAP_BMBT]		= N_("bmbt blocks"),
+	[FSMAP_FS]		= N_("static fs metadata"),
+	[FSMAP_LOG]		= N_("journal"),
+	[FSMAP_AG]		= N_("AG btrees"),
+	[FSMAP_INOBT]		= N_("inode btrees"),
+	[FSMAP_INODES]		= N_("inode chunks"),
+	[FSMAP_REFC]		= N_("refcount btree"),
+	[FSMAP_COW]		= N_("CoW staging"),
+	[FSMAP_OTHER]		= N_("other"),
+};
+
+#define FSMAP_NR_HIST	32	/* log2 extent size buckets */
+#define FSMAP_MINSLOTS	1024
+
+struct fsmap_count {
+	unsigned long long	extents;
+	unsigned long long	blocks;
+};
+
+/* Blocks mapped by one inode; a slot is free if it has no extents. */
+struct fsmap_owner {
+	xfs_ino_t		ino;
+	unsigned long long	extents;
+	unsigned long long	blocks;
+};
+
+struct fsmap_owners {
+	struct fsmap_owner	*slots;
+	unsigned int		mask;
+	unsigned int		count;
+};
+
+struct fsmap_ag {
+	struct fsmap_count	class[FSMAP_NR_CLASSES];
+	struct fsmap_count	hist[FSMAP_NR_HIST];
+	struct fsmap_owners	owners;
+};
+
+static struct {
+	xfs_fsblock_t		start_fsb;
+	xfs_fsblock_t		end_fsb;
+	int			histflag;
+	int			topn;
+	struct fsmap_count	class[FSMAP_NR_CLASSES];
+	struct fsmap_owners	owners;
+} fsmap_sum;
+
+static inline unsigned int
+fsmap_owner_hash(
+	xfs_ino_t		ino,
+	unsigned int		mask)
+{
+	return (unsigned int)((ino * 0x9e37fffffffc0001ULL) >> 32) & mask;
+}
+
 static void
-fsmap(
-	xfs_fsblock_t		start_fsb,
-	xfs_fsblock_t		end_fsb)
+fsmap_owners_grow(
+	struct fsmap_owners	*t)
+{
+	struct fsmap_owner	*old = t->slots;
+	unsigned int		oldslots = old ? t->mask + 1 : 0;
+	unsigned int		nslots = old ? oldslots * 2 : FSMAP_MINSLOTS;
+	unsigned int		i, j;
+
+	t->slots = xcalloc(nslots, sizeof(struct fsmap_owner));
+	t->mask = nslots - 1;
+	for (i = 0; i < oldslots; i++) {
+		if (!old[i].extents)
+			continue;
+		for (j = fsmap_owner_hash(old[i].ino, t->mask);
+		     t->slots[j].extents;
+		     j = (j + 1) & t->mask)
+			;
+		t->slots[j] = old[i];
+	}
+	xfree(old);
+}
+
+static void
+fsmap_owner_add(
+	struct fsmap_owners	*t,
+	xfs_ino_t		ino,
+	unsigned long long	extents,
+	unsigned long long	blocks)
+{
+	struct fsmap_owner	*o;
+	unsigned int		i;
+
+	if (!t->slots || t->count >= (t->mask + 1) / 4 * 3)
+		fsmap_owners_grow(t);
+	for (i = fsmap_owner_hash(ino, t->mask); ; i = (i + 1) & t->mask) {
+		o = &t->slots[i];
+		if (!o->extents) {
+			o->ino = ino;
+			t->count++;
+			break;
+		}
+		if (o->ino == ino)
+			break;
+	}
+	o->extents += extents;
+	o->blocks += blocks;
+}
+
+static int
+fsmap_class(
+	struct xfs_rmap_irec	*rec)
+{
+	if (!XFS_RMAP_NON_INODE_OWNER(rec->rm_owner)) {
+		if (rec->rm_flags & XFS_RMAP_BMBT_BLOCK)
+			return FSMAP_BMBT;
+		if (rec->rm_flags & XFS_RMAP_ATTR_FORK)
+			return FSMAP_ATTR;
+		if (rec->rm_flags & XFS_RMAP_UNWRITTEN)
+			return FSMAP_UNWRITTEN;
+		return FSMAP_DATA;
+	}
+	switch (rec->rm_owner) {
+	case XFS_RMAP_OWN_FS:
+		return FSMAP_FS;
+	case XFS_RMAP_OWN_LOG:
+		return FSMAP_LOG;
+	case XFS_RMAP_OWN_AG:
+		return FSMAP_AG;
+	case XFS_RMAP_OWN_INOBT:
+		return FSMAP_INOBT;
+	case XFS_RMAP_OWN_INODES:
+		return FSMAP_INODES;
+	case XFS_RMAP_OWN_REFC:
+		return FSMAP_REFC;
+	case XFS_RMAP_OWN_COW:
+		return FSMAP_COW;
+	default:
+		return FSMAP_OTHER;
+	}
+}
+
+static int
+fsmap_sum_fn(
+	struct xfs_btree_cur	*cur,
+	struct xfs_rmap_irec	*rec,
+	void			*priv)
+{
+	struct fsmap_ag		*fa = priv;
+	struct fsmap_count	*c;
+	int			h;
+
+	c = &fa->class[fsmap_class(rec)];
+	c->extents++;
+	c->blocks += rec->rm_blockcount;
+
+	h = libxfs_highbit32(rec->rm_blockcount);
+	fa->hist[h].extents++;
+	fa->hist[h].blocks += rec->rm_blockcount;
+
+	if (!XFS_RMAP_NON_INODE_OWNER(rec->rm_owner))
+		fsmap_owner_add(&fa->owners, rec->rm_owner, 1,
+				rec->rm_blockcount);
+	return 0;
+}
+
+/* Query the part of @agno inside the range, calling @fn on each record. */
+static int
+fsmap_query_ag(
+	xfs_agnumber_t		agno,
+	xfs_rmap_query_range_fn	fn,
+	void			*priv,
+	struct agscan_out	*out)
 {
-	struct fsmap_info	info;
-	xfs_agnumber_t		start_ag;
-	xfs_agnumber_t		end_ag;
-	xfs_agnumber_t		agno;
-	xfs_daddr_t		eofs;
 	struct xfs_rmap_irec	low = {0};
 	struct xfs_rmap_irec	high = {0};
 	struct xfs_btree_cur	*bt_cur;
 	struct xfs_buf		*agbp;
 	int			error;
 
-	eofs = XFS_FSB_TO_BB(mp, mp->m_sb.sb_dblocks);
-	if (XFS_FSB_TO_DADDR(mp, end_fsb) >= eofs)
-		end_fsb = XFS_DADDR_TO_FSB(mp, eofs - 1);
-
-	low.rm_startblock = XFS_FSB_TO_AGBNO(mp, start_fsb);
-	high.rm_startblock = -1U;
+	if (agno == XFS_FSB_TO_AGNO(mp, fsmap_sum.start_fsb))
+		low.rm_startblock = XFS_FSB_TO_AGBNO(mp, fsmap_sum.start_fsb);
+	if (agno == XFS_FSB_TO_AGNO(mp, fsmap_sum.end_fsb))
+		high.rm_startblock = XFS_FSB_TO_AGBNO(mp, fsmap_sum.end_fsb);
+	else
+		high.rm_startblock = -1U;
 	high.rm_owner = ULLONG_MAX;
 	high.rm_offset = ULLONG_MAX;
 	high.rm_flags = XFS_RMAP_ATTR_FORK | XFS_RMAP_BMBT_BLOCK | XFS_RMAP_UNWRITTEN;
 
-	start_ag = XFS_FSB_TO_AGNO(mp, start_fsb);
-	end_ag = XFS_FSB_TO_AGNO(mp, end_fsb);
+	error = -libxfs_alloc_read_agf(mp, NULL, agno, 0, &agbp);
+	if (error) {
+		agscan_printf(out, _("Error %d while reading AGF.\n"), error);
+		return error;
+	}
 
-	info.nr = 0;
-	for (agno = start_ag; agno <= end_ag; agno++) {
-		if (agno == end_ag)
-			high.rm_startblock = XFS_FSB_TO_AGBNO(mp, end_fsb);
+	bt_cur = libxfs_rmapbt_init_cursor(mp, NULL, agbp, agno);
+	if (!bt_cur) {
+		libxfs_putbuf(agbp);
+		agscan_printf(out, _("Not enough memory.\n"));
+		return ENOMEM;
+	}
 
-		error = -libxfs_alloc_read_agf(mp, NULL, agno, 0, &agbp);
-		if (error) {
-			dbprintf(_("Error %d while reading AGF.\n"), error);
-			return;
-		}
+	error = -libxfs_rmap_query_range(bt_cur, &low, &high, fn, priv);
+	if (error) {
+		libxfs_btree_del_cursor(bt_cur, XFS_BTREE_ERROR);
+		libxfs_putbuf(agbp);
+		agscan_printf(out, _("Error %d while querying fsmap btree.\n"),
+			error);
+		return error;
+	}
 
-		bt_cur = libxfs_rmapbt_init_cursor(mp, NULL, agbp, agno);
-		if (!bt_cur) {
-			libxfs_putbuf(agbp);
-			dbprintf(_("Not enough memory.\n"));
-			return;
-		}
+	libxfs_btree_del_cursor(bt_cur, XFS_BTREE_NOERROR);
+	libxfs_putbuf(agbp);
+	return 0;
+}
 
-		info.agno = agno;
-		error = -libxfs_rmap_query_range(bt_cur, &low, &high,
-				fsmap_fn, &info);
-		if (error) {
-			libxfs_btree_del_cursor(bt_cur, XFS_BTREE_ERROR);
-			libxfs_putbuf(agbp);
-			dbprintf(_("Error %d while querying fsmap btree.\n"),
-				error);
-			return;
-		}
+static int
+fsmap_want_ag(
+	xfs_agnumber_t		agno)
+{
+	return agno >= XFS_FSB_TO_AGNO(mp, fsmap_sum.start_fsb) &&
+	       agno <= XFS_FSB_TO_AGNO(mp, fsmap_sum.end_fsb);
+}
 
-		libxfs_btree_del_cursor(bt_cur, XFS_BTREE_NOERROR);
-		libxfs_putbuf(agbp);
+static void
+fsmap_print_hist(
+	struct agscan_out	*out,
+	xfs_agnumber_t		agno,
+	struct fsmap_count	*hist)
+{
+	unsigned long long	total = 0;
+	int			i;
+
+	for (i = 0; i < FSMAP_NR_HIST; i++)
+		total += hist[i].blocks;
+	if (!total)
+		return;
 
-		if (agno == start_ag)
-			low.rm_startblock = 0;
+	agscan_printf(out, _("AG %u extent sizes:\n"), agno);
+	agscan_printf(out, "%10s %10s %10s %12s %6s\n",
+		_("from"), _("to"), _("extents"), _("blocks"), _("pct"));
+	for (i = 0; i < FSMAP_NR_HIST; i++) {
+		if (!hist[i].extents)
+			continue;
+		agscan_printf(out, "%10u %10u %10llu %12llu %6.2f\n",
+			1U << i, (2U << i) - 1, hist[i].extents,
+			hist[i].blocks, hist[i].blocks * 100.0 / total);
+	}
+}
+
+static void
+fsmap_sum_ag(
+	xfs_agnumber_t		agno,
+	void			*priv,
+	struct agscan_out	*out)
+{
+	struct fsmap_ag		*fa = priv;
+
+	if (fsmap_query_ag(agno, fsmap_sum_fn, fa, out))
+		return;
+	if (fsmap_sum.histflag)
+		fsmap_print_hist(out, agno, fa->hist);
+}
+
+static void
+fsmap_sum_ag_done(
+	xfs_agnumber_t		agno,
+	void			*priv)
+{
+	struct fsmap_ag		*fa = priv;
+	struct fsmap_owner	*o;
+	int			i;
+
+	for (i = 0; i < FSMAP_NR_CLASSES; i++) {
+		fsmap_sum.class[i].extents += fa->class[i].extents;
+		fsmap_sum.class[i].blocks += fa->class[i].blocks;
+	}
+	for (o = fa->owners.slots;
+	     o && o <= &fa->owners.slots[fa->owners.mask]; o++)
+		if (o->extents)
+			fsmap_owner_add(&fsmap_sum.owners, o->ino, o->extents,
+					o->blocks);
+	xfree(fa->owners.slots);
+}
+
+/* Does @a use more space than @b?  Ties go to the lower inode number. */
+static inline int
+fsmap_owner_bigger(
+	struct fsmap_owner	*a,
+	struct fsmap_owner	*b)
+{
+	if (a->blocks != b->blocks)
+		return a->blocks > b->blocks;
+	return a->ino < b->ino;
+}
+
+static void
+fsmap_print_top(void)
+{
+	struct fsmap_owner	*top;
+	struct fsmap_owner	*o;
+	int			ntop = 0;
+	int			i;
+
+	if (!fsmap_sum.topn || !fsmap_sum.owners.count)
+		return;
+
+	/* keep the biggest owners seen so far, biggest first */
+	top = xcalloc(fsmap_sum.topn, sizeof(struct fsmap_owner));
+	for (o = fsmap_sum.owners.slots;
+	     o <= &fsmap_sum.owners.slots[fsmap_sum.owners.mask]; o++) {
+		if (!o->extents)
+			continue;
+		if (ntop == fsmap_sum.topn &&
+		    !fsmap_owner_bigger(o, &top[ntop - 1]))
+			continue;
+		if (ntop < fsmap_sum.topn)
+			ntop++;
+		for (i = ntop - 1; i > 0 && fsmap_owner_bigger(o, &top[i - 1]);
+		     i--)
+			top[i] = top[i - 1];
+		top[i] = *o;
+	}
+
+	dbprintf(_("top %d of %u inodes by blocks mapped:\n"), ntop,
+		fsmap_sum.owners.count);
+	dbprintf("%20s %10s %12s\n", _("inode"), _("extents"), _("blocks"));
+	for (i = 0; i < ntop; i++)
+		dbprintf("%20llu %10llu %12llu\n",
+			(unsigned long long)top[i].ino, top[i].extents,
+			top[i].blocks);
+	xfree(top);
+}
+
+static void
+fsmap_summary(void)
+{
+	unsigned long long	extents = 0;
+	unsigned long long	blocks = 0;
+	int			i;
+
+	memset(fsmap_sum.class, 0, sizeof(fsmap_sum.class));
+	memset(&fsmap_sum.owners, 0, sizeof(fsmap_sum.owners));
+
+	agscan_run(fsmap_want_ag, fsmap_sum_ag, fsmap_sum_ag_done,
+			sizeof(struct fsmap_ag));
+
+	for (i = 0; i < FSMAP_NR_CLASSES; i++) {
+		extents += fsmap_sum.class[i].extents;
+		blocks += fsmap_sum.class[i].blocks;
+	}
+	dbprintf("%-20s %10s %12s %6s\n", _("owner"), _("extents"),
+		_("blocks"), _("pct"));
+	for (i = 0; i < FSMAP_NR_CLASSES; i++) {
+		if (!fsmap_sum.class[i].extents)
+			continue;
+		dbprintf("%-20s %10llu %12llu %6.2f\n",
+			_(fsmap_class_names[i]), fsmap_sum.class[i].extents,
+			fsmap_sum.class[i].blocks,
+			fsmap_sum.class[i].blocks * 100.0 / blocks);
+	}
+	dbprintf("%-20s %10llu %12llu\n", _("total"), extents, blocks);
+
+	fsmap_print_top();
+	xfree(fsmap_sum.owners.slots);
+	fsmap_sum.owners.slots = NULL;
+}
+
+static void
+fsmap(void)
+{
+	struct fsmap_info	info;
+	struct agscan_out	out = { 0 };
+	xfs_agnumber_t		start_ag;
+	xfs_agnumber_t		end_ag;
+	xfs_agnumber_t		agno;
+	int			error;
+
+	start_ag = XFS_FSB_TO_AGNO(mp, fsmap_sum.start_fsb);
+	end_ag = XFS_FSB_TO_AGNO(mp, fsmap_sum.end_fsb);
+
+	info.nr = 0;
+	for (agno = start_ag; agno <= end_ag; agno++) {
+		info.agno = agno;
+		error = fsmap_query_ag(agno, fsmap_fn, &info, &out);
+		agscan_flush(&out);
+		if (error)
+			return;
 	}
 }
 
@@ -120,22 +470,47 @@ fsmap_f(
 {
 	char			*p;
 	int			c;
+	int			summary = 0;
 	xfs_fsblock_t		start_fsb = 0;
 	xfs_fsblock_t		end_fsb = NULLFSBLOCK;
+	xfs_daddr_t		eofs;
 
 	if (!xfs_sb_version_hasrmapbt(&mp->m_sb)) {
 		dbprintf(_("Filesystem does not support reverse mapping btree.\n"));
 		return 0;
 	}
 
-	while ((c = getopt(argc, argv, "")) != EOF) {
+	fsmap_sum.histflag = 0;
+	fsmap_sum.topn = 10;
+	optind = 0;
+	while ((c = getopt(argc, argv, "hn:s")) != EOF) {
 		switch (c) {
+		case 'h':
+			fsmap_sum.histflag = 1;
+			summary = 1;
+			break;
+		case 'n':
+			fsmap_sum.topn = strtol(optarg, &p, 0);
+			if (*p != '\0' || fsmap_sum.topn < 0) {
+				dbprintf(_("Bad fsmap count %s.\n"), optarg);
+				return 0;
+			}
+			summary = 1;
+			break;
+		case 's':
+			summary = 1;
+			break;
 		default:
 			dbprintf(_("Bad option for fsmap command.\n"));
 			return 0;
 		}
 	}
 
+	if (argc > optind + 2) {
+		dbprintf(_("Too many arguments to fsmap command.\n"));
+		return 0;
+	}
+
 	if (argc > optind) {
 		start_fsb = strtoull(argv[optind], &p, 0);
 		if (*p != '\0' || start_fsb >= mp->m_sb.sb_dblocks) {
@@ -152,14 +527,23 @@ fsmap_f(
 		}
 	}
 
-	fsmap(start_fsb, end_fsb);
+	eofs = XFS_FSB_TO_BB(mp, mp->m_sb.sb_dblocks);
+	if (XFS_FSB_TO_DADDR(mp, end_fsb) >= eofs)
+		end_fsb = XFS_DADDR_TO_FSB(mp, eofs - 1);
+	fsmap_sum.start_fsb = start_fsb;
+	fsmap_sum.end_fsb = end_fsb;
+
+	if (summary)
+		fsmap_summary();
+	else
+		fsmap();
 
 	return 0;
 }
 
 static const cmdinfo_t	fsmap_cmd =
-	{ "fsmap", NULL, fsmap_f, 0, 2, 0,
-	  N_("[start_fsb] [end_fsb]"),
+	{ "fsmap", NULL, fsmap_f, 0, 6, 0,
+	  N_("[-s] [-h] [-n count] [start_fsb] [end_fsb]"),
 	  N_("display reverse mapping(s)"), NULL };
 
 void
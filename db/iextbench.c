@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "libxfs.h"
+#include <sys/time.h>
+#include "command.h"
+#include "iextbench.h"
+#include "output.h"
+#include "init.h"
+
+/*
+ * Time the in-core extent list: build a data fork of single block extents
+ * at random offsets, look them up, replace them and tear it down again,
+ * all in random order.  Nothing is read from or written to the disk.
+ */
+
+static int	iextbench_f(int argc, char **argv);
+
+static const cmdinfo_t	iextbench_cmd =
+	{ "iextbench", NULL, iextbench_f, 0, -1, 0,
+	  N_("[-n extents] [-s seed]"),
+	  N_("time random in-core extent list operations"), NULL };
+
+/* Keep the offsets sparse enough that most random ones are in holes. */
+#define IEXTBENCH_SPAN	(1ULL << 40)
+
+static xfs_fileoff_t
+iextbench_random_off(void)
+{
+	return ((((__uint64_t)random() << 31) ^ random()) % IEXTBENCH_SPAN);
+}
+
+static double
+iextbench_secs(
+	struct timeval		*start)
+{
+	struct timeval		now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+	       (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void
+iextbench_report(
+	const char		*what,
+	long			ops,
+	double			secs)
+{
+	dbprintf(_("%-14s %10ld ops %8.3f seconds %12.0f ops/sec\n"),
+		what, ops, secs, secs > 0 ? ops / secs : 0.0);
+}
+
+/* Add a one block extent in a random hole. */
+static void
+iextbench_insert(
+	struct xfs_inode	*ip)
+{
+	struct xfs_bmbt_irec	new;
+	struct xfs_bmbt_irec	got;
+	xfs_extnum_t		idx;
+
+	do {
+		new.br_startoff = iextbench_random_off();
+	} while (libxfs_iext_lookup_extent(ip, &ip->i_df, new.br_startoff,
+					   &idx, &got) &&
+		 got.br_startoff <= new.br_startoff);
+
+	new.br_startblock = new.br_startoff;
+	new.br_blockcount = 1;
+	new.br_state = XFS_EXT_NORM;
+	libxfs_iext_insert(ip, idx, 1, &new, 0);
+}
+
+/* Check that there are @nextents extents, in offset order. */
+static int
+iextbench_verify(
+	struct xfs_inode	*ip,
+	xfs_extnum_t		nextents)
+{
+	struct xfs_bmbt_irec	got;
+	xfs_fileoff_t		next = 0;
+	xfs_extnum_t		idx;
+
+	if (libxfs_iext_count(&ip->i_df) != nextents) {
+		dbprintf(_("expected %d extents, found %d\n"), nextents,
+			libxfs_iext_count(&ip->i_df));
+		return 0;
+	}
+	for (idx = 0; libxfs_iext_get_extent(&ip->i_df, idx, &got); idx++) {
+		if (got.br_startoff < next) {
+			dbprintf(_("extent %d at offset %llu is out of order\n"),
+				idx, (unsigned long long)got.br_startoff);
+			return 0;
+		}
+		next = got.br_startoff + got.br_blockcount;
+	}
+	return 1;
+}
+
+static int
+iextbench_f(
+	int			argc,
+	char			**argv)
+{
+	struct xfs_inode	ip;
+	struct xfs_bmbt_irec	got;
+	struct timeval		start;
+	xfs_extnum_t		idx;
+	long			nextents = 1000000;
+	long			i;
+	unsigned int		seed = 0;
+	char			*p;
+	int			c;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "n:s:")) != EOF) {
+		switch (c) {
+		case 'n':
+			nextents = strtol(optarg, &p, 0);
+			if (*p != '\0' || nextents <= 0 || nextents > INT_MAX) {
+				dbprintf(_("bad extent count %s\n"), optarg);
+				return 0;
+			}
+			break;
+		case 's':
+			seed = strtoul(optarg, &p, 0);
+			if (*p != '\0') {
+				dbprintf(_("bad seed %s\n"), optarg);
+				return 0;
+			}
+			break;
+		default:
+			dbprintf(_("bad option for iextbench command\n"));
+			return 0;
+		}
+	}
+	if (optind != argc) {
+		dbprintf(_("bad argument count %d to iextbench, expected 0 "
+			   "arguments\n"), argc - 1);
+		return 0;
+	}
+
+	memset(&ip, 0, sizeof(ip));
+	ip.i_mount = mp;
+	ip.i_d.di_format = XFS_DINODE_FMT_EXTENTS;
+	ip.i_df.if_flags = XFS_IFEXTENTS;
+	srandom(seed);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nextents; i++)
+		iextbench_insert(&ip);
+	iextbench_report(_("insert"), nextents, iextbench_secs(&start));
+	if (!iextbench_verify(&ip, nextents))
+		goto out;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nextents; i++)
+		libxfs_iext_lookup_extent(&ip, &ip.i_df,
+				iextbench_random_off(), &idx, &got);
+	iextbench_report(_("lookup"), nextents, iextbench_secs(&start));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nextents; i++) {
+		libxfs_iext_remove(&ip, random() % nextents, 1, 0);
+		iextbench_insert(&ip);
+	}
+	iextbench_report(_("remove+insert"), nextents, iextbench_secs(&start));
+	if (!iextbench_verify(&ip, nextents))
+		goto out;
+
+	gettimeofday(&start, NULL);
+	for (i = nextents; i > 0; i--)
+		libxfs_iext_remove(&ip, random() % i, 1, 0);
+	iextbench_report(_("remove"), nextents, iextbench_secs(&start));
+	iextbench_verify(&ip, 0);
+out:
+	libxfs_idestroy_fork(&ip, XFS_DATA_FORK);
+	return 0;
+}
+
+void
+iextbench_init(void)
+{
+	add_command(&iextbench_cmd);
+}
@@ -501,6 +501,9 @@ write_cur(void)
 	else
 		write_cur_buf();
 
+	/* raw writes bypass the in-core inodes, so don't trust them now */
+	libxfs_icache_invalidate();
+
 	/* If we didn't write the crc automatically, re-check inode validity */
 	if (xfs_sb_version_hascrc(&mp->m_sb) &&
 	    skip_crc && iocur_top->ino_buf) {
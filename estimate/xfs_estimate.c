@@ -23,7 +23,8 @@
  */
 #include "libxfs.h"
 #include <sys/stat.h>
-#include <ftw.h>
+#include <dirent.h>
+#include "workqueue.h"
 
 unsigned long long
 cvtnum(char *s)
@@ -45,8 +46,6 @@ cvtnum(char *s)
 	return 0LL;
 }
 
-int ffn(const char *, const struct stat *, int, struct FTW *);
-
 #define BLOCKSIZE	4096
 #define INODESIZE	256
 #define PERDIRENTRY	\
@@ -71,6 +70,39 @@ int __debug = 0;
 int ilog = 0;
 int elog = 0;
 
+/*
+ * Space used by a set of directory entries.  Each directory walked adds up
+ * its entries in one of these and then folds it into the totals above.
+ */
+struct est {
+	unsigned long long	dirsize;
+	unsigned long long	fullblocks;
+	unsigned long long	isize;
+	unsigned long long	nslinks;
+	unsigned long long	nfiles;
+	unsigned long long	ndirs;
+	unsigned long long	nspecial;
+};
+
+/* A directory waiting to be read. */
+struct est_dir {
+	char			*path;
+	size_t			len;
+};
+
+struct est_walk {
+	dev_t			dev;		/* don't cross mount points */
+	unsigned long long	pending;	/* directories not yet read */
+	pthread_mutex_t		lock;
+	pthread_cond_t		done;
+};
+
+char *progname;
+
+static void walk(char *);
+static void est_queue_dir(struct workqueue *, const char *, size_t,
+		const char *);
+
 void
 usage(char *progname)
 {
@@ -97,6 +129,7 @@ main(int argc, char **argv)
 	char dname[40];
 	int c;
 
+	progname = basename(argv[0]);
 	setlocale(LC_ALL, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
 	textdomain(PACKAGE);
@@ -168,7 +201,7 @@ main(int argc, char **argv)
 		ndirs=0LL;		/* number of directories */
 		nspecial=0LL;		/* number of special files */
 
-		nftw(argv[optind], ffn, 40, FTW_PHYS | FTW_MOUNT);
+		walk(argv[optind]);
 
 		if (__debug) {
 			printf(_("dirsize=%llu\n"), dirsize);
@@ -213,36 +246,215 @@ main(int argc, char **argv)
 	return 0;
 }
 
-int
-ffn(const char *path, const struct stat *stb, int flags, struct FTW *f)
+/*
+ * Account for one directory entry, which has a path of @pathlen bytes.
+ * A NULL @stb means the entry couldn't be stat'ed.
+ */
+static void
+est_add(
+	struct est		*e,
+	size_t			pathlen,
+	const struct stat	*stb)
 {
 	/* cases are in most-encountered to least-encountered order */
-	dirsize+=PERDIRENTRY+strlen(path);
-	isize+=INODESIZE;
+	e->dirsize+=PERDIRENTRY+pathlen;
+	e->isize+=INODESIZE;
+	if (!stb)
+		return;
 	switch (S_IFMT & stb->st_mode) {
 	case S_IFREG:			/* regular files */
-		fullblocks+=FBLOCKS(stb->st_blocks * 512 + blocksize-1);
+		e->fullblocks+=FBLOCKS(stb->st_blocks * 512 + blocksize-1);
 		if (stb->st_blocks * 512 < stb->st_size)
-			fullblocks++;	/* add one bmap block here */
-		nfiles++;
+			e->fullblocks++;	/* add one bmap block here */
+		e->nfiles++;
 		break;
 	case S_IFLNK:			/* symbolic links */
 		if (stb->st_size >= (INODESIZE - (sizeof(xfs_dinode_t)+4)))
-			fullblocks+=FBLOCKS(stb->st_size + blocksize-1);
-		nslinks++;
+			e->fullblocks+=FBLOCKS(stb->st_size + blocksize-1);
+		e->nslinks++;
 		break;
 	case S_IFDIR:			/* directories */
-		dirsize+=blocksize;	/* fudge upwards */
+		e->dirsize+=blocksize;	/* fudge upwards */
 		if (stb->st_size >= blocksize)
-			dirsize+=blocksize;
-		ndirs++;
+			e->dirsize+=blocksize;
+		e->ndirs++;
 		break;
 	case S_IFIFO:			/* named pipes */
 	case S_IFCHR:			/* Character Special device */
 	case S_IFBLK:			/* Block Special device */
 	case S_IFSOCK:			/* socket */
-		nspecial++;
+		e->nspecial++;
 		break;
 	}
-	return 0;
+}
+
+static void
+est_merge(
+	struct est_walk		*w,
+	struct est		*e)
+{
+	pthread_mutex_lock(&w->lock);
+	dirsize += e->dirsize;
+	fullblocks += e->fullblocks;
+	isize += e->isize;
+	nslinks += e->nslinks;
+	nfiles += e->nfiles;
+	ndirs += e->ndirs;
+	nspecial += e->nspecial;
+	pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Read one directory, stat'ing each entry relative to it and queueing
+ * any subdirectories for the next free thread.  Like nftw with FTW_PHYS
+ * and FTW_MOUNT, symlinks aren't followed and nothing on another device
+ * is counted.
+ */
+static void
+est_walk_dir(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct est_walk		*w = wq->wq_ctx;
+	struct est_dir		*d = arg;
+	struct est		e = { 0 };
+	struct dirent		*dp;
+	struct stat		stb;
+	DIR			*dir;
+	size_t			baselen;
+	int			fd;
+
+	/* children of "/" don't get another separator */
+	baselen = d->len;
+	if (d->path[baselen - 1] != '/')
+		baselen++;
+
+	fd = open(d->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	dir = fd < 0 ? NULL : fdopendir(fd);
+	if (!dir) {
+		if (fd >= 0)
+			close(fd);
+		goto out;
+	}
+
+	while ((dp = readdir(dir)) != NULL) {
+		if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+			continue;
+		if (fstatat(fd, dp->d_name, &stb, AT_SYMLINK_NOFOLLOW) < 0) {
+			est_add(&e, baselen + strlen(dp->d_name), NULL);
+			continue;
+		}
+		if (stb.st_dev != w->dev)
+			continue;
+		est_add(&e, baselen + strlen(dp->d_name), &stb);
+		if (S_ISDIR(stb.st_mode))
+			est_queue_dir(wq, d->path, d->len, dp->d_name);
+	}
+	closedir(dir);
+out:
+	est_merge(w, &e);
+	free(d->path);
+	free(d);
+
+	pthread_mutex_lock(&w->lock);
+	if (--w->pending == 0)
+		pthread_cond_signal(&w->done);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Queue @name in the directory @parent (or @parent itself) to be read. */
+static void
+est_queue_dir(
+	struct workqueue	*wq,
+	const char		*parent,
+	size_t			plen,
+	const char		*name)
+{
+	struct est_walk		*w = wq->wq_ctx;
+	struct est_dir		*d;
+	size_t			len = plen;
+
+	if (name)
+		len += (parent[plen - 1] != '/') + strlen(name);
+	d = malloc(sizeof(*d));
+	if (d)
+		d->path = malloc(len + 1);
+	if (!d || !d->path) {
+		fprintf(stderr, _("%s: out of memory\n"), progname);
+		exit(1);
+	}
+	memcpy(d->path, parent, plen);
+	if (name) {
+		if (parent[plen - 1] != '/')
+			d->path[plen++] = '/';
+		strcpy(d->path + plen, name);
+	}
+	d->path[len] = '\0';
+	d->len = len;
+
+	pthread_mutex_lock(&w->lock);
+	w->pending++;
+	pthread_mutex_unlock(&w->lock);
+
+	if (workqueue_add(wq, est_walk_dir, 0, d)) {
+		fprintf(stderr, _("%s: out of memory\n"), progname);
+		exit(1);
+	}
+}
+
+/*
+ * Add up the space used by everything under @path.  Directories are read
+ * by a pool of threads; the walk spends most of its time waiting for
+ * metadata I/O, so use several threads per CPU.
+ */
+static void
+walk(
+	char			*path)
+{
+	struct est_walk		w = { 0 };
+	struct workqueue	wq;
+	struct est		e = { 0 };
+	struct stat		stb;
+	size_t			len;
+
+	/* nftw strips trailing slashes from the starting path */
+	len = strlen(path);
+	while (len > 1 && path[len - 1] == '/')
+		len--;
+	path = strndup(path, len);
+	if (!path) {
+		fprintf(stderr, _("%s: out of memory\n"), progname);
+		exit(1);
+	}
+
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_cond_init(&w.done, NULL);
+
+	if (lstat(path, &stb) < 0)
+		goto out;
+	est_add(&e, len, &stb);
+	est_merge(&w, &e);
+	if (!S_ISDIR(stb.st_mode))
+		goto out;
+	w.dev = stb.st_dev;
+
+	/*
+	 * The queue only runs dry once the last directory has been read,
+	 * so wait for that before stopping the threads.
+	 */
+	if (workqueue_create(&wq, &w, workqueue_nr_cpus() * 4) != 0) {
+		fprintf(stderr, _("%s: cannot create threads\n"), progname);
+		exit(1);
+	}
+	est_queue_dir(&wq, path, len, NULL);
+	pthread_mutex_lock(&w.lock);
+	while (w.pending)
+		pthread_cond_wait(&w.done, &w.lock);
+	pthread_mutex_unlock(&w.lock);
+	workqueue_destroy(&wq);
+out:
+	pthread_cond_destroy(&w.done);
+	pthread_mutex_destroy(&w.lock);
+	free(path);
 }
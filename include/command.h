@@ -69,5 +69,8 @@ extern int		command(const cmdinfo_t *ci, int argc, char **argv);
 extern void		report_io_times(const char *verb, struct timeval *t2,
 					long long offset, long long count,
 					long long total, int ops, int compact);
+extern void		add_io_totals(long long total, long long ops);
+extern void		get_io_totals(long long *total, long long *ops);
+extern void		reset_io_totals(void);
 
 #endif	/* __COMMAND_H__ */
@@ -163,6 +163,12 @@ platform_discard_blocks(int fd, uint64_t start, uint64_t len)
 	return 0;
 }
 
+static __inline__ int
+platform_zero_range(int fd, uint64_t start, uint64_t len)
+{
+	return EOPNOTSUPP;
+}
+
 /*
  * POSIX timer replacement.
  * It really just do the minimum we need for xfs_repair.
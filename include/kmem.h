@@ -24,22 +24,38 @@
 #define KM_MAYFAIL	0x0008u
 #define KM_LARGE	0x0010u
 
+/*
+ * Zones are slab caches of fixed size objects.  Each thread keeps a small
+ * magazine of free objects per zone so that most allocations and frees
+ * don't touch the zone lock; the zone itself hands out objects from its
+ * partly used slabs, and gives slabs back once they're empty.  Objects
+ * from a zone must be freed with kmem_zone_free, never kmem_free.
+ */
+struct kmem_slab;
+
 typedef struct kmem_zone {
 	int	zone_unitsize;	/* Size in bytes of zone unit           */
 	char	*zone_name;	/* tag name                             */
-	int	allocated;	/* debug: How many currently allocated  */
+	int	zone_id;	/* index of this zone's magazines       */
+	int	zone_objsize;	/* unitsize rounded up for alignment    */
+	int	zone_perslab;	/* objects in each slab                 */
+	pthread_mutex_t	zone_lock;
+	struct kmem_slab *zone_partial;	/* slabs with free objects      */
+	struct kmem_slab *zone_full;	/* slabs without                */
+	struct kmem_slab *zone_empty;	/* one with nothing in use      */
+	unsigned long	zone_nslabs;
+	unsigned long long zone_allocs;	/* stats, folded in from the    */
+	unsigned long long zone_frees;	/* magazines as they're used    */
+	unsigned long long zone_refills;
+	unsigned long long zone_flushes;
 } kmem_zone_t;
 
 extern kmem_zone_t *kmem_zone_init(int, char *);
+extern void	kmem_zone_destroy(kmem_zone_t *);
 extern void	*kmem_zone_alloc(kmem_zone_t *, int);
 extern void	*kmem_zone_zalloc(kmem_zone_t *, int);
-
-static inline void
-kmem_zone_free(kmem_zone_t *zone, void *ptr)
-{
-	zone->allocated--;
-	free(ptr);
-}
+extern void	kmem_zone_free(kmem_zone_t *, void *);
+extern void	kmem_report(FILE *);
 
 extern void	*kmem_alloc(size_t, int);
 extern void	*kmem_zalloc(size_t, int);
@@ -139,6 +139,33 @@ platform_discard_blocks(int fd, uint64_t start, uint64_t len)
 	return 0;
 }
 
+/*
+ * Have the kernel zero a range of a file or block device, which for devices
+ * may be done with write-same/write-zeroes commands rather than by sending
+ * zeroes down the wire.  Returns 0 or an errno if it can't be done this way.
+ */
+static __inline__ int
+platform_zero_range(int fd, uint64_t start, uint64_t len)
+{
+#ifdef BLKZEROOUT
+	__uint64_t range[2] = { start, len };
+	struct stat st;
+
+	if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKZEROOUT, &range) < 0)
+			return errno;
+		return 0;
+	}
+#endif
+#ifdef FALLOC_FL_ZERO_RANGE
+	if (fallocate(fd, FALLOC_FL_ZERO_RANGE, start, len) < 0)
+		return errno;
+	return 0;
+#else
+	return EOPNOTSUPP;
+#endif
+}
+
 #define ENOATTR		ENODATA	/* Attribute not found */
 #define EFSCORRUPTED	EUCLEAN	/* Filesystem is corrupted */
 #define EFSBADCRC	EBADMSG	/* Bad CRC detected */
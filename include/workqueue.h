@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef __WORKQUEUE_H__
+#define __WORKQUEUE_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * A simple pool of threads running queued work items in FIFO order, for
+ * the tools that want to spread per-AG work over a few threads.  Errors
+ * are returned to the caller; xfs_repair wraps these to bail out instead.
+ */
+struct workqueue;
+
+typedef void workqueue_func_t(struct workqueue *wq, uint32_t index,
+			      void *arg);
+
+struct workqueue_item {
+	struct workqueue	*queue;
+	struct workqueue_item	*next;
+	workqueue_func_t	*function;
+	void			*arg;
+	uint32_t		index;
+};
+
+struct workqueue {
+	void			*wq_ctx;	/* for the work functions */
+	pthread_t		*threads;
+	struct workqueue_item	*next_item;
+	struct workqueue_item	*last_item;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wakeup;
+	unsigned int		item_count;
+	unsigned int		thread_count;
+	int			terminate;
+};
+
+extern int workqueue_create(struct workqueue *wq, void *wq_ctx,
+			    unsigned int nr_workers);
+extern int workqueue_add(struct workqueue *wq, workqueue_func_t fn,
+			 uint32_t index, void *arg);
+extern void workqueue_destroy(struct workqueue *wq);
+extern unsigned int workqueue_nr_cpus(void);
+
+#endif	/* __WORKQUEUE_H__ */
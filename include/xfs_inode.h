@@ -54,6 +54,7 @@ typedef struct xfs_inode {
 	struct xfs_ifork	i_df;		/* data fork */
 	struct xfs_trans	*i_transp;	/* ptr to owning transaction */
 	struct xfs_inode_log_item *i_itemp;	/* logging information */
+	unsigned int		i_flags;	/* XFS_I* flags, see below */
 	unsigned int		i_delayed_blks;	/* count of delay alloc blks */
 	struct xfs_icdinode	i_d;		/* most of ondisk inode */
 
@@ -65,6 +66,11 @@ typedef struct xfs_inode {
 	struct inode		i_vnode;
 } xfs_inode_t;
 
+/*
+ * In-core inode flags.
+ */
+#define XFS_ISTALE	(1 << 1)	/* in-core copy is out of date */
+
 static inline struct inode *VFS_I(struct xfs_inode *ip)
 {
 	return &ip->i_vnode;
@@ -151,6 +157,9 @@ extern int	libxfs_iflush_int (struct xfs_inode *, struct xfs_buf *);
 extern int	libxfs_iget(struct xfs_mount *, struct xfs_trans *, xfs_ino_t,
 				uint, struct xfs_inode **);
 extern void	libxfs_iput(struct xfs_inode *);
+extern void	libxfs_istale(struct xfs_inode *);
+extern void	libxfs_icache_invalidate(void);
+extern void	libxfs_icache_purge(void);
 
 #define IRELE(ip) libxfs_iput(ip)
 
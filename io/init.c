@@ -75,6 +75,7 @@ init_commands(void)
 	mincore_init();
 	mmap_init();
 	open_init();
+	parallel_init();
 	parent_init();
 	pread_init();
 	prealloc_init();
@@ -105,6 +105,7 @@ extern void		imap_init(void);
 extern void		inject_init(void);
 extern void		mmap_init(void);
 extern void		open_init(void);
+extern void		parallel_init(void);
 extern void		parent_init(void);
 extern void		pread_init(void);
 extern void		prealloc_init(void);
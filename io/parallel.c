@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <sys/wait.h>
+#include "command.h"
+#include "input.h"
+#include "init.h"
+#include "io.h"
+
+/*
+ * Run a sequence of xfs_io commands concurrently in a number of workers.
+ *
+ * Every xfs_io command parses its arguments with getopt(3) and works on the
+ * process-wide file table, I/O buffer and iovec, so commands cannot safely
+ * be run on several threads of the one process.  Instead each worker is a
+ * forked child with its own copy of that state and (by default) its own
+ * open file description for the current file, which gives the same kernel
+ * side contention on the inode as threads would.  Results are sent back to
+ * the parent over a pipe for the per-worker and aggregate reports.
+ */
+
+#define PARALLEL_SEP	";"	/* separates commands in the sequence */
+
+static cmdinfo_t parallel_cmd;
+
+struct worker_result {
+	int		worker;
+	int		error;
+	long long	total;
+	long long	ops;
+	struct timeval	time;
+};
+
+struct parallel_args {
+	char		**lines;	/* command sequence to run */
+	int		nlines;
+	int		iterations;	/* times to run the sequence */
+	int		barrier_fd;	/* read end of start barrier, or -1 */
+	int		result_fd;	/* write end of result pipe */
+	int		share;		/* use the file table descriptors */
+	int		quiet;		/* discard worker command output */
+};
+
+static void
+parallel_help(void)
+{
+	printf(_(
+"\n"
+" runs a sequence of commands concurrently in a number of workers\n"
+"\n"
+" Example:\n"
+" 'parallel -n 8 -b pwrite -R 0 1g ; fsync' - eight workers each write 1GiB\n"
+"        at random offsets into the open file and fsync it, all starting at\n"
+"        the same time\n"
+"\n"
+" The command sequence follows the options; individual commands are separated\n"
+" by a '%s' surrounded by spaces.  Each worker is a separate process with its\n"
+" own open file description for the current file, opened with the same flags\n"
+" (less create/truncate) as the original.  When all workers are done, the\n"
+" bytes and operations reported by each worker's commands are summarised per\n"
+" worker and in aggregate.\n"
+" -b   -- open all the files first, then start all workers together\n"
+" -C   -- print timing statistics in a condensed format\n"
+" -i N -- run the command sequence N times in each worker\n"
+" -n N -- number of workers to start (default 2)\n"
+" -q   -- discard the output of the commands run by the workers\n"
+" -s   -- don't reopen, worker N uses open file N %% (number of open files)\n"
+"\n"), PARALLEL_SEP);
+}
+
+/*
+ * Glue the argument vector back into individual command lines, breaking it
+ * at each separator.  The lines are split again with breakline() in the
+ * workers, just like commands given on the command line.
+ */
+static char **
+parallel_lines(
+	int		argc,
+	char		**argv,
+	int		*nlines)
+{
+	char		**lines = NULL;
+	int		start = 1;
+	int		n = 0;
+	int		i;
+
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], PARALLEL_SEP) == 0) {
+			start = 1;
+			continue;
+		}
+		if (start) {
+			lines = realloc(lines, ++n * sizeof(char *));
+			if (!lines)
+				goto out_nomem;
+			lines[n - 1] = strdup(argv[i]);
+			if (!lines[n - 1])
+				goto out_nomem;
+			start = 0;
+			continue;
+		}
+		lines[n - 1] = realloc(lines[n - 1],
+				strlen(lines[n - 1]) + strlen(argv[i]) + 2);
+		if (!lines[n - 1])
+			goto out_nomem;
+		strcat(lines[n - 1], " ");
+		strcat(lines[n - 1], argv[i]);
+	}
+	*nlines = n;
+	return lines;
+
+out_nomem:
+	perror("malloc");
+	exit(1);
+}
+
+static void
+parallel_free_lines(
+	char		**lines,
+	int		nlines)
+{
+	int		i;
+
+	for (i = 0; i < nlines; i++)
+		free(lines[i]);
+	free(lines);
+}
+
+/*
+ * Run one command line in a worker.  Returns -1 on error, otherwise the
+ * command's return value, which is non-zero if the worker should stop.
+ */
+static int
+parallel_run_line(
+	const char	*line)
+{
+	const cmdinfo_t	*ct;
+	char		*input;
+	char		**v;
+	int		c = 0;
+	int		done = 0;
+
+	input = strdup(line);
+	if (!input) {
+		perror("strdup");
+		return -1;
+	}
+	v = breakline(input, &c);
+	if (c) {
+		ct = find_command(v[0]);
+		if (ct)
+			done = command(ct, c, v);
+		else
+			done = -1;
+	}
+	doneline(input, v);
+	return done;
+}
+
+static void
+parallel_worker(
+	int			index,
+	struct parallel_args	*args)
+{
+	struct worker_result	result = { 0 };
+	struct timeval		t1;
+	char			c;
+	int			fd, i, j;
+	int			done = 0;
+
+	result.worker = index;
+
+	if (args->share) {
+		file = &filetable[index % filecount];
+	} else if (!(file->flags & IO_TMPFILE)) {
+		/* an O_TMPFILE has no name to reopen, so it is shared */
+		fd = openfile(file->name, NULL,
+				file->flags & ~(IO_CREAT | IO_TRUNC), 0600);
+		if (fd < 0) {
+			result.error = 1;
+			goto out;
+		}
+		file->fd = fd;
+	}
+
+	if (args->quiet) {
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+	}
+
+	/* the barrier opens when the parent closes its end of the pipe */
+	if (args->barrier_fd >= 0) {
+		while (read(args->barrier_fd, &c, 1) < 0 && errno == EINTR)
+			;
+		close(args->barrier_fd);
+	}
+
+	reset_io_totals();
+	gettimeofday(&t1, NULL);
+	for (i = 0; !done && i < args->iterations; i++)
+		for (j = 0; !done && j < args->nlines; j++)
+			done = parallel_run_line(args->lines[j]);
+	gettimeofday(&result.time, NULL);
+	result.time = tsub(result.time, t1);
+	get_io_totals(&result.total, &result.ops);
+	if (done < 0)
+		result.error = 1;
+out:
+	fflush(stdout);
+	fflush(stderr);
+	/* smaller than PIPE_BUF, so results from all workers stay intact */
+	if (write(args->result_fd, &result, sizeof(result)) != sizeof(result))
+		perror("write");
+	_exit(result.error);
+}
+
+static int
+parallel_result_cmp(
+	const void		*a,
+	const void		*b)
+{
+	return ((const struct worker_result *)a)->worker -
+	       ((const struct worker_result *)b)->worker;
+}
+
+static void
+parallel_report(
+	struct worker_result	*results,
+	int			nworkers,
+	struct timeval		*wall,
+	int			Cflag)
+{
+	struct worker_result	*r;
+	long long		total = 0;
+	long long		ops = 0;
+	char			verb[32];
+	int			errors = 0;
+
+	qsort(results, nworkers, sizeof(*results), parallel_result_cmp);
+	for (r = results; r < &results[nworkers]; r++) {
+		if (r->error) {
+			printf(_("worker %d failed\n"), r->worker);
+			errors++;
+			continue;
+		}
+		snprintf(verb, sizeof(verb), _("worker %d"), r->worker);
+		report_io_times(verb, &r->time, 0, r->total, r->total,
+				(int)r->ops, Cflag);
+		total += r->total;
+		ops += r->ops;
+	}
+	snprintf(verb, sizeof(verb), _("%d workers"), nworkers - errors);
+	report_io_times(verb, wall, 0, total, total, (int)ops, Cflag);
+}
+
+static int
+parallel_f(
+	int			argc,
+	char			**argv)
+{
+	struct parallel_args	args = { 0 };
+	struct worker_result	*results, r;
+	struct timeval		t1, t2;
+	int			barrier[2] = { -1, -1 };
+	int			resfd[2];
+	int			nworkers = 2;
+	int			bflag = 0, Cflag = 0;
+	int			nresults = 0;
+	pid_t			pid;
+	char			*sp;
+	int			c, i;
+
+	args.iterations = 1;
+	args.barrier_fd = -1;
+
+	/* stop at the first non-option, the rest belongs to the commands */
+	while ((c = getopt(argc, argv, "+bCi:n:qs")) != EOF) {
+		switch (c) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'C':
+			Cflag = 1;
+			break;
+		case 'i':
+			args.iterations = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || args.iterations <= 0) {
+				printf(_("non-numeric iteration count -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'n':
+			nworkers = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || nworkers <= 0) {
+				printf(_("non-numeric worker count -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'q':
+			args.quiet = 1;
+			break;
+		case 's':
+			args.share = 1;
+			break;
+		default:
+			return command_usage(&parallel_cmd);
+		}
+	}
+	if (optind == argc)
+		return command_usage(&parallel_cmd);
+
+	args.lines = parallel_lines(argc - optind, argv + optind, &args.nlines);
+	if (!args.nlines) {
+		command_usage(&parallel_cmd);
+		goto out_free;
+	}
+	for (i = 0; i < args.nlines; i++) {
+		sp = strchr(args.lines[i], ' ');
+		if (sp)
+			*sp = '\0';
+		if (!find_command(args.lines[i])) {
+			fprintf(stderr, _("command \"%s\" not found\n"),
+				args.lines[i]);
+			goto out_free;
+		}
+		if (sp)
+			*sp = ' ';
+	}
+
+	results = calloc(nworkers, sizeof(struct worker_result));
+	if (!results) {
+		perror("calloc");
+		goto out_free;
+	}
+	if (pipe(resfd) < 0) {
+		perror("pipe");
+		goto out_results;
+	}
+	if (bflag && pipe(barrier) < 0) {
+		perror("pipe");
+		goto out_pipe;
+	}
+	args.barrier_fd = barrier[0];
+	args.result_fd = resfd[1];
+
+	/* don't let the workers inherit (and repeat) buffered output */
+	fflush(stdout);
+	fflush(stderr);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < nworkers; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			break;
+		}
+		if (pid == 0) {
+			close(resfd[0]);
+			if (barrier[1] >= 0)
+				close(barrier[1]);
+			parallel_worker(i, &args);
+		}
+	}
+	nworkers = i;
+
+	close(resfd[1]);
+	if (barrier[0] >= 0) {
+		close(barrier[0]);
+		gettimeofday(&t1, NULL);
+		close(barrier[1]);
+	}
+
+	while (nresults < nworkers) {
+		c = read(resfd[0], &r, sizeof(r));
+		if (c < 0 && errno == EINTR)
+			continue;
+		if (c != sizeof(r))
+			break;
+		results[nresults++] = r;
+	}
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+	gettimeofday(&t2, NULL);
+	t2 = tsub(t2, t1);
+
+	if (nresults < nworkers)
+		fprintf(stderr, _("%d of %d workers did not report results\n"),
+			nworkers - nresults, nworkers);
+	if (nresults)
+		parallel_report(results, nresults, &t2, Cflag);
+
+	close(resfd[0]);
+	goto out_results;
+out_pipe:
+	close(resfd[0]);
+	close(resfd[1]);
+out_results:
+	free(results);
+out_free:
+	parallel_free_lines(args.lines, args.nlines);
+	return 0;
+}
+
+void
+parallel_init(void)
+{
+	parallel_cmd.name = "parallel";
+	parallel_cmd.cfunc = parallel_f;
+	parallel_cmd.argmin = 1;
+	parallel_cmd.argmax = -1;
+	parallel_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK |
+			     CMD_FLAG_ONESHOT;
+	parallel_cmd.args =
+		_("[-bCqs] [-i N] [-n N] command [args] [; command [args]]...");
+	parallel_cmd.oneline =
+		_("run a sequence of commands in a number of concurrent workers");
+	parallel_cmd.help = parallel_help;
+
+	add_command(&parallel_cmd);
+}
@@ -486,6 +486,7 @@ pread_f(
 	}
 	if (c < 0)
 		return 0;
+	add_io_totals(total, c);
 	if (qflag)
 		return 0;
 	gettimeofday(&t2, NULL);
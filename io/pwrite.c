@@ -379,6 +379,7 @@ pwrite_f(
 	}
 	if (c < 0)
 		goto done;
+	add_io_totals(total, c);
 	if (Wflag)
 		fsync(file->fd);
 	if (wflag)
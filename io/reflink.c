@@ -160,6 +160,7 @@ dedupe_f(
 
 	gettimeofday(&t1, NULL);
 	total = dedupe_ioctl(fd, soffset, doffset, count, &ops);
+	add_io_totals(total, ops);
 	if (ops == 0 || quiet_flag)
 		goto done;
 	gettimeofday(&t2, NULL);
@@ -284,6 +285,7 @@ clone_all:
 
 	gettimeofday(&t1, NULL);
 	total = reflink_ioctl(fd, soffset, doffset, count, &ops);
+	add_io_totals(total, ops);
 	if (ops == 0 || quiet_flag)
 		goto done;
 	gettimeofday(&t2, NULL);
@@ -146,6 +146,7 @@ sendfile_f(
 	c = send_buffer(offset, count, fd, &total);
 	if (c < 0)
 		goto done;
+	add_io_totals(total, c);
 	if (qflag)
 		goto done;
 	gettimeofday(&t2, NULL);
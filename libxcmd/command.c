@@ -34,6 +34,14 @@ struct cmdline {
 static int	ncmdline;
 struct cmdline	*cmdline;
 
+/*
+ * Running totals of the I/O done by commands, whether or not they report
+ * it, so that a caller which runs a whole sequence of commands can
+ * summarise the lot afterwards.
+ */
+static long long	io_total_bytes;
+static long long	io_total_ops;
+
 static int
 compare(const void *a, const void *b)
 {
@@ -272,3 +280,28 @@ report_io_times(
 			tdiv((double)total, *t2), tdiv((double)ops, *t2));
 	}
 }
+
+void
+add_io_totals(
+	long long		total,
+	long long		ops)
+{
+	io_total_bytes += total;
+	io_total_ops += ops;
+}
+
+void
+get_io_totals(
+	long long		*total,
+	long long		*ops)
+{
+	*total = io_total_bytes;
+	*ops = io_total_ops;
+}
+
+void
+reset_io_totals(void)
+{
+	io_total_bytes = 0;
+	io_total_ops = 0;
+}
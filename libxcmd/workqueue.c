@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "workqueue.h"
+
+static void *
+workqueue_thread(
+	void			*arg)
+{
+	struct workqueue	*wq = arg;
+	struct workqueue_item	*wi;
+
+	/*
+	 * Loop pulling work from the queue until it is empty and we have
+	 * been told to exit.
+	 */
+	for (;;) {
+		pthread_mutex_lock(&wq->lock);
+		while (wq->next_item == NULL && !wq->terminate)
+			pthread_cond_wait(&wq->wakeup, &wq->lock);
+		if (wq->next_item == NULL) {
+			pthread_mutex_unlock(&wq->lock);
+			break;
+		}
+
+		wi = wq->next_item;
+		wq->next_item = wi->next;
+		wq->item_count--;
+		pthread_mutex_unlock(&wq->lock);
+
+		(wi->function)(wi->queue, wi->index, wi->arg);
+		free(wi);
+	}
+
+	return NULL;
+}
+
+/*
+ * Start @nr_workers threads.  Returns 0 or a positive errno.
+ */
+int
+workqueue_create(
+	struct workqueue	*wq,
+	void			*wq_ctx,
+	unsigned int		nr_workers)
+{
+	unsigned int		i;
+	int			err = 0;
+
+	memset(wq, 0, sizeof(*wq));
+	pthread_cond_init(&wq->wakeup, NULL);
+	pthread_mutex_init(&wq->lock, NULL);
+
+	wq->wq_ctx = wq_ctx;
+	wq->threads = malloc(nr_workers * sizeof(pthread_t));
+	if (!wq->threads)
+		return ENOMEM;
+
+	for (i = 0; i < nr_workers; i++) {
+		err = pthread_create(&wq->threads[i], NULL, workqueue_thread,
+				wq);
+		if (err)
+			break;
+		wq->thread_count++;
+	}
+
+	if (err)
+		workqueue_destroy(wq);
+	return err;
+}
+
+/*
+ * Queue @fn to be called with @index and @arg by the next free thread.
+ * Returns 0 or a positive errno.
+ */
+int
+workqueue_add(
+	struct workqueue	*wq,
+	workqueue_func_t	fn,
+	uint32_t		index,
+	void			*arg)
+{
+	struct workqueue_item	*wi;
+
+	/* without any threads, just do the work now */
+	if (wq->thread_count == 0) {
+		fn(wq, index, arg);
+		return 0;
+	}
+
+	wi = malloc(sizeof(struct workqueue_item));
+	if (!wi)
+		return ENOMEM;
+	wi->function = fn;
+	wi->index = index;
+	wi->arg = arg;
+	wi->queue = wq;
+	wi->next = NULL;
+
+	pthread_mutex_lock(&wq->lock);
+	if (wq->next_item == NULL) {
+		wq->next_item = wi;
+		pthread_cond_signal(&wq->wakeup);
+	} else {
+		wq->last_item->next = wi;
+	}
+	wq->last_item = wi;
+	wq->item_count++;
+	pthread_mutex_unlock(&wq->lock);
+
+	return 0;
+}
+
+/*
+ * Wait for all queued work to be done and tear down the threads.
+ */
+void
+workqueue_destroy(
+	struct workqueue	*wq)
+{
+	unsigned int		i;
+
+	pthread_mutex_lock(&wq->lock);
+	wq->terminate = 1;
+	pthread_mutex_unlock(&wq->lock);
+
+	pthread_cond_broadcast(&wq->wakeup);
+
+	for (i = 0; i < wq->thread_count; i++)
+		pthread_join(wq->threads[i], NULL);
+
+	free(wq->threads);
+	wq->threads = NULL;
+	wq->thread_count = 0;
+	pthread_mutex_destroy(&wq->lock);
+	pthread_cond_destroy(&wq->wakeup);
+}
+
+/*
+ * A sensible default number of threads: one per online CPU.
+ */
+unsigned int
+workqueue_nr_cpus(void)
+{
+	long			nr;
+
+	nr = sysconf(_SC_NPROCESSORS_ONLN);
+	return nr < 1 ? 1 : nr;
+}
@@ -73,6 +73,7 @@ cache_init(
 	cache->compare = cache_operations->compare;
 	cache->bulkrelse = cache_operations->bulkrelse ?
 		cache_operations->bulkrelse : cache_generic_bulkrelse;
+	cache->report = cache_operations->report;
 	pthread_mutex_init(&cache->c_mutex, NULL);
 
 	for (i = 0; i < hashsize; i++) {
@@ -733,4 +734,7 @@ cache_report(
 		fprintf(fp, "Hash buckets with >%2d entries %6ld (%3ld%%)\n",
 			i - 1, hash_bucket_lengths[i],
 			((cache->c_count - total) * 100) / cache->c_count);
+
+	if (cache->report)
+		cache->report(fp, cache);
 }
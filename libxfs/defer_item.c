@@ -100,7 +100,7 @@ xfs_extent_free_finish_item(
 	error = xfs_free_extent(tp, free->xefi_startblock,
 			free->xefi_blockcount, &free->xefi_oinfo,
 			XFS_AG_RESV_NONE);
-	kmem_free(free);
+	kmem_zone_free(xfs_bmap_free_item_zone, free);
 	return error;
 }
 
@@ -119,7 +119,7 @@ xfs_extent_free_cancel_item(
 	struct xfs_extent_free_item	*free;
 
 	free = container_of(item, struct xfs_extent_free_item, xefi_list);
-	kmem_free(free);
+	kmem_zone_free(xfs_bmap_free_item_zone, free);
 }
 
 static const struct xfs_defer_op_type xfs_extent_free_defer_type = {
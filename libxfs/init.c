@@ -41,8 +41,13 @@ char *progname = "libxfs";	/* default, changed by each tool */
 struct cache *libxfs_bcache;	/* global buffer cache */
 int libxfs_bhash_size;		/* #buckets in bcache */
 
+struct cache *libxfs_icache;	/* global inode cache */
+int libxfs_ihash_size;		/* #buckets in icache */
+
 int	use_xfs_buf_lock;	/* global flag: use xfs_buf_t locks for MT */
 
+void	(*libxfs_write_hook)(void);	/* called before writing to a device */
+
 static void manage_zones(int);	/* setup global zones */
 
 kmem_zone_t	*xfs_inode_zone;
@@ -365,6 +370,10 @@ libxfs_init(libxfs_init_t *a)
 		libxfs_bhash_size = LIBXFS_BHASHSIZE(sbp);
 	libxfs_bcache = cache_init(a->bcache_flags, libxfs_bhash_size,
 				   &libxfs_bcache_operations);
+	if (!libxfs_ihash_size)
+		libxfs_ihash_size = LIBXFS_IHASHSIZE(sbp);
+	libxfs_icache = cache_init(a->icache_flags, libxfs_ihash_size,
+				   &libxfs_icache_operations);
 	use_xfs_buf_lock = a->usebuflock;
 	manage_zones(0);
 	rval = 1;
@@ -404,14 +413,14 @@ manage_zones(int release)
 	extern void		xfs_dir_startup();
 
 	if (release) {	/* free zone allocation */
-		kmem_free(xfs_buf_zone);
-		kmem_free(xfs_inode_zone);
-		kmem_free(xfs_ifork_zone);
-		kmem_free(xfs_buf_item_zone);
-		kmem_free(xfs_da_state_zone);
-		kmem_free(xfs_btree_cur_zone);
-		kmem_free(xfs_bmap_free_item_zone);
-		kmem_free(xfs_log_item_desc_zone);
+		kmem_zone_destroy(xfs_buf_zone);
+		kmem_zone_destroy(xfs_inode_zone);
+		kmem_zone_destroy(xfs_ifork_zone);
+		kmem_zone_destroy(xfs_buf_item_zone);
+		kmem_zone_destroy(xfs_da_state_zone);
+		kmem_zone_destroy(xfs_btree_cur_zone);
+		kmem_zone_destroy(xfs_bmap_free_item_zone);
+		kmem_zone_destroy(xfs_log_item_desc_zone);
 		return;
 	}
 	/* otherwise initialise zone allocation */
@@ -870,6 +879,7 @@ libxfs_umount(xfs_mount_t *mp)
 	int			agno;
 
 	libxfs_rtmount_destroy(mp);
+	libxfs_icache_purge();
 	libxfs_bcache_purge();
 
 	for (agno = 0; agno < mp->m_maxagi; agno++) {
@@ -894,6 +904,7 @@ void
 libxfs_destroy(void)
 {
 	manage_zones(1);
+	cache_destroy(libxfs_icache);
 	cache_destroy(libxfs_bcache);
 }
 
@@ -910,6 +921,8 @@ libxfs_report(FILE *fp)
 	char *c;
 
 	cache_report(fp, "libxfs_bcache", libxfs_bcache);
+	cache_report(fp, "libxfs_icache", libxfs_icache);
+	kmem_report(fp);
 
 	t = time(NULL);
 	c = asctime(localtime(&t));
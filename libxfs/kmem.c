@@ -1,15 +1,283 @@
 
 
 #include "libxfs_priv.h"
+#include <sys/mman.h>
 
 /*
  * Simple memory interface
  */
 
+/*
+ * Zone allocator.  Objects are carved out of KMEM_SLAB_SIZE slabs, so
+ * there is no malloc header on each object and no malloc arena lock to
+ * fight over.  Each slab keeps its own free list and count of objects in
+ * use, and the zone hands out objects from its partly used slabs.  Once
+ * every object in a slab has been freed, the slab's pages are given back
+ * to the system and the slab goes on a list of spares for any zone to
+ * reuse, keeping one empty slab per zone to save churning.
+ *
+ * Slabs are mapped KMEM_MAP_SLABS at a time and aligned to their size, so
+ * an object's slab is found by masking its address.
+ *
+ * Each thread also keeps a magazine of up to KMEM_MAG_SIZE free objects
+ * for every zone; the zone lock is only taken to refill an empty magazine
+ * or to drain half of a full one.
+ */
+
+#define KMEM_MAX_ZONES	32
+#define KMEM_MAG_SIZE	64
+#define KMEM_SLAB_SIZE	(64 * 1024)
+#define KMEM_MAP_SLABS	64
+#define KMEM_ALIGN	16
+
+struct kmem_slab {
+	struct kmem_slab	*next;
+	struct kmem_slab	*prev;
+	void			*free;	/* free objects, linked through word 0 */
+	int			inuse;
+};
+#define KMEM_SLAB_HDR	round_up(sizeof(struct kmem_slab), KMEM_ALIGN)
+#define KMEM_SLAB(ptr)	\
+	((struct kmem_slab *)((unsigned long)(ptr) & ~(KMEM_SLAB_SIZE - 1UL)))
+
+struct kmem_magazine {
+	int		nr;
+	unsigned long	allocs;		/* not yet folded into the zone */
+	unsigned long	frees;
+	void		*objs[KMEM_MAG_SIZE];
+};
+
+struct kmem_magazines {
+	struct kmem_magazines	*prev;
+	struct kmem_magazines	*next;
+	struct kmem_magazine	mags[KMEM_MAX_ZONES];
+};
+
+static pthread_mutex_t	kmem_zones_lock = PTHREAD_MUTEX_INITIALIZER;
+static kmem_zone_t	*kmem_zones[KMEM_MAX_ZONES];
+static struct kmem_magazines *kmem_threads;	/* every thread's magazines */
+static pthread_key_t	kmem_mag_key;
+static pthread_once_t	kmem_mag_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t	kmem_slabs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct kmem_slab	*kmem_spare_slabs;	/* pages already given back */
+static char		*kmem_map;		/* unused part of the last map */
+static char		*kmem_map_end;
+
+static void
+kmem_slab_link(struct kmem_slab **list, struct kmem_slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if (*list)
+		(*list)->prev = slab;
+	*list = slab;
+}
+
+static void
+kmem_slab_unlink(struct kmem_slab **list, struct kmem_slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+/* Map some more slabs, aligned to their size. */
+static void
+kmem_slab_map(kmem_zone_t *zone)
+{
+	size_t		len = (KMEM_MAP_SLABS + 1) * KMEM_SLAB_SIZE;
+	char		*map;
+	char		*start;
+	char		*end;
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr,
+			_("%s: zone alloc failed (%s, %d bytes): %s\n"),
+			progname, zone->zone_name, KMEM_SLAB_SIZE,
+			strerror(errno));
+		exit(1);
+	}
+	start = (char *)round_up((unsigned long)map, KMEM_SLAB_SIZE);
+	end = start + KMEM_MAP_SLABS * KMEM_SLAB_SIZE;
+	if (start > map)
+		munmap(map, start - map);
+	munmap(end, map + len - end);
+	kmem_map = start;
+	kmem_map_end = end;
+}
+
+/* Get a slab and fill in its free list.  Called with the zone lock held. */
+static struct kmem_slab *
+kmem_slab_get(kmem_zone_t *zone)
+{
+	struct kmem_slab	*slab;
+	char			*obj;
+	int			i;
+
+	pthread_mutex_lock(&kmem_slabs_lock);
+	slab = kmem_spare_slabs;
+	if (slab) {
+		kmem_spare_slabs = slab->next;
+	} else {
+		if (kmem_map == kmem_map_end)
+			kmem_slab_map(zone);
+		slab = (struct kmem_slab *)kmem_map;
+		kmem_map += KMEM_SLAB_SIZE;
+	}
+	pthread_mutex_unlock(&kmem_slabs_lock);
+
+	/* hand out the objects in address order */
+	slab->free = NULL;
+	slab->inuse = 0;
+	obj = (char *)slab + KMEM_SLAB_HDR;
+	for (i = zone->zone_perslab - 1; i >= 0; i--) {
+		*(void **)(obj + i * zone->zone_objsize) = slab->free;
+		slab->free = obj + i * zone->zone_objsize;
+	}
+	zone->zone_nslabs++;
+	return slab;
+}
+
+/* Give an empty slab's pages back to the system and keep it as a spare. */
+static void
+kmem_slab_put(kmem_zone_t *zone, struct kmem_slab *slab)
+{
+	madvise(slab, KMEM_SLAB_SIZE, MADV_DONTNEED);
+	zone->zone_nslabs--;
+
+	pthread_mutex_lock(&kmem_slabs_lock);
+	slab->next = kmem_spare_slabs;
+	kmem_spare_slabs = slab;
+	pthread_mutex_unlock(&kmem_slabs_lock);
+}
+
+/* Take an object from the zone.  Called with the zone lock held. */
+static void *
+kmem_zone_get(kmem_zone_t *zone)
+{
+	struct kmem_slab	*slab;
+	void			*ptr;
+
+	slab = zone->zone_partial;
+	if (!slab) {
+		slab = zone->zone_empty;
+		if (slab)
+			zone->zone_empty = NULL;
+		else
+			slab = kmem_slab_get(zone);
+		kmem_slab_link(&zone->zone_partial, slab);
+	}
+	ptr = slab->free;
+	slab->free = *(void **)ptr;
+	slab->inuse++;
+	if (!slab->free) {
+		kmem_slab_unlink(&zone->zone_partial, slab);
+		kmem_slab_link(&zone->zone_full, slab);
+	}
+	return ptr;
+}
+
+/* Give an object back to the zone.  Called with the zone lock held. */
+static void
+kmem_zone_put(kmem_zone_t *zone, void *ptr)
+{
+	struct kmem_slab	*slab = KMEM_SLAB(ptr);
+
+	if (!slab->free) {
+		kmem_slab_unlink(&zone->zone_full, slab);
+		kmem_slab_link(&zone->zone_partial, slab);
+	}
+	*(void **)ptr = slab->free;
+	slab->free = ptr;
+	if (--slab->inuse)
+		return;
+
+	kmem_slab_unlink(&zone->zone_partial, slab);
+	if (zone->zone_empty)
+		kmem_slab_put(zone, zone->zone_empty);
+	zone->zone_empty = slab;
+}
+
+/* Fold a magazine's counters into the zone.  Called with the zone lock held. */
+static void
+kmem_mag_fold(kmem_zone_t *zone, struct kmem_magazine *mag)
+{
+	zone->zone_allocs += mag->allocs;
+	zone->zone_frees += mag->frees;
+	mag->allocs = mag->frees = 0;
+}
+
+/* Give everything in an exiting thread's magazines back to the zones. */
+static void
+kmem_mag_destroy(void *arg)
+{
+	struct kmem_magazines	*mags = arg;
+	struct kmem_magazine	*mag;
+	kmem_zone_t		*zone;
+	int			i;
+
+	pthread_mutex_lock(&kmem_zones_lock);
+	for (i = 0; i < KMEM_MAX_ZONES; i++) {
+		zone = kmem_zones[i];
+		mag = &mags->mags[i];
+		if (!zone)
+			continue;
+		pthread_mutex_lock(&zone->zone_lock);
+		kmem_mag_fold(zone, mag);
+		while (mag->nr)
+			kmem_zone_put(zone, mag->objs[--mag->nr]);
+		pthread_mutex_unlock(&zone->zone_lock);
+	}
+	if (mags->prev)
+		mags->prev->next = mags->next;
+	else
+		kmem_threads = mags->next;
+	if (mags->next)
+		mags->next->prev = mags->prev;
+	pthread_mutex_unlock(&kmem_zones_lock);
+	free(mags);
+}
+
+static void
+kmem_mag_key_init(void)
+{
+	pthread_key_create(&kmem_mag_key, kmem_mag_destroy);
+}
+
+/* Find this thread's magazines, setting them up on first use. */
+static struct kmem_magazines *
+kmem_mag_get(void)
+{
+	struct kmem_magazines	*mags;
+
+	mags = pthread_getspecific(kmem_mag_key);
+	if (mags)
+		return mags;
+
+	mags = calloc(1, sizeof(*mags));
+	if (mags == NULL)
+		return NULL;
+	pthread_mutex_lock(&kmem_zones_lock);
+	mags->next = kmem_threads;
+	if (kmem_threads)
+		kmem_threads->prev = mags;
+	kmem_threads = mags;
+	pthread_mutex_unlock(&kmem_zones_lock);
+	pthread_setspecific(kmem_mag_key, mags);
+	return mags;
+}
+
 kmem_zone_t *
 kmem_zone_init(int size, char *name)
 {
-	kmem_zone_t	*ptr = malloc(sizeof(kmem_zone_t));
+	kmem_zone_t	*ptr = calloc(1, sizeof(kmem_zone_t));
+	int		i;
 
 	if (ptr == NULL) {
 		fprintf(stderr, _("%s: zone init failed (%s, %d bytes): %s\n"),
@@ -17,26 +285,100 @@ kmem_zone_init(int size, char *name)
 			strerror(errno));
 		exit(1);
 	}
+	pthread_once(&kmem_mag_once, kmem_mag_key_init);
 	ptr->zone_unitsize = size;
 	ptr->zone_name = name;
-	ptr->allocated = 0;
+	ptr->zone_objsize = round_up(max_t(int, size, sizeof(void *)),
+				    KMEM_ALIGN);
+	ptr->zone_perslab = (KMEM_SLAB_SIZE - KMEM_SLAB_HDR) /
+				ptr->zone_objsize;
+	if (ptr->zone_perslab < 8) {
+		fprintf(stderr, _("%s: zone init failed (%s, %d bytes): %s\n"),
+			progname, name, size, strerror(EINVAL));
+		exit(1);
+	}
+	pthread_mutex_init(&ptr->zone_lock, NULL);
+
+	/* zones past the end of the table just don't get magazines */
+	ptr->zone_id = -1;
+	pthread_mutex_lock(&kmem_zones_lock);
+	for (i = 0; i < KMEM_MAX_ZONES; i++) {
+		if (!kmem_zones[i]) {
+			kmem_zones[i] = ptr;
+			ptr->zone_id = i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&kmem_zones_lock);
 	return ptr;
 }
 
+/*
+ * Free the zone and every object allocated from it.  Nothing else may be
+ * using the zone.
+ */
+void
+kmem_zone_destroy(kmem_zone_t *zone)
+{
+	struct kmem_magazines	*mags;
+	struct kmem_slab	*slab;
+
+	if (!zone)
+		return;
+
+	pthread_mutex_lock(&kmem_zones_lock);
+	if (zone->zone_id >= 0) {
+		for (mags = kmem_threads; mags; mags = mags->next)
+			memset(&mags->mags[zone->zone_id], 0,
+			       sizeof(struct kmem_magazine));
+		kmem_zones[zone->zone_id] = NULL;
+	}
+	pthread_mutex_unlock(&kmem_zones_lock);
+
+	while ((slab = zone->zone_partial) != NULL) {
+		zone->zone_partial = slab->next;
+		kmem_slab_put(zone, slab);
+	}
+	while ((slab = zone->zone_full) != NULL) {
+		zone->zone_full = slab->next;
+		kmem_slab_put(zone, slab);
+	}
+	if (zone->zone_empty)
+		kmem_slab_put(zone, zone->zone_empty);
+	pthread_mutex_destroy(&zone->zone_lock);
+	free(zone);
+}
+
 void *
 kmem_zone_alloc(kmem_zone_t *zone, int flags)
 {
-	void	*ptr = malloc(zone->zone_unitsize);
+	struct kmem_magazines	*mags = NULL;
+	struct kmem_magazine	*mag;
+	void			*ptr;
 
-	if (ptr == NULL) {
-		fprintf(stderr, _("%s: zone alloc failed (%s, %d bytes): %s\n"),
-			progname, zone->zone_name, zone->zone_unitsize,
-			strerror(errno));
-		exit(1);
+	if (zone->zone_id >= 0)
+		mags = kmem_mag_get();
+	if (!mags) {
+		pthread_mutex_lock(&zone->zone_lock);
+		ptr = kmem_zone_get(zone);
+		zone->zone_allocs++;
+		pthread_mutex_unlock(&zone->zone_lock);
+		return ptr;
 	}
-	zone->allocated++;
-	return ptr;
+
+	mag = &mags->mags[zone->zone_id];
+	if (!mag->nr) {
+		pthread_mutex_lock(&zone->zone_lock);
+		kmem_mag_fold(zone, mag);
+		while (mag->nr < KMEM_MAG_SIZE / 2)
+			mag->objs[mag->nr++] = kmem_zone_get(zone);
+		zone->zone_refills++;
+		pthread_mutex_unlock(&zone->zone_lock);
+	}
+	mag->allocs++;
+	return mag->objs[--mag->nr];
 }
+
 void *
 kmem_zone_zalloc(kmem_zone_t *zone, int flags)
 {
@@ -46,6 +388,76 @@ kmem_zone_zalloc(kmem_zone_t *zone, int flags)
 	return ptr;
 }
 
+void
+kmem_zone_free(kmem_zone_t *zone, void *ptr)
+{
+	struct kmem_magazines	*mags = NULL;
+	struct kmem_magazine	*mag;
+
+	if (zone->zone_id >= 0)
+		mags = kmem_mag_get();
+	if (!mags) {
+		pthread_mutex_lock(&zone->zone_lock);
+		kmem_zone_put(zone, ptr);
+		zone->zone_frees++;
+		pthread_mutex_unlock(&zone->zone_lock);
+		return;
+	}
+
+	mag = &mags->mags[zone->zone_id];
+	if (mag->nr == KMEM_MAG_SIZE) {
+		pthread_mutex_lock(&zone->zone_lock);
+		kmem_mag_fold(zone, mag);
+		while (mag->nr > KMEM_MAG_SIZE / 2)
+			kmem_zone_put(zone, mag->objs[--mag->nr]);
+		zone->zone_flushes++;
+		pthread_mutex_unlock(&zone->zone_lock);
+	}
+	mag->frees++;
+	mag->objs[mag->nr++] = ptr;
+}
+
+/*
+ * Print the counters for every zone that has been used.  Other threads'
+ * magazines are only folded in as they refill or drain, so the numbers
+ * can lag by a magazine or so per thread while they're running.
+ */
+void
+kmem_report(FILE *fp)
+{
+	struct kmem_magazines	*mags;
+	kmem_zone_t		*zone;
+	int			i;
+
+	pthread_once(&kmem_mag_once, kmem_mag_key_init);
+	mags = pthread_getspecific(kmem_mag_key);
+	pthread_mutex_lock(&kmem_zones_lock);
+	for (i = 0; i < KMEM_MAX_ZONES; i++) {
+		zone = kmem_zones[i];
+		if (!zone)
+			continue;
+		pthread_mutex_lock(&zone->zone_lock);
+		if (mags)
+			kmem_mag_fold(zone, &mags->mags[i]);
+		if (zone->zone_allocs)
+			fprintf(fp, "%s: %d byte objects\n"
+				"Slabs = %lu (%lu KiB)\n"
+				"Allocations = %llu\n"
+				"Frees = %llu\n"
+				"In use = %lld\n"
+				"Magazine refills = %llu\n"
+				"Magazine flushes = %llu\n",
+				zone->zone_name, zone->zone_objsize,
+				zone->zone_nslabs,
+				zone->zone_nslabs * KMEM_SLAB_SIZE / 1024,
+				zone->zone_allocs, zone->zone_frees,
+				(long long)(zone->zone_allocs -
+					    zone->zone_frees),
+				zone->zone_refills, zone->zone_flushes);
+		pthread_mutex_unlock(&zone->zone_lock);
+	}
+	pthread_mutex_unlock(&kmem_zones_lock);
+}
 
 void *
 kmem_alloc(size_t size, int flags)
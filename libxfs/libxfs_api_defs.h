@@ -68,6 +68,10 @@
 #define xfs_bmap_last_offset		libxfs_bmap_last_offset
 #define xfs_bmap_search_extents		libxfs_bmap_search_extents
 #define xfs_iext_lookup_extent		libxfs_iext_lookup_extent
+#define xfs_iext_get_extent		libxfs_iext_get_extent
+#define xfs_iext_count			libxfs_iext_count
+#define xfs_iext_insert			libxfs_iext_insert
+#define xfs_iext_remove			libxfs_iext_remove
 #define xfs_bmapi_write			libxfs_bmapi_write
 #define xfs_bmapi_read			libxfs_bmapi_read
 #define xfs_bunmapi			libxfs_bunmapi
@@ -80,21 +84,28 @@
 #define xfs_defer_cancel		libxfs_defer_cancel
 
 #define xfs_da_brelse			libxfs_da_brelse
+#define xfs_da_get_buf			libxfs_da_get_buf
+#define xfs_da_grow_inode		libxfs_da_grow_inode
 #define xfs_da_hashname			libxfs_da_hashname
 #define xfs_da_shrink_inode		libxfs_da_shrink_inode
 #define xfs_da_read_buf			libxfs_da_read_buf
+#define xfs_da3_node_create		libxfs_da3_node_create
 #define xfs_dir_createname		libxfs_dir_createname
 #define xfs_dir_init			libxfs_dir_init
 #define xfs_dir_lookup			libxfs_dir_lookup
 #define xfs_dir_replace			libxfs_dir_replace
 #define xfs_dir2_isblock		libxfs_dir2_isblock
 #define xfs_dir2_isleaf			libxfs_dir2_isleaf
+#define xfs_dir2_grow_inode		libxfs_dir2_grow_inode
+#define xfs_dir2_data_freescan		libxfs_dir2_data_freescan
 #define xfs_dir2_data_freescan_int	libxfs_dir2_data_freescan_int
 #define xfs_dir2_data_log_entry		libxfs_dir2_data_log_entry
 #define xfs_dir2_data_log_header	libxfs_dir2_data_log_header
 #define xfs_dir2_data_make_free		libxfs_dir2_data_make_free
 #define xfs_dir2_data_use_free		libxfs_dir2_data_use_free
 #define xfs_dir2_shrink_inode		libxfs_dir2_shrink_inode
+#define xfs_dir3_data_init		libxfs_dir3_data_init
+#define xfs_dir3_leaf_get_buf		libxfs_dir3_leaf_get_buf
 
 #define xfs_inode_from_disk		libxfs_inode_from_disk
 #define xfs_inode_to_disk		libxfs_inode_to_disk
@@ -120,6 +131,7 @@
 
 #define xfs_symlink_blocks		libxfs_symlink_blocks
 #define xfs_symlink_hdr_ok		libxfs_symlink_hdr_ok
+#define xfs_symlink_hdr_set		libxfs_symlink_hdr_set
 
 #define xfs_verify_cksum		libxfs_verify_cksum
 
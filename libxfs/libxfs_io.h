@@ -105,6 +105,7 @@ enum xfs_buf_flags_t {	/* b_flags bits */
 #define XFS_BUF_SET_PTR(bp,p,cnt)	({	\
 	(bp)->b_addr = (char *)(p);		\
 	XFS_BUF_SET_COUNT(bp,cnt);		\
+	0;					\
 })
 
 #define XFS_BUF_SET_ADDR(bp,blk)	((bp)->b_bn = (blk))
@@ -138,6 +139,11 @@ extern struct cache_operations	libxfs_bcache_operations;
 
 #define LIBXFS_GETBUF_TRYLOCK	(1 << 0)
 
+/* Inode Cache Interfaces */
+
+extern struct cache	*libxfs_icache;
+extern struct cache_operations	libxfs_icache_operations;
+
 #ifdef XFS_BUF_TRACING
 
 #define libxfs_readbuf(dev, daddr, len, flags, ops) \
@@ -215,6 +221,8 @@ extern int	libxfs_readbufr_map(struct xfs_buftarg *, struct xfs_buf *, int);
 extern int	libxfs_device_zero(struct xfs_buftarg *, xfs_daddr_t, uint);
 
 extern int libxfs_bhash_size;
+extern int libxfs_ihash_size;
+extern void (*libxfs_write_hook)(void);
 
 #define LIBXFS_BREAD	0x1
 #define LIBXFS_BWRITE	0x2
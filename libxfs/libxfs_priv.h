@@ -334,7 +334,7 @@ roundup_64(__uint64_t x, __uint32_t y)
 })
 #define xfs_buf_relse(bp)		libxfs_putbuf(bp)
 #define xfs_buf_get(devp,blkno,len,f)	(libxfs_getbuf((devp), (blkno), (len)))
-#define xfs_bwrite(bp)			libxfs_writebuf((bp), 0)
+#define xfs_bwrite(bp)			libxfs_writebufr(bp)
 #define xfs_buf_delwri_queue(bp, bl)	libxfs_writebuf((bp), 0)
 
 #define XBRW_READ			LIBXFS_BREAD
@@ -76,6 +76,16 @@ libxfs_device_zero(struct xfs_buftarg *btp, xfs_daddr_t start, uint len)
 	char		*z;
 	int		fd;
 
+	if (libxfs_write_hook)
+		libxfs_write_hook();
+
+	fd = libxfs_device_to_fd(btp->dev);
+	start_offset = LIBXFS_BBTOOFF64(start);
+
+	/* try to zero the range without writing it out ourselves first */
+	if (platform_zero_range(fd, start_offset, BBTOB((xfs_off_t)len)) == 0)
+		return 0;
+
 	zsize = min(BDSTRAT_SIZE, BBTOB(len));
 	if ((z = memalign(libxfs_device_alignment(), zsize)) == NULL) {
 		fprintf(stderr,
@@ -85,9 +95,6 @@ libxfs_device_zero(struct xfs_buftarg *btp, xfs_daddr_t start, uint len)
 	}
 	memset(z, 0, zsize);
 
-	fd = libxfs_device_to_fd(btp->dev);
-	start_offset = LIBXFS_BBTOOFF64(start);
-
 	if ((lseek(fd, start_offset, SEEK_SET)) < 0) {
 		fprintf(stderr, _("%s: %s seek to offset %llu failed: %s\n"),
 			progname, __FUNCTION__,
@@ -496,9 +503,102 @@ libxfs_getsb(xfs_mount_t *mp, int flags)
 
 kmem_zone_t			*xfs_buf_zone;
 
-static struct cache_mru		xfs_buf_freelist =
-	{{&xfs_buf_freelist.cm_list, &xfs_buf_freelist.cm_list},
-	 0, PTHREAD_MUTEX_INITIALIZER };
+/*
+ * Released buffers keep their memory and go on the free list for their size,
+ * so that the next buffer of that size can take one without searching for
+ * it.  Each size up to XFS_BUF_POOL_BBS basic blocks has a list of its own;
+ * anything bigger (mostly log recovery windows) goes on the last one.  Free
+ * buffers are also kept on an LRU across all sizes: if there are none of the
+ * right size, the oldest free buffer gives up its memory and its header is
+ * reused, so the free lists never hold more buffers than the cache let go of.
+ */
+#define XFS_BUF_POOL_BBS	BTOBB(XFS_MAX_BLOCKSIZE)
+
+struct xfs_buf_pool {
+	struct list_head	bp_list;	/* free buffers, by b_node.cn_hash */
+	unsigned int		bp_count;	/* buffers on bp_list */
+	unsigned long		bp_hits;	/* reused as they were */
+	unsigned long		bp_misses;	/* had to get new memory */
+};
+
+static struct {
+	pthread_mutex_t		lock;
+	struct list_head	lru;		/* by b_node.cn_mru, oldest last */
+	unsigned int		count;		/* buffers on the lru */
+	unsigned long		allocs;		/* new buffer headers */
+	unsigned long		steals;		/* memory taken from another size */
+	struct xfs_buf_pool	pools[XFS_BUF_POOL_BBS + 2];
+} xfs_buf_free = {
+	.lock	= PTHREAD_MUTEX_INITIALIZER,
+	.lru	= { &xfs_buf_free.lru, &xfs_buf_free.lru },
+};
+
+/* Find the free list for a size.  Called with the free list lock held. */
+static struct xfs_buf_pool *
+xfs_buf_pool(
+	unsigned int		bytes)
+{
+	struct xfs_buf_pool	*pool;
+
+	pool = &xfs_buf_free.pools[min_t(unsigned int, BTOBB(bytes),
+					 XFS_BUF_POOL_BBS + 1)];
+	if (!pool->bp_list.next)
+		list_head_init(&pool->bp_list);
+	return pool;
+}
+
+/* Put a buffer on the free lists.  Called with the free list lock held. */
+static void
+xfs_buf_free_add(
+	struct xfs_buf		*bp)
+{
+	struct xfs_buf_pool	*pool = xfs_buf_pool(bp->b_bcount);
+
+	list_add(&bp->b_node.cn_mru, &xfs_buf_free.lru);
+	list_add(&bp->b_node.cn_hash, &pool->bp_list);
+	xfs_buf_free.count++;
+	pool->bp_count++;
+}
+
+/* Take a buffer off the free lists.  Called with the free list lock held. */
+static void
+xfs_buf_free_del(
+	struct xfs_buf		*bp)
+{
+	list_del_init(&bp->b_node.cn_mru);
+	list_del_init(&bp->b_node.cn_hash);
+	xfs_buf_free.count--;
+	xfs_buf_pool(bp->b_bcount)->bp_count--;
+}
+
+static void
+libxfs_breport(
+	FILE			*fp,
+	struct cache		*cache)
+{
+	struct xfs_buf_pool	*pool;
+	int			i;
+
+	pthread_mutex_lock(&xfs_buf_free.lock);
+	fprintf(fp, "Free buffers = %u\n"
+			"Buffer headers allocated = %lu\n"
+			"Buffers resized = %lu\n",
+			xfs_buf_free.count,
+			xfs_buf_free.allocs,
+			xfs_buf_free.steals);
+	for (i = 1; i <= XFS_BUF_POOL_BBS + 1; i++) {
+		pool = &xfs_buf_free.pools[i];
+		if (pool->bp_hits + pool->bp_misses == 0)
+			continue;
+		fprintf(fp, "Buffer pool %s%6u bytes: free %6u reused %9lu "
+				"new %9lu\n",
+			i > XFS_BUF_POOL_BBS ? ">" : " ",
+			(unsigned int)BBTOB(min(i, XFS_BUF_POOL_BBS)),
+			pool->bp_count,
+			pool->bp_hits, pool->bp_misses);
+	}
+	pthread_mutex_unlock(&xfs_buf_free.lock);
+}
 
 /*
  * The bufkey is used to pass the new buffer information to the cache object
@@ -608,6 +708,7 @@ libxfs_initbuf_map(xfs_buf_t *bp, struct xfs_buftarg *btp,
 	int i;
 
 	bytes = sizeof(struct xfs_buf_map) * nmaps;
+	free(bp->b_maps);
 	bp->b_maps = malloc(bytes);
 	if (!bp->b_maps) {
 		fprintf(stderr,
@@ -632,34 +733,43 @@ libxfs_initbuf_map(xfs_buf_t *bp, struct xfs_buftarg *btp,
 xfs_buf_t *
 __libxfs_getbufr(int blen)
 {
-	xfs_buf_t	*bp;
+	struct xfs_buf_pool	*pool;
+	xfs_buf_t		*bp;
 
 	/*
-	 * first look for a buffer that can be used as-is,
-	 * if one cannot be found, see if there is a buffer,
-	 * and if so, free its buffer and set b_addr to NULL
-	 * before calling libxfs_initbuf.
+	 * First look for a free buffer of the right size that can be used
+	 * as-is.  If there isn't one, take the oldest free buffer of any size,
+	 * free its memory and set b_addr to NULL before calling libxfs_initbuf.
 	 */
-	pthread_mutex_lock(&xfs_buf_freelist.cm_mutex);
-	if (!list_empty(&xfs_buf_freelist.cm_list)) {
-		list_for_each_entry(bp, &xfs_buf_freelist.cm_list, b_node.cn_mru) {
-			if (bp->b_bcount == blen) {
-				list_del_init(&bp->b_node.cn_mru);
-				break;
-			}
-		}
-		if (&bp->b_node.cn_mru == &xfs_buf_freelist.cm_list) {
-			bp = list_entry(xfs_buf_freelist.cm_list.next,
-					xfs_buf_t, b_node.cn_mru);
-			list_del_init(&bp->b_node.cn_mru);
-			free(bp->b_addr);
-			bp->b_addr = NULL;
-			free(bp->b_maps);
-			bp->b_maps = NULL;
-		}
-	} else
-		bp = kmem_zone_zalloc(xfs_buf_zone, 0);
-	pthread_mutex_unlock(&xfs_buf_freelist.cm_mutex);
+	pthread_mutex_lock(&xfs_buf_free.lock);
+	pool = xfs_buf_pool(blen);
+	list_for_each_entry(bp, &pool->bp_list, b_node.cn_hash) {
+		if (bp->b_bcount == blen)
+			break;
+	}
+	if (&bp->b_node.cn_hash != &pool->bp_list) {
+		xfs_buf_free_del(bp);
+		pool->bp_hits++;
+	} else if (!list_empty(&xfs_buf_free.lru)) {
+		bp = list_entry(xfs_buf_free.lru.prev, xfs_buf_t,
+				b_node.cn_mru);
+		xfs_buf_free_del(bp);
+		xfs_buf_free.steals++;
+		pool->bp_misses++;
+	} else {
+		bp = NULL;
+		xfs_buf_free.allocs++;
+		pool->bp_misses++;
+	}
+	pthread_mutex_unlock(&xfs_buf_free.lock);
+
+	if (!bp)
+		return kmem_zone_zalloc(xfs_buf_zone, 0);
+
+	if (bp->b_bcount != blen) {
+		free(bp->b_addr);
+		bp->b_addr = NULL;
+	}
 	bp->b_ops = NULL;
 	if (bp->b_flags & LIBXFS_B_DIRTY)
 		fprintf(stderr, "found dirty buffer (bulk) on free list!");
@@ -1134,6 +1244,9 @@ libxfs_writebufr(xfs_buf_t *bp)
 		}
 	}
 
+	if (libxfs_write_hook)
+		libxfs_write_hook();
+
 	if (!(bp->b_flags & LIBXFS_B_DISCONTIG)) {
 		bp->b_error = __write_buf(fd, bp->b_addr, bp->b_bcount,
 				    LIBXFS_BBTOOFF64(bp->b_bn), bp->b_flags);
@@ -1236,9 +1349,9 @@ libxfs_brelse(
 		fprintf(stderr,
 			"releasing dirty buffer to free list!");
 
-	pthread_mutex_lock(&xfs_buf_freelist.cm_mutex);
-	list_add(&bp->b_node.cn_mru, &xfs_buf_freelist.cm_list);
-	pthread_mutex_unlock(&xfs_buf_freelist.cm_mutex);
+	pthread_mutex_lock(&xfs_buf_free.lock);
+	xfs_buf_free_add(bp);
+	pthread_mutex_unlock(&xfs_buf_free.lock);
 }
 
 static unsigned int
@@ -1252,16 +1365,17 @@ libxfs_bulkrelse(
 	if (list_empty(list))
 		return 0 ;
 
-	list_for_each_entry(bp, list, b_node.cn_mru) {
+	pthread_mutex_lock(&xfs_buf_free.lock);
+	while (!list_empty(list)) {
+		bp = list_entry(list->next, xfs_buf_t, b_node.cn_mru);
+		list_del(&bp->b_node.cn_mru);
 		if (bp->b_flags & LIBXFS_B_DIRTY)
 			fprintf(stderr,
 				"releasing dirty buffer (bulk) to free list!");
+		xfs_buf_free_add(bp);
 		count++;
 	}
-
-	pthread_mutex_lock(&xfs_buf_freelist.cm_mutex);
-	list_splice(list, &xfs_buf_freelist.cm_list);
-	pthread_mutex_unlock(&xfs_buf_freelist.cm_mutex);
+	pthread_mutex_unlock(&xfs_buf_free.lock);
 
 	return count;
 }
@@ -1317,46 +1431,79 @@ struct cache_operations libxfs_bcache_operations = {
 	.flush		= libxfs_bflush,
 	.relse		= libxfs_brelse,
 	.compare	= libxfs_bcompare,
-	.bulkrelse	= libxfs_bulkrelse
+	.bulkrelse	= libxfs_bulkrelse,
+	.report		= libxfs_breport,
 };
 
 
 /*
- * Inode cache stubs.
+ * Inode cache.
+ *
+ * In-core inodes are kept in a hashed, reference counted cache so that
+ * repeated lookups of the same inode don't have to read the inode cluster
+ * buffer and decode the inode forks all over again.  Inodes are only changed
+ * under transactions, and committing a transaction writes them straight back
+ * into their cluster buffers, so an unreferenced cached inode is never dirty
+ * and can be reclaimed whenever the cache fills up.
+ *
+ * Anything that changes an inode behind the cache's back - by writing the
+ * inode cluster buffer directly, or by cancelling a dirty transaction - must
+ * mark the affected inodes stale.  Stale inodes are never returned from a
+ * lookup and are freed as soon as the last reference to them goes away.
  */
 
 extern kmem_zone_t	*xfs_ili_zone;
 extern kmem_zone_t	*xfs_inode_zone;
 
-int
-libxfs_iget(xfs_mount_t *mp, xfs_trans_t *tp, xfs_ino_t ino, uint lock_flags,
-		xfs_inode_t **ipp)
+struct xfs_inokey {
+	struct xfs_mount	*mp;
+	xfs_ino_t		ino;
+};
+
+static unsigned int
+libxfs_ihash(cache_key_t key, unsigned int hashsize, unsigned int hashshift)
 {
-	xfs_inode_t	*ip;
-	int		error = 0;
+	uint64_t	hashval = ((struct xfs_inokey *)key)->ino;
+	uint64_t	tmp;
 
-	ip = kmem_zone_zalloc(xfs_inode_zone, 0);
-	if (!ip)
-		return -ENOMEM;
+	tmp = hashval ^ (GOLDEN_RATIO_PRIME + hashval) / CACHE_LINE_SIZE;
+	tmp = tmp ^ ((tmp ^ GOLDEN_RATIO_PRIME) >> hashshift);
+	return tmp % hashsize;
+}
 
-	ip->i_ino = ino;
-	ip->i_mount = mp;
-	error = xfs_iread(mp, tp, ip, 0);
-	if (error) {
-		kmem_zone_free(xfs_inode_zone, ip);
-		*ipp = NULL;
-		return error;
-	}
+static int
+libxfs_icompare(struct cache_node *node, cache_key_t key)
+{
+	struct xfs_inode	*ip = (struct xfs_inode *)node;
+	struct xfs_inokey	*ikey = (struct xfs_inokey *)key;
 
-	/*
-	 * set up the inode ops structure that the libxfs code relies on
-	 */
-	if (XFS_ISDIR(ip))
-		ip->d_ops = mp->m_dir_inode_ops;
-	else
-		ip->d_ops = mp->m_nondir_inode_ops;
+	if (ip->i_ino == ikey->ino && ip->i_mount == ikey->mp &&
+	    !(ip->i_flags & XFS_ISTALE))
+		return CACHE_HIT;
+	return CACHE_MISS;
+}
 
-	*ipp = ip;
+static struct cache_node *
+libxfs_ialloc_node(cache_key_t key)
+{
+	struct xfs_inokey	*ikey = (struct xfs_inokey *)key;
+	struct xfs_inode	*ip;
+
+	ip = kmem_zone_zalloc(xfs_inode_zone, 0);
+	if (!ip)
+		return NULL;
+	ip->i_ino = ikey->ino;
+	ip->i_mount = ikey->mp;
+	return (struct cache_node *)ip;
+}
+
+/*
+ * Cached inodes are written back when their transaction commits, so there
+ * is never anything to flush by the time they can be reclaimed.
+ */
+static int
+libxfs_iflush_node(struct cache_node *node)
+{
 	return 0;
 }
 
@@ -1376,12 +1523,118 @@ libxfs_idestroy(xfs_inode_t *ip)
 		xfs_idestroy_fork(ip, XFS_COW_FORK);
 }
 
-void
-libxfs_iput(xfs_inode_t *ip)
+static void
+libxfs_irelse(struct cache_node *node)
 {
+	struct xfs_inode	*ip = (struct xfs_inode *)node;
+
 	if (ip->i_itemp)
 		kmem_zone_free(xfs_ili_zone, ip->i_itemp);
 	ip->i_itemp = NULL;
 	libxfs_idestroy(ip);
 	kmem_zone_free(xfs_inode_zone, ip);
 }
+
+int
+libxfs_iget(xfs_mount_t *mp, xfs_trans_t *tp, xfs_ino_t ino, uint lock_flags,
+		xfs_inode_t **ipp)
+{
+	struct xfs_inokey	key = {0};
+	xfs_inode_t		*ip;
+	int			error = 0;
+
+	key.mp = mp;
+	key.ino = ino;
+	if (!cache_node_get(libxfs_icache, &key, (struct cache_node **)&ip)) {
+		/* cache hit, the inode has already been read and set up */
+		*ipp = ip;
+		return 0;
+	}
+
+	error = xfs_iread(mp, tp, ip, 0);
+	if (error) {
+		libxfs_istale(ip);
+		libxfs_iput(ip);
+		*ipp = NULL;
+		return error;
+	}
+
+	/*
+	 * set up the inode ops structure that the libxfs code relies on
+	 */
+	if (XFS_ISDIR(ip))
+		ip->d_ops = mp->m_dir_inode_ops;
+	else
+		ip->d_ops = mp->m_nondir_inode_ops;
+
+	*ipp = ip;
+	return 0;
+}
+
+void
+libxfs_iput(xfs_inode_t *ip)
+{
+	struct cache_node	*node = (struct cache_node *)ip;
+	struct xfs_inokey	key = {0};
+	bool			purge;
+
+	/*
+	 * Nobody can look stale inodes up again, so free them on the last
+	 * put.  That has to be decided while we still hold our reference, as
+	 * the shaker can free the inode as soon as it's dropped.  If it does
+	 * so before we purge, the purge doesn't find it in the hash chain and
+	 * does nothing.
+	 */
+	pthread_mutex_lock(&node->cn_mutex);
+	purge = (ip->i_flags & XFS_ISTALE) && node->cn_count == 1;
+	pthread_mutex_unlock(&node->cn_mutex);
+	if (purge) {
+		key.mp = ip->i_mount;
+		key.ino = ip->i_ino;
+	}
+
+	cache_node_put(libxfs_icache, node);
+	if (purge)
+		cache_node_purge(libxfs_icache, &key, node);
+}
+
+/*
+ * Mark an in-core inode as no longer matching what is on disk so that the
+ * next lookup reads it in again.
+ */
+void
+libxfs_istale(xfs_inode_t *ip)
+{
+	ip->i_flags |= XFS_ISTALE;
+}
+
+static void
+libxfs_istale_node(struct cache_node *node)
+{
+	libxfs_istale((struct xfs_inode *)node);
+}
+
+/*
+ * Invalidate every cached inode, for use after the inode buffers have been
+ * modified directly.  Inodes still in use keep their in-core copy until they
+ * are released; unreferenced ones are reclaimed as the cache fills up.
+ */
+void
+libxfs_icache_invalidate(void)
+{
+	cache_walk(libxfs_icache, libxfs_istale_node);
+}
+
+void
+libxfs_icache_purge(void)
+{
+	cache_purge(libxfs_icache);
+}
+
+struct cache_operations libxfs_icache_operations = {
+	.hash		= libxfs_ihash,
+	.alloc		= libxfs_ialloc_node,
+	.flush		= libxfs_iflush_node,
+	.relse		= libxfs_irelse,
+	.compare	= libxfs_icompare,
+};
@@ -30,7 +30,7 @@
 #include "xfs_trans.h"
 #include "xfs_sb.h"
 
-static void xfs_trans_free_items(struct xfs_trans *tp);
+static void xfs_trans_free_items(struct xfs_trans *tp, bool abort);
 
 /*
  * Simple transaction interface
@@ -64,14 +64,7 @@ libxfs_trans_add_item(
 	ASSERT(lip->li_mountp == tp->t_mountp);
 	ASSERT(lip->li_ailp == tp->t_mountp->m_ail);
 
-	lidp = calloc(sizeof(struct xfs_log_item_desc), 1);
-	if (!lidp) {
-		fprintf(stderr, _("%s: lidp calloc failed (%d bytes): %s\n"),
-			progname, (int)sizeof(struct xfs_log_item_desc),
-			strerror(errno));
-		exit(1);
-	}
-
+	lidp = kmem_zone_zalloc(xfs_log_item_desc_zone, KM_SLEEP | KM_NOFS);
 	lidp->lid_item = lip;
 	lidp->lid_flags = 0;
 	list_add_tail(&lidp->lid_trans, &tp->t_items);
@@ -87,7 +80,7 @@ libxfs_trans_del_item(
 	struct xfs_log_item	*lip)
 {
 	list_del_init(&lip->li_desc->lid_trans);
-	free(lip->li_desc);
+	kmem_zone_free(xfs_log_item_desc_zone, lip->li_desc);
 	lip->li_desc = NULL;
 }
 
@@ -106,6 +99,7 @@ libxfs_trans_roll(
 	struct xfs_mount	*mp;
 	struct xfs_trans	*trans;
 	struct xfs_trans_res	tres;
+	unsigned int		blocks;
 	int			error;
 
 	/*
@@ -121,6 +115,7 @@ libxfs_trans_roll(
 	mp = trans->t_mountp;
 	tres.tr_logres = trans->t_log_res;
 	tres.tr_logcount = trans->t_log_count;
+	blocks = trans->t_blk_res;
 
 	/*
 	 * Commit the current transaction.
@@ -145,6 +140,8 @@ libxfs_trans_roll(
 	tres.tr_logflags = XFS_TRANS_PERM_LOG_RES;
 	error = libxfs_trans_alloc(mp, &tres, 0, 0, 0, tpp);
 	trans = *tpp;
+	if (!error)
+		trans->t_blk_res = blocks;
 	/*
 	 *  Ensure that the inode is in the new transaction and locked.
 	 */
@@ -185,6 +182,7 @@ libxfs_trans_alloc(
 		exit(1);
 	}
 	ptr->t_mountp = mp;
+	ptr->t_blk_res = blocks;
 	INIT_LIST_HEAD(&ptr->t_items);
 #ifdef XACT_DEBUG
 	fprintf(stderr, "allocated new transaction %p\n", ptr);
@@ -201,7 +199,7 @@ libxfs_trans_cancel(
 	xfs_trans_t	*otp = tp;
 #endif
 	if (tp != NULL) {
-		xfs_trans_free_items(tp);
+		xfs_trans_free_items(tp, true);
 		free(tp);
 		tp = NULL;
 	}
@@ -231,6 +229,13 @@ libxfs_trans_iget(
 		return error;
 	ASSERT(ip != NULL);
 
+	/* a cached inode may already be part of this transaction */
+	if (ip->i_transp == tp) {
+		*ipp = ip;
+		return 0;
+	}
+	ASSERT(ip->i_transp == NULL);
+
 	if (ip->i_itemp == NULL)
 		xfs_inode_item_init(ip, mp);
 	iip = ip->i_itemp;
@@ -681,6 +686,8 @@ inode_item_done(
 	}
 
 	ip->i_transp = NULL;	/* disassociate from transaction */
+	iip->ili_last_fields = iip->ili_fields;
+	iip->ili_fields = 0;
 	XFS_BUF_SET_FSPRIVATE(bp, NULL);	/* remove log item */
 	XFS_BUF_SET_FSPRIVATE2(bp, NULL);	/* remove xact ptr */
 	libxfs_writebuf(bp, 0);
@@ -760,13 +767,21 @@ buf_item_unlock(
 
 static void
 inode_item_unlock(
-	xfs_inode_log_item_t	*iip)
+	xfs_inode_log_item_t	*iip,
+	bool			abort)
 {
 	xfs_inode_t		*ip = iip->ili_inode;
 
 	/* Clear the transaction pointer in the inode. */
 	ip->i_transp = NULL;
 
+	/*
+	 * Changes made under a cancelled transaction never make it to disk,
+	 * so the cached copy of the inode can't be trusted any more.
+	 */
+	if (abort)
+		libxfs_istale(ip);
+
 	iip->ili_flags = 0;
 }
 
@@ -776,18 +791,23 @@ inode_item_unlock(
  */
 static void
 xfs_trans_free_items(
-	struct xfs_trans	*tp)
+	struct xfs_trans	*tp,
+	bool			abort)
 {
 	struct xfs_log_item_desc *lidp, *next;
+	bool			dirty;
 
 	list_for_each_entry_safe(lidp, next, &tp->t_items, lid_trans) {
 		struct xfs_log_item	*lip = lidp->lid_item;
 
+		dirty = (tp->t_flags & XFS_TRANS_DIRTY) ||
+			(lidp->lid_flags & XFS_LID_DIRTY);
                 xfs_trans_del_item(lip);
 		if (lip->li_type == XFS_LI_BUF)
 			buf_item_unlock((xfs_buf_log_item_t *)lip);
 		else if (lip->li_type == XFS_LI_INODE)
-			inode_item_unlock((xfs_inode_log_item_t *)lip);
+			inode_item_unlock((xfs_inode_log_item_t *)lip,
+					  abort && dirty);
 		else {
 			fprintf(stderr, _("%s: unrecognised log item type\n"),
 				progname);
@@ -812,7 +832,7 @@ libxfs_trans_commit(
 #ifdef XACT_DEBUG
 		fprintf(stderr, "committed clean transaction %p\n", tp);
 #endif
-		xfs_trans_free_items(tp);
+		xfs_trans_free_items(tp, false);
 		free(tp);
 		tp = NULL;
 		return 0;
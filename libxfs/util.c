@@ -349,11 +349,11 @@ libxfs_iprint(
 	printf("    i_df.if_u1.if_extents/if_data %lx\n",
 		(unsigned long)ip->i_df.if_u1.if_extents);
 	if (ip->i_df.if_flags & XFS_IFEXTENTS) {
-		nextents = ip->i_df.if_bytes / (uint)sizeof(*ep);
-		for (ep = ip->i_df.if_u1.if_extents, i = 0; i < nextents;
-								i++, ep++) {
+		nextents = xfs_iext_count(&ip->i_df);
+		for (i = 0; i < nextents; i++) {
 			xfs_bmbt_irec_t rec;
 
+			ep = xfs_iext_get_ext(&ip->i_df, i);
 			xfs_bmbt_get_all(ep, &rec);
 			printf("\t%d: startoff %llu, startblock 0x%llx,"
 				" blockcount %llu, state %d\n",
@@ -0,0 +1,709 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "libxfs_priv.h"
+#include "xfs_fs.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_inode.h"
+#include "xfs_bmap_btree.h"
+
+/*
+ * In-core extent tree.
+ *
+ * Once a fork has more extents than fit in a single XFS_IEXT_BUFSZ buffer
+ * the records are kept in an order-statistic B+tree.  The leaves hold the
+ * extent records themselves, in file offset order, and the interior nodes
+ * hold a pointer to each child along with the number of records below it.
+ * The counts let us find the record at a given extent index, which is how
+ * everything outside this file addresses the extent list, in O(log n)
+ * time, and inserting or removing a record only has to move the rest of
+ * one leaf and fix up the counts on the way back to the root.
+ *
+ * Callers update records in place through the pointer returned by
+ * xfs_iext_get_ext, so the interior nodes can't cache any startoff keys.
+ * Lookups by file offset compare against the first record below each
+ * child instead, which is still only a few cache lines per level.
+ *
+ * Nodes that fall below half full on removal are merged with or refilled
+ * from a neighbour, except that a split caused by appending leaves the old
+ * node full and starts an empty one, so extent lists built in order (as
+ * they are when read in from disk) pack every leaf.
+ */
+
+#define XFS_IEXT_LEAF_RECS	\
+	((XFS_IEXT_BUFSZ - sizeof(int)) / sizeof(xfs_bmbt_rec_host_t))
+#define XFS_IEXT_NODE_PTRS	64
+#define XFS_IEXT_MAXLEVELS	8
+
+struct xfs_iext_leaf {
+	int			nr;
+	xfs_bmbt_rec_host_t	recs[XFS_IEXT_LEAF_RECS];
+};
+
+struct xfs_iext_node {
+	int			nr;
+	xfs_extnum_t		counts[XFS_IEXT_NODE_PTRS];
+	void			*ptrs[XFS_IEXT_NODE_PTRS];
+};
+
+struct xfs_iext_tree {
+	void			*root;
+	int			height;		/* 1 if the root is a leaf */
+};
+
+/*
+ * Path from the root to a record.  nodes[0] is the root and slots[l] is
+ * the entry in nodes[l] that was followed to get to the next level down.
+ */
+struct xfs_iext_cursor {
+	struct xfs_iext_node	*nodes[XFS_IEXT_MAXLEVELS];
+	int			slots[XFS_IEXT_MAXLEVELS];
+	struct xfs_iext_leaf	*leaf;
+	int			pos;
+};
+
+static inline struct xfs_iext_tree *
+xfs_iext_tree(
+	struct xfs_ifork	*ifp)
+{
+	ASSERT(ifp->if_flags & XFS_IFEXTTREE);
+	return ifp->if_u1.if_ext_tree;
+}
+
+static void *
+xfs_iext_alloc(
+	struct xfs_ifork	*ifp,
+	size_t			size)
+{
+	ifp->if_real_bytes += size;
+	return kmem_zalloc(size, KM_NOFS);
+}
+
+static void
+xfs_iext_free(
+	struct xfs_ifork	*ifp,
+	void			*p,
+	size_t			size)
+{
+	ifp->if_real_bytes -= size;
+	kmem_free(p);
+}
+
+/* Number of records below @node. */
+static xfs_extnum_t
+xfs_iext_node_sum(
+	struct xfs_iext_node	*node)
+{
+	xfs_extnum_t		sum = 0;
+	int			i;
+
+	for (i = 0; i < node->nr; i++)
+		sum += node->counts[i];
+	return sum;
+}
+
+/* Number of records below @child, which is a leaf if @leaf is set. */
+static inline xfs_extnum_t
+xfs_iext_child_count(
+	void			*child,
+	bool			leaf)
+{
+	if (leaf)
+		return ((struct xfs_iext_leaf *)child)->nr;
+	return xfs_iext_node_sum(child);
+}
+
+/* First record in the subtree at @ptr, @levels levels above the leaves. */
+static xfs_bmbt_rec_host_t *
+xfs_iext_first_rec(
+	void			*ptr,
+	int			levels)
+{
+	while (levels-- > 0)
+		ptr = ((struct xfs_iext_node *)ptr)->ptrs[0];
+	return &((struct xfs_iext_leaf *)ptr)->recs[0];
+}
+
+/*
+ * Walk down to the record at @idx.  When @inserting, an index on the
+ * boundary between two children goes to the end of the left one, so that
+ * appending to a leaf is preferred over prepending to the next.
+ */
+static void
+xfs_iext_seek(
+	struct xfs_iext_tree	*tree,
+	xfs_extnum_t		idx,
+	bool			inserting,
+	struct xfs_iext_cursor	*cur)
+{
+	struct xfs_iext_node	*node;
+	void			*ptr = tree->root;
+	int			level;
+	int			i;
+
+	for (level = 0; level < tree->height - 1; level++) {
+		node = ptr;
+		for (i = 0; i < node->nr - 1; i++) {
+			if (idx < node->counts[i] ||
+			    (inserting && idx == node->counts[i]))
+				break;
+			idx -= node->counts[i];
+		}
+		cur->nodes[level] = node;
+		cur->slots[level] = i;
+		ptr = node->ptrs[i];
+	}
+	cur->leaf = ptr;
+	cur->pos = idx;
+	ASSERT(idx <= cur->leaf->nr);
+}
+
+/*
+ * Insert @ptr, with @count records below it, at @slot in @node.  If the
+ * node is full it is split and the new right hand node is returned.
+ */
+static struct xfs_iext_node *
+xfs_iext_node_insert(
+	struct xfs_ifork	*ifp,
+	struct xfs_iext_node	*node,
+	int			slot,
+	void			*ptr,
+	xfs_extnum_t		count)
+{
+	struct xfs_iext_node	*new = NULL;
+	int			split;
+
+	if (node->nr == XFS_IEXT_NODE_PTRS) {
+		new = xfs_iext_alloc(ifp, sizeof(*new));
+		split = slot == node->nr ? slot : node->nr / 2;
+		new->nr = node->nr - split;
+		memcpy(new->ptrs, &node->ptrs[split],
+				new->nr * sizeof(node->ptrs[0]));
+		memcpy(new->counts, &node->counts[split],
+				new->nr * sizeof(node->counts[0]));
+		node->nr = split;
+		if (slot > split || split == XFS_IEXT_NODE_PTRS) {
+			node = new;
+			slot -= split;
+		}
+	}
+
+	memmove(&node->ptrs[slot + 1], &node->ptrs[slot],
+			(node->nr - slot) * sizeof(node->ptrs[0]));
+	memmove(&node->counts[slot + 1], &node->counts[slot],
+			(node->nr - slot) * sizeof(node->counts[0]));
+	node->ptrs[slot] = ptr;
+	node->counts[slot] = count;
+	node->nr++;
+	return new;
+}
+
+/* Make room for a zeroed record at @idx and return it. */
+static xfs_bmbt_rec_host_t *
+xfs_iext_tree_insert(
+	struct xfs_ifork	*ifp,
+	xfs_extnum_t		idx)
+{
+	struct xfs_iext_tree	*tree = xfs_iext_tree(ifp);
+	struct xfs_iext_cursor	cur;
+	struct xfs_iext_leaf	*leaf;
+	struct xfs_iext_leaf	*newleaf = NULL;
+	struct xfs_iext_node	*node;
+	void			*new;
+	xfs_bmbt_rec_host_t	*rec;
+	int			level;
+	int			split;
+	int			pos;
+
+	xfs_iext_seek(tree, idx, true, &cur);
+	leaf = cur.leaf;
+	pos = cur.pos;
+
+	if (leaf->nr == XFS_IEXT_LEAF_RECS) {
+		/*
+		 * Appending starts a new leaf and inserting at the front
+		 * moves everything out of the way, so a list built at
+		 * either end fills its leaves.  Anything else splits the
+		 * leaf down the middle.
+		 */
+		newleaf = xfs_iext_alloc(ifp, sizeof(*newleaf));
+		if (pos == leaf->nr || pos == 0)
+			split = pos;
+		else
+			split = leaf->nr / 2;
+		newleaf->nr = leaf->nr - split;
+		memcpy(newleaf->recs, &leaf->recs[split],
+				newleaf->nr * sizeof(leaf->recs[0]));
+		leaf->nr = split;
+		if (pos > split || split == XFS_IEXT_LEAF_RECS) {
+			leaf = newleaf;
+			pos -= split;
+		}
+	}
+
+	rec = &leaf->recs[pos];
+	memmove(rec + 1, rec, (leaf->nr - pos) * sizeof(*rec));
+	memset(rec, 0, sizeof(*rec));
+	leaf->nr++;
+
+	/*
+	 * Fix up the counts on the way back to the root, adding the new
+	 * sibling to the parent whenever a child was split.
+	 */
+	new = newleaf;
+	for (level = tree->height - 2; level >= 0; level--) {
+		node = cur.nodes[level];
+		if (!new) {
+			node->counts[cur.slots[level]]++;
+			continue;
+		}
+		node->counts[cur.slots[level]] = xfs_iext_child_count(
+				node->ptrs[cur.slots[level]],
+				level == tree->height - 2);
+		new = xfs_iext_node_insert(ifp, node, cur.slots[level] + 1,
+				new, xfs_iext_child_count(new,
+					level == tree->height - 2));
+	}
+
+	if (new) {
+		ASSERT(tree->height < XFS_IEXT_MAXLEVELS);
+		node = xfs_iext_alloc(ifp, sizeof(*node));
+		node->ptrs[0] = tree->root;
+		node->counts[0] = xfs_iext_child_count(tree->root,
+				tree->height == 1);
+		node->ptrs[1] = new;
+		node->counts[1] = xfs_iext_child_count(new, tree->height == 1);
+		node->nr = 2;
+		tree->root = node;
+		tree->height++;
+	}
+	return rec;
+}
+
+/*
+ * The children in @slot and @slot + 1 of @node are leaves.  Merge them if
+ * they fit in one, otherwise share the records out evenly.  Returns true
+ * if they were merged.
+ */
+static bool
+xfs_iext_leaf_balance(
+	struct xfs_ifork	*ifp,
+	struct xfs_iext_node	*node,
+	int			slot)
+{
+	struct xfs_iext_leaf	*left = node->ptrs[slot];
+	struct xfs_iext_leaf	*right = node->ptrs[slot + 1];
+	int			total = left->nr + right->nr;
+	int			move;
+
+	if (total <= XFS_IEXT_LEAF_RECS) {
+		memcpy(&left->recs[left->nr], right->recs,
+				right->nr * sizeof(right->recs[0]));
+		left->nr = total;
+		xfs_iext_free(ifp, right, sizeof(*right));
+		node->counts[slot] = total;
+		node->nr--;
+		memmove(&node->ptrs[slot + 1], &node->ptrs[slot + 2],
+				(node->nr - slot - 1) * sizeof(node->ptrs[0]));
+		memmove(&node->counts[slot + 1], &node->counts[slot + 2],
+				(node->nr - slot - 1) * sizeof(node->counts[0]));
+		return true;
+	}
+
+	if (left->nr < total / 2) {
+		move = total / 2 - left->nr;
+		memcpy(&left->recs[left->nr], right->recs,
+				move * sizeof(right->recs[0]));
+		memmove(right->recs, &right->recs[move],
+				(right->nr - move) * sizeof(right->recs[0]));
+		left->nr += move;
+		right->nr -= move;
+	} else {
+		move = left->nr - total / 2;
+		memmove(&right->recs[move], right->recs,
+				right->nr * sizeof(right->recs[0]));
+		memcpy(right->recs, &left->recs[left->nr - move],
+				move * sizeof(right->recs[0]));
+		left->nr -= move;
+		right->nr += move;
+	}
+	node->counts[slot] = left->nr;
+	node->counts[slot + 1] = right->nr;
+	return false;
+}
+
+/* As above, for two interior nodes. */
+static bool
+xfs_iext_node_balance(
+	struct xfs_ifork	*ifp,
+	struct xfs_iext_node	*node,
+	int			slot)
+{
+	struct xfs_iext_node	*left = node->ptrs[slot];
+	struct xfs_iext_node	*right = node->ptrs[slot + 1];
+	int			total = left->nr + right->nr;
+	int			move;
+
+	if (total <= XFS_IEXT_NODE_PTRS) {
+		memcpy(&left->ptrs[left->nr], right->ptrs,
+				right->nr * sizeof(right->ptrs[0]));
+		memcpy(&left->counts[left->nr], right->counts,
+				right->nr * sizeof(right->counts[0]));
+		left->nr = total;
+		xfs_iext_free(ifp, right, sizeof(*right));
+		node->counts[slot] += node->counts[slot + 1];
+		node->nr--;
+		memmove(&node->ptrs[slot + 1], &node->ptrs[slot + 2],
+				(node->nr - slot - 1) * sizeof(node->ptrs[0]));
+		memmove(&node->counts[slot + 1], &node->counts[slot + 2],
+				(node->nr - slot - 1) * sizeof(node->counts[0]));
+		return true;
+	}
+
+	if (left->nr < total / 2) {
+		move = total / 2 - left->nr;
+		memcpy(&left->ptrs[left->nr], right->ptrs,
+				move * sizeof(right->ptrs[0]));
+		memcpy(&left->counts[left->nr], right->counts,
+				move * sizeof(right->counts[0]));
+		memmove(right->ptrs, &right->ptrs[move],
+				(right->nr - move) * sizeof(right->ptrs[0]));
+		memmove(right->counts, &right->counts[move],
+				(right->nr - move) * sizeof(right->counts[0]));
+		left->nr += move;
+		right->nr -= move;
+	} else {
+		move = left->nr - total / 2;
+		memmove(&right->ptrs[move], right->ptrs,
+				right->nr * sizeof(right->ptrs[0]));
+		memmove(&right->counts[move], right->counts,
+				right->nr * sizeof(right->counts[0]));
+		memcpy(right->ptrs, &left->ptrs[left->nr - move],
+				move * sizeof(right->ptrs[0]));
+		memcpy(right->counts, &left->counts[left->nr - move],
+				move * sizeof(right->counts[0]));
+		left->nr -= move;
+		right->nr += move;
+	}
+	node->counts[slot] = xfs_iext_node_sum(left);
+	node->counts[slot + 1] = xfs_iext_node_sum(right);
+	return false;
+}
+
+/* Remove the record at @idx. */
+static void
+xfs_iext_tree_delete(
+	struct xfs_ifork	*ifp,
+	xfs_extnum_t		idx)
+{
+	struct xfs_iext_tree	*tree = xfs_iext_tree(ifp);
+	struct xfs_iext_cursor	cur;
+	struct xfs_iext_leaf	*leaf;
+	struct xfs_iext_node	*node;
+	void			*child;
+	bool			isleaf;
+	int			level;
+	int			slot;
+	int			nr;
+	int			min;
+
+	xfs_iext_seek(tree, idx, false, &cur);
+	leaf = cur.leaf;
+	ASSERT(cur.pos < leaf->nr);
+	memmove(&leaf->recs[cur.pos], &leaf->recs[cur.pos + 1],
+			(leaf->nr - cur.pos - 1) * sizeof(leaf->recs[0]));
+	leaf->nr--;
+	for (level = 0; level < tree->height - 1; level++)
+		cur.nodes[level]->counts[cur.slots[level]]--;
+
+	/*
+	 * Walk back up, freeing children that are now empty and merging
+	 * or refilling those that are less than half full, until a level
+	 * doesn't change shape.
+	 */
+	for (level = tree->height - 2; level >= 0; level--) {
+		node = cur.nodes[level];
+		slot = cur.slots[level];
+		child = node->ptrs[slot];
+		isleaf = level == tree->height - 2;
+		if (isleaf) {
+			nr = ((struct xfs_iext_leaf *)child)->nr;
+			min = XFS_IEXT_LEAF_RECS / 2;
+		} else {
+			nr = ((struct xfs_iext_node *)child)->nr;
+			min = XFS_IEXT_NODE_PTRS / 2;
+		}
+
+		if (nr == 0) {
+			xfs_iext_free(ifp, child, isleaf ?
+					sizeof(struct xfs_iext_leaf) :
+					sizeof(struct xfs_iext_node));
+			node->nr--;
+			memmove(&node->ptrs[slot], &node->ptrs[slot + 1],
+				(node->nr - slot) * sizeof(node->ptrs[0]));
+			memmove(&node->counts[slot], &node->counts[slot + 1],
+				(node->nr - slot) * sizeof(node->counts[0]));
+			continue;
+		}
+		if (nr >= min || node->nr == 1)
+			break;
+		if (slot == node->nr - 1)
+			slot--;
+		if (isleaf ? !xfs_iext_leaf_balance(ifp, node, slot) :
+			     !xfs_iext_node_balance(ifp, node, slot))
+			break;
+	}
+
+	/* Drop any levels above the root that only have one child. */
+	while (tree->height > 1) {
+		node = tree->root;
+		if (node->nr > 1)
+			break;
+		ASSERT(node->nr == 1);
+		tree->root = node->ptrs[0];
+		tree->height--;
+		xfs_iext_free(ifp, node, sizeof(*node));
+	}
+}
+
+/* Free everything in the subtree at @ptr, @levels levels above the leaves. */
+static void
+xfs_iext_free_subtree(
+	struct xfs_ifork	*ifp,
+	void			*ptr,
+	int			levels)
+{
+	struct xfs_iext_node	*node = ptr;
+	int			i;
+
+	if (levels == 0) {
+		xfs_iext_free(ifp, ptr, sizeof(struct xfs_iext_leaf));
+		return;
+	}
+	for (i = 0; i < node->nr; i++)
+		xfs_iext_free_subtree(ifp, node->ptrs[i], levels - 1);
+	xfs_iext_free(ifp, node, sizeof(*node));
+}
+
+/* Copy out the records in the subtree at @ptr, returning the next slot. */
+static xfs_bmbt_rec_host_t *
+xfs_iext_copy_subtree(
+	void			*ptr,
+	int			levels,
+	xfs_bmbt_rec_host_t	*dst)
+{
+	struct xfs_iext_node	*node = ptr;
+	struct xfs_iext_leaf	*leaf = ptr;
+	int			i;
+
+	if (levels == 0) {
+		memcpy(dst, leaf->recs, leaf->nr * sizeof(*dst));
+		return dst + leaf->nr;
+	}
+	for (i = 0; i < node->nr; i++)
+		dst = xfs_iext_copy_subtree(node->ptrs[i], levels - 1, dst);
+	return dst;
+}
+
+/*
+ * Switch from linear (direct) or inline extent records to an extent tree,
+ * once the space needed for incore extents rises above XFS_IEXT_BUFSZ.
+ */
+void
+xfs_iext_tree_init(
+	struct xfs_ifork	*ifp)
+{
+	struct xfs_iext_tree	*tree;
+	xfs_bmbt_rec_host_t	*old = ifp->if_u1.if_extents;
+	xfs_extnum_t		nextents = xfs_iext_count(ifp);
+	int			old_bytes = ifp->if_real_bytes;
+	xfs_extnum_t		i;
+
+	ASSERT(!(ifp->if_flags & XFS_IFEXTTREE));
+	ASSERT(nextents <= XFS_LINEAR_EXTS);
+
+	tree = kmem_alloc(sizeof(*tree), KM_NOFS);
+	ifp->if_real_bytes = 0;
+	tree->root = xfs_iext_alloc(ifp, sizeof(struct xfs_iext_leaf));
+	tree->height = 1;
+	ifp->if_u1.if_ext_tree = tree;
+	ifp->if_flags |= XFS_IFEXTTREE;
+
+	for (i = 0; i < nextents; i++)
+		*xfs_iext_tree_insert(ifp, i) = old[i];
+	if (old_bytes)
+		kmem_free(old);
+	else if (nextents)
+		memset(ifp->if_u2.if_inline_ext, 0,
+				XFS_INLINE_EXTS * sizeof(xfs_bmbt_rec_t));
+}
+
+/*
+ * Switch back to a linear (direct) extent list once the number of extents
+ * has dropped to @nextents.  Callers stay in the tree until the list is
+ * well below XFS_LINEAR_EXTS so that we don't bounce between the two.
+ */
+STATIC void
+xfs_iext_tree_to_direct(
+	struct xfs_ifork	*ifp,
+	xfs_extnum_t		nextents)
+{
+	struct xfs_iext_tree	*tree = xfs_iext_tree(ifp);
+	xfs_bmbt_rec_host_t	*ep;
+	int			size;
+
+	ASSERT(nextents > 0 && nextents <= XFS_LINEAR_EXTS);
+	size = roundup_pow_of_two(nextents * sizeof(xfs_bmbt_rec_t));
+	ep = kmem_zalloc(size, KM_NOFS);
+	xfs_iext_copy_subtree(tree->root, tree->height - 1, ep);
+	xfs_iext_tree_destroy(ifp);
+	ifp->if_u1.if_extents = ep;
+	ifp->if_real_bytes = size;
+}
+
+/*
+ * Return a pointer to the extent record at index @idx.
+ */
+xfs_bmbt_rec_host_t *
+xfs_iext_tree_get(
+	struct xfs_ifork	*ifp,
+	xfs_extnum_t		idx)
+{
+	struct xfs_iext_tree	*tree = xfs_iext_tree(ifp);
+	struct xfs_iext_node	*node;
+	void			*ptr = tree->root;
+	int			level;
+	int			i;
+
+	for (level = 0; level < tree->height - 1; level++) {
+		node = ptr;
+		for (i = 0; i < node->nr - 1; i++) {
+			if (idx < node->counts[i])
+				break;
+			idx -= node->counts[i];
+		}
+		ptr = node->ptrs[i];
+	}
+	ASSERT(idx < ((struct xfs_iext_leaf *)ptr)->nr);
+	return &((struct xfs_iext_leaf *)ptr)->recs[idx];
+}
+
+/*
+ * Insert @count zeroed records at index @idx.  The caller updates if_bytes
+ * and fills in the new records.
+ */
+void
+xfs_iext_tree_add(
+	struct xfs_ifork	*ifp,
+	xfs_extnum_t		idx,
+	int			count)
+{
+	int			i;
+
+	for (i = 0; i < count; i++)
+		xfs_iext_tree_insert(ifp, idx + i);
+}
+
+/*
+ * Remove @count records starting at index @idx, switching back to a
+ * linear list if that leaves few enough.  The caller updates if_bytes.
+ */
+void
+xfs_iext_tree_remove(
+	struct xfs_ifork	*ifp,
+	xfs_extnum_t		idx,
+	int			count)
+{
+	xfs_extnum_t		nextents = xfs_iext_count(ifp) - count;
+	int			i;
+
+	ASSERT(nextents > 0);
+	for (i = 0; i < count; i++)
+		xfs_iext_tree_delete(ifp, idx);
+
+	if (nextents <= XFS_LINEAR_EXTS / 2) {
+		xfs_iext_tree_to_direct(ifp, nextents);
+		if (nextents <= XFS_INLINE_EXTS)
+			xfs_iext_direct_to_inline(ifp, nextents);
+	}
+}
+
+/*
+ * Find the leaf whose records would contain file offset @bno.  Returns the
+ * records in the leaf, the number of them in *nrecsp and the index of the
+ * first one in *basep.
+ */
+xfs_bmbt_rec_host_t *
+xfs_iext_tree_bno_to_leaf(
+	struct xfs_ifork	*ifp,
+	xfs_fileoff_t		bno,
+	xfs_extnum_t		*basep,
+	int			*nrecsp)
+{
+	struct xfs_iext_tree	*tree = xfs_iext_tree(ifp);
+	struct xfs_iext_node	*node;
+	struct xfs_iext_leaf	*leaf;
+	void			*ptr = tree->root;
+	xfs_extnum_t		base = 0;
+	int			level;
+	int			low;
+	int			high;
+	int			mid;
+	int			i;
+
+	for (level = 0; level < tree->height - 1; level++) {
+		node = ptr;
+		/* last child starting at or before bno, or the first */
+		low = 1;
+		high = node->nr - 1;
+		while (low <= high) {
+			mid = (low + high) >> 1;
+			if (bno < xfs_bmbt_get_startoff(xfs_iext_first_rec(
+					node->ptrs[mid],
+					tree->height - level - 2)))
+				high = mid - 1;
+			else
+				low = mid + 1;
+		}
+		for (i = 0; i < high; i++)
+			base += node->counts[i];
+		ptr = node->ptrs[high];
+	}
+	leaf = ptr;
+	*basep = base;
+	*nrecsp = leaf->nr;
+	return leaf->recs;
+}
+
+/*
+ * Free the extent tree.  The caller resets the rest of the fork.
+ */
+void
+xfs_iext_tree_destroy(
+	struct xfs_ifork	*ifp)
+{
+	struct xfs_iext_tree	*tree = xfs_iext_tree(ifp);
+
+	xfs_iext_free_subtree(ifp, tree->root, tree->height - 1);
+	ASSERT(ifp->if_real_bytes == 0);
+	kmem_free(tree);
+	ifp->if_u1.if_ext_tree = NULL;
+	ifp->if_flags &= ~XFS_IFEXTTREE;
+}
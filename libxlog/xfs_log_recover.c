@@ -1189,11 +1189,11 @@ xlog_recover_commit_trans(
 	int			error = 0;
 
 	hlist_del(&trans->r_list);
-	if ((error = xlog_recover_do_trans(log, trans, pass)))
-		return error;
+	error = xlog_recover_do_trans(log, trans, pass);
 
+	/* it's off the hash now, so free it even if the pass is stopping */
 	xlog_recover_free_trans(trans);
-	return 0;
+	return error;
 }
 
 STATIC int
@@ -1305,6 +1305,43 @@ xlog_recover_process_data(
 	return 0;
 }
 
+/*
+ * Calculate the CRC of a log record the same way the kernel does when it
+ * writes it: the header with the CRC field zeroed, then the extended headers
+ * holding the rest of the cycle data for v2 logs, then the packed data.
+ */
+STATIC __le32
+xlog_cksum(
+	struct xlog		*log,
+	struct xlog_rec_header	*rhead,
+	char			*dp,
+	int			size)
+{
+	__uint32_t		crc;
+
+	crc = xfs_start_cksum_safe((char *)rhead,
+			sizeof(struct xlog_rec_header),
+			offsetof(struct xlog_rec_header, h_crc));
+
+	if (xfs_sb_version_haslogv2(&log->l_mp->m_sb)) {
+		union xlog_in_core2 *xhdr = (union xlog_in_core2 *)rhead;
+		int		i;
+		int		xheads;
+
+		xheads = size / XLOG_HEADER_CYCLE_SIZE;
+		if (size % XLOG_HEADER_CYCLE_SIZE)
+			xheads++;
+
+		for (i = 1; i < xheads; i++) {
+			crc = crc32c(crc, &xhdr[i].hic_xheader,
+				     sizeof(struct xlog_rec_ext_header));
+		}
+	}
+
+	crc = crc32c(crc, dp, size);
+	return xfs_end_cksum(crc);
+}
+
 /*
  * Upack the log buffer data and crc check it. If the check fails, issue a
  * warning if and only if the CRC in the header is non-zero. This makes the
@@ -1314,11 +1351,7 @@ xlog_recover_process_data(
  *
  * When filesystems are CRC enabled, this CRC mismatch becomes a fatal log
  * corruption failure
- *
- * XXX: we do not calculate the CRC here yet. It's not clear what we should do
- * with CRC errors here in userspace, so we'll address that problem later on.
  */
-#define xlog_cksum(l,r,dp,len)	((r)->h_crc)
 STATIC int
 xlog_unpack_data_crc(
 	struct xlog_rec_header	*rhead,
@@ -1349,18 +1382,14 @@ xlog_unpack_data_crc(
 	return 0;
 }
 
-STATIC int
-xlog_unpack_data(
+/* Put back the cycle data stamped over the first word of each block. */
+STATIC void
+xlog_unpack_cycles(
 	struct xlog_rec_header	*rhead,
 	char			*dp,
 	struct xlog		*log)
 {
 	int			i, j, k;
-	int			error;
-
-	error = xlog_unpack_data_crc(rhead, dp, log);
-	if (error)
-		return error;
 
 	for (i = 0; i < BTOBB(be32_to_cpu(rhead->h_len)) &&
 		  i < (XLOG_HEADER_CYCLE_SIZE / BBSIZE); i++) {
@@ -1377,7 +1406,21 @@ xlog_unpack_data(
 			dp += BBSIZE;
 		}
 	}
+}
 
+STATIC int
+xlog_unpack_data(
+	struct xlog_rec_header	*rhead,
+	char			*dp,
+	struct xlog		*log)
+{
+	int			error;
+
+	error = xlog_unpack_data_crc(rhead, dp, log);
+	if (error)
+		return error;
+
+	xlog_unpack_cycles(rhead, dp, log);
 	return 0;
 }
 
@@ -1417,6 +1460,553 @@ xlog_valid_rec_header(
 	return 0;
 }
 
+/*
+ * Streaming log reader for recovery passes.
+ *
+ * Records are read out of large, sector aligned windows of the log rather
+ * than with a pair of small synchronous reads per record.  While the caller
+ * unpacks and processes the records in one window, a helper thread reads
+ * the next window of the active part of the log into a second buffer, so
+ * the CRC checks and record processing overlap with the I/O.
+ *
+ * A record that straddles two windows is made contiguous by copying the
+ * part in the old window into space reserved in front of the new one,
+ * which costs at most one record per window.  A window never crosses the
+ * physical end of the log; after the last window the readahead moves on to
+ * the start of the log, so a pass that wraps doesn't have to stall there.
+ * Records that are themselves split across the end of the log are rare and
+ * are still read piecemeal by the caller.
+ */
+#define XLOG_READ_WINDOW	BTOBB(2 * 1024 * 1024)
+
+struct xlog_window {
+	struct xfs_buf		*bp;
+	xfs_daddr_t		blk;	/* first block, sector aligned */
+	int			len;	/* blocks available, sector multiple */
+	char			*addr;	/* data for blk */
+	int			error;
+};
+
+struct xlog_reader {
+	struct xlog		*log;
+	xfs_daddr_t		head_blk;
+	xfs_daddr_t		tail_blk;
+	int			winblks;	/* blocks read per window */
+	int			recblks;	/* largest record + a sector */
+	struct xlog_window	win[2];
+	struct xlog_window	*cur;	/* window being parsed */
+	struct xlog_window	*ra;	/* window being read ahead */
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wakeup;
+	int			ra_pending;
+	int			terminate;
+	int			threaded;
+};
+
+/* Read a window, leaving room for the tail of a record in front of it. */
+STATIC int
+xlog_reader_io(
+	struct xlog_reader	*rd,
+	struct xlog_window	*win)
+{
+	win->addr = win->bp->b_addr + BBTOB(rd->recblks);
+	return xlog_bread_offset(rd->log, win->blk, win->len, win->bp,
+				 win->addr);
+}
+
+static void *
+xlog_reader_thread(
+	void			*arg)
+{
+	struct xlog_reader	*rd = arg;
+	struct xlog_window	*win;
+
+	pthread_mutex_lock(&rd->lock);
+	for (;;) {
+		while (!rd->ra_pending && !rd->terminate)
+			pthread_cond_wait(&rd->wakeup, &rd->lock);
+		if (rd->terminate)
+			break;
+		win = rd->ra;
+		pthread_mutex_unlock(&rd->lock);
+
+		win->error = xlog_reader_io(rd, win);
+
+		pthread_mutex_lock(&rd->lock);
+		rd->ra_pending = 0;
+		pthread_cond_broadcast(&rd->wakeup);
+	}
+	pthread_mutex_unlock(&rd->lock);
+	return NULL;
+}
+
+/* Wait for any readahead in progress to complete. */
+STATIC void
+xlog_reader_wait(
+	struct xlog_reader	*rd)
+{
+	if (!rd->threaded)
+		return;
+	pthread_mutex_lock(&rd->lock);
+	while (rd->ra_pending)
+		pthread_cond_wait(&rd->wakeup, &rd->lock);
+	pthread_mutex_unlock(&rd->lock);
+}
+
+/*
+ * Start reading the part of the active log following the current window
+ * into the readahead buffer.
+ */
+STATIC void
+xlog_reader_ahead(
+	struct xlog_reader	*rd)
+{
+	struct xlog		*log = rd->log;
+	xfs_daddr_t		blk = rd->cur->blk + rd->cur->len;
+	xfs_daddr_t		end;
+
+	rd->ra->len = 0;
+	if (!rd->threaded)
+		return;
+
+	if (blk >= log->l_logBBsize)
+		blk = 0;
+	if (rd->tail_blk <= rd->head_blk) {
+		if (blk < rd->tail_blk || blk >= rd->head_blk)
+			return;
+	} else if (blk >= rd->head_blk && blk < rd->tail_blk) {
+		return;
+	}
+
+	end = min(blk + rd->winblks, log->l_logBBsize);
+	if (blk < rd->head_blk)
+		end = min(end, round_up(rd->head_blk, log->l_sectBBsize));
+
+	pthread_mutex_lock(&rd->lock);
+	rd->ra->blk = blk;
+	rd->ra->len = end - blk;
+	rd->ra->error = 0;
+	rd->ra_pending = 1;
+	pthread_cond_signal(&rd->wakeup);
+	pthread_mutex_unlock(&rd->lock);
+}
+
+static inline int
+xlog_window_has(
+	struct xlog_window	*win,
+	xfs_daddr_t		blk_no,
+	int			nbblks)
+{
+	return win->len && blk_no >= win->blk &&
+	       blk_no + nbblks <= win->blk + win->len;
+}
+
+/*
+ * Return a pointer to @nbblks blocks of log data starting at @blk_no if they
+ * are in the current window, without moving the reader.
+ */
+STATIC char *
+xlog_reader_peek(
+	struct xlog_reader	*rd,
+	xfs_daddr_t		blk_no,
+	int			nbblks)
+{
+	if (!xlog_window_has(rd->cur, blk_no, nbblks))
+		return NULL;
+	return rd->cur->addr + BBTOB(blk_no - rd->cur->blk);
+}
+
+/*
+ * Return a pointer to @nbblks blocks of log data starting at @blk_no in
+ * @offset.  The range must not cross the physical end of the log.  The data
+ * stays valid until the next call.
+ */
+STATIC int
+xlog_reader_read(
+	struct xlog_reader	*rd,
+	xfs_daddr_t		blk_no,
+	int			nbblks,
+	char			**offset)
+{
+	struct xlog		*log = rd->log;
+	struct xlog_window	*win = rd->cur;
+	xfs_daddr_t		start;
+	int			error;
+
+	if (nbblks <= 0 || nbblks > rd->recblks - log->l_sectBBsize ||
+	    blk_no + nbblks > log->l_logBBsize) {
+		xfs_warn(log->l_mp, "Invalid log read (0x%llx/0x%x)",
+			(unsigned long long)blk_no, nbblks);
+		XFS_ERROR_REPORT(__func__, XFS_ERRLEVEL_HIGH, log->l_mp);
+		return EFSCORRUPTED;
+	}
+
+	if (xlog_window_has(win, blk_no, nbblks))
+		goto found;
+
+	/*
+	 * Move on to the readahead window if it covers the range, first
+	 * copying across the start of the range if that is in this window.
+	 */
+	xlog_reader_wait(rd);
+	win = rd->ra;
+	if (win->len && !win->error) {
+		start = round_down(blk_no, log->l_sectBBsize);
+		if (start < win->blk &&
+		    win->blk == rd->cur->blk + rd->cur->len &&
+		    xlog_window_has(rd->cur, start, win->blk - start)) {
+			win->addr -= BBTOB(win->blk - start);
+			memcpy(win->addr, rd->cur->addr +
+					BBTOB(start - rd->cur->blk),
+			       BBTOB(win->blk - start));
+			win->len += win->blk - start;
+			win->blk = start;
+		}
+		if (xlog_window_has(win, blk_no, nbblks)) {
+			rd->ra = rd->cur;
+			rd->cur = win;
+			xlog_reader_ahead(rd);
+			goto found;
+		}
+	}
+
+	/* no luck, read a new window starting at this block */
+	win = rd->cur;
+	win->blk = round_down(blk_no, log->l_sectBBsize);
+	win->len = min(rd->winblks, log->l_logBBsize - win->blk);
+	error = xlog_reader_io(rd, win);
+	if (error) {
+		win->len = 0;
+		return error;
+	}
+	xlog_reader_ahead(rd);
+found:
+	*offset = win->addr + BBTOB(blk_no - win->blk);
+	return 0;
+}
+
+STATIC void
+xlog_reader_free(
+	struct xlog_reader	*rd)
+{
+	if (rd->threaded) {
+		pthread_mutex_lock(&rd->lock);
+		rd->terminate = 1;
+		pthread_cond_signal(&rd->wakeup);
+		pthread_mutex_unlock(&rd->lock);
+		pthread_join(rd->thread, NULL);
+	}
+	pthread_cond_destroy(&rd->wakeup);
+	pthread_mutex_destroy(&rd->lock);
+	if (rd->win[0].bp)
+		xlog_put_bp(rd->win[0].bp);
+	if (rd->win[1].bp)
+		xlog_put_bp(rd->win[1].bp);
+}
+
+/*
+ * Set up a reader for the active log between @tail_blk and @head_blk that
+ * can return records of up to @hblks of header and @h_size bytes of data.
+ * If the readahead thread can't be started, the reader still works, it
+ * just reads synchronously.
+ */
+STATIC int
+xlog_reader_init(
+	struct xlog_reader	*rd,
+	struct xlog		*log,
+	xfs_daddr_t		head_blk,
+	xfs_daddr_t		tail_blk,
+	int			hblks,
+	int			h_size)
+{
+	memset(rd, 0, sizeof(*rd));
+	rd->log = log;
+	rd->head_blk = head_blk;
+	rd->tail_blk = tail_blk;
+	rd->recblks = round_up(hblks + BTOBB(h_size) + log->l_sectBBsize,
+			       log->l_sectBBsize);
+	rd->winblks = max(XLOG_READ_WINDOW, rd->recblks);
+	rd->winblks = round_down(min(rd->winblks, log->l_logBBsize),
+				 log->l_sectBBsize);
+	pthread_mutex_init(&rd->lock, NULL);
+	pthread_cond_init(&rd->wakeup, NULL);
+
+	rd->win[0].bp = libxfs_getbufr(log->l_dev, (xfs_daddr_t)-1,
+				       rd->recblks + rd->winblks);
+	rd->win[1].bp = libxfs_getbufr(log->l_dev, (xfs_daddr_t)-1,
+				       rd->recblks + rd->winblks);
+	if (!rd->win[0].bp || !rd->win[1].bp) {
+		xlog_reader_free(rd);
+		return ENOMEM;
+	}
+	rd->cur = &rd->win[0];
+	rd->ra = &rd->win[1];
+
+	if (pthread_create(&rd->thread, NULL, xlog_reader_thread, rd) == 0)
+		rd->threaded = 1;
+	return 0;
+}
+
+/*
+ * Records are checked and unpacked in batches.  The CRC calculation and
+ * the cycle data unpacking of each record in a batch are independent of
+ * the other records, so they are spread over a pool of helper threads.
+ * The records are then handed to xlog_recover_process_data() one at a time
+ * in log order, because reassembling the transactions depends on it.
+ */
+#define XLOG_UNPACK_BATCH	64	/* records per batch */
+#define XLOG_UNPACK_THREADS	8	/* most helper threads to start */
+
+struct xlog_unpack_rec {
+	struct xlog_rec_header	*rhead;
+	char			*dp;
+	int			crc_ok;
+};
+
+struct xlog_unpack_pool {
+	struct xlog		*log;
+	struct xlog_unpack_rec	recs[XLOG_UNPACK_BATCH];
+	int			nr;
+	int			next;		/* next record to unpack */
+	int			busy;		/* helpers still working */
+	unsigned int		batch;		/* batch sequence number */
+	int			terminate;
+	int			nthreads;
+	pthread_t		threads[XLOG_UNPACK_THREADS];
+	pthread_mutex_t		lock;
+	pthread_cond_t		wakeup;
+	pthread_cond_t		done;
+};
+
+/*
+ * Unpack the records of the current batch until there are none left.
+ * Records with a bad CRC are left alone so that they can be reported in
+ * order by xlog_unpack_data() when the batch is processed.
+ */
+STATIC void
+xlog_unpack_work(
+	struct xlog_unpack_pool	*pool)
+{
+	struct xlog_unpack_rec	*rec;
+	int			i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i >= pool->nr)
+			break;
+
+		rec = &pool->recs[i];
+		rec->crc_ok = xlog_cksum(pool->log, rec->rhead, rec->dp,
+				be32_to_cpu(rec->rhead->h_len)) ==
+				rec->rhead->h_crc;
+		if (rec->crc_ok)
+			xlog_unpack_cycles(rec->rhead, rec->dp, pool->log);
+	}
+}
+
+static void *
+xlog_unpack_thread(
+	void			*arg)
+{
+	struct xlog_unpack_pool	*pool = arg;
+	unsigned int		batch = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->batch == batch && !pool->terminate)
+			pthread_cond_wait(&pool->wakeup, &pool->lock);
+		if (pool->terminate)
+			break;
+		batch = pool->batch;
+		pthread_mutex_unlock(&pool->lock);
+
+		xlog_unpack_work(pool);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/*
+ * Unpack and process the records in the current batch, stopping at the
+ * first record that fails.  The batch is empty afterwards either way.
+ */
+STATIC int
+xlog_unpack_batch(
+	struct xlog_unpack_pool	*pool,
+	struct hlist_head	rhash[],
+	int			pass)
+{
+	struct xlog_unpack_rec	*rec;
+	int			error = 0;
+	int			i;
+
+	if (!pool->nr)
+		return 0;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->next = 0;
+	if (pool->nthreads && pool->nr > 1) {
+		pool->busy = pool->nthreads;
+		pool->batch++;
+		pthread_cond_broadcast(&pool->wakeup);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	xlog_unpack_work(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nr; i++) {
+		rec = &pool->recs[i];
+		if (!rec->crc_ok) {
+			error = xlog_unpack_data(rec->rhead, rec->dp, pool->log);
+			if (error)
+				break;
+		}
+		error = xlog_recover_process_data(pool->log, rhash, rec->rhead,
+						  rec->dp, pass);
+		if (error)
+			break;
+	}
+	pool->nr = 0;
+	return error;
+}
+
+STATIC void
+xlog_unpack_pool_free(
+	struct xlog_unpack_pool	*pool)
+{
+	int			i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->terminate = 1;
+	pthread_cond_broadcast(&pool->wakeup);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->wakeup);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+/*
+ * Start a helper for each CPU beyond the one the caller runs on.  If none
+ * can be started the caller unpacks every record itself.
+ */
+STATIC void
+xlog_unpack_pool_init(
+	struct xlog_unpack_pool	*pool,
+	struct xlog		*log)
+{
+	long			ncpus;
+
+	memset(pool, 0, sizeof(*pool));
+	pool->log = log;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wakeup, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	while (pool->nthreads < min(ncpus - 1, XLOG_UNPACK_THREADS)) {
+		if (pthread_create(&pool->threads[pool->nthreads], NULL,
+				   xlog_unpack_thread, pool))
+			break;
+		pool->nthreads++;
+	}
+}
+
+/*
+ * Process the records from *@blkp up to @end, adding them to the unpack
+ * batch for as long as they are in the reader's current window.  If
+ * @stop_at_wrap is set, stop at the first record that is split across the
+ * physical end of the log and leave it to the caller.  On return *@blkp is
+ * the first block not processed.
+ */
+STATIC int
+xlog_recover_records(
+	struct xlog		*log,
+	struct xlog_reader	*rd,
+	struct xlog_unpack_pool	*pool,
+	struct hlist_head	rhash[],
+	xfs_daddr_t		*blkp,
+	xfs_daddr_t		end,
+	int			hblks,
+	int			pass,
+	bool			stop_at_wrap)
+{
+	struct xlog_rec_header	*rhead;
+	xfs_daddr_t		blk_no = *blkp;
+	char			*offset;
+	int			bblks;
+	int			error = 0;
+	int			error2;
+
+	while (blk_no < end) {
+		if (stop_at_wrap && blk_no + hblks > log->l_logBBsize)
+			break;
+
+		offset = xlog_reader_peek(rd, blk_no, hblks);
+		if (!offset) {
+			error = xlog_unpack_batch(pool, rhash, pass);
+			if (error)
+				break;
+			error = xlog_reader_read(rd, blk_no, hblks, &offset);
+			if (error)
+				break;
+		}
+
+		rhead = (xlog_rec_header_t *)offset;
+		error = xlog_valid_rec_header(log, rhead, blk_no);
+		if (error)
+			break;
+
+		/*
+		 * Get the whole record, header and data section together,
+		 * so the header stays valid if the reader has to move on to
+		 * its next window.
+		 */
+		bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
+		if (stop_at_wrap && blk_no + hblks + bblks > log->l_logBBsize)
+			break;
+
+		offset = xlog_reader_peek(rd, blk_no, hblks + bblks);
+		if (!offset) {
+			error = xlog_unpack_batch(pool, rhash, pass);
+			if (error)
+				break;
+			error = xlog_reader_read(rd, blk_no, hblks + bblks,
+						 &offset);
+			if (error)
+				break;
+		}
+
+		pool->recs[pool->nr].rhead = (xlog_rec_header_t *)offset;
+		pool->recs[pool->nr].dp = offset + BBTOB(hblks);
+		if (++pool->nr == XLOG_UNPACK_BATCH) {
+			error = xlog_unpack_batch(pool, rhash, pass);
+			if (error)
+				break;
+		}
+		blk_no += hblks + bblks;
+	}
+
+	/* records ahead of a bad one are still processed, as before */
+	error2 = xlog_unpack_batch(pool, rhash, pass);
+	*blkp = blk_no;
+	return error2 ? error2 : error;
+}
+
 /*
  * Read the log from tail to head and process the log records found.
  * Handle the two cases where the tail and head are in the same cycle
@@ -1440,6 +2030,10 @@ xlog_do_recovery_pass(
 	int			bblks, split_bblks;
 	int			hblks, split_hblks, wrapped_hblks;
 	struct hlist_head	rhash[XLOG_RHASH_SIZE];
+	struct xlog_reader	rd;
+	struct xlog_unpack_pool	pool;
+	xlog_recover_t		*trans;
+	int			i;
 
 	ASSERT(head_blk != tail_blk);
 
@@ -1490,36 +2084,19 @@ xlog_do_recovery_pass(
 		xlog_put_bp(hbp);
 		return ENOMEM;
 	}
+	error = xlog_reader_init(&rd, log, head_blk, tail_blk, hblks, h_size);
+	if (error) {
+		xlog_put_bp(dbp);
+		xlog_put_bp(hbp);
+		return error;
+	}
+	xlog_unpack_pool_init(&pool, log);
 
 	memset(rhash, 0, sizeof(rhash));
 	if (tail_blk <= head_blk) {
-		for (blk_no = tail_blk; blk_no < head_blk; ) {
-			error = xlog_bread(log, blk_no, hblks, hbp, &offset);
-			if (error)
-				goto bread_err2;
-
-			rhead = (xlog_rec_header_t *)offset;
-			error = xlog_valid_rec_header(log, rhead, blk_no);
-			if (error)
-				goto bread_err2;
-
-			/* blocks in data section */
-			bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
-			error = xlog_bread(log, blk_no + hblks, bblks, dbp,
-					   &offset);
-			if (error)
-				goto bread_err2;
-
-			error = xlog_unpack_data(rhead, offset, log);
-			if (error)
-				goto bread_err2;
-
-			error = xlog_recover_process_data(log,
-						rhash, rhead, offset, pass);
-			if (error)
-				goto bread_err2;
-			blk_no += bblks + hblks;
-		}
+		blk_no = tail_blk;
+		error = xlog_recover_records(log, &rd, &pool, rhash, &blk_no,
+					     head_blk, hblks, pass, false);
 	} else {
 		/*
 		 * Perform recovery around the end of the physical log.
@@ -1528,6 +2105,15 @@ xlog_do_recovery_pass(
 		 */
 		blk_no = tail_blk;
 		while (blk_no < log->l_logBBsize) {
+			/* whole records before the physical end of the log */
+			error = xlog_recover_records(log, &rd, &pool, rhash,
+					&blk_no, log->l_logBBsize, hblks,
+					pass, true);
+			if (error)
+				goto bread_err2;
+			if (blk_no >= log->l_logBBsize)
+				break;
+
 			/*
 			 * Check for header wrapping around physical end-of-log
 			 */
@@ -1536,8 +2122,8 @@ xlog_do_recovery_pass(
 			wrapped_hblks = 0;
 			if (blk_no + hblks <= log->l_logBBsize) {
 				/* Read header in one read */
-				error = xlog_bread(log, blk_no, hblks, hbp,
-						   &offset);
+				error = xlog_reader_read(&rd, blk_no, hblks,
+							 &offset);
 				if (error)
 					goto bread_err2;
 			} else {
@@ -1584,8 +2170,8 @@ xlog_do_recovery_pass(
 
 			/* Read in data for log record */
 			if (blk_no + bblks <= log->l_logBBsize) {
-				error = xlog_bread(log, blk_no, bblks, dbp,
-						   &offset);
+				error = xlog_reader_read(&rd, blk_no, bblks,
+							 &offset);
 				if (error)
 					goto bread_err2;
 			} else {
@@ -1642,35 +2228,26 @@ xlog_do_recovery_pass(
 		blk_no -= log->l_logBBsize;
 
 		/* read first part of physical log */
-		while (blk_no < head_blk) {
-			error = xlog_bread(log, blk_no, hblks, hbp, &offset);
-			if (error)
-				goto bread_err2;
-
-			rhead = (xlog_rec_header_t *)offset;
-			error = xlog_valid_rec_header(log, rhead, blk_no);
-			if (error)
-				goto bread_err2;
-
-			bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
-			error = xlog_bread(log, blk_no+hblks, bblks, dbp,
-					   &offset);
-			if (error)
-				goto bread_err2;
-
-			error = xlog_unpack_data(rhead, offset, log);
-			if (error)
-				goto bread_err2;
-
-			error = xlog_recover_process_data(log, rhash,
-							rhead, offset, pass);
-			if (error)
-				goto bread_err2;
-			blk_no += bblks + hblks;
-		}
+		error = xlog_recover_records(log, &rd, &pool, rhash, &blk_no,
+					     head_blk, hblks, pass, false);
 	}
 
  bread_err2:
+	/*
+	 * Transactions are freed when they commit, but those without a commit
+	 * record before the head, or still open when the pass was stopped
+	 * early, are left in the hash.
+	 */
+	for (i = 0; i < XLOG_RHASH_SIZE; i++) {
+		while (rhash[i].first) {
+			trans = hlist_entry(rhash[i].first, xlog_recover_t,
+					    r_list);
+			hlist_del(&trans->r_list);
+			xlog_recover_free_trans(trans);
+		}
+	}
+	xlog_unpack_pool_free(&pool);
+	xlog_reader_free(&rd);
 	xlog_put_bp(dbp);
  bread_err1:
 	xlog_put_bp(hbp);
@@ -20,6 +20,12 @@
 
 #include "logprint.h"
 
+/* if set, called for each transaction instead of printing it */
+int		(*xlog_trans_hook)(struct xlog *, struct xlog_recover *);
+
+static long	bench_trans;
+static long	bench_items;
+
 void
 xlog_recover_print_trans_head(
 	xlog_recover_t	*tr)
@@ -36,6 +42,8 @@ xlog_recover_do_trans(
 	xlog_recover_t	*trans,
 	int		pass)
 {
+	if (xlog_trans_hook)
+		return xlog_trans_hook(log, trans);
 	xlog_recover_print_trans(trans, &trans->r_itemq, 3);
 	return 0;
 }
@@ -94,3 +102,82 @@ xfs_log_print_trans(
 		exit(1);
 	}
 }
+
+static int
+bench_count_trans(
+	struct xlog	*log,
+	xlog_recover_t	*trans)
+{
+	bench_trans++;
+	bench_items += trans->r_theader.th_num_items;
+	return 0;
+}
+
+static double
+bench_secs(
+	struct timeval	*start)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+	       (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/*
+ * Time a transactional scan of the whole active log, as done by -t and
+ * by log recovery, without the cost of formatting any of it.
+ */
+void
+xfs_log_bench(
+	struct xlog	*log,
+	int		print_block_start)
+{
+	xfs_daddr_t	head_blk, tail_blk;
+	struct timeval	start;
+	long long	blocks;
+	double		find_secs, scan_secs;
+	int		error;
+
+	gettimeofday(&start, NULL);
+	error = xlog_find_tail(log, &head_blk, &tail_blk);
+	if (error) {
+		fprintf(stderr, _("%s: failed to find head and tail, error: %d\n"),
+			progname, error);
+		exit(1);
+	}
+	find_secs = bench_secs(&start);
+
+	if (print_block_start != -1)
+		tail_blk = print_block_start;
+	printf(_("    log tail: %lld head: %lld state: %s\n"),
+		(long long)tail_blk,
+		(long long)head_blk,
+		(tail_blk == head_blk)?"<CLEAN>":"<DIRTY>");
+	printf(_("    find head and tail: %.3f seconds\n"), find_secs);
+	if (head_blk == tail_blk)
+		return;
+
+	xlog_trans_hook = bench_count_trans;
+	print_record_header = 0;
+	gettimeofday(&start, NULL);
+	error = xlog_do_recovery_pass(log, head_blk, tail_blk,
+				      XLOG_RECOVER_PASS1);
+	scan_secs = bench_secs(&start);
+	if (error) {
+		fprintf(stderr, _("%s: failed in xfs_do_recovery_pass, error: %d\n"),
+			progname, error);
+		exit(1);
+	}
+
+	blocks = head_blk - tail_blk;
+	if (blocks < 0)
+		blocks += log->l_logBBsize;
+	printf(_("    scanned %lld blocks (%.1f MiB), %ld transactions, "
+		 "%ld items\n"),
+		blocks, BBTOB(blocks) / (1024.0 * 1024.0),
+		bench_trans, bench_items);
+	printf(_("    recovery pass: %.3f seconds, %.1f MiB/sec\n"),
+		scan_secs, scan_secs > 0 ?
+			BBTOB(blocks) / (1024.0 * 1024.0) / scan_secs : 0.0);
+}
@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "libxfs.h"
+#include "libxlog.h"
+
+#include "logprint.h"
+
+/*
+ * Filtered transactional view of the log.
+ *
+ * A first pass over the log reassembles every transaction without printing
+ * anything, and indexes each one by the LSN of the record it starts in, the
+ * inodes it logs and the disk addresses of the buffers it logs.  The query
+ * is answered from the index, and then only the log records from the start
+ * of each matching transaction to its commit are read and decoded again to
+ * print it.  Output is one line per transaction and per item, made up of
+ * key=value fields.
+ */
+
+struct query_trans {
+	xfs_lsn_t	lsn;		/* LSN of the record it starts in */
+	xlog_tid_t	tid;
+	int		match;
+	int		printed;
+};
+
+struct query_key {
+	__uint64_t	key;		/* inode number or daddr */
+	int		len;		/* basic blocks, for buffers */
+	int		trans;		/* index into query_index.trans */
+};
+
+static struct query_index {
+	struct query_trans	*trans;
+	int			ntrans;
+	int			maxtrans;
+	struct query_key	*inodes;
+	int			ninodes;
+	int			maxinodes;
+	struct query_key	*bufs;
+	int			nbufs;
+	int			maxbufs;
+	int			maxbuflen;
+} idx;
+
+/* the query from the command line */
+static __uint64_t	*query_inos;
+static int		nquery_inos;
+static __uint64_t	*query_daddrs;
+static int		nquery_daddrs;
+static xfs_lsn_t	query_lsn_lo;
+static xfs_lsn_t	query_lsn_hi = LLONG_MAX;
+
+/* matching transactions in LSN order, for the decode passes */
+static struct query_trans **matches;
+static int		nmatches;
+static int		next_match;	/* first match not yet printed */
+static struct query_trans *target;	/* match a decode pass starts at */
+
+static void *
+query_grow(
+	void		*array,
+	int		*max,
+	size_t		size)
+{
+	*max = *max ? *max * 2 : 1024;
+	array = realloc(array, *max * size);
+	if (!array) {
+		fprintf(stderr, _("%s: out of memory building log index\n"),
+			progname);
+		exit(1);
+	}
+	return array;
+}
+
+static void
+query_add_key(
+	struct query_key	**keys,
+	int			*nkeys,
+	int			*maxkeys,
+	__uint64_t		key,
+	int			len)
+{
+	if (*nkeys == *maxkeys)
+		*keys = query_grow(*keys, maxkeys, sizeof(**keys));
+	(*keys)[*nkeys].key = key;
+	(*keys)[*nkeys].len = len;
+	(*keys)[*nkeys].trans = idx.ntrans - 1;
+	(*nkeys)++;
+}
+
+static int
+query_index_trans(
+	struct xlog		*log,
+	xlog_recover_t		*trans)
+{
+	xlog_recover_item_t	*item;
+	xfs_inode_log_format_t	in_buf, *in_f;
+	xfs_buf_log_format_t	*blf;
+
+	if (idx.ntrans == idx.maxtrans)
+		idx.trans = query_grow(idx.trans, &idx.maxtrans,
+				       sizeof(*idx.trans));
+	idx.trans[idx.ntrans].lsn = trans->r_lsn;
+	idx.trans[idx.ntrans].tid = trans->r_log_tid;
+	idx.trans[idx.ntrans].match = 0;
+	idx.trans[idx.ntrans].printed = 0;
+	idx.ntrans++;
+
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		if (!item->ri_cnt)
+			continue;
+		switch (ITEM_TYPE(item)) {
+		case XFS_LI_INODE:
+			in_f = xfs_inode_item_format_convert(
+					item->ri_buf[0].i_addr,
+					item->ri_buf[0].i_len, &in_buf);
+			query_add_key(&idx.inodes, &idx.ninodes,
+				      &idx.maxinodes, in_f->ilf_ino, 0);
+			break;
+		case XFS_LI_BUF:
+			blf = item->ri_buf[0].i_addr;
+			query_add_key(&idx.bufs, &idx.nbufs, &idx.maxbufs,
+				      blf->blf_blkno, blf->blf_len);
+			idx.maxbuflen = max(idx.maxbuflen, (int)blf->blf_len);
+			break;
+		}
+	}
+	return 0;
+}
+
+static void
+query_print_item(
+	struct query_trans	*qt,
+	xlog_recover_item_t	*item)
+{
+	xfs_inode_log_format_t	in_buf, *in_f;
+	xfs_buf_log_format_t	*blf;
+	xfs_dq_logformat_t	*dq;
+	struct xfs_icreate_log	*icl;
+
+	printf("lsn=%u:%u tid=0x%x ", CYCLE_LSN(qt->lsn), BLOCK_LSN(qt->lsn),
+	       qt->tid);
+	if (!item->ri_cnt) {
+		printf("type=none\n");
+		return;
+	}
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_INODE:
+		in_f = xfs_inode_item_format_convert(item->ri_buf[0].i_addr,
+				item->ri_buf[0].i_len, &in_buf);
+		printf("type=inode ino=%llu fields=0x%x regions=%d "
+		       "daddr=%lld len=%d\n",
+		       (unsigned long long)in_f->ilf_ino, in_f->ilf_fields,
+		       in_f->ilf_size, (long long)in_f->ilf_blkno,
+		       in_f->ilf_len);
+		break;
+	case XFS_LI_BUF:
+		blf = item->ri_buf[0].i_addr;
+		printf("type=buf daddr=%lld len=%u flags=0x%x regions=%d\n",
+		       (long long)blf->blf_blkno, blf->blf_len,
+		       blf->blf_flags, blf->blf_size);
+		break;
+	case XFS_LI_ICREATE:
+		icl = item->ri_buf[0].i_addr;
+		printf("type=icreate agno=%u agbno=%u count=%u\n",
+		       be32_to_cpu(icl->icl_ag), be32_to_cpu(icl->icl_agbno),
+		       be32_to_cpu(icl->icl_count));
+		break;
+	case XFS_LI_DQUOT:
+		dq = item->ri_buf[0].i_addr;
+		printf("type=dquot id=%u daddr=%lld len=%d\n",
+		       dq->qlf_id, (long long)dq->qlf_blkno, dq->qlf_len);
+		break;
+	case XFS_LI_EFI:
+		printf("type=efi\n");
+		break;
+	case XFS_LI_EFD:
+		printf("type=efd\n");
+		break;
+	case XFS_LI_RUI:
+		printf("type=rui\n");
+		break;
+	case XFS_LI_RUD:
+		printf("type=rud\n");
+		break;
+	case XFS_LI_CUI:
+		printf("type=cui\n");
+		break;
+	case XFS_LI_CUD:
+		printf("type=cud\n");
+		break;
+	case XFS_LI_BUI:
+		printf("type=bui\n");
+		break;
+	case XFS_LI_BUD:
+		printf("type=bud\n");
+		break;
+	case XFS_LI_QUOTAOFF:
+		printf("type=quotaoff\n");
+		break;
+	default:
+		printf("type=unknown magic=0x%x\n", ITEM_TYPE(item));
+		break;
+	}
+}
+
+static struct query_trans *
+query_find_match(
+	xfs_lsn_t		lsn,
+	xlog_tid_t		tid)
+{
+	int			lo = 0, hi = nmatches, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (matches[mid]->lsn < lsn)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < nmatches && matches[lo]->lsn == lsn; lo++)
+		if (matches[lo]->tid == tid)
+			return matches[lo];
+	return NULL;
+}
+
+/*
+ * Print the matching transactions as they are reassembled again.  Once the
+ * one the pass started at has been printed, and no other match started
+ * ahead of the transaction just seen, stop the pass; the next one starts
+ * at the next match still to be printed.
+ */
+static int
+query_print_trans(
+	struct xlog		*log,
+	xlog_recover_t		*trans)
+{
+	struct query_trans	*qt;
+	xlog_recover_item_t	*item;
+
+	qt = query_find_match(trans->r_lsn, trans->r_log_tid);
+	if (qt && !qt->printed) {
+		printf("lsn=%u:%u tid=0x%x type=trans items=%d\n",
+		       CYCLE_LSN(qt->lsn), BLOCK_LSN(qt->lsn), qt->tid,
+		       trans->r_theader.th_num_items);
+		list_for_each_entry(item, &trans->r_itemq, ri_list)
+			query_print_item(qt, item);
+		qt->printed = 1;
+		while (next_match < nmatches && matches[next_match]->printed)
+			next_match++;
+	}
+
+	if (target->printed &&
+	    (next_match == nmatches ||
+	     matches[next_match]->lsn > trans->r_lsn))
+		return ECANCELED;
+	return 0;
+}
+
+static int
+query_key_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct query_key	*ka = a;
+	const struct query_key	*kb = b;
+
+	if (ka->key < kb->key)
+		return -1;
+	if (ka->key > kb->key)
+		return 1;
+	return ka->trans - kb->trans;
+}
+
+static int
+query_lsn_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct query_trans *ta = *(struct query_trans **)a;
+	const struct query_trans *tb = *(struct query_trans **)b;
+
+	if (ta->lsn < tb->lsn)
+		return -1;
+	return ta->lsn > tb->lsn;
+}
+
+/* Index of the first key not less than @key. */
+static int
+query_key_find(
+	struct query_key	*keys,
+	int			nkeys,
+	__uint64_t		key)
+{
+	int			lo = 0, hi = nkeys, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (keys[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void
+query_match_keys(void)
+{
+	__uint64_t		daddr, start;
+	int			i, j;
+
+	qsort(idx.inodes, idx.ninodes, sizeof(*idx.inodes), query_key_cmp);
+	qsort(idx.bufs, idx.nbufs, sizeof(*idx.bufs), query_key_cmp);
+
+	if (!nquery_inos && !nquery_daddrs) {
+		for (i = 0; i < idx.ntrans; i++)
+			idx.trans[i].match = 1;
+		return;
+	}
+
+	for (i = 0; i < nquery_inos; i++) {
+		for (j = query_key_find(idx.inodes, idx.ninodes,
+					query_inos[i]);
+		     j < idx.ninodes && idx.inodes[j].key == query_inos[i];
+		     j++)
+			idx.trans[idx.inodes[j].trans].match = 1;
+	}
+
+	/* a buffer matches if the address is anywhere inside it */
+	for (i = 0; i < nquery_daddrs; i++) {
+		daddr = query_daddrs[i];
+		start = daddr > idx.maxbuflen ? daddr - idx.maxbuflen : 0;
+		for (j = query_key_find(idx.bufs, idx.nbufs, start);
+		     j < idx.nbufs && idx.bufs[j].key <= daddr; j++) {
+			if (daddr < idx.bufs[j].key + idx.bufs[j].len)
+				idx.trans[idx.bufs[j].trans].match = 1;
+		}
+	}
+}
+
+void
+xfs_log_query(
+	struct xlog		*log)
+{
+	xfs_daddr_t		head_blk, tail_blk;
+	int			error;
+	int			i;
+
+	error = xlog_find_tail(log, &head_blk, &tail_blk);
+	if (error) {
+		fprintf(stderr, _("%s: failed to find head and tail, error: %d\n"),
+			progname, error);
+		exit(1);
+	}
+	if (head_blk == tail_blk)
+		return;
+
+	/* build the index */
+	print_record_header = 0;
+	xlog_trans_hook = query_index_trans;
+	error = xlog_do_recovery_pass(log, head_blk, tail_blk,
+				      XLOG_RECOVER_PASS1);
+	if (error) {
+		fprintf(stderr, _("%s: failed in xfs_do_recovery_pass, error: %d\n"),
+			progname, error);
+		exit(1);
+	}
+
+	/* look up the query */
+	query_match_keys();
+	matches = calloc((unsigned int)idx.ntrans, sizeof(*matches));
+	if (idx.ntrans && !matches) {
+		fprintf(stderr, _("%s: out of memory building log index\n"),
+			progname);
+		exit(1);
+	}
+	for (i = 0; i < idx.ntrans; i++) {
+		if (idx.trans[i].match &&
+		    idx.trans[i].lsn >= query_lsn_lo &&
+		    idx.trans[i].lsn <= query_lsn_hi)
+			matches[nmatches++] = &idx.trans[i];
+	}
+	qsort(matches, nmatches, sizeof(*matches), query_lsn_cmp);
+
+	/* decode and print the records holding the matches */
+	xlog_trans_hook = query_print_trans;
+	while (next_match < nmatches) {
+		target = matches[next_match];
+		error = xlog_do_recovery_pass(log, head_blk,
+					      BLOCK_LSN(target->lsn),
+					      XLOG_RECOVER_PASS1);
+		if (error && error != ECANCELED) {
+			fprintf(stderr,
+		_("%s: failed in xfs_do_recovery_pass, error: %d\n"),
+				progname, error);
+			exit(1);
+		}
+		if (!target->printed) {
+			fprintf(stderr,
+		_("%s: transaction 0x%x at lsn %u:%u not found again\n"),
+				progname, target->tid, CYCLE_LSN(target->lsn),
+				BLOCK_LSN(target->lsn));
+			target->printed = 1;
+			while (next_match < nmatches &&
+			       matches[next_match]->printed)
+				next_match++;
+		}
+	}
+
+	free(matches);
+	free(idx.trans);
+	free(idx.inodes);
+	free(idx.bufs);
+}
+
+static __uint64_t *
+query_add_value(
+	__uint64_t	*values,
+	int		*nvalues,
+	const char	*arg,
+	const char	*what)
+{
+	char		*p;
+	__uint64_t	v;
+
+	v = strtoull(arg, &p, 0);
+	if (*arg == '\0' || *p != '\0') {
+		fprintf(stderr, _("%s: bad %s -- %s\n"), progname, what, arg);
+		usage();
+	}
+	values = realloc(values, (*nvalues + 1) * sizeof(*values));
+	if (!values) {
+		fprintf(stderr, _("%s: out of memory\n"), progname);
+		exit(1);
+	}
+	values[(*nvalues)++] = v;
+	return values;
+}
+
+void
+query_add_ino(
+	const char	*arg)
+{
+	query_inos = query_add_value(query_inos, &nquery_inos, arg,
+				     _("inode number"));
+}
+
+void
+query_add_daddr(
+	const char	*arg)
+{
+	query_daddrs = query_add_value(query_daddrs, &nquery_daddrs, arg,
+				       _("disk address"));
+}
+
+/* An LSN is either cycle:block or the raw 64 bit number. */
+static int
+query_parse_lsn(
+	const char	*arg,
+	xfs_lsn_t	*lsn)
+{
+	unsigned long	cycle, block;
+	char		*p;
+
+	cycle = strtoul(arg, &p, 0);
+	if (p == arg)
+		return 0;
+	if (*p == '\0') {
+		*lsn = cycle;
+		return 1;
+	}
+	if (*p != ':')
+		return 0;
+	arg = p + 1;
+	block = strtoul(arg, &p, 0);
+	if (p == arg || *p != '\0')
+		return 0;
+	*lsn = xlog_assign_lsn(cycle, block);
+	return 1;
+}
+
+/* -L first[,last]; either end may be left out */
+void
+query_set_lsn_range(
+	const char	*arg)
+{
+	char		*s, *comma;
+	int		ok = 1;
+
+	s = strdup(arg);
+	if (!s) {
+		fprintf(stderr, _("%s: out of memory\n"), progname);
+		exit(1);
+	}
+	comma = strchr(s, ',');
+	if (comma)
+		*comma++ = '\0';
+	if (*s)
+		ok = query_parse_lsn(s, &query_lsn_lo);
+	if (ok && comma && *comma)
+		ok = query_parse_lsn(comma, &query_lsn_hi);
+	else if (ok && !comma)
+		query_lsn_hi = query_lsn_lo;
+	free(s);
+	if (!ok) {
+		fprintf(stderr, _("%s: bad LSN range -- %s\n"), progname, arg);
+		usage();
+	}
+}
@@ -27,6 +27,8 @@
 #define OP_PRINT_TRANS	1
 #define OP_DUMP		2
 #define OP_COPY		3
+#define OP_BENCH	4
+#define OP_QUERY	5
 
 int	print_data;
 int	print_only_data;
@@ -58,6 +60,11 @@ Options:\n\
 	-b          in transactional view, extract buffer info\n\
 	-i          in transactional view, extract inode info\n\
 	-q          in transactional view, extract quota info\n\
+    -T              time a transactional scan of the log, print only totals\n\
+    -I <inode>      list transactions logging this inode\n\
+    -B <daddr>      list transactions logging a buffer covering this daddr\n\
+    -L <lsn>[,<lsn>] list transactions starting in this LSN range\n\
+	            (LSNs are cycle:block; -I and -B may be repeated)\n\
     -D              print only data; no decoding\n\
     -V              print version information\n"),
 	progname);
@@ -146,7 +153,7 @@ main(int argc, char **argv)
 	memset(&mount, 0, sizeof(mount));
 
 	progname = basename(argv[0]);
-	while ((c = getopt(argc, argv, "bC:cdefl:iqnors:tDVv")) != EOF) {
+	while ((c = getopt(argc, argv, "bB:C:cdefI:l:iL:qnors:tTDVv")) != EOF) {
 		switch (c) {
 			case 'D':
 				print_only_data++;
@@ -155,6 +162,10 @@ main(int argc, char **argv)
 			case 'b':
 				print_buffer++;
 				break;
+			case 'B':
+				print_operation = OP_QUERY;
+				query_add_daddr(optarg);
+				break;
 			case 'c':
 			    /* default is to stop on error.
 			     * -c turns this off.
@@ -184,6 +195,14 @@ main(int argc, char **argv)
 			case 'i':
 				print_inode++;
 				break;
+			case 'I':
+				print_operation = OP_QUERY;
+				query_add_ino(optarg);
+				break;
+			case 'L':
+				print_operation = OP_QUERY;
+				query_set_lsn_range(optarg);
+				break;
 			case 'q':
 				print_quota++;
 				break;
@@ -199,6 +218,9 @@ main(int argc, char **argv)
 			case 't':
 				print_operation = OP_PRINT_TRANS;
 				break;
+			case 'T':
+				print_operation = OP_BENCH;
+				break;
 			case 'v':
 				print_overwrite++;
 				break;
@@ -219,7 +241,8 @@ main(int argc, char **argv)
 		usage();
 
 	x.isreadonly = LIBXFS_ISINACTIVE;
-	printf(_("xfs_logprint:\n"));
+	if (print_operation != OP_QUERY)
+		printf(_("xfs_logprint:\n"));
 	if (!libxfs_init(&x))
 		exit(1);
 
@@ -228,17 +251,19 @@ main(int argc, char **argv)
 
 	logfd = (x.logfd < 0) ? x.dfd : x.logfd;
 
-	printf(_("    data device: 0x%llx\n"), (unsigned long long)x.ddev);
-
-	if (x.logname) {
-		printf(_("    log file: \"%s\" "), x.logname);
-	} else {
-		printf(_("    log device: 0x%llx "), (unsigned long long)x.logdev);
+	/* keep the query output machine readable */
+	if (print_operation != OP_QUERY) {
+		printf(_("    data device: 0x%llx\n"),
+			(unsigned long long)x.ddev);
+		if (x.logname)
+			printf(_("    log file: \"%s\" "), x.logname);
+		else
+			printf(_("    log device: 0x%llx "),
+				(unsigned long long)x.logdev);
+		printf(_("daddr: %lld length: %lld\n\n"),
+			(long long)x.logBBstart, (long long)x.logBBsize);
 	}
 
-	printf(_("daddr: %lld length: %lld\n\n"),
-		(long long)x.logBBstart, (long long)x.logBBsize);
-
 	ASSERT(x.logBBsize <= INT_MAX);
 
 	log.l_dev = mount.m_logdev_targp;
@@ -254,6 +279,12 @@ main(int argc, char **argv)
 	case OP_PRINT_TRANS:
 		xfs_log_print_trans(&log, print_start);
 		break;
+	case OP_BENCH:
+		xfs_log_bench(&log, print_start);
+		break;
+	case OP_QUERY:
+		xfs_log_query(&log);
+		break;
 	case OP_DUMP:
 		xfs_log_dump(&log, logfd, print_start);
 		break;
@@ -29,13 +29,22 @@ extern int	print_overwrite;
 extern int	print_no_data;
 extern int	print_no_print;
 
+extern int	(*xlog_trans_hook)(struct xlog *, struct xlog_recover *);
+
 /* exports */
+extern void usage(void);
 extern void xlog_print_lseek(struct xlog *, int, xfs_daddr_t, int);
 
 extern void xfs_log_copy(struct xlog *, int, char *);
 extern void xfs_log_dump(struct xlog *, int, int);
 extern void xfs_log_print(struct xlog *, int, int);
 extern void xfs_log_print_trans(struct xlog *, int);
+extern void xfs_log_bench(struct xlog *, int);
+extern void xfs_log_query(struct xlog *);
+
+extern void query_add_ino(const char *);
+extern void query_add_daddr(const char *);
+extern void query_set_lsn_range(const char *);
 
 extern void print_xlog_record_line(void);
 extern void print_xlog_op_line(void);
@@ -18,6 +18,9 @@
 
 #include "libxfs.h"
 #include <sys/stat.h>
+#include <sys/xattr.h>
+#include <dirent.h>
+#include <pthread.h>
 #include "xfs_multidisk.h"
 
 /*
@@ -29,9 +32,18 @@ static struct xfs_trans * getres(struct xfs_mount *mp, uint blocks);
 static void rsvfile(xfs_mount_t *mp, xfs_inode_t *ip, long long len);
 static int newfile(xfs_trans_t *tp, xfs_inode_t *ip, struct xfs_defer_ops *dfops,
 	xfs_fsblock_t *first, int dolocal, int logit, char *buf, int len);
-static char *newregfile(char **pp, int *len);
+static int newregfile(char **pp, long long *len);
+static void writefile(xfs_mount_t *mp, xfs_inode_t *ip, int fd, long long len);
 static void rtinit(xfs_mount_t *mp);
-static long filesize(int fd);
+static long long filesize(int fd);
+static void populate_from_dir(xfs_mount_t *mp, struct fsxattr *fsxp,
+	char *path);
+
+/*
+ * Set by setup_proto() if the prototype given is a directory tree to copy
+ * rather than a protofile.
+ */
+static char *protodir;
 
 /*
  * Use this for block reservations needed for mkfs's conditions
@@ -43,6 +55,12 @@ static long filesize(int fd);
 	((uint)(MKFS_BLOCKRES_INODE + XFS_DA_NODE_MAXDEPTH + \
 	(XFS_BM_MAXLEVELS(mp, XFS_DATA_FORK) - 1) + (rb)))
 
+/*
+ * Regular file data is copied from the source file to the new filesystem
+ * through a buffer of this size, so memory use doesn't depend on file size.
+ */
+#define	MKFS_COPY_SIZE		(1024 * 1024)
+
 static long long
 getnum(
 	const char	*str,
@@ -70,11 +88,16 @@ setup_proto(
 {
 	char		*buf = NULL;
 	static char	dflt[] = "d--755 0 0 $";
+	struct stat	stb;
 	int		fd;
 	long		size;
 
 	if (!fname)
 		return dflt;
+	if (stat(fname, &stb) == 0 && S_ISDIR(stb.st_mode)) {
+		protodir = fname;
+		return dflt;
+	}
 	if ((fd = open(fname, O_RDONLY)) < 0 || (size = filesize(fd)) < 0) {
 		fprintf(stderr, _("%s: failed to open %s: %s\n"),
 			progname, fname, strerror(errno));
@@ -246,6 +269,7 @@ newfile(
 	xfs_mount_t	*mp;
 	xfs_extlen_t	nb;
 	int		nmap;
+	int		hdr;
 
 	flags = 0;
 	mp = ip->i_mount;
@@ -259,7 +283,8 @@ newfile(
 		ip->i_d.di_format = XFS_DINODE_FMT_LOCAL;
 		flags = XFS_ILOG_DDATA;
 	} else if (len > 0) {
-		nb = XFS_B_TO_FSB(mp, len);
+		/* one contiguous extent, so one header as the kernel writes */
+		nb = libxfs_symlink_blocks(mp, len);
 		nmap = 1;
 		error = -libxfs_bmapi_write(tp, ip, 0, nb, 0, first, nb,
 				&map, &nmap, dfops);
@@ -275,9 +300,11 @@ newfile(
 		d = XFS_FSB_TO_DADDR(mp, map.br_startblock);
 		bp = libxfs_trans_get_buf(logit ? tp : 0, mp->m_dev, d,
 			nb << mp->m_blkbb_log, 0);
-		memmove(XFS_BUF_PTR(bp), buf, len);
-		if (len < XFS_BUF_COUNT(bp))
-			memset(XFS_BUF_PTR(bp) + len, 0, XFS_BUF_COUNT(bp) - len);
+		hdr = libxfs_symlink_hdr_set(mp, ip->i_ino, 0, len, bp);
+		memmove(XFS_BUF_PTR(bp) + hdr, buf, len);
+		if (hdr + len < XFS_BUF_COUNT(bp))
+			memset(XFS_BUF_PTR(bp) + hdr + len, 0,
+				XFS_BUF_COUNT(bp) - hdr - len);
 		if (logit)
 			libxfs_trans_log_buf(tp, bp, 0, XFS_BUF_COUNT(bp) - 1);
 		else
@@ -287,15 +314,14 @@ newfile(
 	return flags;
 }
 
-static char *
+static int
 newregfile(
 	char		**pp,
-	int		*len)
+	long long	*len)
 {
-	char		*buf;
 	int		fd;
 	char		*fname;
-	long		size;
+	long long	size;
 
 	fname = getstr(pp);
 	if ((fd = open(fname, O_RDONLY)) < 0 || (size = filesize(fd)) < 0) {
@@ -303,19 +329,234 @@ newregfile(
 			progname, fname, strerror(errno));
 		exit(1);
 	}
-	if ((*len = (int)size)) {
-		buf = malloc(size);
-		if (read(fd, buf, size) < size) {
-			fprintf(stderr, _("%s: read failed on %s: %s\n"),
-				progname, fname, strerror(errno));
+	*len = size;
+	return fd;
+}
+
+/*
+ * A regular file's data is copied in two steps: first the blocks for all of
+ * the data in the source file are allocated and described by a copy job,
+ * then the job copies the data from the source file straight to the target
+ * device.  The second step needs no filesystem state, so jobs can be run by
+ * a pool of threads while the rest of the filesystem is being built.
+ */
+struct copy_extent {
+	off64_t		soff;		/* offset in the source file */
+	off64_t		doff;		/* offset on the target device */
+	long long	len;		/* bytes to copy */
+	int		dfd;		/* target device */
+};
+
+struct copy_job {
+	struct copy_job	*next;
+	int		fd;		/* source file */
+	int		nextents;
+	int		maxextents;
+	struct copy_extent *extents;
+};
+
+static void
+addextent(
+	xfs_mount_t	*mp,
+	xfs_inode_t	*ip,
+	struct copy_job	*job,
+	xfs_bmbt_irec_t	*map)
+{
+	struct copy_extent *ext;
+	struct xfs_buftarg *btp;
+	xfs_daddr_t	d;
+
+	if (job->nextents == job->maxextents) {
+		job->maxextents = job->maxextents ? job->maxextents * 2 : 4;
+		job->extents = realloc(job->extents,
+				job->maxextents * sizeof(*job->extents));
+		if (!job->extents)
+			fail(_("cannot allocate file copy job"), ENOMEM);
+	}
+	if (XFS_IS_REALTIME_INODE(ip)) {
+		btp = mp->m_rtdev_targp;
+		d = XFS_FSB_TO_BB(mp, map->br_startblock);
+	} else {
+		btp = mp->m_ddev_targp;
+		d = XFS_FSB_TO_DADDR(mp, map->br_startblock);
+	}
+	ext = &job->extents[job->nextents++];
+	ext->dfd = libxfs_device_to_fd(btp->dev);
+	ext->doff = BBTOB(d);
+	ext->soff = XFS_FSB_TO_B(mp, map->br_startoff);
+	ext->len = XFS_FSB_TO_B(mp, map->br_blockcount);
+}
+
+/*
+ * Allocate blocks for the byte range [start, end) of the new file, at most
+ * one maximally sized extent per transaction, and add them to the job.
+ */
+static void
+allocfile_range(
+	xfs_mount_t	*mp,
+	xfs_inode_t	*ip,
+	struct copy_job	*job,
+	off64_t		start,
+	off64_t		end)
+{
+	xfs_fileoff_t	bno;
+	xfs_fileoff_t	ebno;
+	xfs_extlen_t	len;
+	int		error;
+	xfs_fsblock_t	first;
+	struct xfs_defer_ops	dfops;
+	int		i;
+	xfs_bmbt_irec_t	map[XFS_BMAP_MAX_NMAP];
+	int		nmap;
+	xfs_trans_t	*tp;
+
+	bno = XFS_B_TO_FSBT(mp, start);
+	ebno = XFS_B_TO_FSB(mp, end);
+	while (bno < ebno) {
+		len = ebno - bno > MAXEXTLEN ? MAXEXTLEN : ebno - bno;
+		tp = getres(mp, len);
+		libxfs_trans_ijoin(tp, ip, 0);
+		libxfs_defer_init(&dfops, &first);
+		nmap = XFS_BMAP_MAX_NMAP;
+		error = -libxfs_bmapi_write(tp, ip, bno, len, 0, &first, len,
+				map, &nmap, &dfops);
+		if (error)
+			fail(_("error allocating space for a file"), error);
+		if (nmap == 0) {
+			fprintf(stderr,
+				_("%s: cannot allocate space for file\n"),
+				progname);
 			exit(1);
 		}
-	} else
-		buf = 0;
-	close(fd);
+		error = -libxfs_defer_finish(&tp, &dfops, ip);
+		if (error)
+			fail(_("error allocating space for a file"), error);
+		libxfs_trans_commit(tp);
+
+		for (i = 0; i < nmap; i++) {
+			addextent(mp, ip, job, &map[i]);
+			bno = map[i].br_startoff + map[i].br_blockcount;
+		}
+	}
+}
+
+/*
+ * Allocate the blocks for the data of a regular file, skipping over any
+ * holes in the source so that sparse files stay sparse, and return the job
+ * that fills them in.  The job owns the source file descriptor.
+ */
+static struct copy_job *
+allocfile(
+	xfs_mount_t	*mp,
+	xfs_inode_t	*ip,
+	int		fd,
+	long long	len)
+{
+	struct copy_job	*job;
+	off64_t		start;
+	off64_t		end;
+	off64_t		off;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		fail(_("cannot allocate file copy job"), ENOMEM);
+	job->fd = fd;
+
+	for (start = 0; start < len; start = end) {
+		end = len;
+#ifdef SEEK_DATA
+		off = lseek64(fd, start, SEEK_DATA);
+		if (off < 0 && errno == ENXIO)
+			break;		/* only a hole left */
+		if (off >= 0) {
+			start = off;
+			off = lseek64(fd, start, SEEK_HOLE);
+			if (off >= 0 && off < len)
+				end = off;
+		}
+#endif
+		if (start >= end)
+			break;
+		allocfile_range(mp, ip, job, start, end);
+	}
+	return job;
+}
+
+/*
+ * Copy the data for each extent of a job through a buffer of MKFS_COPY_SIZE
+ * bytes, zeroing anything beyond the end of the source file in the last
+ * block, then free the job.
+ */
+static void
+runjob(
+	struct copy_job	*job,
+	char		*buf)
+{
+	struct copy_extent *ext;
+	off64_t		soff;
+	off64_t		doff;
+	long long	left;
+	ssize_t		count;
+	ssize_t		done;
+	ssize_t		n;
+
+	for (ext = job->extents; ext < &job->extents[job->nextents]; ext++) {
+		soff = ext->soff;
+		doff = ext->doff;
+		for (left = ext->len; left > 0; left -= count) {
+			count = left > MKFS_COPY_SIZE ? MKFS_COPY_SIZE : left;
+			for (done = 0; done < count; done += n) {
+				n = pread64(job->fd, buf + done, count - done,
+						soff + done);
+				if (n < 0)
+					fail(_("read failed on source file"),
+						errno);
+				if (n == 0)
+					break;
+			}
+			if (done < count)
+				memset(buf + done, 0, count - done);
+			n = pwrite64(ext->dfd, buf, count, doff);
+			if (n != count)
+				fail(_("write failed for file data"),
+					n < 0 ? errno : EIO);
+			soff += count;
+			doff += count;
+		}
+	}
+	close(job->fd);
+	free(job->extents);
+	free(job);
+}
+
+static char *
+copybuf_alloc(void)
+{
+	char		*buf;
+
+	buf = memalign(libxfs_device_alignment(), MKFS_COPY_SIZE);
+	if (!buf)
+		fail(_("cannot allocate file copy buffer"), ENOMEM);
 	return buf;
 }
 
+/*
+ * Fill in the data of a regular file from the source file and close it.
+ */
+static void
+writefile(
+	xfs_mount_t	*mp,
+	xfs_inode_t	*ip,
+	int		fd,
+	long long	len)
+{
+	char		*buf;
+
+	buf = copybuf_alloc();
+	runjob(allocfile(mp, ip, fd, len), buf);
+	free(buf);
+}
+
 static void
 newdirent(
 	xfs_mount_t	*mp,
@@ -368,6 +609,7 @@ parseproto(
 
 	char		*buf;
 	int		error;
+	int		fd;
 	xfs_fsblock_t	first;
 	int		flags;
 	struct xfs_defer_ops	dfops;
@@ -458,19 +700,30 @@ parseproto(
 	libxfs_defer_init(&dfops, &first);
 	switch (fmt) {
 	case IF_REGULAR:
-		buf = newregfile(pp, &len);
-		tp = getres(mp, XFS_B_TO_FSB(mp, len));
+		fd = newregfile(pp, &llen);
+		tp = getres(mp, 0);
 		error = -libxfs_inode_alloc(&tp, pip, mode|S_IFREG, 1, 0,
 					   &creds, fsxp, &ip);
 		if (error)
 			fail(_("Inode allocation failed"), error);
-		flags |= newfile(tp, ip, &dfops, &first, 0, 0, buf, len);
-		if (buf)
-			free(buf);
+		ip->i_d.di_size = llen;
 		libxfs_trans_ijoin(tp, pip, 0);
 		xname.type = XFS_DIR3_FT_REG_FILE;
 		newdirent(mp, tp, pip, &xname, ip->i_ino, &first, &dfops);
-		break;
+		libxfs_trans_log_inode(tp, ip, flags);
+		error = -libxfs_defer_finish(&tp, &dfops, ip);
+		if (error)
+			fail(_("Error encountered creating file from prototype file"),
+				error);
+		libxfs_trans_commit(tp);
+
+		/*
+		 * Allocate and write the data separately, in bounded chunks,
+		 * so that the file size doesn't matter.
+		 */
+		writefile(mp, ip, fd, llen);
+		IRELE(ip);
+		return;
 
 	case IF_RESERVED:			/* pre-allocated space only */
 		value = getstr(pp);
@@ -545,7 +798,7 @@ parseproto(
 	case IF_SYMLINK:
 		buf = getstr(pp);
 		len = (int)strlen(buf);
-		tp = getres(mp, XFS_B_TO_FSB(mp, len));
+		tp = getres(mp, libxfs_symlink_blocks(mp, len));
 		error = -libxfs_inode_alloc(&tp, pip, mode|S_IFLNK, 1, 0,
 				&creds, fsxp, &ip);
 		if (error)
@@ -618,7 +871,578 @@ parse_proto(
 	struct fsxattr	*fsx,
 	char		**pp)
 {
-	parseproto(mp, NULL, fsx, pp, NULL);
+	if (protodir)
+		populate_from_dir(mp, fsx, protodir);
+	else
+		parseproto(mp, NULL, fsx, pp, NULL);
+}
+
+/*
+ * Populate the filesystem from a directory tree.
+ *
+ * The tree is walked depth first, creating the entries of each directory in
+ * batches of up to DIR_BATCH per transaction.  The blocks for regular file
+ * data are allocated as each batch is committed, and the data is then copied
+ * by a pool of threads while the walk carries on.
+ */
+#define	DIR_BATCH		64	/* directory entries per transaction */
+#define	COPY_QUEUE_MAX		256	/* copy jobs waiting for a thread */
+#define	HLINK_HASH_SIZE		4096
+#define	MKFS_SYMLINK_MAXLEN	1024
+
+/*
+ * Blocks to reserve for creating a single directory entry, which may be a
+ * new directory or a remote symlink.
+ */
+#define	MKFS_ENTRY_BLOCKRES	\
+	((uint)(MKFS_BLOCKRES_INODE + XFS_DIRENTER_SPACE_RES(mp, MAXNAMELEN) + \
+	libxfs_symlink_blocks(mp, MKFS_SYMLINK_MAXLEN)))
+
+struct copy_queue {
+	pthread_mutex_t	lock;
+	pthread_cond_t	wait;		/* a job was queued, or we're done */
+	pthread_cond_t	space;		/* a job was taken off the queue */
+	struct copy_job	*head;
+	struct copy_job	**tail;
+	int		count;
+	int		done;
+	int		nthreads;
+	pthread_t	*threads;
+};
+
+/* source files with more than one link, to find their inode again */
+struct hlink {
+	struct hlink	*next;
+	dev_t		dev;
+	ino_t		ino;
+	xfs_ino_t	xino;
+};
+
+struct dir_ent {
+	xfs_inode_t	*ip;		/* NULL if the entry was skipped */
+	xfs_ino_t	ino;
+	char		*path;
+	struct stat	st;
+	int		fd;		/* source for file data, or -1 */
+	int		link;		/* new name for an existing inode */
+};
+
+static struct copy_queue	copyq;
+static struct hlink		*hlinks[HLINK_HASH_SIZE];
+
+static void *
+copy_worker(
+	void		*arg)
+{
+	struct copy_queue *q = arg;
+	struct copy_job	*job;
+	char		*buf;
+
+	buf = copybuf_alloc();
+	pthread_mutex_lock(&q->lock);
+	for (;;) {
+		while (!q->head && !q->done)
+			pthread_cond_wait(&q->wait, &q->lock);
+		job = q->head;
+		if (!job)
+			break;
+		q->head = job->next;
+		if (!q->head)
+			q->tail = &q->head;
+		q->count--;
+		pthread_cond_signal(&q->space);
+		pthread_mutex_unlock(&q->lock);
+		runjob(job, buf);
+		pthread_mutex_lock(&q->lock);
+	}
+	pthread_mutex_unlock(&q->lock);
+	free(buf);
+	return NULL;
+}
+
+static void
+copyq_start(
+	struct copy_queue *q)
+{
+	long		nr;
+	int		error;
+	int		i;
+
+	nr = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr < 1)
+		nr = 1;
+	memset(q, 0, sizeof(*q));
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->wait, NULL);
+	pthread_cond_init(&q->space, NULL);
+	q->tail = &q->head;
+	q->threads = calloc(nr, sizeof(pthread_t));
+	if (!q->threads)
+		fail(_("cannot allocate copy threads"), ENOMEM);
+	for (i = 0; i < nr; i++) {
+		error = pthread_create(&q->threads[i], NULL, copy_worker, q);
+		if (error)
+			fail(_("cannot create copy thread"), error);
+		q->nthreads++;
+	}
+}
+
+static void
+copyq_add(
+	struct copy_queue *q,
+	struct copy_job	*job)
+{
+	job->next = NULL;
+	pthread_mutex_lock(&q->lock);
+	while (q->count >= COPY_QUEUE_MAX)
+		pthread_cond_wait(&q->space, &q->lock);
+	*q->tail = job;
+	q->tail = &job->next;
+	q->count++;
+	pthread_cond_signal(&q->wait);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * Wait for all the queued data to be copied.
+ */
+static void
+copyq_finish(
+	struct copy_queue *q)
+{
+	int		i;
+
+	pthread_mutex_lock(&q->lock);
+	q->done = 1;
+	pthread_cond_broadcast(&q->wait);
+	pthread_mutex_unlock(&q->lock);
+	for (i = 0; i < q->nthreads; i++)
+		pthread_join(q->threads[i], NULL);
+	free(q->threads);
+	pthread_cond_destroy(&q->space);
+	pthread_cond_destroy(&q->wait);
+	pthread_mutex_destroy(&q->lock);
+}
+
+static struct hlink **
+hlink_bucket(
+	struct stat	*st)
+{
+	return &hlinks[(st->st_ino ^ st->st_dev) % HLINK_HASH_SIZE];
+}
+
+static xfs_ino_t
+hlink_find(
+	struct stat	*st)
+{
+	struct hlink	*hl;
+
+	for (hl = *hlink_bucket(st); hl; hl = hl->next)
+		if (hl->ino == st->st_ino && hl->dev == st->st_dev)
+			return hl->xino;
+	return NULLFSINO;
+}
+
+static void
+hlink_add(
+	struct stat	*st,
+	xfs_ino_t	xino)
+{
+	struct hlink	**bucket = hlink_bucket(st);
+	struct hlink	*hl;
+
+	hl = malloc(sizeof(*hl));
+	if (!hl)
+		fail(_("cannot allocate hard link table"), ENOMEM);
+	hl->dev = st->st_dev;
+	hl->ino = st->st_ino;
+	hl->xino = xino;
+	hl->next = *bucket;
+	*bucket = hl;
+}
+
+static void
+hlink_free(void)
+{
+	struct hlink	*hl;
+	int		i;
+
+	for (i = 0; i < HLINK_HASH_SIZE; i++) {
+		while ((hl = hlinks[i]) != NULL) {
+			hlinks[i] = hl->next;
+			free(hl);
+		}
+	}
+}
+
+/*
+ * Copy the extended attributes in the user, trusted and security namespaces.
+ * Anything else, like POSIX ACLs, has no direct equivalent and is skipped.
+ */
+static void
+copy_xattrs(
+	xfs_inode_t	*ip,
+	const char	*path)
+{
+	char		*names;
+	char		*name;
+	char		*attrname;
+	unsigned char	*value;
+	ssize_t		size;
+	ssize_t		len;
+	int		flags;
+	int		error;
+
+	size = llistxattr(path, NULL, 0);
+	if (size <= 0)
+		return;
+	names = malloc(size);
+	value = malloc(XATTR_SIZE_MAX);
+	if (!names || !value)
+		fail(_("cannot allocate extended attribute buffer"), ENOMEM);
+	size = llistxattr(path, names, size);
+	for (name = names; size > 0 && name < names + size;
+	     name += strlen(name) + 1) {
+		if (strncmp(name, "user.", 5) == 0) {
+			flags = 0;
+			attrname = name + 5;
+		} else if (strncmp(name, "trusted.", 8) == 0) {
+			flags = LIBXFS_ATTR_ROOT;
+			attrname = name + 8;
+		} else if (strncmp(name, "security.", 9) == 0) {
+			flags = LIBXFS_ATTR_SECURE;
+			attrname = name + 9;
+		} else
+			continue;
+		len = lgetxattr(path, name, value, XATTR_SIZE_MAX);
+		if (len < 0) {
+			fprintf(stderr, _("%s: cannot read attribute %s of %s: %s\n"),
+				progname, name, path, strerror(errno));
+			exit(1);
+		}
+		error = -libxfs_attr_set(ip, (unsigned char *)attrname,
+				value, len, flags);
+		if (error)
+			fail(_("error setting extended attribute"), error);
+	}
+	free(value);
+	free(names);
+}
+
+static void
+settimes(
+	xfs_inode_t	*ip,
+	struct stat	*st)
+{
+	VFS_I(ip)->i_atime = st->st_atim;
+	VFS_I(ip)->i_mtime = st->st_mtim;
+}
+
+/*
+ * Create the inode and directory entry for one source file in the current
+ * batch transaction, which creating the inode may roll.
+ */
+static void
+newentry(
+	xfs_mount_t	*mp,
+	xfs_trans_t	**tpp,
+	xfs_inode_t	*dp,
+	struct fsxattr	*fsxp,
+	char		*name,
+	struct dir_ent	*ent,
+	struct xfs_defer_ops *dfops,
+	xfs_fsblock_t	*first)
+{
+	struct stat	*st = &ent->st;
+	char		target[MKFS_SYMLINK_MAXLEN + 1];
+	xfs_inode_t	*ip;
+	xfs_dev_t	rdev = 0;
+	struct xfs_name	xname;
+	cred_t		creds;
+	xfs_ino_t	xino;
+	int		flags = XFS_ILOG_CORE;
+	int		len = 0;
+	int		error;
+
+	ent->ip = NULL;
+	ent->fd = -1;
+	ent->link = 0;
+	xname.name = (unsigned char *)name;
+	xname.len = strlen(name);
+
+	switch (st->st_mode & S_IFMT) {
+	case S_IFREG:
+		xname.type = XFS_DIR3_FT_REG_FILE;
+		break;
+	case S_IFDIR:
+		xname.type = XFS_DIR3_FT_DIR;
+		break;
+	case S_IFLNK:
+		xname.type = XFS_DIR3_FT_SYMLINK;
+		len = readlink(ent->path, target, sizeof(target));
+		if (len < 0 || len > MKFS_SYMLINK_MAXLEN) {
+			fprintf(stderr, _("%s: cannot read symlink %s: %s\n"),
+				progname, ent->path,
+				strerror(len < 0 ? errno : ENAMETOOLONG));
+			exit(1);
+		}
+		break;
+	case S_IFCHR:
+		xname.type = XFS_DIR3_FT_CHRDEV;
+		rdev = IRIX_MKDEV(major(st->st_rdev), minor(st->st_rdev));
+		break;
+	case S_IFBLK:
+		xname.type = XFS_DIR3_FT_BLKDEV;
+		rdev = IRIX_MKDEV(major(st->st_rdev), minor(st->st_rdev));
+		break;
+	case S_IFIFO:
+		xname.type = XFS_DIR3_FT_FIFO;
+		break;
+	case S_IFSOCK:
+		xname.type = XFS_DIR3_FT_SOCK;
+		break;
+	default:
+		fprintf(stderr, _("%s: skipping %s, unknown file type 0%o\n"),
+			progname, ent->path, st->st_mode & S_IFMT);
+		return;
+	}
+
+	/* another name for a file we've already created */
+	if (!S_ISDIR(st->st_mode) && st->st_nlink > 1 &&
+	    (xino = hlink_find(st)) != NULLFSINO) {
+		error = -libxfs_trans_iget(mp, *tpp, xino, 0, 0, &ip);
+		if (error)
+			fail(_("cannot find hard linked inode"), error);
+		inc_nlink(VFS_I(ip));
+		libxfs_trans_log_inode(*tpp, ip, XFS_ILOG_CORE);
+		ent->link = 1;
+		goto out_dirent;
+	}
+
+	if (S_ISREG(st->st_mode) && st->st_size > 0) {
+		ent->fd = open(ent->path, O_RDONLY);
+		if (ent->fd < 0) {
+			fprintf(stderr, _("%s: cannot open %s: %s\n"),
+				progname, ent->path, strerror(errno));
+			exit(1);
+		}
+	}
+
+	memset(&creds, 0, sizeof(creds));
+	creds.cr_uid = st->st_uid;
+	creds.cr_gid = st->st_gid;
+	error = -libxfs_inode_alloc(tpp, dp, st->st_mode, 1, rdev, &creds,
+			fsxp, &ip);
+	if (error)
+		fail(_("Inode allocation failed"), error);
+	/* a rolled transaction no longer holds the parent */
+	if (dp->i_transp != *tpp)
+		libxfs_trans_ijoin(*tpp, dp, 0);
+
+	/* don't let setgid parents change the ownership or mode */
+	ip->i_d.di_gid = st->st_gid;
+	VFS_I(ip)->i_mode = st->st_mode;
+	settimes(ip, st);
+
+	switch (st->st_mode & S_IFMT) {
+	case S_IFREG:
+		ip->i_d.di_size = st->st_size;
+		break;
+	case S_IFDIR:
+		inc_nlink(VFS_I(ip));		/* account for . */
+		newdirectory(mp, *tpp, ip, dp);
+		inc_nlink(VFS_I(dp));
+		libxfs_trans_log_inode(*tpp, dp, XFS_ILOG_CORE);
+		break;
+	case S_IFLNK:
+		flags |= newfile(*tpp, ip, dfops, first, 1, 1, target, len);
+		break;
+	}
+	libxfs_trans_log_inode(*tpp, ip, flags);
+	if (!S_ISDIR(st->st_mode) && st->st_nlink > 1)
+		hlink_add(st, ip->i_ino);
+
+out_dirent:
+	newdirent(mp, *tpp, dp, &xname, ip->i_ino, first, dfops);
+	ent->ip = ip;
+	ent->ino = ip->i_ino;
+}
+
+static int
+populate_filter(
+	const struct dirent *d)
+{
+	return strcmp(d->d_name, ".") && strcmp(d->d_name, "..");
+}
+
+/*
+ * Reserve space for creating up to *nr directory entries, reducing the
+ * batch size if the filesystem is too full to reserve for all of them.
+ */
+static struct xfs_trans *
+getbatch(
+	struct xfs_mount *mp,
+	int		*nr)
+{
+	struct xfs_trans_res tres = {0};
+	struct xfs_trans *tp;
+	int		error;
+
+	for (;;) {
+		error = -libxfs_trans_alloc(mp, &tres,
+				MKFS_BLOCKRES(*nr * MKFS_ENTRY_BLOCKRES),
+				0, 0, &tp);
+		if (!error)
+			return tp;
+		if (*nr == 1)
+			res_failed(error);
+		*nr = (*nr + 1) / 2;
+	}
+}
+
+/*
+ * Create everything in the source directory @path under the directory @dp,
+ * then recurse into the subdirectories.
+ */
+static void
+populate_dir(
+	xfs_mount_t	*mp,
+	struct fsxattr	*fsxp,
+	xfs_inode_t	*dp,
+	char		*path,
+	struct stat	*dst)
+{
+	struct dir_ent	ents[DIR_BATCH];
+	struct dir_ent	*ent;
+	struct dirent	**names;
+	struct dir_ent	*subdirs;
+	xfs_inode_t	*ip;
+	xfs_trans_t	*tp;
+	struct xfs_defer_ops dfops;
+	xfs_fsblock_t	first;
+	int		nsubdirs = 0;
+	int		error;
+	int		n, nr;
+	int		i, j;
+
+	n = scandir(path, &names, populate_filter, alphasort);
+	if (n < 0) {
+		fprintf(stderr, _("%s: cannot read directory %s: %s\n"),
+			progname, path, strerror(errno));
+		exit(1);
+	}
+	subdirs = calloc(n + 1, sizeof(*subdirs));
+	if (!subdirs)
+		fail(_("cannot allocate directory entries"), ENOMEM);
+
+	for (i = 0; i < n; ) {
+		nr = n - i < DIR_BATCH ? n - i : DIR_BATCH;
+		tp = getbatch(mp, &nr);
+		libxfs_defer_init(&dfops, &first);
+		libxfs_trans_ijoin(tp, dp, 0);
+		for (j = 0; j < nr; j++, i++) {
+			ent = &ents[j];
+			if (asprintf(&ent->path, "%s/%s", path,
+					names[i]->d_name) < 0)
+				fail(_("cannot allocate path name"), ENOMEM);
+			if (lstat(ent->path, &ent->st) < 0) {
+				fprintf(stderr, _("%s: cannot stat %s: %s\n"),
+					progname, ent->path, strerror(errno));
+				exit(1);
+			}
+			newentry(mp, &tp, dp, fsxp, names[i]->d_name, ent,
+					&dfops, &first);
+			free(names[i]);
+		}
+		error = -libxfs_defer_finish(&tp, &dfops, dp);
+		if (error)
+			fail(_("Error encountered populating directory"), error);
+		libxfs_trans_commit(tp);
+
+		/* attributes and file data need transactions of their own */
+		for (ent = ents; ent < &ents[nr]; ent++) {
+			ip = ent->ip;
+			if (ip && !ent->link) {
+				copy_xattrs(ip, ent->path);
+				if (ent->fd >= 0)
+					copyq_add(&copyq, allocfile(mp, ip,
+						ent->fd, ent->st.st_size));
+			}
+			if (ip && S_ISDIR(ent->st.st_mode))
+				subdirs[nsubdirs++] = *ent;
+			else
+				free(ent->path);
+			if (ip)
+				IRELE(ip);
+		}
+	}
+	free(names);
+
+	for (ent = subdirs; ent < &subdirs[nsubdirs]; ent++) {
+		error = -libxfs_iget(mp, NULL, ent->ino, 0, &ip);
+		if (error)
+			fail(_("cannot read directory inode"), error);
+		populate_dir(mp, fsxp, ip, ent->path, &ent->st);
+		IRELE(ip);
+		free(ent->path);
+	}
+	free(subdirs);
+
+	/* adding the entries changed the timestamps */
+	tp = getres(mp, 0);
+	libxfs_trans_ijoin(tp, dp, 0);
+	settimes(dp, dst);
+	libxfs_trans_log_inode(tp, dp, XFS_ILOG_CORE);
+	libxfs_trans_commit(tp);
+}
+
+static void
+populate_from_dir(
+	xfs_mount_t	*mp,
+	struct fsxattr	*fsxp,
+	char		*path)
+{
+	struct xfs_defer_ops dfops;
+	xfs_fsblock_t	first;
+	xfs_inode_t	*ip;
+	xfs_trans_t	*tp;
+	struct stat	st;
+	cred_t		creds;
+	int		error;
+
+	if (stat(path, &st) < 0) {
+		fprintf(stderr, _("%s: cannot stat %s: %s\n"),
+			progname, path, strerror(errno));
+		exit(1);
+	}
+
+	tp = getres(mp, 0);
+	libxfs_defer_init(&dfops, &first);
+	memset(&creds, 0, sizeof(creds));
+	creds.cr_uid = st.st_uid;
+	creds.cr_gid = st.st_gid;
+	error = -libxfs_inode_alloc(&tp, NULL, st.st_mode, 1, 0, &creds,
+			fsxp, &ip);
+	if (error)
+		fail(_("Inode allocation failed"), error);
+	inc_nlink(VFS_I(ip));		/* account for . */
+	mp->m_sb.sb_rootino = ip->i_ino;
+	libxfs_log_sb(tp);
+	newdirectory(mp, tp, ip, ip);
+	libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	error = -libxfs_defer_finish(&tp, &dfops, ip);
+	if (error)
+		fail(_("Directory creation failed"), error);
+	libxfs_trans_commit(tp);
+	/* the RT inodes go right after the root inode, as for protofiles */
+	rtinit(mp);
+	copy_xattrs(ip, path);
+
+	copyq_start(&copyq);
+	populate_dir(mp, fsxp, ip, path, &st);
+	copyq_finish(&copyq);
+	hlink_free();
+	IRELE(ip);
 }
 
 /*
@@ -778,7 +1602,7 @@ rtinit(
 	}
 }
 
-static long
+static long long
 filesize(
 	int		fd)
 {
@@ -786,5 +1610,5 @@ filesize(
 
 	if (fstat(fd, &stb) < 0)
 		return -1;
-	return (long)stb.st_size;
+	return (long long)stb.st_size;
 }
@@ -23,26 +23,41 @@
 #include <grp.h>
 #include "init.h"
 #include "quota.h"
+#include "workqueue.h"
 
 typedef struct du {
-	struct du	*next;
 	__uint64_t	blocks;
 	__uint64_t	blocks30;
 	__uint64_t	blocks60;
 	__uint64_t	blocks90;
-	__uint64_t	nfiles;
+	__uint64_t	nfiles;		/* zero if the slot is unused */
 	__uint32_t	id;
 } du_t;
 
+/*
+ * Open addressing hash table of per-ID usage.  It grows as needed, so
+ * there is no limit on the number of IDs.
+ */
+struct du_table {
+	du_t		*slots;
+	__uint32_t	mask;		/* number of slots - 1 */
+	__uint32_t	count;		/* slots in use */
+};
+
 #define	TSIZE		500
-static __uint64_t	sizes[TSIZE];
-static __uint64_t	overflow;
+#define	DU_MINSLOTS	1024
 
-#define	NDU		60000
-#define	DUHASH		8209
-static du_t		du[3][NDU];
-static du_t		*duhash[3][DUHASH];
-static int		ndu[3];	/* #usr/grp/prj */
+/*
+ * Usage gathered by one walker thread, or the totals for a filesystem
+ * once the walkers are done.
+ */
+struct quot_acc {
+	struct du_table	du[3];		/* usr/grp/prj */
+	__uint64_t	sizes[TSIZE];
+	__uint64_t	overflow;
+};
+
+static struct quot_acc	totals;
 
 #define NBSTAT 		4069
 
@@ -77,13 +92,79 @@ quot_help(void)
 "\n"));
 }
 
+static inline __uint32_t
+du_hash(
+	__uint32_t	id,
+	__uint32_t	mask)
+{
+	return (id * 2654435761U) & mask;
+}
+
+static void
+du_table_free(
+	struct du_table	*t)
+{
+	free(t->slots);
+	memset(t, 0, sizeof(*t));
+}
+
+static void
+du_table_grow(
+	struct du_table	*t)
+{
+	du_t		*old = t->slots;
+	__uint32_t	oldslots = old ? t->mask + 1 : 0;
+	__uint32_t	nslots = old ? oldslots * 2 : DU_MINSLOTS;
+	__uint32_t	i, j;
+
+	t->slots = calloc(nslots, sizeof(du_t));
+	if (!t->slots) {
+		perror("calloc");
+		exit(1);
+	}
+	t->mask = nslots - 1;
+	for (i = 0; i < oldslots; i++) {
+		if (!old[i].nfiles)
+			continue;
+		for (j = du_hash(old[i].id, t->mask); t->slots[j].nfiles;
+		     j = (j + 1) & t->mask)
+			;
+		t->slots[j] = old[i];
+	}
+	free(old);
+}
+
+/* Find the entry for @id, adding an empty one if there is none. */
+static du_t *
+du_lookup(
+	struct du_table	*t,
+	__uint32_t	id)
+{
+	du_t		*dp;
+	__uint32_t	i;
+
+	if (!t->slots || t->count >= (t->mask + 1) / 4 * 3)
+		du_table_grow(t);
+
+	for (i = du_hash(id, t->mask); ; i = (i + 1) & t->mask) {
+		dp = &t->slots[i];
+		if (!dp->nfiles) {
+			dp->id = id;
+			t->count++;
+			return dp;
+		}
+		if (dp->id == id)
+			return dp;
+	}
+}
+
 static void
 quot_bulkstat_add(
+	struct quot_acc	*acc,
 	xfs_bstat_t	*p,
 	uint		flags)
 {
 	du_t		*dp;
-	du_t		**hp;
 	__uint64_t	size;
 	__uint32_t	i, id;
 
@@ -95,32 +176,16 @@ quot_bulkstat_add(
 		if (!(S_ISDIR(p->bs_mode) || S_ISREG(p->bs_mode)))
 			return;
 		if (size >= TSIZE) {
-			overflow += size;
+			acc->overflow += size;
 			size = TSIZE - 1;
 		}
-		sizes[(int)size]++;
+		acc->sizes[(int)size]++;
 		return;
 	}
 	for (i = 0; i < 3; i++) {
 		id = (i == 0) ? p->bs_uid : ((i == 1) ?
 			p->bs_gid : bstat_get_projid(p));
-		hp = &duhash[i][id % DUHASH];
-		for (dp = *hp; dp; dp = dp->next)
-			if (dp->id == id)
-				break;
-		if (dp == NULL) {
-			if (ndu[i] >= NDU)
-				return;
-			dp = &du[i][(ndu[i]++)];
-			dp->next = *hp;
-			*hp = dp;
-			dp->id = id;
-			dp->nfiles = 0;
-			dp->blocks = 0;
-			dp->blocks30 = 0;
-			dp->blocks60 = 0;
-			dp->blocks90 = 0;
-		}
+		dp = du_lookup(&acc->du[i], id);
 		dp->blocks += size;
 
 		if (now - p->bs_atime.tv_sec > 30 * (60*60*24))
@@ -133,58 +198,193 @@ quot_bulkstat_add(
 	}
 }
 
+/* Fold one walker's usage into the totals and free it. */
+static void
+quot_acc_merge(
+	struct quot_acc	*acc)
+{
+	du_t		*sp, *dp;
+	int		i;
+	__uint32_t	j;
+
+	for (i = 0; i < TSIZE; i++)
+		totals.sizes[i] += acc->sizes[i];
+	totals.overflow += acc->overflow;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; acc->du[i].slots && j <= acc->du[i].mask; j++) {
+			sp = &acc->du[i].slots[j];
+			if (!sp->nfiles)
+				continue;
+			dp = du_lookup(&totals.du[i], sp->id);
+			dp->blocks += sp->blocks;
+			dp->blocks30 += sp->blocks30;
+			dp->blocks60 += sp->blocks60;
+			dp->blocks90 += sp->blocks90;
+			dp->nfiles += sp->nfiles;
+		}
+		du_table_free(&acc->du[i]);
+	}
+}
+
+/*
+ * The filesystem is walked by a thread per CPU.  Each takes the next AG
+ * in turn and bulkstats the inode numbers belonging to it, adding up the
+ * usage in its own tables, which are merged when all threads are done.
+ */
+struct quot_walk {
+	char		*fsdir;
+	int		fsfd;
+	uint		flags;
+	int		agino_log;	/* bits of inode number within an AG */
+	__uint32_t	agcount;
+	__uint32_t	next_ag;
+	pthread_mutex_t	lock;
+};
+
+static void
+quot_bulkstat_ag(
+	struct quot_walk	*walk,
+	struct quot_acc		*acc,
+	xfs_bstat_t		*buf,
+	__uint32_t		agno)
+{
+	xfs_fsop_bulkreq_t	bulkreq;
+	__u64			start, end;
+	__u64			last;
+	__s32			count;
+	int			i, sts;
+
+	start = (__u64)agno << walk->agino_log;
+	if (agno + 1 < walk->agcount)
+		end = (__u64)(agno + 1) << walk->agino_log;
+	else
+		end = ~0ULL;
+
+	/* bulkstat returns the inodes after lastip */
+	last = start ? start - 1 : 0;
+	bulkreq.lastip = &last;
+	bulkreq.icount = NBSTAT;
+	bulkreq.ubuffer = buf;
+	bulkreq.ocount = &count;
+
+	while ((sts = xfsctl(walk->fsdir, walk->fsfd, XFS_IOC_FSBULKSTAT,
+			     &bulkreq)) == 0) {
+		if (count == 0)
+			return;
+		for (i = 0; i < count; i++) {
+			if (buf[i].bs_ino >= end)
+				return;
+			quot_bulkstat_add(acc, &buf[i], walk->flags);
+		}
+	}
+	if (sts < 0)
+		perror("XFS_IOC_FSBULKSTAT");
+}
+
+static void
+quot_bulkstat_worker(
+	struct workqueue	*wq,
+	__uint32_t		index,
+	void			*arg)
+{
+	struct quot_walk	*walk = wq->wq_ctx;
+	struct quot_acc		*acc = arg;
+	xfs_bstat_t		*buf;
+	__uint32_t		agno;
+
+	buf = calloc(NBSTAT, sizeof(xfs_bstat_t));
+	if (!buf) {
+		perror("calloc");
+		return;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&walk->lock);
+		agno = walk->next_ag++;
+		pthread_mutex_unlock(&walk->lock);
+		if (agno >= walk->agcount)
+			break;
+		quot_bulkstat_ag(walk, acc, buf, agno);
+	}
+	free(buf);
+}
+
 static void
 quot_bulkstat_mount(
 	char			*fsdir,
 	uint			flags)
 {
-	xfs_fsop_bulkreq_t	bulkreq;
-	xfs_bstat_t		*buf;
-	__u64			last = 0;
-	__s32			count;
-	int			i, sts, fsfd;
-	du_t			**dp;
+	struct quot_walk	walk = { 0 };
+	struct quot_acc		*accs;
+	struct workqueue	wq;
+	xfs_fsop_geom_t		geo;
+	unsigned int		nthreads;
+	unsigned int		i;
+	int			bits;
 
 	/*
 	 * Initialize tables between checks; because of the qsort
 	 * in report() the hash tables must be rebuilt each time.
 	 */
-	for (sts = 0; sts < TSIZE; sts++)
-		sizes[sts] = 0;
-	overflow = 0;
 	for (i = 0; i < 3; i++)
-		for (dp = duhash[i]; dp < &duhash[i][DUHASH]; dp++)
-			*dp = NULL;
-	ndu[0] = ndu[1] = ndu[2] = 0;
+		du_table_free(&totals.du[i]);
+	memset(&totals, 0, sizeof(totals));
 
-	fsfd = open(fsdir, O_RDONLY);
-	if (fsfd < 0) {
+	walk.fsdir = fsdir;
+	walk.flags = flags;
+	walk.fsfd = open(fsdir, O_RDONLY);
+	if (walk.fsfd < 0) {
 		perror(fsdir);
 		return;
 	}
 
-	buf = (xfs_bstat_t *)calloc(NBSTAT, sizeof(xfs_bstat_t));
-	if (!buf) {
-		perror("calloc");
-		close(fsfd);
-		return;
+	/*
+	 * Inode numbers are the AG number above the AG block number and the
+	 * inode's index in its block.  Without the geometry, walk the whole
+	 * filesystem as one range.
+	 */
+	if (xfsctl(fsdir, walk.fsfd, XFS_IOC_FSGEOMETRY, &geo) == 0 &&
+	    geo.agcount && geo.agblocks && geo.inodesize) {
+		walk.agcount = geo.agcount;
+		for (bits = 0; (1ULL << bits) < geo.agblocks; bits++)
+			;
+		walk.agino_log = bits;
+		for (bits = 0; (geo.inodesize << bits) < geo.blocksize; bits++)
+			;
+		walk.agino_log += bits;
+	} else {
+		walk.agcount = 1;
 	}
+	pthread_mutex_init(&walk.lock, NULL);
 
-	bulkreq.lastip = &last;
-	bulkreq.icount = NBSTAT;
-	bulkreq.ubuffer = buf;
-	bulkreq.ocount = &count;
+	nthreads = min(workqueue_nr_cpus(), walk.agcount);
+	accs = calloc(nthreads, sizeof(struct quot_acc));
+	if (!accs) {
+		perror("calloc");
+		goto out;
+	}
 
-	while ((sts = xfsctl(fsdir, fsfd, XFS_IOC_FSBULKSTAT, &bulkreq)) == 0) {
-		if (count == 0)
-			break;
-		for (i = 0; i < count; i++)
-			quot_bulkstat_add(&buf[i], flags);
+	/* each worker walks AGs until there are none left */
+	i = 0;
+	if (workqueue_create(&wq, &walk, nthreads) == 0) {
+		for (; i < nthreads; i++)
+			if (workqueue_add(&wq, quot_bulkstat_worker, i,
+					  &accs[i]))
+				break;
+		workqueue_destroy(&wq);
 	}
-	if (sts < 0)
-		perror("XFS_IOC_FSBULKSTAT"),
-	free(buf);
-	close(fsfd);
+	if (i == 0) {
+		wq.wq_ctx = &walk;
+		quot_bulkstat_worker(&wq, 0, &accs[0]);
+	}
+
+	for (i = 0; i < nthreads; i++)
+		quot_acc_merge(&accs[i]);
+	free(accs);
+out:
+	pthread_mutex_destroy(&walk.lock);
+	close(walk.fsfd);
 }
 
 static int
@@ -208,23 +408,35 @@ typedef char *(*idtoname_t)(__uint32_t);
 static void
 quot_report_mount_any_type(
 	FILE		*fp,
-	du_t		*dp,
-	int		count,
+	struct du_table	*t,
 	idtoname_t	names,
 	uint		form,
 	uint		type,
 	fs_path_t	*mount,
 	uint		flags)
 {
+	du_t		*dus, *dp;
 	char		*cp;
+	__uint32_t	count = 0;
+	__uint32_t	i;
 
 	fprintf(fp, _("%s (%s) %s:\n"),
 		mount->fs_name, mount->fs_dir, type_to_string(type));
-	qsort(dp, count, sizeof(dp[0]),
+
+	dus = malloc(t->count * sizeof(du_t));
+	if (t->count && !dus) {
+		perror("malloc");
+		return;
+	}
+	for (i = 0; t->slots && i <= t->mask; i++)
+		if (t->slots[i].nfiles)
+			dus[count++] = t->slots[i];
+	qsort(dus, count, sizeof(dus[0]),
 		(int (*)(const void *, const void *))qcompare);
-	for (; dp < &dp[count]; dp++) {
+
+	for (dp = dus; dp < &dus[count]; dp++) {
 		if (dp->blocks == 0)
-			return;
+			break;
 		fprintf(fp, "%8llu    ", (unsigned long long) dp->blocks);
 		if (form & XFS_INODE_QUOTA)
 			fprintf(fp, "%8llu    ",
@@ -241,6 +453,7 @@ quot_report_mount_any_type(
 			       (unsigned long long) dp->blocks90);
 		fputc('\n', fp);
 	}
+	free(dus);
 }
 
 static void
@@ -253,15 +466,15 @@ quot_report_mount(
 {
 	switch (type) {
 	case XFS_GROUP_QUOTA:
-		quot_report_mount_any_type(fp, du[1], ndu[1], gid_to_name,
+		quot_report_mount_any_type(fp, &totals.du[1], gid_to_name,
 						form, type, mount, flags);
 		break;
 	case XFS_PROJ_QUOTA:
-		quot_report_mount_any_type(fp, du[2], ndu[2], prid_to_name,
+		quot_report_mount_any_type(fp, &totals.du[2], prid_to_name,
 						form, type, mount, flags);
 		break;
 	case XFS_USER_QUOTA:
-		quot_report_mount_any_type(fp, du[0], ndu[0], uid_to_name,
+		quot_report_mount_any_type(fp, &totals.du[0], uid_to_name,
 						form, type, mount, flags);
 	}
 }
@@ -297,15 +510,15 @@ quot_histogram_mount(
 	fprintf(fp, _("%s (%s):\n"), mount->fs_name, mount->fs_dir);
 
 	for (i = 0; i < TSIZE - 1; i++)
-		if (sizes[i] > 0) {
-			t += sizes[i] * i;
+		if (totals.sizes[i] > 0) {
+			t += totals.sizes[i] * i;
 			fprintf(fp, _("%d\t%llu\t%llu\n"), i,
-			       (unsigned long long) sizes[i],
+			       (unsigned long long) totals.sizes[i],
 			       (unsigned long long) t);
 		}
 	fprintf(fp, _("%d\t%llu\t%llu\n"), TSIZE - 1,
-		(unsigned long long) sizes[TSIZE - 1],
-		(unsigned long long) (overflow + t));
+		(unsigned long long) totals.sizes[TSIZE - 1],
+		(unsigned long long) (totals.overflow + t));
 }
 
 static void
@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "libxfs.h"
+#include "libxlog.h"
+#include <sys/mman.h>
+#include "avl.h"
+#include "globals.h"
+#include "incore.h"
+#include "protos.h"
+#include "err_protos.h"
+#include "rt.h"
+#include "checkpoint.h"
+
+/*
+ * Checkpoints.
+ *
+ * A checkpoint holds everything phases 6 and 7 need from the phases
+ * before them, so that a run which dies in phase 6 or 7 can be started
+ * again from there rather than from phase 1.  It is taken once phase 5
+ * is done and everything it wrote is on disk.  By then the block maps,
+ * reverse mappings and duplicate extent trees are finished with, and
+ * what's left is the incore inode tree, the realtime bitmap and summary
+ * computed for phase 6 and a handful of flags.
+ *
+ * What phase 6 changes on disk, e.g. a new lost+found or entries moved
+ * between directories, can't be fed back into that state, so in modify
+ * mode the first write to the filesystem after the checkpoint marks it
+ * stale and resuming from it is refused.  A run that dies before phase 6
+ * has anything to fix, or one in no modify mode, can still be resumed.
+ *
+ * The file is laid out the way it is used, so that it can be mapped and
+ * walked through: a header, then for each AG a count and that many inode
+ * records, each followed by its link counts, file types and parents.
+ * Everything is in host byte order and 8 byte aligned, as a checkpoint
+ * is only good for a restart on the same host anyway.
+ */
+
+#define XR_CKPT_MAGIC		"XFSRCKPT"
+#define XR_CKPT_VERSION		2
+#define XR_CKPT_NFLAGS		16
+
+/* flags set by phases 1-5 that the later phases and the summary look at */
+static int * const ckpt_flags[] = {
+	&need_root_inode, &need_root_dotdot, &need_rbmino, &need_rsumino,
+	&lost_quotas, &have_uquotino, &have_gquotino, &have_pquotino,
+	&lost_uquotino, &lost_gquotino, &lost_pquotino,
+	&bad_ino_btree, &copied_sunit, &fs_is_dirty,
+};
+
+struct ckpt_head {
+	char			magic[8];
+	__uint32_t		version;
+	__uint32_t		crc;		/* crc32c of the rest */
+	__uint64_t		len;		/* bytes after the header */
+	__uint32_t		no_modify;
+	__uint32_t		stale;		/* the fs has been written since */
+	__uint32_t		agcount;
+	__uint32_t		pad;
+	__int64_t		max_lsn;
+	__int32_t		log_cycle;	/* where the log head was */
+	__int32_t		log_block;
+	__uint64_t		rbmlen;		/* computed rt bitmap bytes */
+	__uint64_t		rsumlen;	/* computed rt summary bytes */
+	__int32_t		flags[XR_CKPT_NFLAGS];
+	struct xfs_sb		sb;		/* incore superblock */
+	struct xfs_sb		dsb;		/* primary superblock on disk */
+};
+
+struct ckpt_ag {
+	__uint32_t		agno;
+	__uint32_t		nrecs;
+};
+
+/*
+ * Followed by XFS_INODES_PER_CHUNK on-disk link counts of nlink_size
+ * bytes each, XFS_INODES_PER_CHUNK file types if the filesystem has
+ * them, and the parent of each inode in pmask.
+ */
+struct ckpt_irec {
+	__uint64_t		ir_free;
+	__uint64_t		ir_sparse;
+	__uint64_t		confirmed;
+	__uint64_t		isa_dir;
+	__uint64_t		was_rl;
+	__uint64_t		is_rl;
+	__uint64_t		pmask;
+	__uint32_t		startnum;
+	__uint8_t		nlink_size;
+	__uint8_t		pad[3];
+};
+
+static const char		*ckpt_path;
+static pthread_once_t		ckpt_stale_once = PTHREAD_ONCE_INIT;
+
+struct ckpt_file {
+	FILE			*fp;
+	__uint32_t		crc;
+	__uint64_t		len;
+};
+
+static void
+ckpt_write(
+	struct ckpt_file	*cf,
+	const void		*p,
+	size_t			len)
+{
+	fwrite(p, len, 1, cf->fp);
+	cf->crc = crc32c(cf->crc, p, len);
+	cf->len += len;
+}
+
+static void
+ckpt_write_irec(
+	struct ckpt_file	*cf,
+	ino_tree_node_t		*irec)
+{
+	struct ckpt_irec	rec = { 0 };
+	parent_list_t		*ptbl = irec->ino_un.plist;
+	xfs_ino_t		parent;
+	int			i;
+
+	rec.ir_free = irec->ir_free;
+	rec.ir_sparse = irec->ir_sparse;
+	rec.confirmed = irec->ino_confirmed;
+	rec.isa_dir = irec->ino_isa_dir;
+	rec.was_rl = irec->ino_was_rl;
+	rec.is_rl = irec->ino_is_rl;
+	rec.pmask = ptbl ? ptbl->pmask : 0;
+	rec.startnum = irec->ino_startnum;
+	rec.nlink_size = irec->nlink_size;
+	ckpt_write(cf, &rec, sizeof(rec));
+
+	ckpt_write(cf, irec->disk_nlinks.un8,
+		   XFS_INODES_PER_CHUNK * irec->nlink_size);
+	if (irec->ftypes)
+		ckpt_write(cf, irec->ftypes, XFS_INODES_PER_CHUNK);
+	for (i = 0; i < XFS_INODES_PER_CHUNK; i++) {
+		if (!(rec.pmask & IREC_MASK(i)))
+			continue;
+		parent = get_inode_parent(irec, i);
+		ckpt_write(cf, &parent, sizeof(parent));
+	}
+}
+
+/*
+ * Read the primary superblock.  Returns 0 if it can't be read.
+ */
+static int
+ckpt_disk_sb(
+	struct xfs_mount	*mp,
+	struct xfs_sb		*sb)
+{
+	struct xfs_buf		*sbp;
+
+	sbp = libxfs_getsb(mp, 0);
+	if (!sbp)
+		return 0;
+	memset(sb, 0, sizeof(*sb));
+	libxfs_sb_from_disk(sb, XFS_BUF_TO_SBP(sbp));
+	libxfs_putbuf(sbp);
+	return 1;
+}
+
+/*
+ * Mark the checkpoint stale, or failing that get rid of it, before the
+ * first write to the filesystem after it was taken goes out.
+ */
+static void
+ckpt_mark_stale(void)
+{
+	__uint32_t		stale = 1;
+	int			fd;
+
+	fd = open(ckpt_path, O_WRONLY);
+	if (fd < 0 && errno == ENOENT)
+		return;
+	if (fd >= 0) {
+		if (pwrite(fd, &stale, sizeof(stale),
+			   offsetof(struct ckpt_head, stale)) == sizeof(stale) &&
+		    fsync(fd) == 0) {
+			close(fd);
+			return;
+		}
+		close(fd);
+	}
+	if (unlink(ckpt_path) < 0 && errno != ENOENT)
+		do_error(_("couldn't invalidate checkpoint %s: %s\n"),
+			ckpt_path, strerror(errno));
+}
+
+/* the buffer cache can write from any thread, so only the first one marks */
+static void
+ckpt_write_hook(void)
+{
+	pthread_once(&ckpt_stale_once, ckpt_mark_stale);
+}
+
+static void
+ckpt_watch_writes(
+	const char		*path)
+{
+	if (no_modify)
+		return;
+	ckpt_path = path;
+	libxfs_write_hook = ckpt_write_hook;
+}
+
+/*
+ * Write a checkpoint of the state at the end of phase 5 to @path.  Not
+ * being able to is no reason to stop the repair, so it just says so.
+ */
+void
+save_checkpoint(
+	struct xfs_mount	*mp,
+	const char		*path)
+{
+	struct ckpt_head	head = { { 0 } };
+	struct ckpt_file	cf = { NULL, ~0U, 0 };
+	struct ckpt_ag		ag;
+	ino_tree_node_t		*irec;
+	xfs_agnumber_t		agno;
+	char			*tmp;
+	int			i;
+
+	ASSERT(!full_ino_ex_data);
+	ASSERT(ARRAY_SIZE(ckpt_flags) <= XR_CKPT_NFLAGS);
+
+	do_log(_("        - writing checkpoint to %s...\n"), path);
+
+	/* the checkpoint is only any good if the disk matches it */
+	libxfs_bcache_flush();
+	ckpt_watch_writes(path);
+	if (fsync(libxfs_device_to_fd(mp->m_ddev_targp->dev)) < 0) {
+		do_log(_("couldn't flush %s, no checkpoint written: %s\n"),
+			fs_name, strerror(errno));
+		return;
+	}
+	if (!ckpt_disk_sb(mp, &head.dsb)) {
+		do_log(_("couldn't read superblock, no checkpoint written\n"));
+		return;
+	}
+
+	memcpy(head.magic, XR_CKPT_MAGIC, sizeof(head.magic));
+	head.version = XR_CKPT_VERSION;
+	head.no_modify = no_modify;
+	head.agcount = mp->m_sb.sb_agcount;
+	head.max_lsn = libxfs_max_lsn;
+	head.log_cycle = mp->m_log->l_curr_cycle;
+	head.log_block = mp->m_log->l_curr_block;
+	if (btmcompute) {
+		head.rbmlen = (__uint64_t)mp->m_sb.sb_rbmblocks *
+						mp->m_sb.sb_blocksize;
+		head.rsumlen = mp->m_rsumsize;
+	}
+	for (i = 0; i < ARRAY_SIZE(ckpt_flags); i++)
+		head.flags[i] = *ckpt_flags[i];
+	head.sb = mp->m_sb;
+
+	/* write it out of the way so an old checkpoint survives a crash */
+	tmp = malloc(strlen(path) + 5);
+	if (!tmp)
+		do_error(_("couldn't allocate checkpoint file name\n"));
+	sprintf(tmp, "%s.new", path);
+	cf.fp = fopen(tmp, "w");
+	if (!cf.fp) {
+		do_log(_("couldn't create checkpoint %s: %s\n"), tmp,
+			strerror(errno));
+		free(tmp);
+		return;
+	}
+	fwrite(&head, sizeof(head), 1, cf.fp);
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		ag.agno = agno;
+		ag.nrecs = 0;
+		for (irec = findfirst_inode_rec(agno); irec;
+		     irec = next_ino_rec(irec))
+			ag.nrecs++;
+		ckpt_write(&cf, &ag, sizeof(ag));
+
+		for (irec = findfirst_inode_rec(agno); irec;
+		     irec = next_ino_rec(irec))
+			ckpt_write_irec(&cf, irec);
+	}
+	if (btmcompute) {
+		ckpt_write(&cf, btmcompute, head.rbmlen);
+		ckpt_write(&cf, sumcompute, head.rsumlen);
+	}
+
+	head.crc = cf.crc;
+	head.len = cf.len;
+	rewind(cf.fp);
+	fwrite(&head, sizeof(head), 1, cf.fp);
+
+	if (fflush(cf.fp) || ferror(cf.fp) || fsync(fileno(cf.fp)) < 0) {
+		do_log(_("couldn't write checkpoint %s: %s\n"), tmp,
+			strerror(errno));
+		fclose(cf.fp);
+		unlink(tmp);
+	} else if (fclose(cf.fp) || rename(tmp, path) < 0) {
+		do_log(_("couldn't write checkpoint %s: %s\n"), path,
+			strerror(errno));
+		unlink(tmp);
+	}
+	free(tmp);
+}
+
+struct ckpt_map {
+	const char		*path;
+	const char		*base;
+	size_t			off;
+	size_t			len;
+};
+
+static const void *
+ckpt_pull(
+	struct ckpt_map		*cm,
+	size_t			len)
+{
+	const void		*p;
+
+	if (cm->len - cm->off < len)
+		do_error(_("checkpoint %s is truncated\n"), cm->path);
+	p = cm->base + cm->off;
+	cm->off += len;
+	return p;
+}
+
+static void
+ckpt_read_irec(
+	struct xfs_mount	*mp,
+	struct ckpt_map		*cm,
+	xfs_agnumber_t		agno)
+{
+	const struct ckpt_irec	*rec;
+	const void		*nlinks;
+	ino_tree_node_t		*irec;
+	__uint32_t		nlink = 0;
+	int			i;
+
+	rec = ckpt_pull(cm, sizeof(*rec));
+	if (rec->nlink_size != sizeof(__uint8_t) &&
+	    rec->nlink_size != sizeof(__uint16_t) &&
+	    rec->nlink_size != sizeof(__uint32_t))
+		do_error(_("checkpoint %s is corrupt\n"), cm->path);
+
+	irec = set_inode_free_alloc(mp, agno, rec->startnum);
+	irec->ir_free = rec->ir_free;
+	irec->ir_sparse = rec->ir_sparse;
+	irec->ino_confirmed = rec->confirmed;
+	irec->ino_isa_dir = rec->isa_dir;
+	irec->ino_was_rl = rec->was_rl;
+	irec->ino_is_rl = rec->is_rl;
+
+	nlinks = ckpt_pull(cm, XFS_INODES_PER_CHUNK * rec->nlink_size);
+	for (i = 0; i < XFS_INODES_PER_CHUNK; i++) {
+		switch (rec->nlink_size) {
+		case sizeof(__uint8_t):
+			nlink = ((const __uint8_t *)nlinks)[i];
+			break;
+		case sizeof(__uint16_t):
+			nlink = ((const __uint16_t *)nlinks)[i];
+			break;
+		case sizeof(__uint32_t):
+			nlink = ((const __uint32_t *)nlinks)[i];
+			break;
+		}
+		set_inode_disk_nlinks(irec, i, nlink);
+	}
+	if (irec->ftypes)
+		memcpy(irec->ftypes, ckpt_pull(cm, XFS_INODES_PER_CHUNK),
+		       XFS_INODES_PER_CHUNK);
+	for (i = 0; i < XFS_INODES_PER_CHUNK; i++) {
+		if (rec->pmask & IREC_MASK(i))
+			set_inode_parent(irec, i, *(const xfs_ino_t *)
+					ckpt_pull(cm, sizeof(xfs_ino_t)));
+	}
+}
+
+/*
+ * Load the checkpoint at @path in place of running phases 2 to 5.  The
+ * user asked for this, so if it can't be done there's nothing sensible
+ * to carry on with.
+ */
+void
+load_checkpoint(
+	struct xfs_mount	*mp,
+	const char		*path)
+{
+	const struct ckpt_head	*head;
+	const struct ckpt_ag	*ag;
+	struct ckpt_map		cm = { path };
+	struct xfs_sb		dsb;
+	struct stat		st;
+	xfs_agnumber_t		agno;
+	__uint32_t		i;
+	void			*base;
+	int			fd;
+	int			changed;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		do_error(_("couldn't open checkpoint %s: %s\n"), path,
+			strerror(errno));
+	if (st.st_size < sizeof(*head))
+		do_error(_("checkpoint %s is truncated\n"), path);
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+		do_error(_("couldn't map checkpoint %s: %s\n"), path,
+			strerror(errno));
+	cm.base = base;
+	cm.len = st.st_size;
+
+	head = ckpt_pull(&cm, sizeof(*head));
+	if (memcmp(head->magic, XR_CKPT_MAGIC, sizeof(head->magic)) ||
+	    head->version != XR_CKPT_VERSION)
+		do_error(_("%s is not an xfs_repair checkpoint\n"), path);
+	if (head->len != cm.len - cm.off ||
+	    head->crc != crc32c(~0U, cm.base + cm.off, head->len))
+		do_error(_("checkpoint %s is corrupt\n"), path);
+	if (head->no_modify != no_modify)
+		do_error(no_modify ?
+	_("checkpoint %s was not taken in no modify mode\n") :
+	_("checkpoint %s was taken in no modify mode\n"), path);
+	if (head->stale)
+		do_error(
+	_("%s was changed by phase 6 after checkpoint %s was taken, start "
+	  "again without resume\n"), fs_name, path);
+
+	/*
+	 * The interrupted repair marked the checkpoint stale before writing
+	 * anything after it, and xfs_repair doesn't write the log until it's
+	 * done, so if anything has moved, something other than an interrupted
+	 * repair has been at the filesystem.
+	 */
+	if (!ckpt_disk_sb(mp, &dsb))
+		do_error(_("couldn't read superblock\n"));
+	changed = head->agcount != mp->m_sb.sb_agcount ||
+		  memcmp(&head->dsb, &dsb, sizeof(dsb)) ||
+		  head->log_cycle != mp->m_log->l_curr_cycle ||
+		  head->log_block != mp->m_log->l_curr_block;
+	if (changed)
+		do_error(
+	_("%s has changed since checkpoint %s was taken, start again without "
+	  "resume\n"), fs_name, path);
+
+	do_log(_("        - resuming from checkpoint %s...\n"), path);
+
+	/* phases 3 and 4 may have fixed things in the incore superblock */
+	mp->m_sb = head->sb;
+	for (i = 0; i < ARRAY_SIZE(ckpt_flags); i++)
+		*ckpt_flags[i] = head->flags[i];
+	if (CYCLE_LSN(head->max_lsn) > CYCLE_LSN(libxfs_max_lsn) ||
+	    (CYCLE_LSN(head->max_lsn) == CYCLE_LSN(libxfs_max_lsn) &&
+	     BLOCK_LSN(head->max_lsn) > BLOCK_LSN(libxfs_max_lsn)))
+		libxfs_max_lsn = head->max_lsn;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		ag = ckpt_pull(&cm, sizeof(*ag));
+		if (ag->agno != agno)
+			do_error(_("checkpoint %s is corrupt\n"), path);
+		for (i = 0; i < ag->nrecs; i++)
+			ckpt_read_irec(mp, &cm, agno);
+	}
+
+	if (head->rbmlen) {
+		if (head->rbmlen != (__uint64_t)mp->m_sb.sb_rbmblocks *
+						mp->m_sb.sb_blocksize ||
+		    head->rsumlen != mp->m_rsumsize)
+			do_error(_("checkpoint %s is corrupt\n"), path);
+		rtinit(mp);
+		memcpy(btmcompute, ckpt_pull(&cm, head->rbmlen), head->rbmlen);
+		memcpy(sumcompute, ckpt_pull(&cm, head->rsumlen),
+		       head->rsumlen);
+	}
+	if (cm.off != cm.len)
+		do_error(_("checkpoint %s is corrupt\n"), path);
+
+	munmap(base, st.st_size);
+	close(fd);
+	ckpt_watch_writes(path);
+}
@@ -607,6 +607,7 @@ process_inode_chunk(
 	xfs_ino_t		parent;
 	ino_tree_node_t		*ino_rec;
 	xfs_buf_t		**bplist;
+	char			*hdr_ok;
 	xfs_dinode_t		*dino;
 	int			icnt;
 	int			status;
@@ -653,6 +654,10 @@ process_inode_chunk(
 	if (bplist == NULL)
 		do_error(_("failed to allocate %zd bytes of memory\n"),
 			cluster_count * sizeof(xfs_buf_t *));
+	hdr_ok = calloc(cluster_count, inodes_per_cluster);
+	if (hdr_ok == NULL)
+		do_error(_("failed to allocate %zd bytes of memory\n"),
+			(size_t)cluster_count * inodes_per_cluster);
 
 	for (bp_index = 0; bp_index < cluster_count; bp_index++) {
 		/*
@@ -684,6 +689,7 @@ process_inode_chunk(
 				libxfs_putbuf(bplist[bp_index]);
 			}
 			free(bplist);
+			free(hdr_ok);
 			return(1);
 		}
 
@@ -693,6 +699,23 @@ process_inode_chunk(
 
 		bplist[bp_index]->b_ops = &xfs_inode_buf_ops;
 
+		/*
+		 * Check the headers and CRCs of the whole cluster in one go
+		 * while it is hot in the cache.  Inodes that pass skip those
+		 * checks in verify_dinode() and process_dinode() below, so
+		 * the CRC of a clean inode is computed once, not once per
+		 * pass over the chunk.
+		 */
+		for (cluster_offset = 0; cluster_offset < inodes_per_cluster;
+		     cluster_offset++) {
+			icnt = bp_index * inodes_per_cluster + cluster_offset;
+			hdr_ok[icnt] = !verify_dinode_hdr(mp,
+					xfs_make_iptr(mp, bplist[bp_index],
+						      cluster_offset),
+					XFS_AGINO_TO_INO(mp, agno,
+						first_irec->ino_startnum + icnt));
+		}
+
 next_readbuf:
 		irec_offset += mp->m_sb.sb_inopblock * blks_per_cluster;
 		agbno += blks_per_cluster;
@@ -728,7 +751,8 @@ next_readbuf:
 				 * to reset them later to keep from losing the
 				 * chunk that they're in
 				 */
-				if (verify_dinode(mp, dino, agno, agino) == 0 ||
+				if (verify_dinode(mp, dino, agno, agino,
+						  hdr_ok[icnt]) == 0 ||
 						(agno == 0 &&
 						(mp->m_sb.sb_rootino == agino ||
 						 mp->m_sb.sb_rsumino == agino ||
@@ -771,6 +795,7 @@ next_readbuf:
 				if (bplist[bp_index])
 					libxfs_putbuf(bplist[bp_index]);
 			free(bplist);
+			free(hdr_ok);
 			return(0);
 		}
 
@@ -810,7 +835,8 @@ next_readbuf:
 		status = process_dinode(mp, dino, agno, agino,
 				is_inode_free(ino_rec, irec_offset),
 				&ino_dirty, &is_used,ino_discovery, check_dups,
-				extra_attr_check, &isa_dir, &parent);
+				extra_attr_check, &isa_dir, &parent,
+				hdr_ok[icnt]);
 
 		ASSERT(is_used != 3);
 		if (ino_dirty) {
@@ -955,6 +981,7 @@ process_next:
 					libxfs_putbuf(bplist[bp_index]);
 			}
 			free(bplist);
+			free(hdr_ok);
 			break;
 		} else if (ibuf_offset == mp->m_sb.sb_inopblock)  {
 			/*
@@ -982,6 +1009,71 @@ process_next:
 	return(0);
 }
 
+/*
+ * Inode chunks found to be bogus while their AG was being processed in
+ * slices, waiting to be removed from the inode tree.
+ */
+struct bogus_chunk {
+	xfs_agnumber_t		agno;
+	ino_tree_node_t		*irec;
+};
+
+static struct bogus_chunk	*bogus_chunks;
+static int			nbogus_chunks;
+static int			maxbogus_chunks;
+static pthread_mutex_t		bogus_chunks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+defer_bogus_inode_chunk(
+	xfs_agnumber_t		agno,
+	ino_tree_node_t		*first_irec)
+{
+	pthread_mutex_lock(&bogus_chunks_lock);
+	if (nbogus_chunks == maxbogus_chunks) {
+		maxbogus_chunks = maxbogus_chunks ? maxbogus_chunks * 2 : 16;
+		bogus_chunks = realloc(bogus_chunks,
+				maxbogus_chunks * sizeof(*bogus_chunks));
+		if (!bogus_chunks)
+			do_error(_("couldn't allocate bogus inode chunk list\n"));
+	}
+	bogus_chunks[nbogus_chunks].agno = agno;
+	bogus_chunks[nbogus_chunks].irec = first_irec;
+	nbogus_chunks++;
+	pthread_mutex_unlock(&bogus_chunks_lock);
+}
+
+/*
+ * Blow away the inode records of the chunks deferred above, just as
+ * process_aginodes() does straight away when it has the AG to itself.
+ * Called once all the slices have been processed.
+ */
+void
+free_bogus_inode_chunks(
+	xfs_mount_t		*mp)
+{
+	ino_tree_node_t		*ino_rec;
+	ino_tree_node_t		*prev_ino_rec;
+	int			num_inos;
+	int			i;
+
+	for (i = 0; i < nbogus_chunks; i++) {
+		num_inos = 0;
+		ino_rec = bogus_chunks[i].irec;
+		while (num_inos < mp->m_ialloc_inos && ino_rec != NULL)  {
+			prev_ino_rec = ino_rec;
+
+			if ((ino_rec = next_ino_rec(ino_rec)) != NULL)
+				num_inos += XFS_INODES_PER_CHUNK;
+
+			get_inode_rec(mp, bogus_chunks[i].agno, prev_ino_rec);
+			free_inode_rec(bogus_chunks[i].agno, prev_ino_rec);
+		}
+	}
+	free(bogus_chunks);
+	bogus_chunks = NULL;
+	nbogus_chunks = maxbogus_chunks = 0;
+}
+
 /*
  * check all inodes mentioned in the ag's incore inode maps.
  * the map may be incomplete.  If so, we'll catch the missing
@@ -1005,12 +1097,27 @@ process_aginodes(
 {
 	int 			num_inos, bogus;
 	ino_tree_node_t 	*ino_rec, *first_ino_rec, *prev_ino_rec;
+	xfs_agino_t		start = 0;
+	xfs_agino_t		end = NULLAGINO;
 #ifdef XR_PF_TRACE
 	int			count;
 #endif
-	first_ino_rec = ino_rec = findfirst_inode_rec(agno);
+	/*
+	 * The prefetch args say which part of the AG we're processing if
+	 * it has been split into slices.
+	 */
+	if (pf_args) {
+		start = pf_args->start_agino;
+		end = pf_args->end_agino;
+	}
+	if (!start)
+		first_ino_rec = findfirst_inode_rec(agno);
+	else
+		find_inode_rec_range(mp, agno, start, end, &first_ino_rec,
+				&prev_ino_rec);
+	ino_rec = first_ino_rec;
 
-	while (ino_rec != NULL)  {
+	while (ino_rec != NULL && ino_rec->ino_startnum < end)  {
 		/*
 		 * paranoia - step through inode records until we step
 		 * through a full allocation of inodes.  this could
@@ -1047,6 +1154,16 @@ process_aginodes(
 			abort();
 		}
 
+		if (bogus && (start || end != NULLAGINO)) {
+			/*
+			 * Other slices of this AG may be walking the inode
+			 * tree, leave the records for free_bogus_inode_chunks
+			 * to remove once they are all done.
+			 */
+			defer_bogus_inode_chunk(agno, first_ino_rec);
+			bogus = 0;
+		}
+
 		if (!bogus)
 			first_ino_rec = ino_rec = next_ino_rec(ino_rec);
 		else  {
@@ -32,6 +32,7 @@
 #include "threads.h"
 #include "slab.h"
 #include "rmap.h"
+#include "prefetch.h"
 
 /*
  * gettext lookups for translations of strings use mutexes internally to
@@ -2211,6 +2212,7 @@ process_dinode_int(xfs_mount_t *mp,
 		int *used,		/* out == 1 if inode is in use */
 		int verify_mode,	/* 1 == verify but don't modify inode */
 		int uncertain,		/* 1 == inode is uncertain */
+		int hdr_verified,	/* 1 == verify_dinode_hdr() passed */
 		int ino_discovery,	/* 1 == check dirs for unknown inodes */
 		int check_dups,		/* 1 == check if inode claims
 					 * duplicate blocks		*/
@@ -2251,6 +2253,13 @@ process_dinode_int(xfs_mount_t *mp,
 	 */
 	ASSERT(uncertain == 0 || verify_mode != 0);
 
+	/*
+	 * The caller has already run the checks up to the size check over
+	 * the whole inode cluster and they all passed.
+	 */
+	if (hdr_verified)
+		goto hdr_ok;
+
 	/*
 	 * This is the only valid point to check the CRC; after this we may have
 	 * made changes which invalidate it, and the CRC is only updated again
@@ -2348,6 +2357,7 @@ _("bad (negative) size %" PRId64 " on inode %" PRIu64 "\n"),
 		goto clear_bad_out;
 	}
 
+hdr_ok:
 	/*
 	 * if not in verify mode, check to sii if the inode and imap
 	 * agree that the inode is free
@@ -2735,6 +2745,8 @@ _("Cannot have non-zero CoW extent size %u on non-cowextsize inode %" PRIu64 ",
 				lino);
 			goto clear_bad_out;
 		}
+		if (ino_discovery)
+			pf_record_dir_blocks(dblkmap);
 		break;
 	case XR_INO_SYMLINK:
 		if (process_symlink(mp, lino, dino, dblkmap) != 0) {
@@ -2828,7 +2840,8 @@ process_dinode(
 	int		check_dups,
 	int		extra_attr_check,
 	int		*isa_dir,
-	xfs_ino_t	*parent)
+	xfs_ino_t	*parent,
+	int		hdr_verified)
 {
 	const int	verify_mode = 0;
 	const int	uncertain = 0;
@@ -2837,8 +2850,9 @@ process_dinode(
 	fprintf(stderr, _("processing inode %d/%d\n"), agno, ino);
 #endif
 	return process_dinode_int(mp, dino, agno, ino, was_free, dirty, used,
-				verify_mode, uncertain, ino_discovery,
-				check_dups, extra_attr_check, isa_dir, parent);
+				verify_mode, uncertain, hdr_verified,
+				ino_discovery, check_dups, extra_attr_check,
+				isa_dir, parent);
 }
 
 /*
@@ -2852,7 +2866,8 @@ verify_dinode(
 	xfs_mount_t	*mp,
 	xfs_dinode_t	*dino,
 	xfs_agnumber_t	agno,
-	xfs_agino_t	ino)
+	xfs_agino_t	ino,
+	int		hdr_verified)
 {
 	xfs_ino_t	parent;
 	int		used = 0;
@@ -2864,8 +2879,8 @@ verify_dinode(
 	const int	uncertain = 0;
 
 	return process_dinode_int(mp, dino, agno, ino, 0, &dirty, &used,
-				verify_mode, uncertain, ino_discovery,
-				check_dups, 0, &isa_dir, &parent);
+				verify_mode, uncertain, hdr_verified,
+				ino_discovery, check_dups, 0, &isa_dir, &parent);
 }
 
 /*
@@ -2890,6 +2905,36 @@ verify_uncertain_dinode(
 	const int	uncertain = 1;
 
 	return process_dinode_int(mp, dino, agno, ino, 0, &dirty, &used,
-				verify_mode, uncertain, ino_discovery,
+				verify_mode, uncertain, 0, ino_discovery,
 				check_dups, 0, &isa_dir, &parent);
 }
+
+/*
+ * The checks process_dinode_int() starts with, without any reporting and
+ * with the CRC last as it is by far the most expensive.  The inode chunk
+ * code runs this over each inode cluster as soon as it is read, so that
+ * verify_dinode() and process_dinode() don't have to redo them (and the
+ * CRC in particular) for every inode in the common case where they pass.
+ * Returns 0 if the checks pass, 1 otherwise.
+ */
+int
+verify_dinode_hdr(
+	xfs_mount_t	*mp,
+	xfs_dinode_t	*dino,
+	xfs_ino_t	lino)
+{
+	if (be16_to_cpu(dino->di_magic) != XFS_DINODE_MAGIC ||
+	    !libxfs_dinode_good_version(mp, dino->di_version) ||
+	    (xfs_fsize_t)be64_to_cpu(dino->di_size) < 0)
+		return 1;
+
+	if (!xfs_sb_version_hascrc(&mp->m_sb))
+		return 0;
+
+	if (be64_to_cpu(dino->di_ino) != lino ||
+	    platform_uuid_compare(&dino->di_uuid, &mp->m_sb.sb_meta_uuid) ||
+	    !libxfs_verify_cksum((char *)dino, mp->m_sb.sb_inodesize,
+				XFS_DINODE_CRC_OFF))
+		return 1;
+	return 0;
+}
@@ -75,13 +75,15 @@ process_dinode(xfs_mount_t *mp,
 		int check_dups,
 		int extra_attr_check,
 		int *isa_dir,
-		xfs_ino_t *parent);
+		xfs_ino_t *parent,
+		int hdr_verified);
 
 int
 verify_dinode(xfs_mount_t *mp,
 		xfs_dinode_t *dino,
 		xfs_agnumber_t agno,
-		xfs_agino_t ino);
+		xfs_agino_t ino,
+		int hdr_verified);
 
 int
 verify_uncertain_dinode(xfs_mount_t *mp,
@@ -89,6 +91,11 @@ verify_uncertain_dinode(xfs_mount_t *mp,
 		xfs_agnumber_t agno,
 		xfs_agino_t ino);
 
+int
+verify_dinode_hdr(xfs_mount_t *mp,
+		xfs_dinode_t *dino,
+		xfs_ino_t lino);
+
 int
 verify_inum(xfs_mount_t		*mp,
 		xfs_ino_t	ino);
@@ -109,6 +116,9 @@ process_aginodes(xfs_mount_t		*mp,
 		int			check_dups,
 		int			extra_attr_check);
 
+void
+free_bogus_inode_chunks(xfs_mount_t	*mp);
+
 void
 check_uncertain_aginodes(xfs_mount_t	*mp,
 			xfs_agnumber_t	agno);
@@ -207,6 +207,38 @@ set_rtbmap(
 	 (((__uint64_t) state) << ((bno % XR_BB_NUM) * XR_BB)));
 }
 
+/*
+ * Return a mask of which of the 64 extents starting at @bno are free,
+ * testing a whole word of records at a time.  @bno must be a multiple
+ * of 64.
+ */
+__uint64_t
+get_rtbmap_free(
+	xfs_rtblock_t	bno)
+{
+	__uint64_t	*p = rt_bmap + bno / XR_BB_NUM;
+	__uint64_t	mask = 0;
+	__uint64_t	x;
+	int		i;
+
+	ASSERT(bno % 64 == 0);
+	for (i = 0; i < 64 / XR_BB_NUM; i++) {
+		/* bit 0 of each record is set if the record isn't free */
+		x = p[i] ^ (XR_E_FREE * 0x1111111111111111ULL);
+		x |= x >> 1;
+		x |= x >> 2;
+		x = ~x & 0x1111111111111111ULL;
+
+		/* pack bit 0 of each record into the low 16 bits */
+		x = (x | (x >> 3)) & 0x0303030303030303ULL;
+		x = (x | (x >> 6)) & 0x000f000f000f000fULL;
+		x = (x | (x >> 12)) & 0x000000ff000000ffULL;
+		x = (x | (x >> 24)) & 0xffffULL;
+		mask |= x << (i * XR_BB_NUM);
+	}
+	return mask;
+}
+
 static void
 reset_rt_bmap(void)
 {
@@ -221,8 +253,8 @@ init_rt_bmap(
 	if (mp->m_sb.sb_rextents == 0)
 		return;
 
-	rt_bmap_size = roundup(mp->m_sb.sb_rextents / (NBBY / XR_BB),
-			       sizeof(__uint64_t));
+	/* whole groups of 64 extents, for get_rtbmap_free */
+	rt_bmap_size = roundup(mp->m_sb.sb_rextents, 64) / (NBBY / XR_BB);
 
 	rt_bmap = memalign(sizeof(__uint64_t), rt_bmap_size);
 	if (!rt_bmap) {
@@ -314,6 +314,13 @@ free_ino_tree_node(
  */
 static ino_tree_node_t **last_rec;
 
+/*
+ * Inode discovery adds to the uncertain tree of whatever AG a directory
+ * entry points into, from as many threads as there are AGs or AG slices
+ * being processed, so each AG's tree and cache entry has a lock.
+ */
+static pthread_mutex_t *uncertain_locks;
+
 /*
  * ok, the uncertain inodes are a set of trees just like the
  * good inodes but all starting inode records are (arbitrarily)
@@ -339,6 +346,8 @@ add_aginode_uncertain(
 
 	s_ino = rounddown(ino, XFS_INODES_PER_CHUNK);
 
+	pthread_mutex_lock(&uncertain_locks[agno]);
+
 	/*
 	 * check for a cache hit
 	 */
@@ -349,6 +358,7 @@ add_aginode_uncertain(
 		else
 			set_inode_used(last_rec[agno], offset);
 
+		pthread_mutex_unlock(&uncertain_locks[agno]);
 		return;
 	}
 
@@ -376,6 +386,7 @@ add_aginode_uncertain(
 	 * set cache entry
 	 */
 	last_rec[agno] = ino_rec;
+	pthread_mutex_unlock(&uncertain_locks[agno]);
 }
 
 /*
@@ -826,5 +837,11 @@ incore_ino_init(xfs_mount_t *mp)
 
 	memset(last_rec, 0, sizeof(ino_tree_node_t *) * agcount);
 
+	uncertain_locks = malloc(sizeof(pthread_mutex_t) * agcount);
+	if (!uncertain_locks)
+		do_error(_("couldn't malloc uncertain inode locks\n"));
+	for (i = 0; i < agcount; i++)
+		pthread_mutex_init(&uncertain_locks[i], NULL);
+
 	full_ino_ex_data = 0;
 }
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "libxfs.h"
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include "globals.h"
+#include "err_protos.h"
+#include "numa.h"
+
+/*
+ * NUMA placement of the per-AG work.
+ *
+ * The AGs are split into one contiguous range per node, and a thread
+ * working on an AG is bound to the CPUs of the node owning that range.
+ * Memory is not placed explicitly: the incore inode records, block maps
+ * and buffers of an AG are allocated by the threads that scan, prefetch
+ * and process it, so first touch puts them on the same node.  The prefetch
+ * queuing thread for an AG binds itself to the AG's node, and the I/O
+ * threads it starts inherit that binding.
+ *
+ * The topology is read straight from sysfs so that we don't need libnuma.
+ */
+
+#define NUMA_SYSFS_NODES	"/sys/devices/system/node"
+
+struct numa_node {
+	int		id;
+	cpu_set_t	cpus;
+
+	/* statistics, protected by numa_lock */
+	__uint64_t	items;		/* AGs processed */
+	__uint64_t	remote;		/* ... finishing on another node */
+	double		secs;		/* time spent processing them */
+};
+
+static struct numa_node	*numa_nodes;
+static int		numa_nnodes;
+static xfs_agnumber_t	numa_agcount;
+static cpu_set_t	numa_allcpus;
+static int		numa_bind_failed;
+static pthread_mutex_t	numa_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Parse a sysfs cpu list ("0-3,8,10-11") into @set.
+ */
+static int
+numa_parse_cpulist(
+	const char	*buf,
+	cpu_set_t	*set)
+{
+	const char	*p = buf;
+	char		*end;
+	long		first;
+	long		last;
+
+	CPU_ZERO(set);
+	while (*p && *p != '\n') {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return EINVAL;
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return EINVAL;
+		}
+		if (last >= CPU_SETSIZE)
+			return EINVAL;
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p && *p != '\n')
+			return EINVAL;
+	}
+	return 0;
+}
+
+static int
+numa_node_cmp(
+	const void	*a,
+	const void	*b)
+{
+	return ((struct numa_node *)a)->id - ((struct numa_node *)b)->id;
+}
+
+/*
+ * Find the nodes that have CPUs we are allowed to run on.  Memory only
+ * nodes are no use to us as nothing can be bound to them.
+ */
+static int
+numa_read_topology(void)
+{
+	DIR		*dir;
+	struct dirent	*de;
+	FILE		*fp;
+	char		path[PATH_MAX];
+	char		*buf = NULL;
+	size_t		len = 0;
+	struct numa_node node;
+	struct numa_node *nodes;
+	char		c;
+
+	dir = opendir(NUMA_SYSFS_NODES);
+	if (!dir)
+		return 0;
+
+	while ((de = readdir(dir)) != NULL) {
+		memset(&node, 0, sizeof(node));
+		if (sscanf(de->d_name, "node%d%c", &node.id, &c) != 1)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/cpulist",
+			 NUMA_SYSFS_NODES, de->d_name);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		if (getline(&buf, &len, fp) < 0 ||
+		    numa_parse_cpulist(buf, &node.cpus)) {
+			fclose(fp);
+			continue;
+		}
+		fclose(fp);
+
+		CPU_AND(&node.cpus, &node.cpus, &numa_allcpus);
+		if (CPU_COUNT(&node.cpus) == 0)
+			continue;
+
+		nodes = realloc(numa_nodes, (numa_nnodes + 1) * sizeof(node));
+		if (!nodes)
+			break;
+		numa_nodes = nodes;
+		numa_nodes[numa_nnodes++] = node;
+	}
+	closedir(dir);
+	free(buf);
+
+	if (numa_nnodes)
+		qsort(numa_nodes, numa_nnodes, sizeof(node), numa_node_cmp);
+	return numa_nnodes;
+}
+
+void
+numa_init(
+	struct xfs_mount	*mp)
+{
+	if (sched_getaffinity(0, sizeof(numa_allcpus), &numa_allcpus)) {
+		do_warn(_("cannot get CPU affinity, error = [%d] %s, "
+			  "ignoring -o numa\n"), errno, strerror(errno));
+		return;
+	}
+
+	if (numa_read_topology() < 2) {
+		do_log(_("        - %d NUMA node(s) available, "
+			 "ignoring -o numa\n"), numa_nnodes);
+		free(numa_nodes);
+		numa_nodes = NULL;
+		numa_nnodes = 0;
+		return;
+	}
+
+	numa_agcount = mp->m_sb.sb_agcount;
+	do_log(_("        - binding AG processing to %d NUMA nodes\n"),
+		numa_nnodes);
+}
+
+static struct numa_node *
+numa_ag_node(
+	xfs_agnumber_t		agno)
+{
+	if (agno >= numa_agcount)
+		agno = numa_agcount - 1;
+	return &numa_nodes[(__uint64_t)agno * numa_nnodes / numa_agcount];
+}
+
+/*
+ * Bind the calling thread to the node owning @agno.  Threads it creates
+ * from here on inherit the binding.
+ */
+void
+numa_bind_ag(
+	xfs_agnumber_t		agno)
+{
+	struct numa_node	*node;
+	int			err;
+
+	if (!numa_nnodes)
+		return;
+
+	node = numa_ag_node(agno);
+	err = pthread_setaffinity_np(pthread_self(), sizeof(node->cpus),
+				     &node->cpus);
+	if (err) {
+		pthread_mutex_lock(&numa_lock);
+		if (!numa_bind_failed++)
+			do_warn(_("cannot bind to NUMA node %d, "
+				  "error = [%d] %s\n"),
+				node->id, err, strerror(err));
+		pthread_mutex_unlock(&numa_lock);
+	}
+}
+
+/*
+ * Undo numa_bind_ag() so that threads started from the main thread
+ * afterwards can run anywhere again.
+ */
+void
+numa_unbind(void)
+{
+	if (!numa_nnodes)
+		return;
+	pthread_setaffinity_np(pthread_self(), sizeof(numa_allcpus),
+			       &numa_allcpus);
+}
+
+/*
+ * Account an AG the calling thread has finished processing.  If we end
+ * up on a CPU outside the AG's node, the binding didn't take and the
+ * memory allocated for the AG may be remote.
+ */
+void
+numa_ag_done(
+	xfs_agnumber_t		agno,
+	struct timeval		*start)
+{
+	struct numa_node	*node;
+	struct timeval		now;
+	int			cpu;
+
+	if (!numa_nnodes)
+		return;
+
+	gettimeofday(&now, NULL);
+	cpu = sched_getcpu();
+	node = numa_ag_node(agno);
+
+	pthread_mutex_lock(&numa_lock);
+	node->items++;
+	node->secs += (now.tv_sec - start->tv_sec) +
+		      (now.tv_usec - start->tv_usec) / 1000000.0;
+	if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &node->cpus))
+		node->remote++;
+	pthread_mutex_unlock(&numa_lock);
+}
+
+void
+numa_report(void)
+{
+	struct numa_node	*node;
+
+	if (!numa_nnodes)
+		return;
+
+	do_log(_("NUMA node   AG items   off-node    seconds\n"));
+	for (node = numa_nodes; node < numa_nodes + numa_nnodes; node++)
+		do_log(_("%9d %10llu %10llu %10.2f\n"), node->id,
+			(unsigned long long)node->items,
+			(unsigned long long)node->remote, node->secs);
+	if (numa_bind_failed)
+		do_log(_("%d NUMA bind(s) failed\n"), numa_bind_failed);
+}
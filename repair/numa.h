@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef	_XFS_REPAIR_NUMA_H_
+#define	_XFS_REPAIR_NUMA_H_
+
+struct timeval;
+
+void	numa_init(struct xfs_mount *mp);
+void	numa_bind_ag(xfs_agnumber_t agno);
+void	numa_unbind(void);
+void	numa_ag_done(xfs_agnumber_t agno, struct timeval *start);
+void	numa_report(void);
+
+#endif	/* _XFS_REPAIR_NUMA_H_ */
@@ -136,6 +136,47 @@ zero_log(
 		libxfs_max_lsn = log->l_last_sync_lsn;
 }
 
+/*
+ * A run resumed from a checkpoint skips the scans of this phase, but the
+ * log still has to be found for the final check of the metadata LSNs.
+ */
+void
+phase2_resume(
+	struct xfs_mount	*mp)
+{
+	set_mp(mp);
+
+	if (mp->m_sb.sb_logstart == 0 && !x.logname)
+		do_error(_("This filesystem has an external log.  "
+			   "Specify log device with the -l option.\n"));
+	zero_log(mp);
+}
+
+/*
+ * The -o sweep pre-check stops after this phase, and only looks at the AG
+ * headers and btrees, so there's no log to find and no incore state for
+ * the later phases to set up.  Returns the number of bad blocks found.
+ */
+int
+phase2_sweep(
+	struct xfs_mount	*mp,
+	int			scan_threads)
+{
+	int			bad;
+
+	set_mp(mp);
+
+	do_log(_("Phase 2 - sweep AG headers and btrees...\n"));
+
+	set_progress_msg(PROG_FMT_SCAN_AG, (__uint64_t) glob_agcount);
+
+	bad = sweep_ags(mp, scan_threads);
+
+	print_final_rpt();
+
+	return bad;
+}
+
 /*
  * ok, at this point, the fs is mounted but the root inode may be
  * trashed and the ag headers haven't been checked.  So we have
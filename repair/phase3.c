@@ -66,7 +66,7 @@ process_agi_unlinked(
 
 static void
 process_ag_func(
-	work_queue_t		*wq,
+	struct workqueue	*wq,
 	xfs_agnumber_t 		agno,
 	void			*arg)
 {
@@ -74,9 +74,12 @@ process_ag_func(
 	 * turn on directory processing (inode discovery) and
 	 * attribute processing (extra_attr_check)
 	 */
-	wait_for_inode_prefetch(arg);
-	do_log(_("        - agno = %d\n"), agno);
-	process_aginodes(wq->mp, arg, agno, 1, 0, 1);
+	prefetch_args_t		*pf_args = arg;
+
+	wait_for_inode_prefetch(pf_args);
+	if (!pf_args || !pf_args->start_agino)
+		do_log(_("        - agno = %d\n"), agno);
+	process_aginodes(wq->wq_ctx, pf_args, agno, 1, 0, 1);
 	blkmap_free_final();
 	cleanup_inode_prefetch(arg);
 }
@@ -86,17 +89,18 @@ process_ags(
 	xfs_mount_t		*mp)
 {
 	do_inode_prefetch(mp, ag_stride, process_ag_func, false, false);
+	free_bogus_inode_chunks(mp);
 }
 
 static void
 do_uncertain_aginodes(
-	work_queue_t	*wq,
+	struct workqueue *wq,
 	xfs_agnumber_t	agno,
 	void		*arg)
 {
 	int		*count = arg;
 
-	*count = process_uncertain_aginodes(wq->mp, agno);
+	*count = process_uncertain_aginodes(wq->wq_ctx, agno);
 
 #ifdef XR_INODE_TRACE
 	fprintf(stderr,
@@ -114,7 +118,7 @@ phase3(
 {
 	int			i, j;
 	int			*counts;
-	work_queue_t		wq;
+	struct workqueue	wq;
 
 	do_log(_("Phase 3 - for each AG...\n"));
 	if (!no_modify)
@@ -171,7 +175,8 @@ phase3(
 		create_work_queue(&wq, mp, scan_threads);
 
 		for (i = 0; i < mp->m_sb.sb_agcount; i++)
-			queue_work(&wq, do_uncertain_aginodes, i, &counts[i]);
+			queue_ag_work(&wq, do_uncertain_aginodes, i,
+				      &counts[i]);
 
 		destroy_work_queue(&wq);
 
@@ -134,20 +134,18 @@ quota_sb_check(xfs_mount_t *mp)
 
 static void
 process_ag_func(
-	work_queue_t		*wq,
+	struct workqueue	*wq,
 	xfs_agnumber_t 		agno,
 	void			*arg)
 {
-	wait_for_inode_prefetch(arg);
-	do_log(_("        - agno = %d\n"), agno);
-	process_aginodes(wq->mp, arg, agno, 0, 1, 0);
-	blkmap_free_final();
-	cleanup_inode_prefetch(arg);
+	prefetch_args_t		*pf_args = arg;
 
-	/*
-	 * now recycle the per-AG duplicate extent records
-	 */
-	release_dup_extent_tree(agno);
+	wait_for_inode_prefetch(pf_args);
+	if (!pf_args || !pf_args->start_agino)
+		do_log(_("        - agno = %d\n"), agno);
+	process_aginodes(wq->wq_ctx, pf_args, agno, 0, 1, 0);
+	blkmap_free_final();
+	cleanup_inode_prefetch(pf_args);
 }
 
 static void
@@ -159,6 +157,13 @@ process_ags(
 
 	do_inode_prefetch(mp, ag_stride, process_ag_func, true, false);
 	for (i = 0; i < mp->m_sb.sb_agcount; i++) {
+		/*
+		 * now recycle the per-AG duplicate extent records; not
+		 * before, as inodes in any AG or slice of an AG may own
+		 * blocks in this one
+		 */
+		release_dup_extent_tree(i);
+
 		error = rmap_finish_collecting_fork_recs(mp, i);
 		if (error)
 			do_error(
@@ -169,23 +174,23 @@ _("unable to finish adding attr/data fork reverse-mapping data for AG %u.\n"),
 
 static void
 check_rmap_btrees(
-	work_queue_t	*wq,
+	struct workqueue *wq,
 	xfs_agnumber_t	agno,
 	void		*arg)
 {
 	int		error;
 
-	error = rmap_add_fixed_ag_rec(wq->mp, agno);
+	error = rmap_add_fixed_ag_rec(wq->wq_ctx, agno);
 	if (error)
 		do_error(
 _("unable to add AG %u metadata reverse-mapping data.\n"), agno);
 
-	error = rmap_fold_raw_recs(wq->mp, agno);
+	error = rmap_fold_raw_recs(wq->wq_ctx, agno);
 	if (error)
 		do_error(
 _("unable to merge AG %u metadata reverse-mapping data.\n"), agno);
 
-	error = rmaps_verify_btree(wq->mp, agno);
+	error = rmaps_verify_btree(wq->wq_ctx, agno);
 	if (error)
 		do_error(
 _("%s while checking reverse-mappings"),
@@ -194,13 +199,13 @@ _("%s while checking reverse-mappings"),
 
 static void
 compute_ag_refcounts(
-	work_queue_t	*wq,
+	struct workqueue *wq,
 	xfs_agnumber_t	agno,
 	void		*arg)
 {
 	int		error;
 
-	error = compute_refcounts(wq->mp, agno);
+	error = compute_refcounts(wq->wq_ctx, agno);
 	if (error)
 		do_error(
 _("%s while computing reference count records.\n"),
@@ -209,13 +214,13 @@ _("%s while computing reference count records.\n"),
 
 static void
 process_inode_reflink_flags(
-	struct work_queue	*wq,
+	struct workqueue	*wq,
 	xfs_agnumber_t		agno,
 	void			*arg)
 {
 	int			error;
 
-	error = fix_inode_reflink_flags(wq->mp, agno);
+	error = fix_inode_reflink_flags(wq->wq_ctx, agno);
 	if (error)
 		do_error(
 _("%s while fixing inode reflink flags.\n"),
@@ -224,13 +229,13 @@ _("%s while fixing inode reflink flags.\n"),
 
 static void
 check_refcount_btrees(
-	work_queue_t	*wq,
+	struct workqueue *wq,
 	xfs_agnumber_t	agno,
 	void		*arg)
 {
 	int		error;
 
-	error = check_refcounts(wq->mp, agno);
+	error = check_refcounts(wq->wq_ctx, agno);
 	if (error)
 		do_error(
 _("%s while checking reference counts"),
@@ -241,7 +246,7 @@ static void
 process_rmap_data(
 	struct xfs_mount	*mp)
 {
-	struct work_queue	wq;
+	struct workqueue	wq;
 	xfs_agnumber_t		i;
 
 	if (!rmap_needs_work(mp))
@@ -249,7 +254,7 @@ process_rmap_data(
 
 	create_work_queue(&wq, mp, libxfs_nproc());
 	for (i = 0; i < mp->m_sb.sb_agcount; i++)
-		queue_work(&wq, check_rmap_btrees, i, NULL);
+		queue_ag_work(&wq, check_rmap_btrees, i, NULL);
 	destroy_work_queue(&wq);
 
 	if (!xfs_sb_version_hasreflink(&mp->m_sb))
@@ -257,13 +262,13 @@ process_rmap_data(
 
 	create_work_queue(&wq, mp, libxfs_nproc());
 	for (i = 0; i < mp->m_sb.sb_agcount; i++)
-		queue_work(&wq, compute_ag_refcounts, i, NULL);
+		queue_ag_work(&wq, compute_ag_refcounts, i, NULL);
 	destroy_work_queue(&wq);
 
 	create_work_queue(&wq, mp, libxfs_nproc());
 	for (i = 0; i < mp->m_sb.sb_agcount; i++) {
-		queue_work(&wq, process_inode_reflink_flags, i, NULL);
-		queue_work(&wq, check_refcount_btrees, i, NULL);
+		queue_ag_work(&wq, process_inode_reflink_flags, i, NULL);
+		queue_ag_work(&wq, check_refcount_btrees, i, NULL);
 	}
 	destroy_work_queue(&wq);
 }
@@ -17,6 +17,7 @@
  */
 
 #include "libxfs.h"
+#include "xfs_dir2_priv.h"
 #include "threads.h"
 #include "prefetch.h"
 #include "avl.h"
@@ -76,31 +77,42 @@ add_dotdot_update(
  * Data structures and routines to keep track of directory entries
  * and whether their leaf entry has been seen. Also used for name
  * duplicate checking and rebuilding step if required.
+ *
+ * The entries live in one array, in the order they were added, and are
+ * found through two open addressed (linear probing) tables of array
+ * indexes, one keyed by data address and one by name hash.  Whether an
+ * entry's leaf entry has been seen is kept in a bitmap.  The names point
+ * into the directory buffers until they're copied into a single block by
+ * dir_hash_dup_names.  Freeing the lot is a handful of free() calls, no
+ * matter how big the directory was.
  */
 typedef struct dir_hash_ent {
-	struct dir_hash_ent	*nextbyaddr;	/* next in addr bucket */
-	struct dir_hash_ent	*nextbyhash;	/* next in name bucket */
-	struct dir_hash_ent	*nextbyorder;	/* next in order added */
 	xfs_dahash_t		hashval;	/* hash value of name */
 	__uint32_t		address;	/* offset of data entry */
 	xfs_ino_t 		inum;		/* inode num of entry */
 	short			junkit;		/* name starts with / */
-	short			seen;		/* have seen leaf entry */
 	struct xfs_name		name;
 } dir_hash_ent_t;
 
 typedef struct dir_hash_tab {
-	int			size;		/* size of hash tables */
-	int			names_duped;	/* 1 = ent names malloced */
-	dir_hash_ent_t		*first;		/* ptr to first added entry */
-	dir_hash_ent_t		*last;		/* ptr to last added entry */
-	dir_hash_ent_t		**byhash;	/* ptr to name hash buckets */
-	dir_hash_ent_t		**byaddr;	/* ptr to addr hash buckets */
+	int			nents;		/* number of entries added */
+	int			maxents;	/* size of ents and seen */
+	int			nseen;		/* entries with a leaf entry */
+	int			names_duped;	/* 1 = names copied to names */
+	int			shift;		/* 32 - log2(slots) */
+	__uint32_t		mask;		/* slots - 1 */
+	size_t			namebytes;	/* total length of all names */
+	dir_hash_ent_t		*ents;		/* entries, in order added */
+	__uint64_t		*seen;		/* have seen leaf entry */
+	__uint32_t		*byaddr;	/* addr slots, index + 1 */
+	__uint32_t		*byhash;	/* name hash slots, index + 1 */
+	unsigned char		*names;		/* copies of the names */
 } dir_hash_tab_t;
 
-#define	DIR_HASH_TAB_SIZE(n)	\
-	(sizeof(dir_hash_tab_t) + (sizeof(dir_hash_ent_t *) * (n) * 2))
-#define	DIR_HASH_FUNC(t,a)	((a) % (t)->size)
+/* multiplicative hash of a key to its first slot */
+#define	DIR_HASH_FUNC(t,k)	(((__uint32_t)(k) * 0x9e3779b1U) >> (t)->shift)
+#define	DIR_HASH_NEXT(t,i)	(((i) + 1) & (t)->mask)
+#define	DIR_HASH_SEEN(t,i)	((t)->seen[(i) >> 6] & (1ULL << ((i) & 63)))
 
 /*
  * Track the contents of the freespace table in a directory.
@@ -163,6 +175,83 @@ dir_read_buf(
 	return 0;
 }
 
+static void
+dir_hash_alloc_slots(
+	dir_hash_tab_t		*hashtab,
+	int			bits)
+{
+	size_t			size = sizeof(__uint32_t) << bits;
+
+	hashtab->shift = 32 - bits;
+	hashtab->mask = (1U << bits) - 1;
+	hashtab->byaddr = calloc(size, 1);
+	hashtab->byhash = calloc(size, 1);
+	if (!hashtab->byaddr || !hashtab->byhash)
+		do_error(_("calloc failed in dir_hash_alloc_slots (%zu bytes)\n"),
+			size * 2);
+}
+
+static void
+dir_hash_insert_slot(
+	dir_hash_tab_t		*hashtab,
+	__uint32_t		*slots,
+	__uint32_t		key,
+	int			idx)
+{
+	__uint32_t		i;
+
+	for (i = DIR_HASH_FUNC(hashtab, key); slots[i];
+	     i = DIR_HASH_NEXT(hashtab, i))
+		;
+	slots[i] = idx + 1;
+}
+
+/*
+ * Double the number of slots and put the entries back in, in the order
+ * they were added, so that entries with the same key are probed in that
+ * order.
+ */
+static void
+dir_hash_grow_slots(
+	dir_hash_tab_t		*hashtab)
+{
+	dir_hash_ent_t		*p;
+	__uint32_t		*byaddr = hashtab->byaddr;
+	__uint32_t		*byhash = hashtab->byhash;
+	int			i;
+
+	dir_hash_alloc_slots(hashtab, 32 - hashtab->shift + 1);
+	free(byaddr);
+	free(byhash);
+
+	for (i = 0; i < hashtab->nents; i++) {
+		p = &hashtab->ents[i];
+		dir_hash_insert_slot(hashtab, hashtab->byaddr, p->address, i);
+		if (!p->junkit)
+			dir_hash_insert_slot(hashtab, hashtab->byhash,
+					p->hashval, i);
+	}
+}
+
+static void
+dir_hash_grow_ents(
+	dir_hash_tab_t		*hashtab)
+{
+	int			maxents = hashtab->maxents * 2;
+	size_t			oldwords = (hashtab->maxents + 63) / 64;
+	size_t			words = (maxents + 63) / 64;
+
+	hashtab->ents = realloc(hashtab->ents, maxents * sizeof(dir_hash_ent_t));
+	hashtab->seen = realloc(hashtab->seen, words * sizeof(__uint64_t));
+	if (!hashtab->ents || !hashtab->seen)
+		do_error(_("realloc failed in dir_hash_grow_ents (%zu bytes)\n"),
+			maxents * sizeof(dir_hash_ent_t) +
+			words * sizeof(__uint64_t));
+	memset(hashtab->seen + oldwords, 0,
+		(words - oldwords) * sizeof(__uint64_t));
+	hashtab->maxents = maxents;
+}
+
 /*
  * Returns 0 if the name already exists (ie. a duplicate)
  */
@@ -177,9 +266,9 @@ dir_hash_add(
 	__uint8_t		ftype)
 {
 	xfs_dahash_t		hash = 0;
-	int			byaddr;
-	int			byhash = 0;
 	dir_hash_ent_t		*p;
+	__uint32_t		i;
+	int			idx;
 	int			dup;
 	short			junk;
 	struct xfs_name		xname;
@@ -191,17 +280,17 @@ dir_hash_add(
 	xname.type = ftype;
 
 	junk = name[0] == '/';
-	byaddr = DIR_HASH_FUNC(hashtab, addr);
 	dup = 0;
 
 	if (!junk) {
 		hash = mp->m_dirnameops->hashname(&xname);
-		byhash = DIR_HASH_FUNC(hashtab, hash);
 
 		/*
-		 * search hash bucket for existing name.
+		 * search hash slots for existing name.
 		 */
-		for (p = hashtab->byhash[byhash]; p; p = p->nextbyhash) {
+		for (i = DIR_HASH_FUNC(hashtab, hash); hashtab->byhash[i];
+		     i = DIR_HASH_NEXT(hashtab, i)) {
+			p = &hashtab->ents[hashtab->byhash[i] - 1];
 			if (p->hashval == hash && p->name.len == namelen) {
 				if (memcmp(p->name.name, name, namelen) == 0) {
 					dup = 1;
@@ -212,28 +301,23 @@ dir_hash_add(
 		}
 	}
 
-	if ((p = malloc(sizeof(*p))) == NULL)
-		do_error(_("malloc failed in dir_hash_add (%zu bytes)\n"),
-			sizeof(*p));
-
-	p->nextbyaddr = hashtab->byaddr[byaddr];
-	hashtab->byaddr[byaddr] = p;
-	if (hashtab->last)
-		hashtab->last->nextbyorder = p;
-	else
-		hashtab->first = p;
-	p->nextbyorder = NULL;
-	hashtab->last = p;
+	/* keep the slot tables at most half full */
+	if (hashtab->nents == hashtab->maxents)
+		dir_hash_grow_ents(hashtab);
+	if ((hashtab->nents + 1) * 2 > hashtab->mask + 1)
+		dir_hash_grow_slots(hashtab);
 
+	idx = hashtab->nents++;
+	p = &hashtab->ents[idx];
+	dir_hash_insert_slot(hashtab, hashtab->byaddr, addr, idx);
 	if (!(p->junkit = junk)) {
 		p->hashval = hash;
-		p->nextbyhash = hashtab->byhash[byhash];
-		hashtab->byhash[byhash] = p;
+		dir_hash_insert_slot(hashtab, hashtab->byhash, hash, idx);
 	}
 	p->address = addr;
 	p->inum = inum;
-	p->seen = 0;
 	p->name = xname;
+	hashtab->namebytes += namelen;
 
 	return !dup;
 }
@@ -245,16 +329,7 @@ static int
 dir_hash_unseen(
 	dir_hash_tab_t	*hashtab)
 {
-	int		i;
-	dir_hash_ent_t	*p;
-
-	for (i = 0; i < hashtab->size; i++) {
-		for (p = hashtab->byaddr[i]; p; p = p->nextbyaddr) {
-			if (p->seen == 0)
-				return 1;
-		}
-	}
-	return 0;
+	return hashtab->nseen < hashtab->nents;
 }
 
 static int
@@ -293,40 +368,42 @@ static void
 dir_hash_done(
 	dir_hash_tab_t	*hashtab)
 {
-	int		i;
-	dir_hash_ent_t	*n;
-	dir_hash_ent_t	*p;
-
-	for (i = 0; i < hashtab->size; i++) {
-		for (p = hashtab->byaddr[i]; p; p = n) {
-			n = p->nextbyaddr;
-			if (hashtab->names_duped)
-				free((void *)p->name.name);
-			free(p);
-		}
-	}
+	free(hashtab->names);
+	free(hashtab->byhash);
+	free(hashtab->byaddr);
+	free(hashtab->seen);
+	free(hashtab->ents);
 	free(hashtab);
 }
 
+/*
+ * Size the tables for the number of entries a directory of @size bytes
+ * probably has, up to 65536 slots as the size may be garbage; they grow
+ * if it has more.
+ */
 static dir_hash_tab_t *
 dir_hash_init(
 	xfs_fsize_t	size)
 {
 	dir_hash_tab_t	*hashtab;
-	int		hsize;
-
-	hsize = size / (16 * 4);
-	if (hsize > 65536)
-		hsize = 63336;
-	else if (hsize < 16)
-		hsize = 16;
-	if ((hashtab = calloc(DIR_HASH_TAB_SIZE(hsize), 1)) == NULL)
+	xfs_fsize_t	nents;
+	int		bits;
+
+	nents = size / 64;
+	if (nents < 16)
+		nents = 16;
+	for (bits = 5; bits < 16 && (1LL << bits) < nents * 2; bits++)
+		;
+
+	if ((hashtab = calloc(sizeof(dir_hash_tab_t), 1)) == NULL)
 		do_error(_("calloc failed in dir_hash_init\n"));
-	hashtab->size = hsize;
-	hashtab->byhash = (dir_hash_ent_t**)((char *)hashtab +
-		sizeof(dir_hash_tab_t));
-	hashtab->byaddr = (dir_hash_ent_t**)((char *)hashtab +
-		sizeof(dir_hash_tab_t) + sizeof(dir_hash_ent_t*) * hsize);
+	hashtab->maxents = 1 << (bits - 1);
+	hashtab->ents = malloc(hashtab->maxents * sizeof(dir_hash_ent_t));
+	hashtab->seen = calloc((hashtab->maxents + 63) / 64,
+			sizeof(__uint64_t));
+	if (!hashtab->ents || !hashtab->seen)
+		do_error(_("malloc failed in dir_hash_init\n"));
+	dir_hash_alloc_slots(hashtab, bits);
 	return hashtab;
 }
 
@@ -336,18 +413,22 @@ dir_hash_see(
 	xfs_dahash_t		hash,
 	xfs_dir2_dataptr_t	addr)
 {
-	int			i;
+	__uint32_t		i;
+	int			idx;
 	dir_hash_ent_t		*p;
 
-	i = DIR_HASH_FUNC(hashtab, addr);
-	for (p = hashtab->byaddr[i]; p; p = p->nextbyaddr) {
+	for (i = DIR_HASH_FUNC(hashtab, addr); hashtab->byaddr[i];
+	     i = DIR_HASH_NEXT(hashtab, i)) {
+		idx = hashtab->byaddr[i] - 1;
+		p = &hashtab->ents[idx];
 		if (p->address != addr)
 			continue;
-		if (p->seen)
+		if (DIR_HASH_SEEN(hashtab, idx))
 			return DIR_HASH_CK_DUPLEAF;
 		if (p->junkit == 0 && p->hashval != hash)
 			return DIR_HASH_CK_BADHASH;
-		p->seen = 1;
+		hashtab->seen[idx >> 6] |= 1ULL << (idx & 63);
+		hashtab->nseen++;
 		return DIR_HASH_CK_OK;
 	}
 	return DIR_HASH_CK_NODATA;
@@ -359,11 +440,12 @@ dir_hash_update_ftype(
 	xfs_dir2_dataptr_t	addr,
 	__uint8_t		ftype)
 {
-	int			i;
+	__uint32_t		i;
 	dir_hash_ent_t		*p;
 
-	i = DIR_HASH_FUNC(hashtab, addr);
-	for (p = hashtab->byaddr[i]; p; p = p->nextbyaddr) {
+	for (i = DIR_HASH_FUNC(hashtab, addr); hashtab->byaddr[i];
+	     i = DIR_HASH_NEXT(hashtab, i)) {
+		p = &hashtab->ents[hashtab->byaddr[i] - 1];
 		if (p->address != addr)
 			continue;
 		p->name.type = ftype;
@@ -399,7 +481,7 @@ dir_hash_see_all(
 }
 
 /*
- * Convert name pointers into locally allocated memory.
+ * Copy the names out of the directory buffers into one block of our own.
  * This must only be done after all the entries have been added.
  */
 static void
@@ -411,10 +493,14 @@ dir_hash_dup_names(dir_hash_tab_t *hashtab)
 	if (hashtab->names_duped)
 		return;
 
-	for (p = hashtab->first; p; p = p->nextbyorder) {
-		name = malloc(p->name.len);
+	name = hashtab->names = malloc(hashtab->namebytes + 1);
+	if (!name)
+		do_error(_("malloc failed in dir_hash_dup_names (%zu bytes)\n"),
+			hashtab->namebytes + 1);
+	for (p = hashtab->ents; p < hashtab->ents + hashtab->nents; p++) {
 		memcpy(name, p->name.name, p->name.len);
 		p->name.name = name;
+		name += p->name.len;
 	}
 	hashtab->names_duped = 1;
 }
@@ -1243,6 +1329,470 @@ entry_junked(
 	return !no_modify;
 }
 
+/*
+ * Bulk directory rebuild.
+ *
+ * Re-adding the entries one at a time costs a transaction and a da btree
+ * lookup for every name, plus a leaf split every few hundred names.  For
+ * directories that won't fit in a single block we instead pack the names
+ * into data blocks in the order they were found, then sort the leaf
+ * entries by hash and write the leaf, node and free blocks bottom up,
+ * much as phase 5 builds the AG btrees.  Each block gets a transaction of
+ * its own.
+ */
+struct dir_build_ent {
+	xfs_dahash_t		hashval;
+	xfs_dir2_dataptr_t	address;
+};
+
+struct dir_build_child {
+	xfs_dablk_t		blkno;
+	xfs_dahash_t		hashval;	/* last hash in the block */
+};
+
+struct dir_build {
+	struct xfs_mount	*mp;
+	struct xfs_inode	*ip;
+	struct xfs_da_geometry	*geo;
+	struct xfs_defer_ops	dfops;
+	xfs_fsblock_t		firstblock;
+	dir_hash_ent_t		**names;	/* names to add, in order */
+	int			nnames;
+	struct dir_build_ent	*ents;		/* leaf entries */
+	__be16			*bests;		/* best free in each data block */
+	int			nbests;
+};
+
+static void
+dir_build_trans_alloc(
+	struct dir_build	*bld,
+	struct xfs_da_args	*args)
+{
+	struct xfs_mount	*mp = bld->mp;
+	int			nres = XFS_DIRENTER_SPACE_RES(mp, MAXNAMELEN);
+	int			error;
+
+	memset(args, 0, sizeof(*args));
+	error = -libxfs_trans_alloc(mp, &M_RES(mp)->tr_create, nres, 0, 0,
+				    &args->trans);
+	if (error)
+		res_failed(error);
+	libxfs_trans_ijoin(args->trans, bld->ip, 0);
+	libxfs_defer_init(&bld->dfops, &bld->firstblock);
+
+	args->dp = bld->ip;
+	args->geo = bld->geo;
+	args->whichfork = XFS_DATA_FORK;
+	args->firstblock = &bld->firstblock;
+	args->dfops = &bld->dfops;
+	args->total = nres;
+}
+
+static int
+dir_build_trans_commit(
+	struct dir_build	*bld,
+	struct xfs_da_args	*args,
+	int			error)
+{
+	if (!error)
+		error = -libxfs_defer_finish(&args->trans, &bld->dfops, bld->ip);
+	if (error) {
+		do_warn(
+_("directory rebuild failed in ino %" PRIu64 " (%d), filesystem may be out of space\n"),
+			bld->ip->i_ino, error);
+		libxfs_defer_cancel(&bld->dfops);
+		libxfs_trans_cancel(args->trans);
+		return error;
+	}
+	libxfs_trans_commit(args->trans);
+	return 0;
+}
+
+/*
+ * Would the names fit in a single directory block?  If so it's just as
+ * quick to add them one at a time, and libxfs picks the format for us.
+ */
+static int
+dir_build_fits_block(
+	struct dir_build	*bld)
+{
+	struct xfs_inode	*ip = bld->ip;
+	int			size;
+	int			i;
+
+	size = ip->d_ops->data_entry_offset +
+	       sizeof(struct xfs_dir2_block_tail);
+	for (i = 0; i < bld->nnames; i++) {
+		size += ip->d_ops->data_entsize(bld->names[i]->name.len) +
+			sizeof(struct xfs_dir2_leaf_entry);
+		if (size > bld->geo->blksize)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Pack the names into data blocks, "." and ".." first, and remember the
+ * hash and address of each one for the leaf blocks.
+ */
+static int
+dir_build_data(
+	struct dir_build	*bld)
+{
+	struct xfs_inode	*ip = bld->ip;
+	struct xfs_da_args	args;
+	struct xfs_buf		*bp;
+	struct xfs_dir2_data_hdr *hdr;
+	struct xfs_dir2_data_entry *dep;
+	dir_hash_ent_t		*p;
+	xfs_dir2_db_t		db;
+	int			offset;
+	int			len;
+	int			needlog;
+	int			needscan;
+	int			error;
+	int			i = 0;
+
+	while (i < bld->nnames) {
+		dir_build_trans_alloc(bld, &args);
+		error = -libxfs_dir2_grow_inode(&args, XFS_DIR2_DATA_SPACE, &db);
+		if (!error)
+			error = -libxfs_dir3_data_init(&args, db, &bp);
+		if (error)
+			return dir_build_trans_commit(bld, &args, error);
+		ASSERT(db == bld->nbests);
+
+		hdr = bp->b_addr;
+		offset = ip->d_ops->data_entry_offset;
+		needlog = needscan = 0;
+		for (; i < bld->nnames; i++) {
+			p = bld->names[i];
+			len = ip->d_ops->data_entsize(p->name.len);
+			if (offset + len > bld->geo->blksize)
+				break;
+
+			libxfs_dir2_data_use_free(&args, bp,
+					(xfs_dir2_data_unused_t *)((char *)hdr +
+								   offset),
+					offset, len, &needlog, &needscan);
+			dep = (xfs_dir2_data_entry_t *)((char *)hdr + offset);
+			dep->inumber = cpu_to_be64(p->inum);
+			dep->namelen = p->name.len;
+			memcpy(dep->name, p->name.name, p->name.len);
+			ip->d_ops->data_put_ftype(dep, p->name.type);
+			*ip->d_ops->data_entry_tag_p(dep) = cpu_to_be16(offset);
+			libxfs_dir2_data_log_entry(&args, bp, dep);
+
+			bld->ents[i].hashval = p->hashval;
+			bld->ents[i].address = xfs_dir2_db_off_to_dataptr(
+						bld->geo, db, offset);
+			offset += len;
+		}
+		if (needscan)
+			libxfs_dir2_data_freescan(ip, hdr, &needlog);
+		if (needlog)
+			libxfs_dir2_data_log_header(&args, bp);
+
+		bld->bests[bld->nbests++] =
+			ip->d_ops->data_bestfree_p(hdr)[0].length;
+		error = dir_build_trans_commit(bld, &args, 0);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+static int
+dir_build_ent_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct dir_build_ent *ea = a;
+	const struct dir_build_ent *eb = b;
+
+	if (ea->hashval != eb->hashval)
+		return ea->hashval < eb->hashval ? -1 : 1;
+	if (ea->address != eb->address)
+		return ea->address < eb->address ? -1 : 1;
+	return 0;
+}
+
+static void
+dir_build_fill_leaf(
+	struct dir_build	*bld,
+	struct xfs_buf		*bp,
+	int			first,
+	int			count,
+	xfs_dablk_t		back,
+	xfs_dablk_t		forw)
+{
+	struct xfs_inode	*ip = bld->ip;
+	struct xfs_dir2_leaf	*leaf = bp->b_addr;
+	struct xfs_dir2_leaf_entry *lep = ip->d_ops->leaf_ents_p(leaf);
+	struct xfs_dir3_icleaf_hdr leafhdr;
+	int			i;
+
+	ip->d_ops->leaf_hdr_from_disk(&leafhdr, leaf);
+	leafhdr.count = count;
+	leafhdr.stale = 0;
+	leafhdr.back = back;
+	leafhdr.forw = forw;
+	ip->d_ops->leaf_hdr_to_disk(leaf, &leafhdr);
+	for (i = 0; i < count; i++) {
+		lep[i].hashval = cpu_to_be32(bld->ents[first + i].hashval);
+		lep[i].address = cpu_to_be32(bld->ents[first + i].address);
+	}
+}
+
+/* Single leaf block with a bests table in its tail. */
+static int
+dir_build_leaf1(
+	struct dir_build	*bld)
+{
+	struct xfs_da_args	args;
+	struct xfs_dir2_leaf_tail *ltp;
+	struct xfs_buf		*bp;
+	xfs_dablk_t		blkno;
+	int			error;
+
+	dir_build_trans_alloc(bld, &args);
+	error = -libxfs_da_grow_inode(&args, &blkno);
+	if (!error)
+		error = -libxfs_dir3_leaf_get_buf(&args,
+				xfs_dir2_da_to_db(bld->geo, blkno), &bp,
+				XFS_DIR2_LEAF1_MAGIC);
+	if (error)
+		return dir_build_trans_commit(bld, &args, error);
+
+	dir_build_fill_leaf(bld, bp, 0, bld->nnames, 0, 0);
+	ltp = xfs_dir2_leaf_tail_p(bld->geo, bp->b_addr);
+	ltp->bestcount = cpu_to_be32(bld->nbests);
+	memcpy(xfs_dir2_leaf_bests_p(ltp), bld->bests,
+	       bld->nbests * sizeof(__be16));
+	libxfs_trans_log_buf(args.trans, bp, 0, bld->geo->blksize - 1);
+	return dir_build_trans_commit(bld, &args, 0);
+}
+
+/* Free index blocks, each covering free_max_bests data blocks. */
+static int
+dir_build_free(
+	struct dir_build	*bld)
+{
+	struct xfs_inode	*ip = bld->ip;
+	struct xfs_mount	*mp = bld->mp;
+	struct xfs_da_args	args;
+	struct xfs_dir3_icfree_hdr freehdr;
+	struct xfs_buf		*bp;
+	xfs_dir2_db_t		fdb;
+	int			maxbests = ip->d_ops->free_max_bests(bld->geo);
+	int			first;
+	int			error;
+
+	for (first = 0; first < bld->nbests; first += maxbests) {
+		dir_build_trans_alloc(bld, &args);
+		error = -libxfs_dir2_grow_inode(&args, XFS_DIR2_FREE_SPACE, &fdb);
+		if (!error)
+			error = -libxfs_da_get_buf(args.trans, ip,
+					xfs_dir2_db_to_da(bld->geo, fdb), -1,
+					&bp, XFS_DATA_FORK);
+		if (error)
+			return dir_build_trans_commit(bld, &args, error);
+		ASSERT(fdb == ip->d_ops->db_to_fdb(bld->geo, first));
+
+		bp->b_ops = &xfs_dir3_free_buf_ops;
+		memset(bp->b_addr, 0, bld->geo->blksize);
+		memset(&freehdr, 0, sizeof(freehdr));
+		if (xfs_sb_version_hascrc(&mp->m_sb)) {
+			struct xfs_dir3_free_hdr *hdr3 = bp->b_addr;
+
+			freehdr.magic = XFS_DIR3_FREE_MAGIC;
+			hdr3->hdr.blkno = cpu_to_be64(bp->b_bn);
+			hdr3->hdr.owner = cpu_to_be64(ip->i_ino);
+			platform_uuid_copy(&hdr3->hdr.uuid,
+					   &mp->m_sb.sb_meta_uuid);
+		} else
+			freehdr.magic = XFS_DIR2_FREE_MAGIC;
+		freehdr.firstdb = first;
+		freehdr.nvalid = min(maxbests, bld->nbests - first);
+		freehdr.nused = freehdr.nvalid;
+		ip->d_ops->free_hdr_to_disk(bp->b_addr, &freehdr);
+		memcpy(ip->d_ops->free_bests_p(bp->b_addr), bld->bests + first,
+		       freehdr.nvalid * sizeof(__be16));
+		libxfs_trans_log_buf(args.trans, bp, 0, bld->geo->blksize - 1);
+
+		error = dir_build_trans_commit(bld, &args, 0);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+/*
+ * Leaf blocks and da btree nodes.  The root node has to live at the start
+ * of the leaf space, so all the blocks are allocated up front, root first,
+ * and then written from the leaves upwards with their sibling pointers.
+ */
+static int
+dir_build_node(
+	struct dir_build	*bld)
+{
+	struct xfs_inode	*ip = bld->ip;
+	struct xfs_da_args	args;
+	struct xfs_da3_icnode_hdr nodehdr;
+	struct xfs_da_node_entry *btree;
+	struct dir_build_child	*child;
+	struct xfs_buf		*bp;
+	xfs_dablk_t		*blknos;
+	int			nleaves;
+	int			nblocks;
+	int			nchild;
+	int			nnodes;
+	int			level;
+	int			next;
+	int			first;
+	int			last;
+	int			i;
+	int			j;
+	int			error = 0;
+
+	nleaves = howmany(bld->nnames, ip->d_ops->leaf_max_ents(bld->geo));
+	nblocks = nleaves + 1;
+	for (nchild = nleaves; nchild > bld->geo->node_ents;
+	     nchild = howmany(nchild, bld->geo->node_ents))
+		nblocks += howmany(nchild, bld->geo->node_ents);
+
+	blknos = malloc(nblocks * sizeof(*blknos));
+	child = malloc(nleaves * sizeof(*child));
+	if (!blknos || !child)
+		do_error(_("malloc failed in %s (%zu bytes)\n"), __func__,
+			nblocks * sizeof(*blknos) + nleaves * sizeof(*child));
+
+	for (i = 0; i < nblocks; i++) {
+		dir_build_trans_alloc(bld, &args);
+		error = dir_build_trans_commit(bld, &args,
+				-libxfs_da_grow_inode(&args, &blknos[i]));
+		if (error)
+			goto out;
+	}
+	ASSERT(blknos[0] == bld->geo->leafblk);
+	next = 1;
+
+	/* leaves, with the entries spread evenly across them */
+	for (i = 0; i < nleaves; i++) {
+		first = (__uint64_t)bld->nnames * i / nleaves;
+		last = (__uint64_t)bld->nnames * (i + 1) / nleaves;
+
+		dir_build_trans_alloc(bld, &args);
+		error = -libxfs_dir3_leaf_get_buf(&args,
+				xfs_dir2_da_to_db(bld->geo, blknos[next + i]),
+				&bp, XFS_DIR2_LEAFN_MAGIC);
+		if (error) {
+			dir_build_trans_commit(bld, &args, error);
+			goto out;
+		}
+		dir_build_fill_leaf(bld, bp, first, last - first,
+				i > 0 ? blknos[next + i - 1] : 0,
+				i < nleaves - 1 ? blknos[next + i + 1] : 0);
+		libxfs_trans_log_buf(args.trans, bp, 0, bld->geo->blksize - 1);
+		error = dir_build_trans_commit(bld, &args, 0);
+		if (error)
+			goto out;
+
+		child[i].blkno = blknos[next + i];
+		child[i].hashval = bld->ents[last - 1].hashval;
+	}
+	next += nleaves;
+
+	/* then each level of nodes, ending with a single root */
+	for (nchild = nleaves, level = 1; ; level++) {
+		nnodes = howmany(nchild, bld->geo->node_ents);
+		for (i = 0; i < nnodes; i++) {
+			first = nchild * i / nnodes;
+			last = nchild * (i + 1) / nnodes;
+
+			dir_build_trans_alloc(bld, &args);
+			error = -libxfs_da3_node_create(&args,
+					nnodes == 1 ? blknos[0] : blknos[next + i],
+					level, &bp, XFS_DATA_FORK);
+			if (error) {
+				dir_build_trans_commit(bld, &args, error);
+				goto out;
+			}
+			ip->d_ops->node_hdr_from_disk(&nodehdr, bp->b_addr);
+			nodehdr.count = last - first;
+			if (nnodes > 1) {
+				nodehdr.back = i > 0 ? blknos[next + i - 1] : 0;
+				nodehdr.forw = i < nnodes - 1 ?
+						blknos[next + i + 1] : 0;
+			}
+			ip->d_ops->node_hdr_to_disk(bp->b_addr, &nodehdr);
+			btree = ip->d_ops->node_tree_p(bp->b_addr);
+			for (j = first; j < last; j++) {
+				btree[j - first].hashval =
+					cpu_to_be32(child[j].hashval);
+				btree[j - first].before =
+					cpu_to_be32(child[j].blkno);
+			}
+			libxfs_trans_log_buf(args.trans, bp, 0,
+					bld->geo->blksize - 1);
+			error = dir_build_trans_commit(bld, &args, 0);
+			if (error)
+				goto out;
+
+			child[i].blkno = nnodes == 1 ? blknos[0] :
+						       blknos[next + i];
+			child[i].hashval = child[last - 1].hashval;
+		}
+		if (nnodes == 1)
+			break;
+		next += nnodes;
+		nchild = nnodes;
+	}
+	ASSERT(next == nblocks);
+out:
+	free(child);
+	free(blknos);
+	return error;
+}
+
+static int
+longform_dir2_build(
+	struct dir_build	*bld)
+{
+	struct xfs_inode	*ip = bld->ip;
+	int			leaf1_ents;
+	int			error;
+
+	bld->ents = malloc(bld->nnames * sizeof(*bld->ents));
+	bld->bests = malloc((bld->nnames + 1) * sizeof(*bld->bests));
+	if (!bld->ents || !bld->bests)
+		do_error(_("malloc failed in %s (%zu bytes)\n"), __func__,
+			bld->nnames * (sizeof(*bld->ents) +
+				       sizeof(*bld->bests)));
+
+	error = dir_build_data(bld);
+	if (error)
+		goto out;
+
+	qsort(bld->ents, bld->nnames, sizeof(*bld->ents), dir_build_ent_cmp);
+
+	leaf1_ents = (bld->geo->blksize - ip->d_ops->leaf_hdr_size -
+		      sizeof(struct xfs_dir2_leaf_tail) -
+		      bld->nbests * sizeof(__be16)) /
+		     sizeof(struct xfs_dir2_leaf_entry);
+	if (bld->nnames <= leaf1_ents) {
+		error = dir_build_leaf1(bld);
+	} else {
+		error = dir_build_node(bld);
+		if (!error)
+			error = dir_build_free(bld);
+	}
+out:
+	free(bld->bests);
+	free(bld->ents);
+	return error;
+}
+
 /*
  * Unexpected failure during the rebuild will leave the entries in
  * lost+found on the next run
@@ -1265,6 +1815,10 @@ longform_dir2_rebuild(
 	struct xfs_defer_ops		dfops;
 	xfs_inode_t		pip;
 	dir_hash_ent_t		*p;
+	dir_hash_ent_t		dot;
+	dir_hash_ent_t		dotdot;
+	struct dir_build	bld;
+	int			bulk;
 	int			done;
 
 	/*
@@ -1285,6 +1839,40 @@ longform_dir2_rebuild(
 	    libxfs_dir_ino_validate(mp, pip.i_ino))
 		pip.i_ino = mp->m_sb.sb_rootino;
 
+	/*
+	 * gather up the names to put back, with "." and ".." first so
+	 * that a bulk rebuild puts them at the start of the first block
+	 */
+	memset(&bld, 0, sizeof(bld));
+	bld.mp = mp;
+	bld.ip = ip;
+	bld.geo = mp->m_dir_geo;
+	bld.names = malloc((hashtab->nents + 2) * sizeof(*bld.names));
+	if (!bld.names)
+		do_error(_("malloc failed in %s (%zu bytes)\n"), __func__,
+			(hashtab->nents + 2) * sizeof(*bld.names));
+
+	memset(&dot, 0, sizeof(dot));
+	dot.name = xfs_name_dot;
+	dot.inum = ino;
+	dot.hashval = mp->m_dirnameops->hashname(&dot.name);
+	dotdot = dot;
+	dotdot.name = xfs_name_dotdot;
+	dotdot.inum = pip.i_ino;
+	dotdot.hashval = mp->m_dirnameops->hashname(&dotdot.name);
+	bld.names[bld.nnames++] = &dot;
+	bld.names[bld.nnames++] = &dotdot;
+
+	for (p = hashtab->ents; p < hashtab->ents + hashtab->nents; p++) {
+		if (p->name.name[0] == '/' || (p->name.name[0] == '.' &&
+				(p->name.len == 1 || (p->name.len == 2 &&
+						p->name.name[1] == '.'))))
+			continue;
+		bld.names[bld.nnames++] = p;
+	}
+	bulk = !dir_build_fits_block(&bld);
+
+again:
 	libxfs_defer_init(&dfops, &firstblock);
 
 	nres = XFS_REMOVE_SPACE_RES(mp);
@@ -1307,10 +1895,18 @@ longform_dir2_rebuild(
 
 	ASSERT(done);
 
-	error = -libxfs_dir_init(tp, ip, &pip);
-	if (error) {
-		do_warn(_("xfs_dir_init failed -- error - %d\n"), error);
-		goto out_bmap_cancel;
+	if (bulk) {
+		/* the data blocks set the size again as they're added */
+		ASSERT(ip->i_d.di_format == XFS_DINODE_FMT_EXTENTS);
+		ip->i_d.di_size = 0;
+		libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	} else {
+		error = -libxfs_dir_init(tp, ip, &pip);
+		if (error) {
+			do_warn(_("xfs_dir_init failed -- error - %d\n"),
+				error);
+			goto out_bmap_cancel;
+		}
 	}
 
 	error = -libxfs_defer_finish(&tp, &dfops, ip);
@@ -1320,9 +1916,27 @@ longform_dir2_rebuild(
 	if (ino == mp->m_sb.sb_rootino)
 		need_root_dotdot = 0;
 
+	if (bulk) {
+		if (!longform_dir2_build(&bld))
+			goto out;
+
+		/*
+		 * Whatever was built is only part of the directory, so trash
+		 * it again and add the entries one at a time instead.  The
+		 * new directory blocks are still dirty in the cache, and once
+		 * freed their blocks can come back as buffers of another size,
+		 * so write them out first lest they land on top later.
+		 */
+		do_warn(
+_("rebuilding directory inode %" PRIu64 " one entry at a time\n"), ino);
+		libxfs_bcache_flush();
+		bulk = 0;
+		goto again;
+	}
+
 	/* go through the hash list and re-add the inodes */
 
-	for (p = hashtab->first; p; p = p->nextbyorder) {
+	for (p = hashtab->ents; p < hashtab->ents + hashtab->nents; p++) {
 
 		if (p->name.name[0] == '/' || (p->name.name[0] == '.' &&
 				(p->name.len == 1 || (p->name.len == 2 &&
@@ -1357,13 +1971,13 @@ _("name create failed in ino %" PRIu64 " (%d), filesystem may be out of space\n"
 
 		libxfs_trans_commit(tp);
 	}
-
-	return;
+	goto out;
 
 out_bmap_cancel:
 	libxfs_defer_cancel(&dfops);
 	libxfs_trans_cancel(tp);
-	return;
+out:
+	free(bld.names);
 }
 
 
@@ -3117,7 +3731,7 @@ check_for_orphaned_inodes(
 
 static void
 traverse_function(
-	work_queue_t		*wq,
+	struct workqueue	*wq,
 	xfs_agnumber_t 		agno,
 	void			*arg)
 {
@@ -3146,7 +3760,7 @@ traverse_function(
 
 		for (i = 0; i < XFS_INODES_PER_CHUNK; i++)  {
 			if (inode_isadir(irec, i))
-				process_dir_inode(wq->mp, agno, irec, i);
+				process_dir_inode(wq->wq_ctx, agno, irec, i);
 		}
 	}
 	cleanup_inode_prefetch(pf_args);
@@ -3191,6 +3805,13 @@ phase6(xfs_mount_t *mp)
 
 	do_log(_("Phase 6 - check inode connectivity...\n"));
 
+	/*
+	 * Phases 3 and 4 fix inodes by writing their cluster buffers directly,
+	 * so anything cached before now (e.g. the realtime inodes read in at
+	 * mount time) may be out of date.
+	 */
+	libxfs_icache_invalidate();
+
 	incore_ext_teardown(mp);
 
 	add_ino_ex_data(mp);
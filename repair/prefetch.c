@@ -1,5 +1,6 @@
 #include "libxfs.h"
 #include <pthread.h>
+#include <sys/time.h>
 #include "avl.h"
 #include "btree.h"
 #include "globals.h"
@@ -14,6 +15,7 @@
 #include "threads.h"
 #include "prefetch.h"
 #include "progress.h"
+#include "numa.h"
 
 int do_prefetch = 1;
 
@@ -34,6 +36,29 @@ static int		pf_batch_fsbs;
 
 static void		pf_read_inode_dirs(prefetch_args_t *, xfs_buf_t *);
 
+/*
+ * Directory block map.
+ *
+ * Phase 3 records where every directory's blocks are, as runs of whole
+ * directory blocks in the AG the blocks live in.  Phase 6 then reads
+ * them in disk order as it sweeps through the AG's inode clusters,
+ * rather than walking each directory's extent list and bmap btree again
+ * and reading its blocks in whatever order they come.
+ */
+struct pf_dirmap_ext {
+	xfs_agblock_t		agbno;
+	xfs_extlen_t		len;
+};
+
+typedef struct pf_dirmap {
+	pthread_mutex_t		lock;
+	struct pf_dirmap_ext	*exts;
+	int			nexts;
+	int			maxexts;
+} pf_dirmap_t;
+
+static pf_dirmap_t	*pf_dirmaps;
+
 /*
  * Buffer priorities for the libxfs cache
  *
@@ -122,7 +147,13 @@ pf_queue_io(
 	if (!bp)
 		return;
 
-	if (bp->b_flags & LIBXFS_B_UPTODATE) {
+	/*
+	 * A dirty buffer that was never read holds new contents that the
+	 * repair code built in memory, e.g. a directory block allocated by a
+	 * phase 6 rebuild over blocks an earlier scan recorded.  Reading the
+	 * disk into it would throw those away.
+	 */
+	if (bp->b_flags & (LIBXFS_B_UPTODATE | LIBXFS_B_DIRTY)) {
 		if (B_IS_INODE(flag))
 			pf_read_inode_dirs(args, bp);
 		XFS_BUF_SET_PRIORITY(bp, XFS_BUF_PRIORITY(bp) +
@@ -420,6 +451,10 @@ pf_read_inode_dirs(
 				args->dirs_only))
 			continue;
 
+		/* the directory blocks are queued from the dirmap */
+		if (args->dirs_only && pf_dirmaps)
+			continue;
+
 		/*
 		 * do some checks on the inode to see if we can prefetch
 		 * its directory data. It's a cut down version of
@@ -675,6 +710,79 @@ pf_io_worker(
 	return NULL;
 }
 
+static int
+pf_dirmap_ext_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct pf_dirmap_ext *ea = a;
+	const struct pf_dirmap_ext *eb = b;
+
+	if (ea->agbno != eb->agbno)
+		return ea->agbno < eb->agbno ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Sort the directory block runs of an AG and join up the ones that touch
+ * or overlap, so they can be queued in disk order.
+ */
+static void
+pf_dirmap_sort(
+	pf_dirmap_t		*dm)
+{
+	struct pf_dirmap_ext	*ext;
+	struct pf_dirmap_ext	*last;
+
+	if (!dm->nexts)
+		return;
+
+	qsort(dm->exts, dm->nexts, sizeof(*dm->exts), pf_dirmap_ext_cmp);
+	last = dm->exts;
+	for (ext = dm->exts + 1; ext < dm->exts + dm->nexts; ext++) {
+		if (ext->agbno <= last->agbno + last->len) {
+			last->len = max(last->agbno + last->len,
+					ext->agbno + ext->len) - last->agbno;
+			continue;
+		}
+		*++last = *ext;
+	}
+	dm->nexts = last - dm->exts + 1;
+}
+
+/*
+ * Queue every directory block in the AG's map that starts before @end,
+ * starting from the run at *@idx.
+ */
+static void
+pf_queue_dirmap(
+	prefetch_args_t		*args,
+	int			*idx,
+	xfs_agblock_t		end)
+{
+	pf_dirmap_t		*dm = &pf_dirmaps[args->agno];
+	struct pf_dirmap_ext	*ext;
+	struct xfs_buf_map	map;
+	int			fsbcount = mp->m_dir_geo->fsbcount;
+
+	for (; *idx < dm->nexts; (*idx)++) {
+		ext = &dm->exts[*idx];
+		if (ext->agbno >= end)
+			break;
+
+		pftrace("queuing dir blocks %u-%u in AG %d", ext->agbno,
+			ext->agbno + ext->len - 1, args->agno);
+		map.bm_len = XFS_FSB_TO_BB(mp, fsbcount);
+		while (ext->len >= fsbcount) {
+			map.bm_bn = XFS_AGB_TO_DADDR(mp, args->agno,
+						ext->agbno);
+			pf_queue_io(args, &map, 1, B_DIR_META);
+			ext->agbno += fsbcount;
+			ext->len -= fsbcount;
+		}
+	}
+}
+
 static int
 pf_create_prefetch_thread(
 	prefetch_args_t		*args);
@@ -687,16 +795,27 @@ pf_queuing_worker(
 	int			num_inos;
 	ino_tree_node_t		*irec;
 	ino_tree_node_t		*cur_irec;
+	ino_tree_node_t		*last_irec;
 	int			blks_per_cluster;
 	xfs_agblock_t		bno;
 	int			i;
 	int			err;
 	uint64_t		sparse;
+	int			dmidx = 0;
+	int			dirmap = args->dirs_only && pf_dirmaps;
 
 	blks_per_cluster = mp->m_inode_cluster_size >> mp->m_sb.sb_blocklog;
 	if (blks_per_cluster == 0)
 		blks_per_cluster = 1;
 
+	/*
+	 * With -o numa, run on the node owning this AG and let the I/O
+	 * threads inherit that, so the buffers they read are allocated there.
+	 * This thread is usually started by the queuing thread of the previous
+	 * AG, so whatever binding it inherited may be for the wrong node.
+	 */
+	numa_bind_ag(args->agno);
+
 	for (i = 0; i < PF_THREAD_COUNT; i++) {
 		err = pthread_create(&args->io_threads[i], NULL,
 				pf_io_worker, args);
@@ -716,7 +835,16 @@ pf_queuing_worker(
 	}
 	pftrace("starting prefetch for AG %d", args->agno);
 
-	for (irec = findfirst_inode_rec(args->agno); irec != NULL;
+	if (dirmap)
+		pf_dirmap_sort(&pf_dirmaps[args->agno]);
+
+	if (!args->start_agino)
+		irec = findfirst_inode_rec(args->agno);
+	else
+		find_inode_rec_range(mp, args->agno, args->start_agino,
+				args->end_agino, &irec, &last_irec);
+
+	for (; irec != NULL && irec->ino_startnum < args->end_agino;
 			irec = next_ino_rec(irec)) {
 
 		cur_irec = irec;
@@ -727,6 +855,12 @@ pf_queuing_worker(
 			num_inos += XFS_INODES_PER_CHUNK;
 		}
 
+		/* directory blocks up to the end of this inode chunk */
+		if (dirmap)
+			pf_queue_dirmap(args, &dmidx,
+				XFS_AGINO_TO_AGBNO(mp, cur_irec->ino_startnum) +
+				mp->m_ialloc_blks);
+
 		if (args->dirs_only && cur_irec->ino_isa_dir == 0)
 			continue;
 #ifdef XR_PF_TRACE
@@ -773,6 +907,16 @@ pf_queuing_worker(
 		} while (num_inos < mp->m_ialloc_inos);
 	}
 
+	if (dirmap) {
+		pf_dirmap_t	*dm = &pf_dirmaps[args->agno];
+
+		/* everything is queued, this AG's map isn't needed any more */
+		pf_queue_dirmap(args, &dmidx, NULLAGBLOCK);
+		free(dm->exts);
+		dm->exts = NULL;
+		dm->nexts = dm->maxexts = 0;
+	}
+
 	pthread_mutex_lock(&args->lock);
 
 	pftrace("finished queuing inodes for AG %d (inode_bufs_queued = %d)",
@@ -826,6 +970,8 @@ void
 init_prefetch(
 	xfs_mount_t		*pmp)
 {
+	xfs_agnumber_t		i;
+
 	mp = pmp;
 	mp_fd = libxfs_device_to_fd(mp->m_ddev_targp->dev);
 	pf_max_bytes = sysconf(_SC_PAGE_SIZE) << 7;
@@ -833,21 +979,119 @@ init_prefetch(
 	pf_max_fsbs = pf_max_bytes >> mp->m_sb.sb_blocklog;
 	pf_batch_bytes = DEF_BATCH_BYTES;
 	pf_batch_fsbs = DEF_BATCH_BYTES >> (mp->m_sb.sb_blocklog + 1);
+
+	pf_dirmaps = calloc(mp->m_sb.sb_agcount, sizeof(pf_dirmap_t));
+	if (pf_dirmaps == NULL)
+		do_error(_("couldn't allocate directory block map\n"));
+	for (i = 0; i < mp->m_sb.sb_agcount; i++)
+		pthread_mutex_init(&pf_dirmaps[i].lock, NULL);
 }
 
-prefetch_args_t *
-start_inode_prefetch(
+static void
+pf_dirmap_add(
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len)
+{
+	pf_dirmap_t		*dm;
+	struct pf_dirmap_ext	*ext;
+	xfs_agblock_t		agbno = XFS_FSB_TO_AGBNO(mp, fsbno);
+
+	dm = &pf_dirmaps[XFS_FSB_TO_AGNO(mp, fsbno)];
+	pthread_mutex_lock(&dm->lock);
+
+	/* directories are mostly laid out in order, so try appending */
+	ext = dm->nexts ? &dm->exts[dm->nexts - 1] : NULL;
+	if (ext && ext->agbno + ext->len == agbno) {
+		ext->len += len;
+		goto out;
+	}
+
+	if (dm->nexts == dm->maxexts) {
+		dm->maxexts = dm->maxexts ? dm->maxexts * 2 : 64;
+		dm->exts = realloc(dm->exts, dm->maxexts * sizeof(*dm->exts));
+		if (dm->exts == NULL)
+			do_error(_("couldn't grow directory block map\n"));
+	}
+	ext = &dm->exts[dm->nexts++];
+	ext->agbno = agbno;
+	ext->len = len;
+out:
+	pthread_mutex_unlock(&dm->lock);
+}
+
+/*
+ * Record the blocks of a directory that phase 3 found to be good, for
+ * phase 6 to read ahead.  Only directory blocks that sit in one extent
+ * are recorded; the rare one that's split over several is read when
+ * phase 6 gets to it.
+ */
+void
+pf_record_dir_blocks(
+	blkmap_t		*blkmap)
+{
+	bmap_ext_t		*bmp;
+	xfs_fileoff_t		off;
+	xfs_fsblock_t		bno;
+	xfs_filblks_t		len;
+	xfs_filblks_t		skip;
+	int			fsbcount;
+
+	if (!pf_dirmaps || !blkmap)
+		return;
+
+	fsbcount = mp->m_dir_geo->fsbcount;
+	for (bmp = blkmap->exts; bmp < blkmap->exts + blkmap->nexts; bmp++) {
+		off = bmp->startoff;
+		bno = bmp->startblock;
+		len = bmp->blockcount;
+
+		/* trim to whole directory blocks */
+		skip = (fsbcount - off % fsbcount) % fsbcount;
+		if (skip >= len)
+			continue;
+		bno += skip;
+		len -= skip;
+		len -= len % fsbcount;
+		if (len)
+			pf_dirmap_add(bno, len);
+	}
+}
+
+/*
+ * Throw the directory block map away once phase 6 is done with it.  A
+ * resumed run throws it away up front, as it has skipped the phase 3 that
+ * would have filled it, and phase 6 then goes back to finding directory
+ * blocks through the directory inodes.
+ */
+void
+pf_forget_dir_blocks(void)
+{
+	xfs_agnumber_t		i;
+
+	if (!pf_dirmaps)
+		return;
+
+	for (i = 0; i < mp->m_sb.sb_agcount; i++) {
+		free(pf_dirmaps[i].exts);
+		pthread_mutex_destroy(&pf_dirmaps[i].lock);
+	}
+	free(pf_dirmaps);
+	pf_dirmaps = NULL;
+}
+
+static prefetch_args_t *
+pf_alloc_args(
 	xfs_agnumber_t		agno,
+	xfs_agino_t		start_agino,
+	xfs_agino_t		end_agino,
 	int			dirs_only,
-	prefetch_args_t		*prev_args)
+	long			max_queue)
 {
 	prefetch_args_t		*args;
-	long			max_queue;
-
-	if (!do_prefetch || agno >= mp->m_sb.sb_agcount)
-		return NULL;
 
 	args = calloc(1, sizeof(prefetch_args_t));
+	if (!args)
+		do_error(_("couldn't allocate prefetch args\n"));
 
 	btree_init(&args->io_queue);
 	if (pthread_mutex_init(&args->lock, NULL) != 0)
@@ -857,21 +1101,46 @@ start_inode_prefetch(
 	if (pthread_cond_init(&args->start_processing, NULL) != 0)
 		do_error(_("failed to initialize prefetch cond var\n"));
 	args->agno = agno;
+	args->start_agino = start_agino;
+	args->end_agino = end_agino;
 	args->dirs_only = dirs_only;
+	sem_init(&args->ra_count, 0, max_queue);
+	return args;
+}
+
+/*
+ * Start prefetching the inode chunks of @agno from @start_agino up to
+ * @end_agino, sharing the read ahead budget with @nqueues other
+ * prefetch-and-process loops running at the same time.
+ */
+static prefetch_args_t *
+start_inode_prefetch_range(
+	xfs_agnumber_t		agno,
+	xfs_agino_t		start_agino,
+	xfs_agino_t		end_agino,
+	int			dirs_only,
+	prefetch_args_t		*prev_args,
+	int			nqueues)
+{
+	prefetch_args_t		*args;
+	long			max_queue;
+
+	if (!do_prefetch || agno >= mp->m_sb.sb_agcount)
+		return NULL;
 
 	/*
 	 * use only 1/8 of the libxfs cache as we are only counting inodes
 	 * and not any other associated metadata like directories
 	 */
 
-	max_queue = libxfs_bcache->c_maxcount / thread_count / 8;
+	max_queue = libxfs_bcache->c_maxcount / nqueues / 8;
 	if (mp->m_inode_cluster_size > mp->m_sb.sb_blocksize)
 		max_queue = max_queue *
 			(mp->m_inode_cluster_size >> mp->m_sb.sb_blocklog) /
 			mp->m_ialloc_blks;
 
-	sem_init(&args->ra_count, 0, max_queue);
-
+	args = pf_alloc_args(agno, start_agino, end_agino, dirs_only,
+			max_queue);
 	if (!prev_args) {
 		if (!pf_create_prefetch_thread(args))
 			return NULL;
@@ -888,6 +1157,16 @@ start_inode_prefetch(
 	return args;
 }
 
+prefetch_args_t *
+start_inode_prefetch(
+	xfs_agnumber_t		agno,
+	int			dirs_only,
+	prefetch_args_t		*prev_args)
+{
+	return start_inode_prefetch_range(agno, 0, NULLAGINO, dirs_only,
+					  prev_args, thread_count);
+}
+
 /*
  * prefetch_ag_range runs a prefetch-and-process loop across a range of AGs. It
  * begins with @start+ag, and finishes with @end_ag - 1 (i.e. does not prefetch
@@ -910,15 +1189,16 @@ start_inode_prefetch(
  */
 static void
 prefetch_ag_range(
-	struct work_queue	*work,
+	struct workqueue	*work,
 	xfs_agnumber_t		start_ag,
 	xfs_agnumber_t		end_ag,
 	bool			dirs_only,
-	void			(*func)(struct work_queue *,
+	void			(*func)(struct workqueue *,
 					xfs_agnumber_t, void *))
 {
 	int			i;
 	struct prefetch_args	*pf_args[2];
+	struct timeval		start;
 
 	pf_args[start_ag & 1] = start_inode_prefetch(start_ag, dirs_only, NULL);
 	for (i = start_ag; i < end_ag; i++) {
@@ -926,20 +1206,25 @@ prefetch_ag_range(
 		if (i + 1 < end_ag)
 			pf_args[(~i) & 1] = start_inode_prefetch(i + 1,
 						dirs_only, pf_args[i & 1]);
+		/* the prefetch threads bind themselves, see pf_queuing_worker */
+		numa_bind_ag(i);
+		gettimeofday(&start, NULL);
 		func(work, i, pf_args[i & 1]);
+		numa_ag_done(i, &start);
 	}
+	numa_unbind();
 }
 
 struct pf_work_args {
 	xfs_agnumber_t	start_ag;
 	xfs_agnumber_t	end_ag;
 	bool		dirs_only;
-	void		(*func)(struct work_queue *, xfs_agnumber_t, void *);
+	void		(*func)(struct workqueue *, xfs_agnumber_t, void *);
 };
 
 static void
 prefetch_ag_range_work(
-	struct work_queue	*work,
+	struct workqueue	*work,
 	xfs_agnumber_t		unused,
 	void			*args)
 {
@@ -950,6 +1235,132 @@ prefetch_ag_range_work(
 	free(args);
 }
 
+/*
+ * Splitting an AG into slices costs a set of prefetch threads per slice, so
+ * don't make slices of fewer inode chunks than this.
+ */
+#define PF_MIN_SLICE_CHUNKS	256
+
+struct pf_slice_args {
+	xfs_agino_t	start_agino;
+	xfs_agino_t	end_agino;
+	int		nworkers;
+	bool		read_ahead;
+	void		(*func)(struct workqueue *, xfs_agnumber_t, void *);
+};
+
+static void
+prefetch_slice_work(
+	struct workqueue	*work,
+	xfs_agnumber_t		agno,
+	void			*args)
+{
+	struct pf_slice_args	*sargs = args;
+	prefetch_args_t		*pf_args = NULL;
+
+	if (sargs->read_ahead)
+		pf_args = start_inode_prefetch_range(agno, sargs->start_agino,
+				sargs->end_agino, 0, NULL, sargs->nworkers);
+
+	/*
+	 * The processing side only learns the slice from the prefetch args,
+	 * so without read ahead hand it args that nothing reads into.
+	 */
+	if (!pf_args) {
+		pf_args = pf_alloc_args(agno, sargs->start_agino,
+				sargs->end_agino, 0, 0);
+		pf_args->can_start_processing = 1;
+	}
+	sargs->func(work, agno, pf_args);
+	free(args);
+}
+
+static void
+queue_slice(
+	struct workqueue	*queue,
+	xfs_agnumber_t		agno,
+	xfs_agino_t		start_agino,
+	xfs_agino_t		end_agino,
+	bool			read_ahead,
+	void			(*func)(struct workqueue *,
+					xfs_agnumber_t, void *))
+{
+	struct pf_slice_args	*sargs;
+
+	sargs = malloc(sizeof(struct pf_slice_args));
+	if (!sargs)
+		do_error(_("couldn't allocate AG slice\n"));
+	sargs->start_agino = start_agino;
+	sargs->end_agino = end_agino;
+	sargs->nworkers = queue->thread_count;
+	sargs->read_ahead = read_ahead;
+	sargs->func = func;
+	queue_ag_work(queue, prefetch_slice_work, agno, sargs);
+}
+
+/*
+ * With fewer AGs than CPUs, processing whole AGs leaves CPUs idle however
+ * big the AGs are.  Cut each AG into slices of whole inode allocation
+ * units with about the same number of inode records, each with its own
+ * prefetch, aiming for two slices per CPU over the whole filesystem so
+ * that a slow slice doesn't hold everything up.  A slice boundary is
+ * always at the start of an inode record and a multiple of
+ * m_ialloc_inos, so the records processed together by
+ * process_inode_chunk() never straddle slices.
+ */
+static void
+do_inode_prefetch_slices(
+	struct xfs_mount	*mp,
+	void			(*func)(struct workqueue *,
+					xfs_agnumber_t, void *),
+	bool			read_ahead)
+{
+	struct workqueue	queue;
+	ino_tree_node_t		*irec;
+	ino_tree_node_t		*next;
+	xfs_agnumber_t		agno;
+	xfs_agino_t		start;
+	int			nworkers = libxfs_nproc();
+	int			nslices;
+	int			nrecs;
+	int			per_slice;
+	int			i;
+
+	create_work_queue(&queue, mp, nworkers);
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		nrecs = 0;
+		for (irec = findfirst_inode_rec(agno); irec;
+		     irec = next_ino_rec(irec))
+			nrecs++;
+
+		nslices = min(howmany(2 * nworkers, mp->m_sb.sb_agcount),
+			      nrecs / PF_MIN_SLICE_CHUNKS);
+		if (nslices <= 1) {
+			queue_slice(&queue, agno, 0, NULLAGINO, read_ahead,
+				    func);
+			continue;
+		}
+
+		per_slice = howmany(nrecs, nslices);
+		start = 0;
+		i = 0;
+		for (irec = findfirst_inode_rec(agno); irec;
+		     irec = next_ino_rec(irec)) {
+			if (++i < per_slice)
+				continue;
+			next = next_ino_rec(irec);
+			if (!next || next->ino_startnum % mp->m_ialloc_inos)
+				continue;
+			queue_slice(&queue, agno, start, next->ino_startnum,
+				    read_ahead, func);
+			start = next->ino_startnum;
+			i = 0;
+		}
+		queue_slice(&queue, agno, start, NULLAGINO, read_ahead, func);
+	}
+	destroy_work_queue(&queue);
+}
+
 /*
  * Do inode prefetch in the most optimal way for the context under which repair
  * has been run.
@@ -958,16 +1369,29 @@ void
 do_inode_prefetch(
 	struct xfs_mount	*mp,
 	int			stride,
-	void			(*func)(struct work_queue *,
+	void			(*func)(struct workqueue *,
 					xfs_agnumber_t, void *),
 	bool			check_cache,
 	bool			dirs_only)
 {
 	int			i;
-	struct work_queue	queue;
-	struct work_queue	*queues;
+	struct workqueue	queue;
+	struct workqueue	*queues;
 	int			queues_started = 0;
 
+	/*
+	 * Phases 3 and 4 process AGs a slice at a time if there are too few
+	 * AGs to keep the CPUs busy.  That reads from all over each AG at
+	 * once, so only do it if the storage can take parallel I/O, i.e. the
+	 * stride isn't zero.  As below, there's no point reading ahead if
+	 * everything is still in the cache.
+	 */
+	if (stride && !dirs_only && mp->m_sb.sb_agcount < libxfs_nproc()) {
+		do_inode_prefetch_slices(mp, func,
+			!(check_cache && !libxfs_bcache_overflowed()));
+		return;
+	}
+
 	/*
 	 * If the previous phases of repair have not overflowed the buffer
 	 * cache, then we don't need to re-read any of the metadata in the
@@ -975,10 +1399,10 @@ do_inode_prefetch(
 	 * CPU to maximise parallelism of the queue to be processed.
 	 */
 	if (check_cache && !libxfs_bcache_overflowed()) {
-		queue.mp = mp;
+		queue.wq_ctx = mp;
 		create_work_queue(&queue, mp, libxfs_nproc());
 		for (i = 0; i < mp->m_sb.sb_agcount; i++)
-			queue_work(&queue, func, i, NULL);
+			queue_ag_work(&queue, func, i, NULL);
 		destroy_work_queue(&queue);
 		return;
 	}
@@ -988,7 +1412,7 @@ do_inode_prefetch(
 	 * directly after each AG is queued.
 	 */
 	if (!stride) {
-		queue.mp = mp;
+		queue.wq_ctx = mp;
 		prefetch_ag_range(&queue, 0, mp->m_sb.sb_agcount,
 				  dirs_only, func);
 		return;
@@ -997,7 +1421,7 @@ do_inode_prefetch(
 	/*
 	 * create one worker thread for each segment of the volume
 	 */
-	queues = malloc(thread_count * sizeof(work_queue_t));
+	queues = malloc(thread_count * sizeof(struct workqueue));
 	for (i = 0; i < thread_count; i++) {
 		struct pf_work_args *wargs;
 
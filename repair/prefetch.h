@@ -4,7 +4,7 @@
 #include <semaphore.h>
 #include "incore.h"
 
-struct work_queue;
+struct workqueue;
 
 extern int 	do_prefetch;
 
@@ -18,6 +18,8 @@ typedef struct prefetch_args {
 	pthread_cond_t		start_reading;
 	pthread_cond_t		start_processing;
 	int			agno;
+	xfs_agino_t		start_agino;	/* inode chunks to read, */
+	xfs_agino_t		end_agino;	/* NULLAGINO for all */
 	int			dirs_only;
 	volatile int		can_start_reading;
 	volatile int		can_start_processing;
@@ -35,6 +37,15 @@ void
 init_prefetch(
 	xfs_mount_t		*pmp);
 
+struct blkmap;
+
+void
+pf_record_dir_blocks(
+	struct blkmap		*blkmap);
+
+void
+pf_forget_dir_blocks(void);
+
 prefetch_args_t *
 start_inode_prefetch(
 	xfs_agnumber_t		agno,
@@ -45,7 +56,7 @@ void
 do_inode_prefetch(
 	struct xfs_mount	*mp,
 	int			stride,
-	void			(*func)(struct work_queue *,
+	void			(*func)(struct workqueue *,
 					xfs_agnumber_t, void *),
 	bool			check_cache,
 	bool			dirs_only);
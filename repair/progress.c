@@ -383,8 +383,11 @@ timestamp(int end, int phase, char *buf)
 	time_t    now;
 	struct tm *tmp;
 
-	if (verbose > 1)
+	if (verbose > 1) {
 		cache_report(stderr, "libxfs_bcache", libxfs_bcache);
+		cache_report(stderr, "libxfs_icache", libxfs_icache);
+		kmem_report(stderr);
+	}
 
 	now = time(NULL);
 
@@ -25,6 +25,7 @@
 #include "protos.h"
 #include "err_protos.h"
 #include "rt.h"
+#include "threads.h"
 
 #define xfs_highbit64 libxfs_highbit64	/* for XFS_RTBLOCKLOG macro */
 
@@ -51,6 +52,117 @@ rtinit(xfs_mount_t *mp)
 	_("couldn't allocate memory for incore realtime summary info.\n"));
 }
 
+/*
+ * The bitmap is generated in units of this many bitmap blocks, spread
+ * over a thread per CPU.  A unit only writes its own bitmap words and the
+ * summary counters of free extents that start in its bitmap blocks, so
+ * the threads never touch the same memory.  Free extents that run across
+ * the end of a unit are left for generate_rtinfo to count afterwards.
+ */
+#define RTINFO_UNIT_BLOCKS	64
+
+struct rtinfo_unit {
+	xfs_rtblock_t	start;		/* first rt extent of the unit */
+	xfs_rtblock_t	end;		/* first rt extent after the unit */
+	xfs_rtblock_t	lead;		/* length of free extent at start */
+	xfs_rtblock_t	tail;		/* start of free extent at end */
+	__uint64_t	nfree;		/* free rt extents in the unit */
+};
+
+struct rtinfo {
+	xfs_rtword_t		*words;
+	xfs_suminfo_t		*sumcompute;
+	struct rtinfo_unit	*units;
+};
+
+/* count a free extent of [start, end) in the summary */
+static void
+rtinfo_count(
+	xfs_mount_t	*mp,
+	xfs_suminfo_t	*sumcompute,
+	xfs_rtblock_t	start,
+	xfs_rtblock_t	end)
+{
+	int		log;
+	int		offs;
+
+	log = XFS_RTBLOCKLOG(end - start);
+	offs = XFS_SUMOFFS(mp, log, start / (mp->m_sb.sb_blocksize * NBBY));
+	sumcompute[offs]++;
+}
+
+/*
+ * Fill in the bitmap words for one unit, 64 extents at a time, and count
+ * the free extents that lie entirely inside it.  The free extent that
+ * starts the unit (if any) is only measured, in lead, and the one still
+ * open at the end of it is only noted, in tail.
+ */
+static void
+generate_rtinfo_unit(
+	struct workqueue	*wq,
+	xfs_agnumber_t		unit,
+	void			*arg)
+{
+	struct rtinfo		*rti = arg;
+	struct rtinfo_unit	*u = &rti->units[unit];
+	xfs_mount_t		*mp = wq->wq_ctx;
+	xfs_rtword_t		*words;
+	xfs_rtblock_t		extno;
+	xfs_rtblock_t		start_ext = 0;
+	__uint64_t		mask;
+	__uint64_t		full;
+	__uint64_t		bits;
+	int			in_extent = 0;
+	int			pos;
+	int			n;
+
+	words = rti->words + u->start / (sizeof(xfs_rtword_t) * NBBY);
+	u->lead = 0;
+	u->tail = u->end;
+	u->nfree = 0;
+
+	for (extno = u->start; extno < u->end; extno += 64) {
+		mask = get_rtbmap_free(extno);
+		n = min(u->end - extno, 64);
+		full = n < 64 ? xfs_mask64lo(n) : ~0ULL;
+		mask &= full;
+		*words++ = (xfs_rtword_t)mask;
+		*words++ = (xfs_rtword_t)(mask >> 32);
+
+		/* the common cases: nothing changes in this word */
+		if (mask == (in_extent ? full : 0))
+			continue;
+
+		/* find each boundary between free and used in the word */
+		for (pos = 0; pos < n; ) {
+			bits = (in_extent ? ~mask : mask) >> pos;
+			if (!bits)
+				break;
+			pos += xfs_lowbit64(bits);
+			if (pos >= n)
+				break;
+			if (!in_extent) {
+				start_ext = extno + pos;
+				in_extent = 1;
+				continue;
+			}
+			u->nfree += extno + pos - start_ext;
+			if (start_ext == u->start)
+				u->lead = extno + pos - start_ext;
+			else
+				rtinfo_count(mp, rti->sumcompute, start_ext,
+						extno + pos);
+			in_extent = 0;
+		}
+	}
+	if (in_extent) {
+		u->nfree += u->end - start_ext;
+		if (start_ext == u->start)
+			u->lead = u->end - u->start;
+		u->tail = start_ext;
+	}
+}
+
 /*
  * generate the real-time bitmap and summary info based on the
  * incore realtime extent map.
@@ -60,69 +172,69 @@ generate_rtinfo(xfs_mount_t	*mp,
 		xfs_rtword_t	*words,
 		xfs_suminfo_t	*sumcompute)
 {
-	xfs_rtblock_t	extno;
-	xfs_rtblock_t	start_ext;
-	int		bitsperblock;
-	int		bmbno;
-	xfs_rtword_t	freebit;
-	xfs_rtword_t	bits;
-	int		start_bmbno;
-	int		i;
-	int		offs;
-	int		log;
-	int		len;
-	int		in_extent;
+	struct rtinfo		rti;
+	struct rtinfo_unit	*u;
+	struct workqueue	wq;
+	xfs_rtblock_t		unitsize;
+	xfs_rtblock_t		start_ext;
+	int			nunits;
+	int			in_extent;
+	int			i;
 
 	ASSERT(mp->m_rbmip == NULL);
 
-	bitsperblock = mp->m_sb.sb_blocksize * NBBY;
-	extno = start_ext = 0;
-	bmbno = in_extent = start_bmbno = 0;
+	if (mp->m_sb.sb_rextents == 0)
+		return(0);
+
+	unitsize = (xfs_rtblock_t)RTINFO_UNIT_BLOCKS *
+			mp->m_sb.sb_blocksize * NBBY;
+	nunits = howmany(mp->m_sb.sb_rextents, unitsize);
+
+	rti.words = words;
+	rti.sumcompute = sumcompute;
+	rti.units = calloc(nunits, sizeof(struct rtinfo_unit));
+	if (!rti.units)
+		do_error(
+	_("couldn't allocate memory for realtime bitmap generation.\n"));
+
+	create_work_queue(&wq, mp, min(libxfs_nproc(), nunits));
+	for (i = 0; i < nunits; i++) {
+		u = &rti.units[i];
+		u->start = i * unitsize;
+		u->end = min(u->start + unitsize, mp->m_sb.sb_rextents);
+		queue_work(&wq, generate_rtinfo_unit, i, &rti);
+	}
+	destroy_work_queue(&wq);
 
 	/*
-	 * slower but simple, don't play around with trying to set
-	 * things one word at a time, just set bit as required.
-	 * Have to * track start and end (size) of each range of
-	 * free extents to set the summary info properly.
+	 * Now join up the free extents that run from one unit into the
+	 * next and count them.
 	 */
-	while (extno < mp->m_sb.sb_rextents)  {
-		freebit = 1;
-		*words = 0;
-		bits = 0;
-		for (i = 0; i < sizeof(xfs_rtword_t) * NBBY &&
-				extno < mp->m_sb.sb_rextents; i++, extno++)  {
-			if (get_rtbmap(extno) == XR_E_FREE)  {
-				sb_frextents++;
-				bits |= freebit;
+	start_ext = 0;
+	in_extent = 0;
+	for (i = 0; i < nunits; i++) {
+		u = &rti.units[i];
+		sb_frextents += u->nfree;
 
-				if (in_extent == 0) {
-					start_ext = extno;
-					start_bmbno = bmbno;
-					in_extent = 1;
-				}
-			} else if (in_extent == 1) {
-				len = (int) (extno - start_ext);
-				log = XFS_RTBLOCKLOG(len);
-				offs = XFS_SUMOFFS(mp, log, start_bmbno);
-				sumcompute[offs]++;
-				in_extent = 0;
+		if (u->lead) {
+			if (!in_extent)
+				start_ext = u->start;
+			if (u->lead == u->end - u->start) {
+				in_extent = 1;
+				continue;
 			}
-
-			freebit <<= 1;
+			rtinfo_count(mp, sumcompute, start_ext,
+					u->start + u->lead);
+		} else if (in_extent) {
+			rtinfo_count(mp, sumcompute, start_ext, u->start);
 		}
-		*words = bits;
-		words++;
-
-		if (extno % bitsperblock == 0)
-			bmbno++;
-	}
-	if (in_extent == 1) {
-		len = (int) (extno - start_ext);
-		log = XFS_RTBLOCKLOG(len);
-		offs = XFS_SUMOFFS(mp, log, start_bmbno);
-		sumcompute[offs]++;
+		in_extent = u->tail < u->end;
+		start_ext = u->tail;
 	}
+	if (in_extent)
+		rtinfo_count(mp, sumcompute, start_ext, mp->m_sb.sb_rextents);
 
+	free(rti.units);
 	return(0);
 }
 
@@ -24,9 +24,15 @@
 #include "protos.h"
 #include "err_protos.h"
 #include "xfs_multidisk.h"
+#include "threads.h"
 
 #define BSIZE	(1024 * 1024)
 
+#define PROBE_SIZE	(64 * 1024)	/* read at each likely AG boundary */
+#define PROBE_AGS	4		/* AG boundaries to try per geometry */
+#define SCAN_CHUNK	(4 * 1024 * 1024)	/* brute force scan read size */
+#define SCAN_WINDOW_MAX	(64ULL * 1024 * 1024 * 1024)
+
 /*
  * copy the fields of a superblock that are present in primary and
  * secondaries -- preserve fields that are different in the primary.
@@ -98,6 +104,56 @@ verify_sb_blocksize(xfs_sb_t *sb)
 	return 0;
 }
 
+/*
+ * Cheap test for a superblock magic number at the start of a sector, before
+ * going to the trouble of decoding and verifying the whole thing.
+ */
+static inline bool
+sb_magic_ok(
+	char		*buf)
+{
+	return *(__be32 *)buf == cpu_to_be32(XFS_SB_MAGIC);
+}
+
+/*
+ * See if the superblock in @buf is a usable secondary, and if so, whether
+ * the rest of the filesystem agrees with it.  Returns 1 with the superblock
+ * copied into @rsb if so.
+ */
+static int
+check_secondary_sb(
+	xfs_sb_t	*rsb,
+	char		*buf)
+{
+	xfs_sb_t	bufsb;
+	int		dirty;
+
+	if (!sb_magic_ok(buf))
+		return 0;
+
+	memset(&bufsb, 0, sizeof(xfs_sb_t));
+	libxfs_sb_from_disk(&bufsb, (xfs_dsb_t *)buf);
+	if (verify_sb(buf, &bufsb, 0) != XR_OK)
+		return 0;
+
+	do_warn(_("found candidate secondary superblock...\n"));
+
+	/*
+	 * found one.  now verify it by looking
+	 * for other secondaries.
+	 */
+	memmove(rsb, &bufsb, sizeof(xfs_sb_t));
+	rsb->sb_inprogress = 0;
+	copied_sunit = 1;
+
+	if (verify_set_primary_sb(rsb, 0, &dirty) == XR_OK)  {
+		do_warn(_("verified secondary superblock...\n"));
+		return 1;
+	}
+	do_warn(_("unable to verify superblock, continuing...\n"));
+	return 0;
+}
+
 /*
  * find a secondary superblock, copy it into the sb buffer.
  * start is the point to begin reading BSIZE bytes.
@@ -111,11 +167,8 @@ __find_secondary_sb(
 {
 	xfs_off_t	off;
 	xfs_sb_t	*sb;
-	xfs_sb_t	bufsb;
-	char		*c_bufsb;
 	int		done;
 	int		i;
-	int		dirty;
 	int		retval;
 	int		bsize;
 
@@ -126,9 +179,7 @@ __find_secondary_sb(
 		exit(1);
 	}
 
-	memset(&bufsb, 0, sizeof(xfs_sb_t));
 	retval = 0;
-	dirty = 0;
 	bsize = 0;
 
 	/*
@@ -153,30 +204,9 @@ __find_secondary_sb(
 		 * we don't know how big the sectors really are.
 		 */
 		for (i = 0; !done && i < bsize; i += BBSIZE)  {
-			c_bufsb = (char *)sb + i;
-			libxfs_sb_from_disk(&bufsb, (xfs_dsb_t *)c_bufsb);
-
-			if (verify_sb(c_bufsb, &bufsb, 0) != XR_OK)
-				continue;
-
-			do_warn(_("found candidate secondary superblock...\n"));
-
-			/*
-			 * found one.  now verify it by looking
-			 * for other secondaries.
-			 */
-			memmove(rsb, &bufsb, sizeof(xfs_sb_t));
-			rsb->sb_inprogress = 0;
-			copied_sunit = 1;
-
-			if (verify_set_primary_sb(rsb, 0, &dirty) == XR_OK)  {
-				do_warn(
-			_("verified secondary superblock...\n"));
+			if (check_secondary_sb(rsb, (char *)sb + i)) {
 				done = 1;
 				retval = 1;
-			} else  {
-				do_warn(
-			_("unable to verify superblock, continuing...\n"));
 			}
 		}
 	}
@@ -185,41 +215,271 @@ __find_secondary_sb(
 	return retval;
 }
 
+static void
+add_probe_geometry(
+	__uint64_t	*agbytes,
+	int		*nr,
+	__uint64_t	agsize,
+	int		blocklog)
+{
+	__uint64_t	bytes = agsize << blocklog;
+	int		i;
+
+	if (bytes < XFS_AG_MIN_BYTES || bytes > XFS_AG_MAX_BYTES)
+		return;
+	for (i = 0; i < *nr; i++)
+		if (agbytes[i] == bytes)
+			return;
+	agbytes[(*nr)++] = bytes;
+}
+
+/*
+ * Look for a secondary superblock at the first few AG boundaries implied by
+ * the geometries mkfs would most likely have chosen for a device this size:
+ * the default geometry for each block size, with and without stripe
+ * alignment, and power of two AG counts with the default block size.  Each
+ * guess costs a handful of small reads, so this is much quicker than
+ * scanning if it works.
+ */
 static int
-guess_default_geometry(
-	__uint64_t		*agsize,
-	__uint64_t		*agcount,
-	libxfs_init_t		*x)
+probe_secondary_sb(
+	xfs_sb_t		*rsb)
 {
 	struct fs_topology	ft;
-	int			blocklog;
+	__uint64_t		agbytes[2 * (XFS_MAX_BLOCKSIZE_LOG -
+					     XFS_MIN_BLOCKSIZE_LOG + 1) + 32];
+	__uint64_t		agsize;
+	__uint64_t		agcount;
 	__uint64_t		dblocks;
+	xfs_off_t		devbytes;
+	xfs_off_t		off;
+	char			*buf;
 	int			multidisk;
+	int			blocklog;
+	int			nr = 0;
+	int			retval = 0;
+	int			i, j;
 
 	memset(&ft, 0, sizeof(ft));
-	get_topology(x, &ft, 1);
-
-	/*
-	 * get geometry from get_topology result.
-	 * Use default block size (2^12)
-	 */
-	blocklog = 12;
+	get_topology(&x, &ft, 1);
 	multidisk = ft.dswidth | ft.dsunit;
-	dblocks = x->dsize >> (blocklog - BBSHIFT);
-	calc_default_ag_geometry(blocklog, dblocks, multidisk,
-				 agsize, agcount);
+	devbytes = (xfs_off_t)x.dsize << BBSHIFT;
+
+	/* the default block size first, it's by far the most likely */
+	for (i = -1; i <= XFS_MAX_BLOCKSIZE_LOG - XFS_MIN_BLOCKSIZE_LOG; i++) {
+		blocklog = i < 0 ? XFS_DFL_BLOCKSIZE_LOG :
+				   XFS_MIN_BLOCKSIZE_LOG + i;
+		if (i >= 0 && blocklog == XFS_DFL_BLOCKSIZE_LOG)
+			continue;
+		dblocks = x.dsize >> (blocklog - BBSHIFT);
+		calc_default_ag_geometry(blocklog, dblocks, multidisk,
+					 &agsize, &agcount);
+		add_probe_geometry(agbytes, &nr, agsize, blocklog);
+		calc_default_ag_geometry(blocklog, dblocks, !multidisk,
+					 &agsize, &agcount);
+		add_probe_geometry(agbytes, &nr, agsize, blocklog);
+	}
+	dblocks = x.dsize >> (XFS_DFL_BLOCKSIZE_LOG - BBSHIFT);
+	for (agcount = 2; agcount <= XFS_MAX_AGNUMBER && nr < ARRAY_SIZE(agbytes);
+	     agcount <<= 1)
+		add_probe_geometry(agbytes, &nr, howmany(dblocks, agcount),
+				   XFS_DFL_BLOCKSIZE_LOG);
+
+	buf = memalign(libxfs_device_alignment(), PROBE_SIZE);
+	if (!buf) {
+		do_error(
+	_("error finding secondary superblock -- failed to memalign buffer\n"));
+		exit(1);
+	}
+
+	for (i = 0; !retval && i < nr; i++) {
+		for (j = 1; !retval && j <= PROBE_AGS; j++) {
+			off = j * agbytes[i];
+			if (off + PROBE_SIZE > devbytes)
+				break;
+			if (pread(x.dfd, buf, PROBE_SIZE, off) != PROBE_SIZE)
+				break;
+			retval = check_secondary_sb(rsb, buf);
+		}
+		do_warn(".");
+	}
+
+	free(buf);
+	return retval;
+}
+
+/*
+ * Brute force scan state.  The device is scanned a window at a time, with
+ * a thread per CPU reading SCAN_CHUNK sized pieces of the window and noting
+ * every sector that looks like a valid superblock.  The candidates are then
+ * checked against the rest of the filesystem in disk order, just as a
+ * serial scan would, before moving on to the next window.
+ */
+struct sb_candidate {
+	xfs_off_t	off;
+	char		*buf;		/* XFS_MAX_SECTORSIZE bytes */
+};
+
+struct sb_scan {
+	pthread_mutex_t		lock;
+	xfs_off_t		next;	/* next chunk to read */
+	xfs_off_t		end;	/* end of this window */
+	struct sb_candidate	*cands;
+	int			ncands;
+	int			maxcands;
+};
+
+static void
+scan_sb_add(
+	struct sb_scan		*scan,
+	xfs_off_t		off,
+	char			*buf)
+{
+	struct sb_candidate	*cand;
+	char			*copy;
+
+	copy = malloc(XFS_MAX_SECTORSIZE);
+	if (!copy)
+		do_error(
+	_("error finding secondary superblock -- out of memory\n"));
+	memcpy(copy, buf, XFS_MAX_SECTORSIZE);
+
+	/* another worker may move the array, so fill the slot under the lock */
+	pthread_mutex_lock(&scan->lock);
+	if (scan->ncands == scan->maxcands) {
+		scan->maxcands = scan->maxcands ? scan->maxcands * 2 : 16;
+		scan->cands = realloc(scan->cands,
+				scan->maxcands * sizeof(*scan->cands));
+		if (!scan->cands)
+			do_error(
+	_("error finding secondary superblock -- out of memory\n"));
+	}
+	cand = &scan->cands[scan->ncands++];
+	cand->off = off;
+	cand->buf = copy;
+	pthread_mutex_unlock(&scan->lock);
+}
+
+static void
+scan_sb_worker(
+	struct workqueue	*wq,
+	xfs_agnumber_t		unused,
+	void			*arg)
+{
+	struct sb_scan		*scan = arg;
+	xfs_sb_t		sb;
+	xfs_off_t		off;
+	ssize_t			len;
+	char			*buf;
+	int			i;
+
+	/* read a little extra so that a whole sector follows each start */
+	buf = memalign(libxfs_device_alignment(),
+			SCAN_CHUNK + XFS_MAX_SECTORSIZE);
+	if (!buf)
+		do_error(
+	_("error finding secondary superblock -- failed to memalign buffer\n"));
 
-	return blocklog;
+	for (;;) {
+		pthread_mutex_lock(&scan->lock);
+		off = scan->next;
+		scan->next += SCAN_CHUNK;
+		pthread_mutex_unlock(&scan->lock);
+		if (off >= scan->end)
+			break;
+
+		len = pread(x.dfd, buf, SCAN_CHUNK + XFS_MAX_SECTORSIZE, off);
+		if (len <= 0)
+			break;
+		if (len < SCAN_CHUNK + XFS_MAX_SECTORSIZE)
+			memset(buf + len, 0, SCAN_CHUNK + XFS_MAX_SECTORSIZE - len);
+		if (len > SCAN_CHUNK)
+			len = SCAN_CHUNK;
+
+		for (i = 0; i < len; i += BBSIZE) {
+			if (!sb_magic_ok(buf + i))
+				continue;
+			memset(&sb, 0, sizeof(xfs_sb_t));
+			libxfs_sb_from_disk(&sb, (xfs_dsb_t *)(buf + i));
+			if (verify_sb(buf + i, &sb, 0) != XR_OK)
+				continue;
+			scan_sb_add(scan, off + i, buf + i);
+		}
+	}
+	free(buf);
+}
+
+static int
+scan_sb_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct sb_candidate *ca = a;
+	const struct sb_candidate *cb = b;
+
+	if (ca->off < cb->off)
+		return -1;
+	return ca->off > cb->off;
+}
+
+static int
+scan_secondary_sb(
+	xfs_sb_t		*rsb)
+{
+	struct sb_scan		scan;
+	struct workqueue	wq;
+	xfs_off_t		devbytes;
+	xfs_off_t		start;
+	xfs_off_t		window;
+	int			nthreads;
+	int			retval = 0;
+	int			i;
+
+	nthreads = libxfs_nproc();
+	if (nthreads < 1)
+		nthreads = 1;
+	devbytes = (xfs_off_t)x.dsize << BBSHIFT;
+	window = (xfs_off_t)SCAN_CHUNK * nthreads * 4;
+
+	memset(&scan, 0, sizeof(scan));
+	pthread_mutex_init(&scan.lock, NULL);
+
+	/* skip the first AG since we know that's bad */
+	for (start = XFS_AG_MIN_BYTES; !retval && start < devbytes;
+	     start = scan.end) {
+		scan.next = start;
+		scan.end = min(start + window, devbytes);
+		scan.ncands = 0;
+
+		create_work_queue(&wq, NULL, nthreads);
+		for (i = 0; i < nthreads; i++)
+			queue_work(&wq, scan_sb_worker, 0, &scan);
+		destroy_work_queue(&wq);
+		do_warn(".");
+
+		qsort(scan.cands, scan.ncands, sizeof(*scan.cands),
+				scan_sb_cmp);
+		for (i = 0; i < scan.ncands; i++) {
+			if (!retval)
+				retval = check_secondary_sb(rsb,
+						scan.cands[i].buf);
+			free(scan.cands[i].buf);
+		}
+
+		if (window < SCAN_WINDOW_MAX)
+			window *= 2;
+	}
+
+	free(scan.cands);
+	pthread_mutex_destroy(&scan.lock);
+	return retval;
 }
 
 int
 find_secondary_sb(xfs_sb_t *rsb)
 {
 	int		retval = 0;
-	__uint64_t	agcount;
-	__uint64_t	agsize;
 	__uint64_t	skip;
-	int		blocklog;
 
 	/*
 	 * Attempt to find secondary sb with a coarse approach,
@@ -234,16 +494,13 @@ find_secondary_sb(xfs_sb_t *rsb)
 			retval = __find_secondary_sb(rsb, skip, skip);
 	}
 
-        /* If that failed, retry coarse approach, using default geometry */
-        if (!retval) {
-                blocklog = guess_default_geometry(&agsize, &agcount, &x);
-                skip = agsize << blocklog;
-                retval = __find_secondary_sb(rsb, skip, skip);
-        }
+	/* If that failed, try the geometries mkfs would have likely used */
+	if (!retval)
+		retval = probe_secondary_sb(rsb);
 
-        /* If that failed, fall back to the brute force method */
-        if (!retval)
-                retval = __find_secondary_sb(rsb, XFS_AG_MIN_BYTES, BSIZE);
+	/* If that failed, fall back to the brute force method */
+	if (!retval)
+		retval = scan_secondary_sb(rsb);
 
 	return retval;
 }
@@ -381,9 +381,16 @@ _("bad state %d, inode %" PRIu64 " bmap block 0x%" PRIx64 "\n"),
 	(*tot)++;
 	numrecs = be16_to_cpu(block->bb_numrecs);
 
-	/* Record BMBT blocks in the reverse-mapping data. */
+	/*
+	 * Record BMBT blocks in the reverse-mapping data.  The raw rmap list
+	 * belongs to the AG of the block, which other workers (or other
+	 * slices of that AG) may be adding to as well.
+	 */
 	if (check_dups && collect_rmaps) {
+		agno = XFS_FSB_TO_AGNO(mp, bno);
+		pthread_mutex_lock(&ag_locks[agno].lock);
 		error = rmap_add_bmbt_rec(mp, ino, whichfork, bno);
+		pthread_mutex_unlock(&ag_locks[agno].lock);
 		if (error)
 			do_error(
 _("couldn't add inode %"PRIu64" bmbt block %"PRIu64" reverse-mapping data."),
@@ -2336,7 +2343,7 @@ validate_agi(
  */
 static void
 scan_ag(
-	work_queue_t	*wq,
+	struct workqueue *wq,
 	xfs_agnumber_t	agno,
 	void		*arg)
 {
@@ -2504,7 +2511,7 @@ scan_ags(
 	__uint64_t	ifreecount = 0;
 	__uint64_t	usedblocks = 0;
 	xfs_agnumber_t	i;
-	work_queue_t	wq;
+	struct workqueue wq;
 
 	agcnts = malloc(mp->m_sb.sb_agcount * sizeof(*agcnts));
 	if (!agcnts) {
@@ -2516,7 +2523,7 @@ scan_ags(
 	create_work_queue(&wq, mp, scan_threads);
 
 	for (i = 0; i < mp->m_sb.sb_agcount; i++)
-		queue_work(&wq, scan_ag, i, &agcnts[i]);
+		queue_ag_work(&wq, scan_ag, i, &agcnts[i]);
 
 	destroy_work_queue(&wq);
 
@@ -2554,3 +2561,730 @@ scan_ags(
 			mp->m_sb.sb_dblocks - fdblocks, usedblocks);
 	}
 }
+
+/*
+ * The -o sweep pre-check runs nothing but the buffer verifiers and key
+ * order checks over the AG headers and per-AG btrees, without building any
+ * of the incore state the later phases need.  Each btree is swept a level
+ * at a time from the root down, and the blocks of a level are read in disk
+ * order with nearby blocks merged into large reads.  Everything a block is
+ * checked against comes from its parent, so the blocks of a level can be
+ * checked in whatever order they are read.
+ */
+#define SWEEP_IO_BYTES		(1024 * 1024)	/* largest single read */
+#define SWEEP_GAP_BYTES		(64 * 1024)	/* largest hole read over */
+
+/* a btree key, with the most significant field first */
+struct sweep_key {
+	__uint64_t		k[3];
+};
+
+/* a btree block to be swept, and what its parent says it must hold */
+struct sweep_blk {
+	xfs_agblock_t		bno;
+	xfs_agblock_t		leftsib;	/* 0 if unknown */
+	xfs_agblock_t		rightsib;	/* 0 if unknown */
+	bool			has_low;
+	bool			has_high;
+	struct sweep_key	low;		/* first key in the block */
+	struct sweep_key	high;		/* first key of the next block */
+	int			nptrs;		/* children, -1 if not swept */
+	xfs_agblock_t		*ptrs;
+	struct sweep_key	*keys;
+};
+
+struct sweep_btree {
+	const char		*name;
+	xfs_btnum_t		btnum;
+	__uint32_t		magic;
+	const struct xfs_buf_ops *ops;
+	xfs_agblock_t		root;
+	int			nlevels;
+};
+
+struct sweep_ag {
+	xfs_agnumber_t		agno;
+	char			*iobuf;
+	int			bad;		/* bad blocks found */
+};
+
+static void
+sweep_get_key(
+	struct sweep_btree	*bt,
+	struct xfs_btree_block	*block,
+	int			level,
+	int			i,
+	struct sweep_key	*key)
+{
+	xfs_alloc_key_t		*akp;
+	xfs_alloc_rec_t		*arp;
+	struct xfs_rmap_key	*rkp;
+	struct xfs_rmap_rec	*rrp;
+	xfs_agblock_t		start;
+	xfs_extlen_t		len;
+
+	memset(key, 0, sizeof(*key));
+	switch (bt->btnum) {
+	case XFS_BTNUM_BNO:
+	case XFS_BTNUM_CNT:
+		if (level) {
+			akp = XFS_ALLOC_KEY_ADDR(mp, block, i);
+			start = be32_to_cpu(akp->ar_startblock);
+			len = be32_to_cpu(akp->ar_blockcount);
+		} else {
+			arp = XFS_ALLOC_REC_ADDR(mp, block, i);
+			start = be32_to_cpu(arp->ar_startblock);
+			len = be32_to_cpu(arp->ar_blockcount);
+		}
+		if (bt->btnum == XFS_BTNUM_CNT) {
+			key->k[0] = len;
+			key->k[1] = start;
+		} else
+			key->k[0] = start;
+		break;
+	case XFS_BTNUM_INO:
+	case XFS_BTNUM_FINO:
+		if (level)
+			key->k[0] = be32_to_cpu(
+				XFS_INOBT_KEY_ADDR(mp, block, i)->ir_startino);
+		else
+			key->k[0] = be32_to_cpu(
+				XFS_INOBT_REC_ADDR(mp, block, i)->ir_startino);
+		break;
+	case XFS_BTNUM_RMAP:
+		/* only the low keys, the flags in the offset don't order */
+		if (level) {
+			rkp = XFS_RMAP_KEY_ADDR(block, i);
+			key->k[0] = be32_to_cpu(rkp->rm_startblock);
+			key->k[1] = be64_to_cpu(rkp->rm_owner);
+			key->k[2] = XFS_RMAP_OFF(be64_to_cpu(rkp->rm_offset));
+		} else {
+			rrp = XFS_RMAP_REC_ADDR(block, i);
+			key->k[0] = be32_to_cpu(rrp->rm_startblock);
+			key->k[1] = be64_to_cpu(rrp->rm_owner);
+			key->k[2] = XFS_RMAP_OFF(be64_to_cpu(rrp->rm_offset));
+		}
+		break;
+	case XFS_BTNUM_REFC:
+		if (level)
+			key->k[0] = be32_to_cpu(
+				XFS_REFCOUNT_KEY_ADDR(block, i)->rc_startblock);
+		else
+			key->k[0] = be32_to_cpu(
+				XFS_REFCOUNT_REC_ADDR(block, i)->rc_startblock);
+		break;
+	default:
+		ASSERT(0);
+	}
+}
+
+static xfs_agblock_t
+sweep_get_ptr(
+	struct sweep_btree	*bt,
+	struct xfs_btree_block	*block,
+	int			i)
+{
+	switch (bt->btnum) {
+	case XFS_BTNUM_BNO:
+	case XFS_BTNUM_CNT:
+		return be32_to_cpu(*XFS_ALLOC_PTR_ADDR(mp, block, i,
+						mp->m_alloc_mxr[1]));
+	case XFS_BTNUM_INO:
+	case XFS_BTNUM_FINO:
+		return be32_to_cpu(*XFS_INOBT_PTR_ADDR(mp, block, i,
+						mp->m_inobt_mxr[1]));
+	case XFS_BTNUM_RMAP:
+		return be32_to_cpu(*XFS_RMAP_PTR_ADDR(block, i,
+						mp->m_rmap_mxr[1]));
+	case XFS_BTNUM_REFC:
+		return be32_to_cpu(*XFS_REFCOUNT_PTR_ADDR(block, i,
+						mp->m_refc_mxr[1]));
+	default:
+		ASSERT(0);
+		return NULLAGBLOCK;
+	}
+}
+
+static int
+sweep_key_cmp(
+	struct sweep_key	*k1,
+	struct sweep_key	*k2)
+{
+	int			i;
+
+	for (i = 0; i < 3; i++) {
+		if (k1->k[i] < k2->k[i])
+			return -1;
+		if (k1->k[i] > k2->k[i])
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Keys must go up through a level of a btree, except that different
+ * reverse mappings can share a low key.
+ */
+static bool
+sweep_keys_inorder(
+	struct sweep_btree	*bt,
+	struct sweep_key	*k1,
+	struct sweep_key	*k2)
+{
+	if (bt->btnum == XFS_BTNUM_RMAP)
+		return sweep_key_cmp(k1, k2) <= 0;
+	return sweep_key_cmp(k1, k2) < 0;
+}
+
+/*
+ * Verify one btree block and check it against what its parent says about
+ * it.  @data is the block as read by sweep_level(), or NULL if it has to be
+ * read on its own.  The children of a good interior block are saved for
+ * the next level down.
+ */
+static void
+sweep_block(
+	struct sweep_ag		*sag,
+	struct sweep_btree	*bt,
+	int			level,
+	struct sweep_blk	*blk,
+	char			*data)
+{
+	xfs_agnumber_t		agno = sag->agno;
+	struct xfs_btree_block	*block;
+	struct xfs_buf		*bp;
+	struct sweep_key	key;
+	struct sweep_key	prev;
+	xfs_daddr_t		daddr;
+	int			numrecs;
+	int			hdr_errors = 0;
+	int			i;
+
+	blk->nptrs = -1;
+
+	daddr = XFS_AGB_TO_DADDR(mp, agno, blk->bno);
+	bp = libxfs_getbuf(mp->m_dev, daddr, XFS_FSB_TO_BB(mp, 1));
+	if (!bp)
+		do_error(_("can't read btree block %d/%d\n"), agno, blk->bno);
+	if (!(bp->b_flags & (LIBXFS_B_UPTODATE | LIBXFS_B_DIRTY))) {
+		if (data) {
+			memcpy(bp->b_addr, data, XFS_BUF_SIZE(bp));
+			bp->b_flags |= LIBXFS_B_UPTODATE;
+		} else if (libxfs_readbufr(mp->m_dev, daddr, bp,
+					   XFS_FSB_TO_BB(mp, 1), 0)) {
+			do_warn(_("can't read bt%s block %u/%u\n"),
+				bt->name, agno, blk->bno);
+			sag->bad++;
+			goto out;
+		}
+	}
+
+	/*
+	 * Always run the verifier, the block may be in the cache from
+	 * another btree that claims it too.
+	 */
+	bp->b_error = 0;
+	libxfs_readbuf_verify(bp, bt->ops);
+	if (bp->b_error) {
+		if (bp->b_error == -EFSBADCRC)
+			do_warn(_("bad CRC in bt%s block %u/%u\n"),
+				bt->name, agno, blk->bno);
+		else
+			do_warn(_("bt%s block %u/%u is corrupt, error %d\n"),
+				bt->name, agno, blk->bno, bp->b_error);
+		sag->bad++;
+		goto out;
+	}
+
+	block = XFS_BUF_TO_BLOCK(bp);
+	if (be32_to_cpu(block->bb_magic) != bt->magic) {
+		do_warn(_("bad magic # %#x in bt%s block %d/%d\n"),
+			be32_to_cpu(block->bb_magic), bt->name, agno,
+			blk->bno);
+		sag->bad++;
+		goto out;
+	}
+	if (be16_to_cpu(block->bb_level) != level) {
+		do_warn(_("expected level %d got %d in bt%s block %d/%d\n"),
+			level, be16_to_cpu(block->bb_level), bt->name, agno,
+			blk->bno);
+		sag->bad++;
+		goto out;
+	}
+	if (xfs_sb_version_hascrc(&mp->m_sb) &&
+	    be32_to_cpu(block->bb_u.s.bb_owner) != agno) {
+		do_warn(_("bad owner %u in bt%s block %u/%u\n"),
+			be32_to_cpu(block->bb_u.s.bb_owner), bt->name, agno,
+			blk->bno);
+		hdr_errors++;
+	}
+	if (blk->leftsib &&
+	    be32_to_cpu(block->bb_u.s.bb_leftsib) != blk->leftsib) {
+		do_warn(_("bad left sibling %u in bt%s block %u/%u, "
+			  "expected %u\n"),
+			be32_to_cpu(block->bb_u.s.bb_leftsib), bt->name, agno,
+			blk->bno, blk->leftsib);
+		hdr_errors++;
+	}
+	if (blk->rightsib &&
+	    be32_to_cpu(block->bb_u.s.bb_rightsib) != blk->rightsib) {
+		do_warn(_("bad right sibling %u in bt%s block %u/%u, "
+			  "expected %u\n"),
+			be32_to_cpu(block->bb_u.s.bb_rightsib), bt->name, agno,
+			blk->bno, blk->rightsib);
+		hdr_errors++;
+	}
+
+	/* the verifier has checked numrecs against the block size */
+	numrecs = be16_to_cpu(block->bb_numrecs);
+	for (i = 1; i <= numrecs; i++) {
+		sweep_get_key(bt, block, level, i, &key);
+		if (i == 1 && blk->has_low && sweep_key_cmp(&key, &blk->low)) {
+			do_warn(
+	_("first key in bt%s block %u/%u doesn't match its parent\n"),
+				bt->name, agno, blk->bno);
+			hdr_errors++;
+		}
+		if (i > 1 && !sweep_keys_inorder(bt, &prev, &key)) {
+			do_warn(
+	_("out of order keys %d and %d in bt%s block %u/%u\n"),
+				i - 1, i, bt->name, agno, blk->bno);
+			hdr_errors++;
+		}
+		prev = key;
+	}
+	if (numrecs && blk->has_high &&
+	    !sweep_keys_inorder(bt, &prev, &blk->high)) {
+		do_warn(
+	_("last key in bt%s block %u/%u is past the next block's\n"),
+			bt->name, agno, blk->bno);
+		hdr_errors++;
+	}
+
+	if (hdr_errors) {
+		sag->bad++;
+		goto out;
+	}
+	if (level == 0)
+		goto out;
+
+	blk->ptrs = malloc(numrecs * sizeof(xfs_agblock_t));
+	blk->keys = malloc(numrecs * sizeof(struct sweep_key));
+	if (!blk->ptrs || !blk->keys)
+		do_error(_("couldn't allocate bt%s sweep pointers\n"),
+			bt->name);
+	for (i = 0; i < numrecs; i++) {
+		blk->ptrs[i] = sweep_get_ptr(bt, block, i + 1);
+		sweep_get_key(bt, block, level, i + 1, &blk->keys[i]);
+		if (!verify_agbno(mp, agno, blk->ptrs[i])) {
+			do_warn(_("bad btree pointer %u in bt%s block %u/%u\n"),
+				blk->ptrs[i], bt->name, agno, blk->bno);
+			blk->ptrs[i] = NULLAGBLOCK;
+			hdr_errors++;
+		}
+	}
+	blk->nptrs = numrecs;
+	if (hdr_errors)
+		sag->bad++;
+out:
+	libxfs_putbuf(bp);
+}
+
+static int
+sweep_blk_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct sweep_blk	*b1 = *(struct sweep_blk **)a;
+	const struct sweep_blk	*b2 = *(struct sweep_blk **)b;
+
+	if (b1->bno < b2->bno)
+		return -1;
+	return b1->bno > b2->bno;
+}
+
+/*
+ * Sweep all the blocks of one level of a btree, reading them in disk
+ * order, as much as SWEEP_IO_BYTES at a time.
+ */
+static void
+sweep_level(
+	struct sweep_ag		*sag,
+	struct sweep_btree	*bt,
+	int			level,
+	struct sweep_blk	*blks,
+	int			nblks)
+{
+	struct sweep_blk	**order;
+	xfs_agblock_t		first;
+	xfs_agblock_t		last;
+	ssize_t			len;
+	int			fd;
+	int			n;
+	int			i;
+	int			j;
+	int			k;
+
+	order = malloc(nblks * sizeof(*order));
+	if (!order)
+		do_error(_("couldn't allocate bt%s sweep list\n"), bt->name);
+	for (i = 0; i < nblks; i++)
+		order[i] = &blks[i];
+	qsort(order, nblks, sizeof(*order), sweep_blk_cmp);
+
+	/* a block can't be in two places in a btree */
+	for (n = 0, i = 0; i < nblks; i++) {
+		if (n && order[i]->bno == order[n - 1]->bno) {
+			do_warn(_("bt%s block %u/%u is claimed more than once\n"),
+				bt->name, sag->agno, order[i]->bno);
+			order[i]->nptrs = -1;
+			sag->bad++;
+			continue;
+		}
+		order[n++] = order[i];
+	}
+
+	fd = libxfs_device_to_fd(mp->m_ddev_targp->dev);
+	for (i = 0; i < n; i = j) {
+		first = last = order[i]->bno;
+		for (j = i + 1; j < n; j++) {
+			if (XFS_FSB_TO_B(mp, order[j]->bno + 1 - first) >
+							SWEEP_IO_BYTES ||
+			    XFS_FSB_TO_B(mp, order[j]->bno - last - 1) >
+							SWEEP_GAP_BYTES)
+				break;
+			last = order[j]->bno;
+		}
+
+		len = XFS_FSB_TO_B(mp, last + 1 - first);
+		if (pread(fd, sag->iobuf, len, LIBXFS_BBTOOFF64(
+				XFS_AGB_TO_DADDR(mp, sag->agno, first))) != len) {
+			/* read them one by one to find the bad ones */
+			for (k = i; k < j; k++)
+				sweep_block(sag, bt, level, order[k], NULL);
+			continue;
+		}
+		for (k = i; k < j; k++)
+			sweep_block(sag, bt, level, order[k], sag->iobuf +
+				XFS_FSB_TO_B(mp, order[k]->bno - first));
+	}
+	free(order);
+}
+
+/*
+ * Build the next level down from the children of the blocks of this one,
+ * in key order.  Where a block couldn't be swept there's a gap in the next
+ * level, and the siblings either side of it can't be checked.
+ */
+static struct sweep_blk *
+sweep_next_level(
+	struct sweep_blk	*blks,
+	int			nblks,
+	int			*nnext)
+{
+	struct sweep_blk	*next;
+	struct sweep_blk	*child;
+	bool			gap = false;
+	int			count = 0;
+	int			n = 0;
+	int			i;
+	int			j;
+
+	for (i = 0; i < nblks; i++)
+		if (blks[i].nptrs > 0)
+			count += blks[i].nptrs;
+	next = calloc(max(count, 1), sizeof(struct sweep_blk));
+	if (!next)
+		do_error(_("couldn't allocate btree sweep level\n"));
+
+	for (i = 0; i < nblks; i++) {
+		/* gaps further up leave gaps all the way down */
+		if (blks[i].nptrs < 0 || !blks[i].leftsib)
+			gap = true;
+		if (blks[i].nptrs < 0)
+			continue;
+		for (j = 0; j < blks[i].nptrs; j++) {
+			if (blks[i].ptrs[j] == NULLAGBLOCK) {
+				gap = true;
+				continue;
+			}
+			child = &next[n];
+			child->bno = blks[i].ptrs[j];
+			child->low = blks[i].keys[j];
+			child->has_low = true;
+			if (j + 1 < blks[i].nptrs) {
+				child->high = blks[i].keys[j + 1];
+				child->has_high = true;
+			} else {
+				child->high = blks[i].high;
+				child->has_high = blks[i].has_high;
+			}
+			if (gap) {
+				if (n)
+					next[n - 1].rightsib = 0;
+			} else if (n) {
+				child->leftsib = next[n - 1].bno;
+				next[n - 1].rightsib = child->bno;
+			} else
+				child->leftsib = NULLAGBLOCK;
+			child->rightsib = NULLAGBLOCK;
+			gap = false;
+			n++;
+		}
+		free(blks[i].ptrs);
+		free(blks[i].keys);
+	}
+	if ((gap || !blks[nblks - 1].rightsib) && n)
+		next[n - 1].rightsib = 0;
+
+	*nnext = n;
+	return next;
+}
+
+static void
+sweep_btree(
+	struct sweep_ag		*sag,
+	struct sweep_btree	*bt)
+{
+	struct sweep_blk	*blks;
+	struct sweep_blk	*next;
+	int			nblks = 1;
+	int			nnext;
+	int			level;
+
+	if (bt->root == 0 || !verify_agbno(mp, sag->agno, bt->root)) {
+		do_warn(_("bad agbno %u for bt%s root, agno %d\n"),
+			bt->root, bt->name, sag->agno);
+		sag->bad++;
+		return;
+	}
+	if (bt->nlevels < 1 || bt->nlevels > XFS_BTREE_MAXLEVELS) {
+		do_warn(_("bad levels %u for bt%s root, agno %d\n"),
+			bt->nlevels, bt->name, sag->agno);
+		sag->bad++;
+		return;
+	}
+
+	blks = calloc(1, sizeof(struct sweep_blk));
+	if (!blks)
+		do_error(_("couldn't allocate btree sweep level\n"));
+	blks->bno = bt->root;
+	blks->leftsib = NULLAGBLOCK;
+	blks->rightsib = NULLAGBLOCK;
+
+	for (level = bt->nlevels - 1; level >= 0 && nblks; level--) {
+		sweep_level(sag, bt, level, blks, nblks);
+		nnext = 0;
+		next = level ? sweep_next_level(blks, nblks, &nnext) : NULL;
+		free(blks);
+		blks = next;
+		nblks = nnext;
+	}
+	free(blks);
+}
+
+/*
+ * Read and verify an AG header.  Returns NULL if it can't be trusted to
+ * find the btrees from.
+ */
+static struct xfs_buf *
+sweep_header(
+	struct sweep_ag		*sag,
+	xfs_daddr_t		daddr,
+	const struct xfs_buf_ops *ops,
+	const char		*name)
+{
+	struct xfs_buf		*bp;
+
+	bp = libxfs_readbuf(mp->m_dev, XFS_AG_DADDR(mp, sag->agno, daddr),
+			XFS_FSS_TO_BB(mp, 1), 0, ops);
+	if (!bp) {
+		do_warn(_("can't read %s for ag %d\n"), name, sag->agno);
+		sag->bad++;
+		return NULL;
+	}
+	if (!bp->b_error)
+		return bp;
+
+	sag->bad++;
+	if (bp->b_error == -EFSBADCRC) {
+		do_warn(_("bad CRC in %s for ag %d\n"), name, sag->agno);
+		return bp;
+	}
+	do_warn(_("%s for ag %d is corrupt, error %d\n"), name, sag->agno,
+		bp->b_error);
+	libxfs_putbuf(bp);
+	return NULL;
+}
+
+static void
+sweep_agfl(
+	struct sweep_ag		*sag,
+	struct xfs_agf		*agf)
+{
+	struct xfs_buf		*agflbuf;
+	__be32			*freelist;
+	xfs_agblock_t		bno;
+	int			i;
+
+	agflbuf = sweep_header(sag, XFS_AGFL_DADDR(mp), &xfs_agfl_buf_ops,
+			_("agfl block"));
+	if (!agflbuf || !agf || !be32_to_cpu(agf->agf_flcount))
+		goto out;
+
+	if (be32_to_cpu(agf->agf_flfirst) >= XFS_AGFL_SIZE(mp) ||
+	    be32_to_cpu(agf->agf_fllast) >= XFS_AGFL_SIZE(mp)) {
+		do_warn(_("agf %d freelist blocks bad, skipping "
+			  "freelist scan\n"), sag->agno);
+		sag->bad++;
+		goto out;
+	}
+
+	freelist = XFS_BUF_TO_AGFL_BNO(mp, agflbuf);
+	i = be32_to_cpu(agf->agf_flfirst);
+	for (;;) {
+		bno = be32_to_cpu(freelist[i]);
+		if (!verify_agbno(mp, sag->agno, bno)) {
+			do_warn(_("bad agbno %u in agfl, agno %d\n"),
+				bno, sag->agno);
+			sag->bad++;
+			break;
+		}
+		if (i == be32_to_cpu(agf->agf_fllast))
+			break;
+		if (++i == XFS_AGFL_SIZE(mp))
+			i = 0;
+	}
+out:
+	if (agflbuf)
+		libxfs_putbuf(agflbuf);
+}
+
+static void
+sweep_ag(
+	struct workqueue	*wq,
+	xfs_agnumber_t		agno,
+	void			*arg)
+{
+	struct sweep_ag		*sag = arg;
+	struct sweep_btree	bts[XFS_BTNUM_MAX];
+	struct xfs_buf		*sbbuf;
+	struct xfs_buf		*agfbuf;
+	struct xfs_buf		*agibuf;
+	struct xfs_agf		*agf = NULL;
+	struct xfs_agi		*agi;
+	bool			crc = xfs_sb_version_hascrc(&mp->m_sb);
+	int			nbts = 0;
+	int			i;
+
+	sag->agno = agno;
+	sag->iobuf = memalign(libxfs_device_alignment(), SWEEP_IO_BYTES);
+	if (!sag->iobuf)
+		do_error(_("couldn't allocate btree sweep buffer\n"));
+
+	sbbuf = sweep_header(sag, XFS_SB_DADDR, &xfs_sb_buf_ops,
+			_("superblock"));
+	if (sbbuf)
+		libxfs_putbuf(sbbuf);
+
+	agfbuf = sweep_header(sag, XFS_AGF_DADDR(mp), &xfs_agf_buf_ops,
+			_("agf block"));
+	if (agfbuf) {
+		agf = XFS_BUF_TO_AGF(agfbuf);
+		bts[nbts++] = (struct sweep_btree) {
+			.name = "bno", .btnum = XFS_BTNUM_BNO,
+			.magic = crc ? XFS_ABTB_CRC_MAGIC : XFS_ABTB_MAGIC,
+			.ops = &xfs_allocbt_buf_ops,
+			.root = be32_to_cpu(agf->agf_roots[XFS_BTNUM_BNO]),
+			.nlevels = be32_to_cpu(agf->agf_levels[XFS_BTNUM_BNO]),
+		};
+		bts[nbts++] = (struct sweep_btree) {
+			.name = "cnt", .btnum = XFS_BTNUM_CNT,
+			.magic = crc ? XFS_ABTC_CRC_MAGIC : XFS_ABTC_MAGIC,
+			.ops = &xfs_allocbt_buf_ops,
+			.root = be32_to_cpu(agf->agf_roots[XFS_BTNUM_CNT]),
+			.nlevels = be32_to_cpu(agf->agf_levels[XFS_BTNUM_CNT]),
+		};
+		if (xfs_sb_version_hasrmapbt(&mp->m_sb))
+			bts[nbts++] = (struct sweep_btree) {
+			.name = "rmap", .btnum = XFS_BTNUM_RMAP,
+			.magic = XFS_RMAP_CRC_MAGIC,
+			.ops = &xfs_rmapbt_buf_ops,
+			.root = be32_to_cpu(agf->agf_roots[XFS_BTNUM_RMAP]),
+			.nlevels = be32_to_cpu(agf->agf_levels[XFS_BTNUM_RMAP]),
+			};
+		if (xfs_sb_version_hasreflink(&mp->m_sb))
+			bts[nbts++] = (struct sweep_btree) {
+			.name = "refcnt", .btnum = XFS_BTNUM_REFC,
+			.magic = XFS_REFC_CRC_MAGIC,
+			.ops = &xfs_refcountbt_buf_ops,
+			.root = be32_to_cpu(agf->agf_refcount_root),
+			.nlevels = be32_to_cpu(agf->agf_refcount_level),
+			};
+	}
+	sweep_agfl(sag, agf);
+
+	agibuf = sweep_header(sag, XFS_AGI_DADDR(mp), &xfs_agi_buf_ops,
+			_("agi block"));
+	if (agibuf) {
+		agi = XFS_BUF_TO_AGI(agibuf);
+		bts[nbts++] = (struct sweep_btree) {
+			.name = "ino", .btnum = XFS_BTNUM_INO,
+			.magic = crc ? XFS_IBT_CRC_MAGIC : XFS_IBT_MAGIC,
+			.ops = &xfs_inobt_buf_ops,
+			.root = be32_to_cpu(agi->agi_root),
+			.nlevels = be32_to_cpu(agi->agi_level),
+		};
+		if (xfs_sb_version_hasfinobt(&mp->m_sb))
+			bts[nbts++] = (struct sweep_btree) {
+			.name = "fino", .btnum = XFS_BTNUM_FINO,
+			.magic = crc ? XFS_FIBT_CRC_MAGIC : XFS_FIBT_MAGIC,
+			.ops = &xfs_inobt_buf_ops,
+			.root = be32_to_cpu(agi->agi_free_root),
+			.nlevels = be32_to_cpu(agi->agi_free_level),
+			};
+	}
+
+	for (i = 0; i < nbts; i++)
+		sweep_btree(sag, &bts[i]);
+
+	if (agibuf)
+		libxfs_putbuf(agibuf);
+	if (agfbuf)
+		libxfs_putbuf(agfbuf);
+	free(sag->iobuf);
+	PROG_RPT_INC(prog_rpt_done[agno], 1);
+}
+
+/*
+ * Sweep the headers and btrees of all the AGs, scan_threads of them at a
+ * time.  Returns the number of bad blocks found.
+ */
+int
+sweep_ags(
+	struct xfs_mount	*mp,
+	int			scan_threads)
+{
+	struct sweep_ag		*sags;
+	xfs_agnumber_t		i;
+	struct workqueue	wq;
+	int			bad = 0;
+
+	sags = calloc(mp->m_sb.sb_agcount, sizeof(*sags));
+	if (!sags) {
+		do_abort(_("no memory for ag sweep state\n"));
+		return 0;
+	}
+
+	create_work_queue(&wq, mp, scan_threads);
+
+	for (i = 0; i < mp->m_sb.sb_agcount; i++)
+		queue_ag_work(&wq, sweep_ag, i, &sags[i]);
+
+	destroy_work_queue(&wq);
+
+	for (i = 0; i < mp->m_sb.sb_agcount; i++)
+		bad += sags[i].bad;
+	free(sags);
+	return bad;
+}
@@ -70,4 +70,9 @@ scan_ags(
 	struct xfs_mount	*mp,
 	int			scan_threads);
 
+int
+sweep_ags(
+	struct xfs_mount	*mp,
+	int			scan_threads);
+
 #endif /* _XR_SCAN_H */
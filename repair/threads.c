@@ -1,54 +1,12 @@
 #include "libxfs.h"
 #include <pthread.h>
 #include <signal.h>
+#include <sys/time.h>
 #include "threads.h"
 #include "err_protos.h"
 #include "protos.h"
 #include "globals.h"
-
-static void *
-worker_thread(void *arg)
-{
-	work_queue_t	*wq;
-	work_item_t	*wi;
-
-	wq = (work_queue_t*)arg;
-
-	/*
-	 * Loop pulling work from the passed in work queue.
-	 * Check for notification to exit after every chunk of work.
-	 */
-	while (1) {
-		pthread_mutex_lock(&wq->lock);
-
-		/*
-		 * Wait for work.
-		 */
-		while (wq->next_item == NULL && !wq->terminate) {
-			ASSERT(wq->item_count == 0);
-			pthread_cond_wait(&wq->wakeup, &wq->lock);
-		}
-		if (wq->next_item == NULL && wq->terminate) {
-			pthread_mutex_unlock(&wq->lock);
-			break;
-		}
-
-		/*
-		 *  Dequeue work from the head of the list.
-		 */
-		ASSERT(wq->item_count > 0);
-		wi = wq->next_item;
-		wq->next_item = wi->next;
-		wq->item_count--;
-
-		pthread_mutex_unlock(&wq->lock);
-
-		(wi->function)(wi->queue, wi->agno, wi->arg);
-		free(wi);
-	}
-
-	return NULL;
-}
+#include "numa.h"
 
 void
 thread_init(void)
@@ -64,88 +22,85 @@ thread_init(void)
 	pthread_sigmask(SIG_BLOCK, &blocked, NULL);
 }
 
-
+/*
+ * With no workers (e.g. -o phase2_threads=0) the items are run by the
+ * caller as they are queued, rather than never being run at all.
+ */
 void
 create_work_queue(
-	work_queue_t		*wq,
+	struct workqueue	*wq,
 	xfs_mount_t		*mp,
 	int			nworkers)
 {
 	int			err;
-	int			i;
 
-	memset(wq, 0, sizeof(work_queue_t));
+	err = workqueue_create(wq, mp, nworkers);
+	if (err)
+		do_error(_("cannot create worker threads, error = [%d] %s\n"),
+			err, strerror(err));
+}
 
-	pthread_cond_init(&wq->wakeup, NULL);
-	pthread_mutex_init(&wq->lock, NULL);
+void
+queue_work(
+	struct workqueue	*wq,
+	workqueue_func_t	func,
+	xfs_agnumber_t		agno,
+	void			*arg)
+{
+	int			err;
 
-	wq->mp = mp;
-	wq->thread_count = nworkers;
-	wq->threads = malloc(nworkers * sizeof(pthread_t));
-	wq->terminate = 0;
+	err = workqueue_add(wq, func, agno, arg);
+	if (err)
+		do_error(_("cannot allocate worker item, error = [%d] %s\n"),
+			err, strerror(err));
+}
 
-	for (i = 0; i < nworkers; i++) {
-		err = pthread_create(&wq->threads[i], NULL, worker_thread, wq);
-		if (err != 0) {
-			do_error(_("cannot create worker threads, error = [%d] %s\n"),
-				err, strerror(err));
-		}
-	}
+struct ag_work {
+	workqueue_func_t	*func;
+	void			*arg;
+};
 
+static void
+ag_work_worker(
+	struct workqueue	*wq,
+	xfs_agnumber_t		agno,
+	void			*arg)
+{
+	struct ag_work		*aw = arg;
+	struct timeval		start;
+
+	numa_bind_ag(agno);
+	gettimeofday(&start, NULL);
+	aw->func(wq, agno, aw->arg);
+	numa_ag_done(agno, &start);
+	free(aw);
 }
 
+/*
+ * Queue an item that processes the AG it is queued for.  The worker is
+ * moved to that AG's NUMA node before running it.
+ */
 void
-queue_work(
-	work_queue_t	*wq,
-	work_func_t	func,
-	xfs_agnumber_t	agno,
-	void		*arg)
+queue_ag_work(
+	struct workqueue	*wq,
+	workqueue_func_t	func,
+	xfs_agnumber_t		agno,
+	void			*arg)
 {
-	work_item_t	*wi;
+	struct ag_work		*aw;
 
-	wi = (work_item_t *)malloc(sizeof(work_item_t));
-	if (wi == NULL)
+	aw = malloc(sizeof(struct ag_work));
+	if (aw == NULL)
 		do_error(_("cannot allocate worker item, error = [%d] %s\n"),
 			errno, strerror(errno));
-
-	wi->function = func;
-	wi->agno = agno;
-	wi->arg = arg;
-	wi->queue = wq;
-	wi->next = NULL;
-
-	/*
-	 *  Now queue the new work structure to the work queue.
-	 */
-	pthread_mutex_lock(&wq->lock);
-	if (wq->next_item == NULL) {
-		wq->next_item = wi;
-		ASSERT(wq->item_count == 0);
-		pthread_cond_signal(&wq->wakeup);
-	} else {
-		wq->last_item->next = wi;
-	}
-	wq->last_item = wi;
-	wq->item_count++;
-	pthread_mutex_unlock(&wq->lock);
+	aw->func = func;
+	aw->arg = arg;
+	queue_work(wq, ag_work_worker, agno, aw);
 }
 
 void
 destroy_work_queue(
-	work_queue_t	*wq)
+	struct workqueue	*wq)
 {
-	int		i;
-
-	pthread_mutex_lock(&wq->lock);
-	wq->terminate = 1;
-	pthread_mutex_unlock(&wq->lock);
-
-	pthread_cond_broadcast(&wq->wakeup);
-
-	for (i = 0; i < wq->thread_count; i++)
-		pthread_join(wq->threads[i], NULL);
-
-	free(wq->threads);
-	pthread_mutex_destroy(&wq->lock);
-	pthread_cond_destroy(&wq->wakeup);
+	workqueue_destroy(wq);
 }
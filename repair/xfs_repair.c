@@ -34,6 +34,8 @@
 #include "dinode.h"
 #include "slab.h"
 #include "rmap.h"
+#include "checkpoint.h"
+#include "numa.h"
 
 #define	rounddown(x, y)	(((x)/(y))*(y))
 
@@ -61,6 +63,14 @@ static char *o_opts[] = {
 	"force_geometry",
 #define PHASE2_THREADS	6
 	"phase2_threads",
+#define CHECKPOINT	7
+	"checkpoint",
+#define RESUME		8
+	"resume",
+#define NUMA		9
+	"numa",
+#define SWEEP		10
+	"sweep",
 	NULL
 };
 
@@ -77,6 +87,10 @@ static char *c_opts[] = {
 static int	bhash_option_used;
 static long	max_mem_specified;	/* in megabytes */
 static int	phase2_threads = 32;
+static char	*checkpoint_file;
+static int	resume;
+static int	numa;
+static int	sweep;
 
 static void
 usage(void)
@@ -228,6 +242,8 @@ process_args(int argc, char **argv)
 			p = optarg;
 			while (*p != '\0')  {
 				char *val;
+				char *end;
+				long size;
 
 				switch (getsubopt(&p, o_opts, &val))  {
 				case ASSUME_XFS:
@@ -246,8 +262,14 @@ process_args(int argc, char **argv)
 					pre_65_beta = 1;
 					break;
 				case IHASH_SIZE:
-					do_warn(
-		_("-o ihash option has been removed and will be ignored\n"));
+					if (!val)
+						do_abort(
+		_("-o ihash option requires a value\n"));
+					size = strtol(val, &end, 0);
+					if (*end || size <= 0 || size > INT_MAX)
+						do_abort(
+		_("-o ihash option must be a positive integer\n"));
+					libxfs_ihash_size = size;
 					break;
 				case BHASH_SIZE:
 					if (max_mem_specified)
@@ -269,6 +291,33 @@ process_args(int argc, char **argv)
 				case PHASE2_THREADS:
 					phase2_threads = (int)strtol(val, NULL, 0);
 					break;
+				case CHECKPOINT:
+					if (!val || !*val)
+						do_abort(
+		_("-o checkpoint option requires a file name\n"));
+					checkpoint_file = val;
+					break;
+				case RESUME:
+					if (val)
+						noval('o', o_opts, RESUME);
+					if (resume)
+						respec('o', o_opts, RESUME);
+					resume = 1;
+					break;
+				case NUMA:
+					if (val)
+						noval('o', o_opts, NUMA);
+					if (numa)
+						respec('o', o_opts, NUMA);
+					numa = 1;
+					break;
+				case SWEEP:
+					if (val)
+						noval('o', o_opts, SWEEP);
+					if (sweep)
+						respec('o', o_opts, SWEEP);
+					sweep = 1;
+					break;
 				default:
 					unknown('o', val);
 					break;
@@ -334,6 +383,14 @@ process_args(int argc, char **argv)
 		}
 	}
 
+	if (resume && !checkpoint_file)
+		do_abort(_("-o resume option requires -o checkpoint\n"));
+
+	if (sweep && !no_modify)
+		do_abort(_("-o sweep option requires -n\n"));
+	if (sweep && resume)
+		do_abort(_("-o sweep option cannot be used with -o resume\n"));
+
 	if (argc - optind != 1)
 		usage();
 
@@ -639,6 +696,7 @@ main(int argc, char **argv)
 	char		*msgbuf;
 	struct xfs_sb	psb;
 	int		rval;
+	int		bad;
 
 	progname = basename(argv[0]);
 	setlocale(LC_ALL, "");
@@ -800,6 +858,9 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (numa)
+		numa_init(mp);
+
 	if (ag_stride && report_interval) {
 		init_progress_rpt();
 		if (msgbuf) {
@@ -915,25 +976,64 @@ main(int argc, char **argv)
 		return(1);
 	}
 
-	/* make sure the per-ag freespace maps are ok so we can mount the fs */
-	phase2(mp, phase2_threads);
-	timestamp(PHASE_END, 2, NULL);
+	if (sweep) {
+		/*
+		 * Only the structure of the AG headers and btrees is checked,
+		 * the later phases don't run at all.
+		 */
+		bad = phase2_sweep(mp, phase2_threads);
+		timestamp(PHASE_END, 2, NULL);
 
-	if (do_prefetch)
-		init_prefetch(mp);
+		if (ag_stride && report_interval)
+			stop_progress_rpt();
+		if (bad) {
+			do_log(
+	_("Sweep found %d bad metadata blocks, run xfs_repair to fix them.\n"),
+				bad);
+			return(1);
+		}
+		do_log(_("Sweep found no bad metadata blocks.\n"));
+		return(0);
+	}
+
+	if (resume) {
+		/*
+		 * Everything phases 2 to 5 found out is in the checkpoint, and
+		 * what they fixed is already on disk.
+		 */
+		do_log(_("Resuming, skipping phases 2 - 5\n"));
+		phase2_resume(mp);
+		if (do_prefetch) {
+			init_prefetch(mp);
+			pf_forget_dir_blocks();
+		}
+		load_checkpoint(mp, checkpoint_file);
+	} else {
+		/*
+		 * make sure the per-ag freespace maps are ok so we can mount
+		 * the fs
+		 */
+		phase2(mp, phase2_threads);
+		timestamp(PHASE_END, 2, NULL);
+
+		if (do_prefetch)
+			init_prefetch(mp);
 
-	phase3(mp, phase2_threads);
-	timestamp(PHASE_END, 3, NULL);
+		phase3(mp, phase2_threads);
+		timestamp(PHASE_END, 3, NULL);
 
-	phase4(mp);
-	timestamp(PHASE_END, 4, NULL);
+		phase4(mp);
+		timestamp(PHASE_END, 4, NULL);
 
-	if (no_modify)
-		printf(_("No modify flag set, skipping phase 5\n"));
-	else {
-		phase5(mp);
+		if (no_modify)
+			printf(_("No modify flag set, skipping phase 5\n"));
+		else {
+			phase5(mp);
+		}
+		if (checkpoint_file)
+			save_checkpoint(mp, checkpoint_file);
+		timestamp(PHASE_END, 5, NULL);
 	}
-	timestamp(PHASE_END, 5, NULL);
 
 	/*
 	 * Done with the block usage maps, toss them...
@@ -951,6 +1051,7 @@ main(int argc, char **argv)
 		do_warn(
 _("Inode allocation btrees are too corrupted, skipping phases 6 and 7\n"));
 	}
+	pf_forget_dir_blocks();
 
 	if (lost_quotas && !have_uquotino && !have_gquotino && !have_pquotino) {
 		if (!no_modify)  {
@@ -1018,8 +1119,12 @@ _("Warning:  project quota information would be cleared.\n"
 
 		do_log(
 	_("No modify flag set, skipping filesystem flush and exiting.\n"));
-		if (verbose)
+		if (checkpoint_file)
+			unlink(checkpoint_file);
+		if (verbose) {
 			summary_report();
+			numa_report();
+		}
 		if (fs_is_dirty)
 			return(1);
 
@@ -1065,8 +1170,14 @@ _("Note - stripe unit (%d) and width (%d) were copied from a backup superblock.\
 		libxfs_device_close(x.logdev);
 	libxfs_device_close(x.ddev);
 
-	if (verbose)
+	/* everything is on disk, so there's nothing left to resume */
+	if (checkpoint_file)
+		unlink(checkpoint_file);
+
+	if (verbose) {
 		summary_report();
+		numa_report();
+	}
 	do_log(_("done\n"));
 
 	if (dangerously && !no_modify)